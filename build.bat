@@ -18,6 +18,7 @@
 ::  DATASTORE_T    = TCDataStore | CBDataStore
 ::  WITH_EXAMPLES  = ON | OFF
 ::  WITH_ID3       = ON | OFF  (for the examples only)
+::  WITH_STATS     = ON | OFF  (collect the engine's run-time statistics)
 ::  WITH_TESTS     = ON | OFF  (for project developers only)
 ::
 ::  The paramaters are all optional and if none is specified the target and 
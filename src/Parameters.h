@@ -154,6 +154,15 @@ const float MaxIdTime = 20;
 /// that are longer than this limit should be split into "parts".
 const int MaxRecordingLength = 1800;
 
+/// Gating of low-information audio (see Fingerprint::SetGateLevel()). Besides
+/// the silent frames, the frames whose energy is within GateMargin dB of the
+/// gate level are discarded if their spectrum is noise-like, that is if its
+/// flatness (the ratio of the geometric to the arithmetic mean of the bins in
+/// [Kmin,Kmax]) exceeds GateFlatness. The flatness of music is usually well
+/// below 0.2, while that of white noise is about 0.5.
+const float GateMargin = 20;
+const float GateFlatness = 0.4;
+
 // -------------------- Functions -----------------------
 
 
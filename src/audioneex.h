@@ -12,7 +12,11 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <stdexcept>
+#include <exception>
+#include <functional>
+#include <future>
 
 #define ENGINE_VERSION      010301L
 #define ENGINE_VERSION_STR  "1.3.1"
@@ -68,6 +72,27 @@ enum eMatchType
 };
 
 
+/// These constants determine the layout of the postings in the index. Slim
+/// postings don't hold the time of the occurrences, which is resolved (at the
+/// resolution of the matcher's time bins) from a per-fingerprint table that
+/// is stored in the index along with the postings. This shrinks the index and
+/// speeds up the decoding of the postings lists at the cost of a slightly less
+/// accurate time order scoring. Indexes can hold both layouts, so the format can
+/// be chosen when adding new fingerprints, but once slim postings have been
+/// added to an index they will be used for all the fingerprints added thereafter.
+/// The recognizers handle both transparently.
+enum ePostingsFormat
+{
+     /// Postings holding the ID, time and quantization error of
+     /// each occurrence of a term.
+     FULL_POSTINGS,
+
+     /// Postings holding the ID and quantization error of each
+     /// occurrence of a term.
+     SLIM_POSTINGS
+};
+
+
 /// These constants determine the type of classification used internally
 /// by the recognizer to perform the identification. The fuzzy mode uses an 
 /// internal 3-class fuzzy classifier (see Audioneex::eIdClass) while the binary
@@ -157,11 +182,182 @@ struct IdMatch
 };
 
 
+/// Structure for the events produced by the Recognizer in monitoring mode
+/// (see Recognizer::SetMonitoringWindow()). An event is produced when a
+/// recording is identified in the monitored stream (a segment starts) and
+/// when it stops being identified (the segment ends). The times are relative
+/// to the start of the monitored stream (i.e. since the last reset).
+struct MonitorEvent
+{
+    /// The identified fingerprint's unique identifier.
+    uint32_t FID;
+
+    /// Estimated time point within the recording at which the segment starts
+    /// (see IdMatch::CuePoint).
+    uint32_t CuePoint;
+
+    /// Start time of the segment in the monitored stream (in seconds), that is
+    /// the time at which the recording was first identified.
+    double   StartTime;
+
+    /// End time of the segment in the monitored stream (in seconds), that is
+    /// the time at which the recording was last identified. This is zero for
+    /// the events signaling the start of a segment.
+    double   EndTime;
+};
+
+
+/// Structure for the statistics collected by the Recognizer (see
+/// Recognizer::GetStats()). The counters are cumulative since the creation
+/// of the recognizer or the last call to Recognizer::ResetStats(). Apart from
+/// the gating counters, they are only collected if the engine has been built
+/// with the WITH_STATS option and are zero otherwise. Times are in seconds.
+struct RecognizerStats
+{
+    /// Number of spectral frames of the audio fingerprinted so far.
+    uint64_t Frames;
+
+    /// Number of frames discarded as silent (see Recognizer::SetGateLevel()).
+    uint64_t SilentFrames;
+
+    /// Number of frames discarded as low-level noise.
+    uint64_t FlatFrames;
+
+    /// Number of audio chunks whose frames have all been discarded, for which
+    /// the fingerprinting and the matching have been skipped.
+    uint64_t GatedChunks;
+
+    /// Number of calls to Identify(), IdentifyFingerprint(), IdentifyBatch()
+    /// and Flush().
+    uint64_t Calls;
+
+    /// Wall clock time spent in the above calls.
+    double   WallTime;
+
+    /// CPU time spent in the above calls by the calling thread and, in
+    /// pipelined mode, by the fingerprinting thread. The time spent by the
+    /// worker threads in parallel searches and reranking is not included
+    /// (it is accounted for in the stage times below).
+    double   CPUTime;
+
+    /// Number of local fingerprints extracted from the audio.
+    uint64_t LFs;
+
+    /// Time spent in the fingerprinting stages: spectral analysis (FFT),
+    /// peaks detection, points of interest extraction and descriptors.
+    double   FFTTime;
+    double   PeaksTime;
+    double   POITime;
+    double   DescriptorsTime;
+
+    /// Time spent quantizing the local fingerprints into query terms.
+    double   QuantizeTime;
+
+    /// Number of matching steps performed.
+    uint64_t Steps;
+
+    /// Time spent scanning the index lists for candidates.
+    double   SearchTime;
+
+    /// Number of list blocks fetched from the data store.
+    uint64_t BlocksFetched;
+
+    /// Number of (compressed) list bytes decoded.
+    uint64_t BytesDecoded;
+
+    /// Number of postings scanned.
+    uint64_t PostingsScanned;
+
+    /// Number of fingerprints scored while scanning the lists.
+    uint64_t FIDsScored;
+
+    /// Time spent reranking the candidates.
+    double   RerankTime;
+
+    /// Number of candidate fingerprints matched against the query (graph
+    /// matchings performed by the reranking).
+    uint64_t GraphMatchings;
+
+    /// Number of fingerprint bytes fetched for the reranking.
+    uint64_t FingerprintBytes;
+
+    /// Hits and misses of the fingerprint cache, in pages (see
+    /// Engine::SetFingerprintCacheSize()).
+    uint64_t CacheHits;
+    uint64_t CacheMisses;
+};
+
+
+/// Structure for the statistics collected by the Indexer (see
+/// Indexer::GetStats()). The counters are cumulative since the creation of
+/// the indexer or the last call to Indexer::ResetStats(). They are only
+/// collected if the engine has been built with the WITH_STATS option and
+/// are zero otherwise. Times are in seconds.
+struct IndexerStats
+{
+    /// Number of fingerprints indexed.
+    uint64_t Fingerprints;
+
+    /// Number of local fingerprints indexed.
+    uint64_t LFs;
+
+    /// Time spent in the fingerprinting stages (for Indexer::Index(FID) only).
+    double   FFTTime;
+    double   PeaksTime;
+    double   POITime;
+    double   DescriptorsTime;
+
+    /// Time spent quantizing the local fingerprints into index terms.
+    double   QuantizeTime;
+
+    /// Wall clock and CPU time spent adding the postings to the cache.
+    double   IndexTime;
+    double   IndexCPUTime;
+
+    /// Number of cache flushes.
+    uint64_t Flushes;
+
+    /// Wall clock and CPU time spent flushing the cache, and the duration
+    /// of the longest flush.
+    double   FlushTime;
+    double   FlushCPUTime;
+    double   MaxFlushTime;
+
+    /// Number of list chunks emitted and their size in (compressed) bytes.
+    uint64_t ChunksWritten;
+    uint64_t BytesWritten;
+};
+
+
+/// Flags of an index list (see PListHeader::Flags)
+enum ePListFlags
+{
+     /// The term occurs in so many fingerprints that it tells little about
+     /// the audio, so it is no longer indexed and is ignored by the
+     /// recognizers (see Indexer::SetStopTermLimit()).
+     PLIST_STOP_TERM = 1
+};
+
+
 /// A structure holding the header for an index list
 struct PListHeader
 {
     /// Number of blocks in the list
     uint32_t BlockCount;
+
+    /// Number of postings in the list, i.e. the number of fingerprints the
+    /// term occurs in (its document frequency)
+    uint32_t DocFrequency;
+
+    /// Total number of occurrences of the term in the list's postings. This is
+    /// the number of entries to be decoded and scored when the list is scanned.
+    uint32_t Occurrences;
+
+    /// A combination of ePListFlags values
+    uint32_t Flags;
+
+    /// Max value of FID in the list, i.e. that of its last block
+    uint32_t FIDmax;
 };
 
 
@@ -179,6 +375,31 @@ struct PListBlockHeader
 };
 
 
+/// A structure describing a request for an index list's block in a batched read
+/// (see DataStore::ReadPListBlocks())
+struct PListBlockRequest
+{
+    /// The identifier of the list from which to retrieve the block
+    int lid;
+
+    /// The identifier of the block to be retrieved
+    int bid;
+
+    /// Pointer to the caller-owned buffer receiving the block's data
+    uint8_t* buffer;
+
+    /// The size in bytes of the buffer
+    size_t buffer_size;
+
+    /// Whether to include the block's header in the returned data
+    bool headers;
+
+    /// [out] The size in bytes of the block's data (zero if not found). If it is
+    /// greater than buffer_size nothing has been copied.
+    size_t data_size;
+};
+
+
 // ----------------------------------------------------------------------------
 
 
@@ -192,6 +413,15 @@ inline bool IsNull(const IdMatch& res)
            res.CuePoint == 0;
 }
 
+/// Convenience functions to check for null monitor events
+inline bool IsNull(const MonitorEvent& ev)
+{
+    return ev.FID == 0 &&
+           ev.CuePoint == 0 &&
+           ev.StartTime == 0 &&
+           ev.EndTime == 0;
+}
+
 /// Convenience functions to check for null list headers
 inline bool IsNull(const PListHeader& hdr)
 {
@@ -328,6 +558,16 @@ public:
                                       uint8_t* data, 
                                       size_t data_size) = 0;
 
+    /// This method is called by the indexer while flushing the cache, after the chunks
+    /// for a list have been emitted, with the number of fingerprints whose postings have
+    /// been added to the list (i.e. the increment in the term's document frequency).
+    /// Data stores may use it to keep statistics about the terms in the index that can
+    /// be returned by GetDocFrequency(). The default implementation does nothing.
+    ///
+    /// @param[in] lid  The identifier of the list.
+    /// @param[in] df   The number of fingerprints added to the list.
+    virtual void OnIndexerDocFrequency(int /*lid*/, uint32_t /*df*/) {}
+
     /// This method is called by the engine during the identification stage. It shall
     /// return the list's block for the specified list id from the fingerprints index.
     /// Although clients are free to implement their storage solutions and layouts, index
@@ -378,6 +618,98 @@ public:
                                           size_t nbytes = 0,
                                           uint32_t bo = 0) = 0;
 
+    /// Reentrant version of GetPListBlock(). The block's data is copied into the given
+    /// caller-owned buffer rather than being returned in a data store-owned one, so
+    /// that the same data store can serve multiple readers concurrently.
+    /// The default implementation is built upon GetPListBlock(), so it is only
+    /// reentrant if the data store says so (see IsReentrant()).
+    ///
+    /// @param[in]  lid          The identifier of the list from which to retrieve the block.
+    /// @param[in]  bid          The identifier of the block to be retrieved.
+    /// @param[out] buffer       Pointer to the buffer receiving the block's data.
+    /// @param[in]  buffer_size  The size in bytes of the buffer.
+    /// @param[in]  headers      Flag specifying whether to include the block's header
+    ///                          in the returned data (see GetPListBlock()).
+    /// @return                  The size in bytes of the block's data, or zero if the block
+    ///                          is not found. If it is greater than @p buffer_size nothing is
+    ///                          copied and the call shall be repeated with a larger buffer.
+    virtual size_t ReadPListBlock(int lid, int bid,
+                                  uint8_t* buffer,
+                                  size_t buffer_size,
+                                  bool headers=false)
+    {
+        size_t data_size = 0;
+        const uint8_t* data = GetPListBlock(lid, bid, data_size, headers);
+        if(data == nullptr)
+           return 0;
+        if(data_size <= buffer_size)
+           std::memcpy(buffer, data, data_size);
+        return data_size;
+    }
+
+    /// Batched version of ReadPListBlock(). Read all the requested blocks at once, each
+    /// one into its own buffer, setting the size of each block's data in the request.
+    /// Data stores accessed over a network should override this method to fetch all
+    /// the blocks in a single round-trip, since the engine uses it to prefetch the blocks
+    /// for all the query terms. The default implementation calls ReadPListBlock() for
+    /// each request, so it is as reentrant as that method.
+    ///
+    /// @param[in,out] requests  Pointer to an array of block requests.
+    /// @param[in]     count     The number of requests in the array.
+    virtual void ReadPListBlocks(PListBlockRequest* requests, size_t count)
+    {
+        for(size_t i=0; i<count; i++){
+            PListBlockRequest &req = requests[i];
+            req.data_size = ReadPListBlock(req.lid, req.bid,
+                                           req.buffer,
+                                           req.buffer_size,
+                                           req.headers);
+        }
+    }
+
+    /// Reentrant version of GetFingerprint(). The fingerprint's data is copied into the
+    /// given caller-owned buffer. The default implementation is built upon GetFingerprint(),
+    /// so it is only reentrant if the data store says so (see IsReentrant()).
+    ///
+    /// @param[in]  FID    The fingerprint's unique identifier.
+    /// @param[out] buffer Pointer to the buffer receiving the fingerprint's data. It must
+    ///                    be at least @p nbytes bytes long.
+    /// @param[in]  nbytes The size in bytes of the data to be read.
+    /// @param[in]  bo     The offset in bytes within the fingerprint at which to start reading.
+    /// @return            The size of the data actually read (zero if not found).
+    virtual size_t ReadFingerprint(uint32_t FID,
+                                   uint8_t* buffer,
+                                   size_t nbytes,
+                                   uint32_t bo = 0)
+    {
+        size_t read = 0;
+        const uint8_t* data = GetFingerprint(FID, read, nbytes, bo);
+        if(data == nullptr)
+           return 0;
+        read = read < nbytes ? read : nbytes;
+        std::memcpy(buffer, data, read);
+        return read;
+    }
+
+    /// Get the document frequency of the specified term, that is the number of fingerprints
+    /// in the term's postings list. The engine calls this method before reading a list so
+    /// that the terms that are not in the index can be skipped without accessing the data
+    /// store, so it should be answered from memory, for example using the statistics
+    /// collected through OnIndexerDocFrequency() and loaded when opening the data store.
+    /// It is called with the same locking as ReadPListBlock().
+    ///
+    /// @param[in] lid  The identifier of the list.
+    /// @return         The term's document frequency, 0 if the term is known not to be in
+    ///                 the index or -1 if unknown, in which case the list is read as usual.
+    ///                 The default implementation returns -1.
+    virtual int64_t GetDocFrequency(int /*lid*/) { return -1; }
+
+    /// Whether ReadPListBlock(), ReadFingerprint() and GetFingerprintSize() can be
+    /// called concurrently from multiple threads. If not, the engine serializes the
+    /// accesses to the data store from within the same Recognizer, but different
+    /// recognizers must not share the data store. The default is false.
+    virtual bool IsReentrant() const { return false; }
+
 
     virtual ~DataStore() = default;
 
@@ -414,6 +746,13 @@ public:
 
 // ----------------------------------------------------------------------------
 
+class Recognizer;
+
+/// Completion callback of the asynchronous identifications (see
+/// Recognizer::IdentifyAsync()). It receives the recognizer that performed
+/// the identification and the error that occurred, if any (null on success).
+typedef std::function<void(Recognizer&, std::exception_ptr)> IdentifyCallback;
+
 /// Interface to access the engine's core functionality
 
 /// The Recognizer class exposes the part of the API that deals with the audio
@@ -501,6 +840,97 @@ public:
     /// @param[in]  duration  The max duration in seconds.
     virtual void SetMaxRecordingDuration(size_t duration) = 0;
 
+    /// Set the number of threads used by the matcher at each identification step.
+    /// By default the matching is performed on the calling thread. Using more threads
+    /// can reduce the identification latency on large databases, as the search is
+    /// split into ranges of fingerprints that are processed concurrently and the best
+    /// candidates are verified concurrently. The results do not depend on the number
+    /// of threads. Note that the data store accesses are still serialized, so the
+    /// data store need not be thread-safe.
+    ///
+    /// @param[in]  nthreads  The number of threads (must be greater than zero).
+    virtual void SetMatchThreads(size_t nthreads) = 0;
+
+    /// Turn on the continuous monitoring mode. In this mode the recognizer
+    /// is meant to be fed with an indefinitely long stream (e.g. a broadcast)
+    /// and, rather than giving a response and then stopping, it keeps tracking
+    /// the recordings that play in the stream, producing events as they start
+    /// and stop being identified (see GetMonitorEvents()), with no need for
+    /// resetting. The matching is performed over a sliding window of the most
+    /// recent audio, so the memory and the processing time per call stay
+    /// constant regardless of the length of the stream. The window length
+    /// trades the responsiveness to content changes for the accuracy of the
+    /// identification (10-20 seconds is a reasonable choice). A match is
+    /// accepted if its confidence reaches the binary identification threshold
+    /// (see SetBinaryIdThreshold()). A segment ends when a different recording
+    /// is identified or when no recording is identified for the window length
+    /// of the stream, silence included.
+    ///
+    /// @param[in] seconds  The length of the window in seconds. A value of 0
+    ///                     (the default) turns off the monitoring mode.
+    ///
+    /// @note Setting the monitoring window resets the recognizer.
+    virtual void SetMonitoringWindow(float seconds) = 0;
+
+    /// Turn on the pipelined identification. In this mode each call to Identify()
+    /// fingerprints the audio on a dedicated thread while the calling thread matches
+    /// the local fingerprints as soon as enough of them have been extracted for a
+    /// matching step, rather than after the whole chunk has been fingerprinted.
+    /// This reduces the latency of each call on multi-core machines at the cost of
+    /// one more thread per recognizer. The results are the same in both modes.
+    ///
+    /// @param[in] enable  Whether to use the pipelined identification (default off).
+    virtual void SetPipelining(bool enable) = 0;
+
+    /// Set the maximum time a matching step may take. The cost of a step varies
+    /// widely with how common the query's terms are in the index and with how
+    /// ambiguous the audio is, so setting a budget bounds the latency of each
+    /// identification call. When a step runs out of time the search gives up the
+    /// most common terms first and the verification of the candidates, which is
+    /// performed on the best ones first, is cut short. The step then yields the
+    /// best matches found so far and the results are flagged as truncated (see
+    /// IsTruncated()). The budget does not apply to IdentifyBatch().
+    ///
+    /// @param[in] us  The budget in microseconds. A value of 0 (the default)
+    ///                sets no limit.
+    virtual void SetStepBudget(size_t us) = 0;
+
+    /// Set the maximum time each call to Identify() or Flush() may take. The
+    /// matching steps are cut short as for the step budget (see SetStepBudget())
+    /// when the deadline is reached and those that would start afterwards are
+    /// skipped. Note that the fingerprinting of the audio is not interrupted.
+    ///
+    /// @param[in] us  The deadline in microseconds from the start of each call.
+    ///                A value of 0 (the default) sets no deadline.
+    virtual void SetDeadline(size_t us) = 0;
+
+    /// Set the fraction of the query terms searched at each matching step. Some
+    /// terms occur in a large part of the fingerprints in the database, so they
+    /// are costly to search while adding little evidence for the best matches.
+    /// The terms are ranked by their cost, as recorded in the index, and only
+    /// the given fraction of the least costly ones is searched, which trades
+    /// some accuracy for a lower processing time on large databases (0.8-0.9
+    /// is a reasonable choice). This setting does not apply to IdentifyBatch().
+    ///
+    /// @param[in] ratio  The fraction of terms in (0,1]. A value of 1 (the
+    ///                   default) searches all the terms.
+    virtual void SetTermRatio(float ratio) = 0;
+
+    /// Set the level below which the audio is considered silent. The parts of
+    /// the audio below this level, or just above it (up to 20 dB) if they are
+    /// noise-like, produce no useful fingerprints, so they are discarded before
+    /// the fingerprinting and the chunks that are entirely discarded skip the
+    /// matching, which saves processing time on streams with long silences or
+    /// background noise (e.g. speech, live broadcasts). The discarded audio
+    /// still counts toward the identification time and is reported in the
+    /// statistics (see GetStats()). This setting does not apply to
+    /// IdentifyFingerprint(), for which the audio is fingerprinted elsewhere.
+    ///
+    /// @param[in] level  The gate level in dBFS, in [-120,0]. A value of 0 (the
+    ///                   default) disables the gate. Values in [-70,-50] are
+    ///                   a reasonable choice for most sources.
+    virtual void SetGateLevel(float level) = 0;
+
     /// Get the currently set match type.
 	/// @return The currently set match type.
     virtual eMatchType GetMatchType() const = 0;
@@ -525,6 +955,40 @@ public:
 	/// @return The currently set binary id minimum identification time.
 	virtual float GetBinaryIdMinTime() const = 0;
 
+    /// Get the number of threads used by the matcher.
+    /// @return The number of threads used by the matcher.
+    virtual size_t GetMatchThreads() const = 0;
+
+    /// Get the currently set monitoring window.
+    /// @return The monitoring window length in seconds (0 if not monitoring).
+    virtual float GetMonitoringWindow() const = 0;
+
+    /// Check whether the pipelined identification is on.
+    /// @return True if the pipelined identification is on.
+    virtual bool GetPipelining() const = 0;
+
+    /// Get the currently set step budget.
+    /// @return The step budget in microseconds (0 if unlimited).
+    virtual size_t GetStepBudget() const = 0;
+
+    /// Get the currently set deadline.
+    /// @return The deadline in microseconds (0 if none).
+    virtual size_t GetDeadline() const = 0;
+
+    /// Get the currently set fraction of query terms searched at each step.
+    /// @return The fraction of query terms.
+    virtual float GetTermRatio() const = 0;
+
+    /// Get the currently set gate level.
+    /// @return The gate level in dBFS (0 if disabled).
+    virtual float GetGateLevel() const = 0;
+
+    /// Check whether any of the matching steps performed since the start of the
+    /// identification (or the last Reset()) has been cut short by the step budget
+    /// or the deadline, in which case the results may be less accurate.
+    /// @return True if the results are truncated.
+    virtual bool IsTruncated() const = 0;
+
     /// This method is the heart of the recognition engine. Given an audio clip, 
     /// it tries to match it against the reference fingerprints in the database
     /// to find the best match. It is designed and optimized for real-time audio 
@@ -539,6 +1003,84 @@ public:
     /// @param[in]  nsamples   Number of samples in the buffer.
     virtual void Identify(const float *audio, size_t nsamples) = 0;
 
+    /// Identify an audio chunk that has been fingerprinted elsewhere, usually by
+    /// a client device using a Fingerprinter, so that only the fingerprints need
+    /// to be sent to the server rather than the audio. The stream is processed
+    /// exactly as the audio it was extracted from would be by Identify(), so the
+    /// identification proceeds in the same way and the results are the same. The
+    /// streams of an identification must be given in the order they were produced
+    /// by the same fingerprinter. Both quantized and raw streams are accepted (see
+    /// Fingerprinter::SetQuantization()). This call is synchronous (i.e. blocking).
+    ///
+    /// @param[in]  data  Pointer to the stream, as given by Fingerprinter::GetStream().
+    ///                   The engine does not take ownership of the pointer.
+    /// @param[in]  size  Size of the stream in bytes.
+    ///
+    /// @throw InvalidFingerprintException if the stream is malformed, which makes
+    ///        it safe to process data from untrusted sources.
+    virtual void IdentifyFingerprint(const uint8_t *data, size_t size) = 0;
+
+    /// Asynchronous version of Identify(). The audio is copied and queued for
+    /// identification on the engine's worker threads (see SetAsyncThreads()),
+    /// which are shared by all the recognizers, so the calling thread (e.g. an
+    /// audio capture thread) is not blocked by the matching. The snippets given
+    /// to the same recognizer are identified one at a time, in the order they
+    /// were given, while those given to different recognizers are identified
+    /// concurrently.
+    ///
+    /// @param[in]  audio     Pointer to the buffer containing the audio samples
+    ///                       (see Identify()). The buffer can be reused as soon
+    ///                       as the call returns.
+    /// @param[in]  nsamples  Number of samples in the buffer.
+    /// @param[in]  callback  Optional function called on the worker thread once
+    ///                       the identification is completed, before the
+    ///                       returned future gets ready.
+    /// @return  A future that gets ready once the identification is completed
+    ///          and holds any error that occurred.
+    ///
+    /// @note While there are pending identifications the only methods that can
+    ///       be called on the recognizer are IdentifyAsync() and, from within
+    ///       the callbacks, the getters. The results of each identification can
+    ///       be checked in its callback or once its future is ready. Destroying
+    ///       the recognizer waits for all the pending identifications, so the
+    ///       recognizer must not be destroyed from within its own callbacks,
+    ///       as that would wait for the very identification being completed
+    ///       and never return.
+    virtual std::future<void> IdentifyAsync(const float *audio,
+                                            size_t nsamples,
+                                            IdentifyCallback callback = nullptr) = 0;
+
+    /// Identify a batch of audio clips off-line (e.g. to check a large set of
+    /// files against the database). Each clip is identified in a session of its
+    /// own using the current settings of this recognizer, as by resetting the
+    /// recognizer, feeding the clip to Identify() in chunks of the maximum length
+    /// until a response is given and then flushing it. The sessions are run in
+    /// lockstep and share the searches in the index, so each postings list is
+    /// read once per step for the whole batch rather than once per clip, which
+    /// increases the throughput by up to the batch size for popular lists. The
+    /// memory used during the call grows with the batch size (a few tens of KB
+    /// per clip). The monitoring mode does not apply to the batch sessions.
+    /// This call is synchronous and does not affect the current identification
+    /// of the recognizer, if any.
+    ///
+    /// @param[in]  clips     Array of pointers to the buffers containing the clips'
+    ///                       audio samples (see Identify()).
+    /// @param[in]  nsamples  Array with the number of samples of each clip.
+    /// @param[in]  nclips    Number of clips in the batch.
+    virtual void IdentifyBatch(const float* const* clips,
+                               const size_t* nsamples,
+                               size_t nclips) = 0;
+
+    /// Get the results of a clip identified by the last call to IdentifyBatch().
+    ///
+    /// @param[in]  clip  The index of the clip in the batch.
+    /// @return  A pointer to an array of Audioneex::IdMatch structures, as
+    ///          returned by GetResults() at the end of the clip's session.
+    ///
+    /// @note The returned pointer is owned by the identification engine and must not be
+    ///       deleted nor retained by clients. It is valid until the next batch.
+    virtual const IdMatch* GetBatchResults(size_t clip) = 0;
+
     /// Call this method to check the current state of the identification.
     /// Usually this is done right after calling Identify().
     ///
@@ -558,6 +1100,18 @@ public:
     ///       deleted nor retained by clients.
     virtual const IdMatch* GetResults() = 0;
 
+    /// Get the events produced in monitoring mode by the last call to Identify()
+    /// or Flush() (see SetMonitoringWindow()).
+    ///
+    /// @return  A pointer to an array of Audioneex::MonitorEvent structures in
+    /// the order they occurred, terminated by a 'null' element (you can use
+    /// Audioneex::IsNull(MonitorEvent) to check for that). If there are no
+    /// events the returned pointer will be null.
+    ///
+    /// @note The returned pointer is owned by the identification engine and must not be
+    ///       deleted nor retained by clients.
+    virtual const MonitorEvent* GetMonitorEvents() = 0;
+
     /// Get the identification time. This is actually the duration of the audio being
     /// fed to the engine until a response is given (whether positive or negative).
     ///
@@ -592,6 +1146,23 @@ public:
     /// @return The currently set datastore
     virtual DataStore* GetDataStore() const = 0;
 
+    /// Get the (approximate) amount of memory owned by this recognizer. The
+    /// resources shared with other recognizers (see Audioneex::Engine) and the
+    /// buffers shared by all the recognizers running on the same thread are
+    /// not included.
+    ///
+    /// @return  The amount of memory in bytes.
+    virtual size_t GetMemoryUsage() const = 0;
+
+    /// Get the statistics of the audio processed by this recognizer, including
+    /// the clips identified by IdentifyBatch(). They are not cleared by Reset().
+    ///
+    /// @return  The statistics collected so far.
+    virtual RecognizerStats GetStats() const = 0;
+
+    /// Clear the statistics of the recognizer (see GetStats()).
+    virtual void ResetStats() = 0;
+
 
     virtual ~Recognizer() = default;
 
@@ -599,6 +1170,139 @@ public:
 
 // ----------------------------------------------------------------------------
 
+/// Interface to share the engine's resources among many recognizers
+
+/// Applications performing many concurrent identifications (e.g. one per user
+/// session) should create their recognizers from an Engine. The engine holds
+/// the resources that do not depend on the audio being identified (the audio
+/// codes, the data store and a fingerprint cache) and shares them among its
+/// recognizers, so that each recognizer only keeps the state of its own
+/// identification. The buffers used during the processing are shared by all the
+/// recognizers running on the same thread, so an idle recognizer (i.e. not
+/// created or reset since its last identification) takes a few KB of memory.
+/// The engine is thread-safe, while each recognizer must only be used by one
+/// thread at a time (or through Recognizer::IdentifyAsync()).
+
+class AUDIONEEX_API Engine
+{
+public:
+
+    /// Create an instance of engine
+    static Engine* Create();
+
+    /// Set the data store to be used by the recognizers. If it is not reentrant
+    /// (see DataStore::IsReentrant()) the accesses of the recognizers are
+    /// serialized, so they can safely run concurrently.
+    ///
+    /// @param[in] dstore  A pointer to a data store implementation.
+    virtual void SetDataStore(DataStore* dstore) = 0;
+
+    /// Get the currently set data store.
+    /// @return The currently set datastore
+    virtual DataStore* GetDataStore() const = 0;
+
+    /// Set the type of matching algorithm to be used by the recognizers.
+    /// See Recognizer::SetMatchType().
+    virtual void SetMatchType(eMatchType type) = 0;
+
+    /// Get the currently set match type.
+    /// @return The currently set match type.
+    virtual eMatchType GetMatchType() const = 0;
+
+    /// Set the size of the cache of reference fingerprints shared by the
+    /// recognizers. Caching the fingerprints accessed by the reranking saves
+    /// data store accesses when many recognizers identify the same recordings
+    /// (e.g. a popular broadcast). A size of 0 (the default) disables the cache.
+    /// The cache is meant for databases that are not modified while in use:
+    /// if the data store is reopened or changed, set it again on the engine
+    /// (SetDataStore()) to discard the cached fingerprints.
+    ///
+    /// @param[in] bytes  The size of the cache in bytes.
+    virtual void SetFingerprintCacheSize(size_t bytes) = 0;
+
+    /// Get the size of the fingerprint cache.
+    /// @return The size of the fingerprint cache in bytes (0 if disabled).
+    virtual size_t GetFingerprintCacheSize() const = 0;
+
+    /// Create a recognizer sharing this engine's resources. It uses the engine's
+    /// settings at the time of the call and can be configured further like any
+    /// other recognizer.
+    ///
+    /// @return  A pointer to the new recognizer, owned by the client. It may
+    ///          outlive the engine.
+    virtual Recognizer* CreateRecognizer() = 0;
+
+    /// Get the (approximate) amount of memory taken by the shared resources.
+    /// @return  The amount of memory in bytes.
+    virtual size_t GetMemoryUsage() const = 0;
+
+
+    virtual ~Engine() = default;
+
+};
+
+// ----------------------------------------------------------------------------
+
+/// Interface to fingerprint audio for remote identification
+
+/// The Fingerprinter class performs the fingerprinting part of the audio
+/// identification, so that the audio can be fingerprinted on a client device
+/// and only the fingerprints sent to a server for matching (see
+/// Recognizer::IdentifyFingerprint()). The fingerprints of each audio chunk
+/// are serialized in a compact, versioned binary format that is independent
+/// of the platform. A quantized stream takes about 5 bytes per local
+/// fingerprint, which is tens of times less than the audio it was extracted
+/// from, and its processing does not need the audio codes on the server side.
+
+class AUDIONEEX_API Fingerprinter
+{
+public:
+
+    /// Create an instance of fingerprinter
+    static Fingerprinter* Create();
+
+    /// Fingerprint an audio chunk and serialize the produced fingerprints in
+    /// a stream, which is then available through GetStream(). The audio must
+    /// be given in chunks as for Recognizer::Identify().
+    ///
+    /// @param[in]  audio     Pointer to the buffer containing the audio samples.
+    ///                       The engine does not take ownership of the pointer.
+    /// @param[in]  nsamples  Number of samples in the buffer.
+    virtual void Process(const float *audio, size_t nsamples) = 0;
+
+    /// Get the stream produced by the last call to Process().
+    ///
+    /// @return  A pointer to the stream, owned by the fingerprinter and valid
+    ///          until the next call to Process() or Reset().
+    virtual const uint8_t* GetStream() const = 0;
+
+    /// Get the size of the stream produced by the last call to Process().
+    /// @return  The size of the stream in bytes.
+    virtual size_t GetStreamSize() const = 0;
+
+    /// Set whether the fingerprints are quantized before being serialized.
+    /// Quantized streams are much smaller, while raw streams carry the full
+    /// fingerprints (about 20 times larger), so that the quantization is done
+    /// by the recognizer.
+    ///
+    /// @param[in]  enable  Whether to quantize the fingerprints (default on).
+    virtual void SetQuantization(bool enable) = 0;
+
+    /// Check whether the fingerprints are quantized.
+    /// @return  True if the fingerprints are quantized.
+    virtual bool GetQuantization() const = 0;
+
+    /// Reset the fingerprinter's internal state. This must be done at the
+    /// start of each identification, along with resetting the recognizer.
+    virtual void Reset() = 0;
+
+
+    virtual ~Fingerprinter() = default;
+
+};
+
+// ----------------------------------------------------------------------------
+
 /// Interface to access the engine's indexing functionality
 
 /// The Indexer is responsible for the initiation, maintenance and finalization
@@ -684,6 +1388,36 @@ public:
     /// Get the currently set match type
     virtual eMatchType GetMatchType() const = 0;
 
+    /// Set the layout of the postings added to the index. The default is
+    /// FULL_POSTINGS. See Audioneex::ePostingsFormat for details.
+    ///
+    /// @param[in]  format  The postings format.
+    ///
+    /// @note If the index already holds slim postings, slim postings will be
+    ///       used regardless of this setting once the indexing session starts.
+    virtual void SetPostingsFormat(ePostingsFormat format) = 0;
+
+    /// Get the currently set postings format
+    virtual ePostingsFormat GetPostingsFormat() const = 0;
+
+    /// Set the maximum number of fingerprints a term may occur in before being
+    /// pruned from the index as a stop term. Some terms (such as those of the low
+    /// channels firing on near-silence) occur in most of the fingerprints, so their
+    /// lists are scanned by nearly every query while telling little about the audio.
+    /// When a list would grow beyond this limit, the indexer marks it as a stop term
+    /// in its header (see Audioneex::PLIST_STOP_TERM), no longer adds postings to it,
+    /// and the recognizers ignore it. The default is 0 (no limit).
+    ///
+    /// @param[in]  limit  The maximum document frequency of the terms.
+    ///
+    /// @note Pruning is permanent, so the lists marked as stop terms stay so in all
+    ///       the following sessions regardless of this setting. The limit should be
+    ///       set relative to the expected size of the catalogue (e.g. 20-30%).
+    virtual void SetStopTermLimit(uint32_t limit) = 0;
+
+    /// Get the currently set stop term limit
+    virtual uint32_t GetStopTermLimit() const = 0;
+
     /// Set the cache size (in MB). The indexer will flush the cache once this
     /// limit is reached.
     ///
@@ -712,6 +1446,15 @@ public:
     /// Get the currently set audio provider.
     virtual AudioProvider* GetAudioProvider() const = 0;
 
+    /// Get the statistics of the indexing sessions run by this indexer
+    /// (see Audioneex::IndexerStats). They are not cleared by Start().
+    ///
+    /// @return  The statistics collected so far.
+    virtual IndexerStats GetStats() const = 0;
+
+    /// Clear the statistics of the indexer (see GetStats()).
+    virtual void ResetStats() = 0;
+
 
     virtual ~Indexer() = default;
 
@@ -724,6 +1467,20 @@ public:
 /// Get the engine version
 AUDIONEEX_API const char* GetVersion();
 
+/// Set the number of worker threads used by the engine to perform the
+/// asynchronous identifications (see Recognizer::IdentifyAsync()). These
+/// threads are shared by all the recognizers. By default there is one thread
+/// per hardware core. The identifications already queued are completed before
+/// the current threads are stopped, so this call may block.
+///
+/// @param[in]  nthreads  The number of threads (must be greater than zero).
+///
+/// @warning This function must not be called from a completion callback.
+AUDIONEEX_API void SetAsyncThreads(size_t nthreads);
+
+/// Get the number of worker threads used for the asynchronous identifications.
+AUDIONEEX_API size_t GetAsyncThreads();
+
 
 // ----------------------------------------------------------------------------
 
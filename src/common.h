@@ -33,4 +33,10 @@
  #define TEST_HERE( test_code )
 #endif
 
+#ifdef WITH_STATS
+ #define STATS_HERE( stats_code ) stats_code
+#else
+ #define STATS_HERE( stats_code )
+#endif
+
 #endif // COMMON_H
@@ -88,6 +88,22 @@ static void get_callback(lcb_t instance,
 
             std::copy(po, po + gsize, gresp->buf->begin());
         }
+        // Multi-get into a caller-owned buffer. The data is only copied if
+        // it fits, but its size is always returned.
+        else if(gresp->raw)
+        {
+            size_t vsize = item->v.v0.nbytes - gresp->data_offset;
+            size_t gsize = gresp->data_size ? gresp->data_size : vsize;
+
+            gsize = std::min<size_t>(gsize,vsize);
+
+            gresp->read_size = gsize;
+
+            if(gsize <= gresp->raw_size){
+               uint8_t* po = (uint8_t*)(item->v.v0.bytes) + gresp->data_offset;
+               std::copy(po, po + gsize, gresp->raw);
+            }
+        }
         // Set the size of the retrieved value
         gresp->value_size = item->v.v0.nbytes;
     }
@@ -188,8 +204,9 @@ void CBDataStore::Open(eOperation op,
     m_MainIndex.Open(open_mode);
 
     // NOTE: The fingerprints database is not required by the engine
-    //       and the metadata and info database are optional. The delta
-	//       index is only used for build&merge strategies.
+    //       and the metadata database is optional. The info database
+    //       records the format of the index, so it is always used.
+    //       The delta index is only used for build&merge strategies.
 
     if(use_fing_db)
        m_QFingerprints.Open(open_mode);
@@ -197,8 +214,13 @@ void CBDataStore::Open(eOperation op,
     if(use_meta_db)
        m_Metadata.Open(open_mode);
 
-    if(use_info_db)
-       m_Info.Open(open_mode);
+    m_Info.Open(open_mode);
+
+    // Existing indexes must be in the current format, new ones are
+    if(m_MainIndex.GetRecordsCount() > 0)
+       CheckFormat();
+    else if(open_mode != OPEN_READ)
+       RecordFormat();
 
     m_Op = op;
     
@@ -208,8 +230,39 @@ void CBDataStore::Open(eOperation op,
 
 // ----------------------------------------------------------------------------
 
+void CBDataStore::CheckFormat()
+{
+    // Indexes built before the format was recorded have no info
+    DBInfo_t info;
+    info.Version = 0;
+
+    if(m_Info.IsOpen())
+       info = m_Info.Read();
+
+    if(info.Version != INDEX_FORMAT_VERSION)
+       Close();
+
+    CheckIndexFormat(info);
+}
+
+// ----------------------------------------------------------------------------
+
+void CBDataStore::RecordFormat()
+{
+    DBInfo_t info = m_Info.Read();
+    info.Version = INDEX_FORMAT_VERSION;
+    m_Info.Write(info);
+}
+
+// ----------------------------------------------------------------------------
+
 void CBDataStore::Close()
 {
+    // Clearing the buckets is asynchronous and may wipe the format recorded
+    // on opening, so it is recorded again for the index built in the session.
+    if(m_IsOpen && m_Op != GET)
+       RecordFormat();
+
     m_MainIndex.Close();
     m_DeltaIndex.Close();
     m_QFingerprints.Close();
@@ -260,6 +313,26 @@ const uint8_t* CBDataStore::GetPListBlock(int list_id,
 
 // ----------------------------------------------------------------------------
 
+size_t CBDataStore::ReadPListBlock(int list_id,
+                                   int block,
+                                   uint8_t* buffer,
+                                   size_t buffer_size,
+                                   bool headers)
+{
+    PListBlockRequest req = {list_id, block, buffer, buffer_size, headers, 0};
+    m_MainIndex.ReadBlocks(&req, 1);
+    return req.data_size;
+}
+
+// ----------------------------------------------------------------------------
+
+void CBDataStore::ReadPListBlocks(PListBlockRequest* requests, size_t count)
+{
+    m_MainIndex.ReadBlocks(requests, count);
+}
+
+// ----------------------------------------------------------------------------
+
 void CBDataStore::OnIndexerStart()
 {
     if(m_Op == GET)
@@ -793,6 +866,61 @@ size_t CBIndex::ReadBlock(int list_id,
 
 // ----------------------------------------------------------------------------
 
+void CBIndex::ReadBlocks(PListBlockRequest* requests, size_t count)
+{
+    if(m_DBHandle==NULL)
+       throw std::runtime_error
+       ("Database '"+m_Name+"' not open");
+
+    if(count == 0)
+       return;
+
+    std::vector<key_builder<int> >  keys (count);
+    std::vector<CBGetResp>          gresps (count);
+    std::vector<lcb_get_cmd_t>      cmds (count);
+
+    // Schedule one get per block, each with its own response structure,
+    // and wait for all of them at once. The requests are pipelined by the
+    // client library, so this costs about one round-trip to the server.
+    for(size_t i=0; i<count; i++)
+    {
+        PListBlockRequest &req = requests[i];
+
+        // Make the key to the block <listID|blockID>
+        // The list header is prepended to the 1st block
+        keys[i](req.lid, req.bid);
+
+        if(!req.headers)
+           gresps[i].data_offset = req.bid==1 ? sizeof(PListHeader) +
+                                                sizeof(PListBlockHeader)
+                                              : sizeof(PListBlockHeader);
+        gresps[i].raw = req.buffer;
+        gresps[i].raw_size = req.buffer_size;
+
+        const lcb_get_cmd_t* commands[1] = { &cmds[i] };
+        memset(&cmds[i], 0, sizeof(lcb_get_cmd_t));
+
+        cmds[i].v.v0.key = keys[i].get();
+        cmds[i].v.v0.nkey = keys[i].size();
+
+        lcb_error_t err = lcb_get(m_DBHandle, &gresps[i], 1, commands);
+
+        THROW_ON_FAIL(err, "Couldn't initiate get operation.");
+    }
+
+    // Wait for all the get commands to execute
+    lcb_wait(m_DBHandle);
+
+    // NOTE: Blocks that do not exist have zero read data.
+    for(size_t i=0; i<count; i++)
+    {
+        THROW_ON_FAIL(gresps[i].status, "Couldn't get block.");
+        requests[i].data_size = gresps[i].read_size;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
 void CBIndex::WriteBlock(int list_id, 
                          int block_id, 
                          std::vector<uint8_t> &buffer, 
@@ -916,10 +1044,11 @@ void CBIndex::AppendChunk(int list_id,
     // Append chunk
     block.insert(block.end(), chunk, chunk + chunk_size);
 
-    // If this is a new block we need to update the index list header
-    // for the curent list, located in the first block (not necessary if
-    // we're processing the first block as it's already updated above).
-    if(new_block && hdr.ID!=1)
+    // Update the index list header for the curent list, located in the
+    // first block, as the list's statistics change with every chunk (not
+    // necessary if we're processing the first block as it's already updated
+    // above).
+    if(hdr.ID!=1)
        UpdateListHeader(list_id, lhdr);
 }
 
@@ -1131,8 +1260,8 @@ size_t CBFingerprints::ReadFingerprintSize(uint32_t FID)
 {
     /// Unfortunately Couchbase's API does not provide a direct function
     /// to get the size of a stored value, so here we just do a 'get'
-    /// and retrieve the size of the value from the response without
-    /// copying the data.
+    /// and retrieve the size of the value from the response, copying
+    /// only the header of encoded fingerprints (see FingerprintCodec).
 
     if(m_DBHandle==NULL)
        throw std::runtime_error
@@ -1140,6 +1269,8 @@ size_t CBFingerprints::ReadFingerprintSize(uint32_t FID)
 
     // Create response structure
     CBGetResp gresp = {};
+    gresp.buf = &m_Buffer;
+    gresp.data_size = FingerprintCodec::GetHeaderSize();
 
     // Create the get command
     lcb_get_cmd_t cmd;
@@ -1159,7 +1290,9 @@ size_t CBFingerprints::ReadFingerprintSize(uint32_t FID)
 
     THROW_ON_FAIL(gresp.status, "Couldn't execute get operation.");
 
-    return gresp.value_size;
+    size_t fpsize = FingerprintCodec::GetDecodedSize(m_Buffer.data(), gresp.read_size);
+
+    return fpsize ? fpsize : gresp.value_size;
 }
 
 // ----------------------------------------------------------------------------
@@ -1173,11 +1306,10 @@ size_t CBFingerprints::ReadFingerprint(uint32_t FID,
        throw std::runtime_error
        ("Database '"+m_Name+"' not open");
 
-    // Create response structure
+    // Create response structure. The whole record is read, as the
+    // requested range must be decoded.
     CBGetResp gresp = {};
-    gresp.buf = &buffer;
-    gresp.data_size = size;
-    gresp.data_offset = bo;
+    gresp.buf = &m_Buffer;
 
     // Create the get command
     lcb_get_cmd_t cmd;
@@ -1197,9 +1329,24 @@ size_t CBFingerprints::ReadFingerprint(uint32_t FID,
 
     THROW_ON_FAIL(gresp.status, "Couldn't execute get operation.");
 
-    // The fingerprint data will be copied in 'buffer' in the get callback
-    
-    return gresp.read_size;
+    if(gresp.read_size == 0)
+       return 0;
+
+    // Decode the requested range (only the frames it spans are decoded)
+    size_t fpsize = FingerprintCodec::GetDecodedSize(m_Buffer.data(), gresp.read_size);
+    if(fpsize == 0)
+       fpsize = gresp.read_size;
+
+    if(bo >= fpsize)
+       return 0;
+
+    size_t gsize = size ? std::min<size_t>(size, fpsize - bo) : fpsize - bo;
+
+    if(gsize > buffer.size())
+       buffer.resize(gsize);
+
+    return FingerprintCodec::Decode(m_Buffer.data(), gresp.read_size,
+                                    buffer.data(), gsize, bo);
 }
 
 // ----------------------------------------------------------------------------
@@ -1221,10 +1368,13 @@ void CBFingerprints::WriteFingerprint(uint32_t FID,
     const lcb_store_cmd_t *commands[1] = { &cmd };
     memset(&cmd, 0, sizeof(cmd));
 
+    // Store the fingerprint in compressed form (see FingerprintCodec)
+    FingerprintCodec::Encode(data, size, m_Buffer);
+
     cmd.v.v0.key = &FID;
     cmd.v.v0.nkey = sizeof(uint32_t);
-    cmd.v.v0.bytes = data;
-    cmd.v.v0.nbytes = size;
+    cmd.v.v0.bytes = m_Buffer.data();
+    cmd.v.v0.nbytes = m_Buffer.size();
     cmd.v.v0.operation = LCB_SET;
 
     lcb_error_t err = lcb_store(m_DBHandle, &sresp, 1, commands);
@@ -1339,6 +1489,9 @@ DBInfo_t CBInfo::Read()
     DBInfo_t dbinfo;
     int key = 0;
 
+    // No version unless recorded in the current record layout
+    dbinfo.Version = 0;
+
     // Create response structure
     CBGetResp gresp = {};
     gresp.buf = &m_Buffer;
@@ -1361,10 +1514,10 @@ DBInfo_t CBInfo::Read()
 
     THROW_ON_FAIL(gresp.status, "Couldn't execute get operation.");
 
-    if(gresp.read_size > 0){
-       assert(gresp.read_size == sizeof(DBInfo_t));
+    if(gresp.read_size == sizeof(DBInfo_t))
        dbinfo = *reinterpret_cast<DBInfo_t*>(m_Buffer.data());
-    }
+    else if(gresp.read_size >= sizeof(int))
+       dbinfo.MatchType = *reinterpret_cast<int*>(m_Buffer.data());
     return dbinfo;
 }
 
@@ -13,6 +13,7 @@
 
 #include <libcouchbase/couchbase.h>
 #include "KVDataStore.h"
+#include "FingerprintCodec.h"
 
 //-----------------------------------------------------------------------------
 
@@ -26,6 +27,8 @@ struct CBGetResp
 {
     lcb_error_t status        {};
     std::vector<uint8_t>* buf {nullptr};  // single-get buffer's handle
+    uint8_t* raw              {nullptr};  // caller-owned buffer (multi-get)
+    size_t   raw_size         {0};        // size of the caller-owned buffer
     size_t   data_size        {0};        // size of data to read from value
     size_t   data_offset      {0};        // offset from which to start reading
     size_t   read_size        {0};        // size of data actually read
@@ -134,6 +137,13 @@ public:
               std::vector<uint8_t> &buffer, 
               bool headers=true);
 
+    /// Read the requested index list blocks into the requests' buffers using
+    /// one pipelined multi-get, so that all the blocks are fetched in a single
+    /// round-trip to the server. The size of each block's data is set in the
+    /// corresponding request (nothing is copied if the buffer is too small).
+    void
+    ReadBlocks(Audioneex::PListBlockRequest* requests, size_t count);
+
     /// Write the contents of the given block in the specified index list.
     /// A new block is created if the specified block does not exist.
     void 
@@ -172,6 +182,8 @@ public:
 // ----------------------------------------------------------------------------
 
 /// This class implements functionalities to manipulate a fingerprints collection.
+/// The fingerprints are stored compressed (see FingerprintCodec) and decoded on
+/// reading, so this is transparent to the clients.
 
 class CBFingerprints : public CBCollection
 {
@@ -260,6 +272,13 @@ class CBDataStore : public KVDataStore
     CBInfo                m_Info;
     std::vector<uint8_t>  m_ReadBuffer;
 
+    /// Check that the index is in the current format (see INDEX_FORMAT_VERSION).
+    /// The data store is closed if it's not.
+    void CheckFormat();
+
+    /// Record the current index format in the info database
+    void RecordFormat();
+
 public:
 
     explicit CBDataStore(const std::string &url = std::string());
@@ -330,6 +349,17 @@ public:
                   size_t& data_size, 
                   bool headers=true) override;
 
+    size_t
+    ReadPListBlock(int list_id,
+                   int block,
+                   uint8_t* buffer,
+                   size_t buffer_size,
+                   bool headers=false) override;
+
+    void
+    ReadPListBlocks(Audioneex::PListBlockRequest* requests,
+                    size_t count) override;
+
     size_t
     GetFingerprintSize(uint32_t FID) override;
 
@@ -0,0 +1,397 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+#ifndef FINGERPRINTCODEC_H
+#define FINGERPRINTCODEC_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+/// This class implements the compressed encoding used by the data stores to
+/// save the fingerprints on storage. The engine exchanges fingerprints as raw
+/// arrays of quantized LFs (QLocalFingerprint_t) and reads them by byte ranges
+/// during the reranking, so the encoding must be transparent to it and allow
+/// random access.
+///
+/// The LFs are split into frames of FRAME_LFS LFs, each one encoded on its own
+/// using bit packing (frame of reference): the time is delta coded (T is mostly
+/// monotonic, so deltas are small) and each field takes as many bits as needed
+/// by its largest value within the frame. A frame index in the record's header
+/// allows a byte range to be decoded by decoding only the frames it touches.
+///
+/// Record layout:
+///
+///   [Header][frame offsets (u32 x FrameCount)][frame 1]...[frame n]
+///   frame = [Tbase (u32)][wT][wF][wW][wE][bit-packed LFs]
+///
+/// Fingerprints that cannot be compressed are stored as they are, and records
+/// not recognized as encoded are returned as they are, so data stores written
+/// before the introduction of the encoding can still be read.
+
+class FingerprintCodec
+{
+    /// Size in bytes of a raw LF (T:u32, F:u16, W:u8, E:u8)
+    static const size_t LF_SIZE = 8;
+
+    /// Size in bytes of the frame's header (Tbase and the fields' widths)
+    static const size_t FRAME_HEADER_SIZE = 8;
+
+    struct Header_t
+    {
+        uint32_t Magic;
+        uint16_t Version;
+        uint16_t FrameLFs;
+        uint32_t LFCount;
+        uint32_t FrameCount;
+    };
+
+    /// Raw LF fields
+    struct LF_t
+    {
+        uint32_t T;
+        uint32_t F;
+        uint32_t W;
+        uint32_t E;
+    };
+
+    static void GetLF(const uint8_t* p, LF_t &lf)
+    {
+        uint16_t F;
+        std::memcpy(&lf.T, p, 4);
+        std::memcpy(&F, p + 4, 2);
+        lf.F = F;
+        lf.W = p[6];
+        lf.E = p[7];
+    }
+
+    static void PutLF(const LF_t &lf, uint8_t* p)
+    {
+        uint16_t F = lf.F;
+        std::memcpy(p, &lf.T, 4);
+        std::memcpy(p + 4, &F, 2);
+        p[6] = lf.W;
+        p[7] = lf.E;
+    }
+
+    static int Bits(uint32_t v)
+    {
+        int n = 0;
+        for(; v; v>>=1) n++;
+        return n;
+    }
+
+    static uint32_t ZigZag(uint32_t d)
+    {
+        int32_t s = static_cast<int32_t>(d);
+        return (static_cast<uint32_t>(s) << 1) ^ static_cast<uint32_t>(s >> 31);
+    }
+
+    static uint32_t UnZigZag(uint32_t z)
+    {
+        return (z >> 1) ^ (0u - (z & 1));
+    }
+
+    /// LSB-first bit stream writer
+    class BitWriter
+    {
+        std::vector<uint8_t> &m_Out;
+        uint64_t m_Acc   {0};
+        int      m_NBits {0};
+    public:
+        explicit BitWriter(std::vector<uint8_t> &out) : m_Out(out) {}
+
+        void Put(uint32_t v, int width)
+        {
+            if(width == 0) return;
+            m_Acc |= static_cast<uint64_t>(v) << m_NBits;
+            m_NBits += width;
+            for(; m_NBits >= 8; m_NBits -= 8, m_Acc >>= 8)
+                m_Out.push_back(static_cast<uint8_t>(m_Acc));
+        }
+
+        void Flush()
+        {
+            if(m_NBits > 0)
+               m_Out.push_back(static_cast<uint8_t>(m_Acc));
+            m_Acc = 0;
+            m_NBits = 0;
+        }
+    };
+
+    /// LSB-first bit stream reader
+    class BitReader
+    {
+        const uint8_t* m_Ptr;
+        const uint8_t* m_End;
+        uint64_t m_Acc   {0};
+        int      m_NBits {0};
+    public:
+        BitReader(const uint8_t* begin, const uint8_t* end) :
+            m_Ptr(begin), m_End(end) {}
+
+        uint32_t Get(int width)
+        {
+            if(width == 0) return 0;
+            for(; m_NBits < width; m_NBits += 8){
+                if(m_Ptr == m_End)
+                   throw std::runtime_error
+                   ("Truncated fingerprint frame. The fingerprint database appears to be corrupt.");
+                m_Acc |= static_cast<uint64_t>(*m_Ptr++) << m_NBits;
+            }
+            uint32_t v = static_cast<uint32_t>(m_Acc & ((uint64_t(1) << width) - 1));
+            m_Acc >>= width;
+            m_NBits -= width;
+            return v;
+        }
+    };
+
+    /// Get the header of the given record if it's encoded, null otherwise
+    static const Header_t* GetHeader(const uint8_t* data, size_t size, Header_t &hdr)
+    {
+        if(data == nullptr || size < sizeof(Header_t))
+           return nullptr;
+
+        std::memcpy(&hdr, data, sizeof(Header_t));
+
+        if(hdr.Magic != MAGIC ||
+           hdr.Version != VERSION ||
+           hdr.FrameLFs != FRAME_LFS)
+           return nullptr;
+
+        size_t nframes = (static_cast<size_t>(hdr.LFCount) + FRAME_LFS - 1) / FRAME_LFS;
+
+        if(hdr.FrameCount != nframes ||
+           size < sizeof(Header_t) + nframes * (4 + FRAME_HEADER_SIZE))
+           throw std::runtime_error
+           ("Invalid fingerprint record. The fingerprint database appears to be corrupt.");
+
+        return &hdr;
+    }
+
+    /// Decode the specified frame into the given buffer (FRAME_LFS raw LFs
+    /// at most). Returns the number of decoded LFs.
+    static size_t DecodeFrame(const uint8_t* data,
+                              size_t size,
+                              const Header_t &hdr,
+                              size_t frame,
+                              uint8_t* out)
+    {
+        const uint8_t* index = data + sizeof(Header_t);
+
+        uint32_t begin, end;
+        std::memcpy(&begin, index + frame * 4, 4);
+        if(frame + 1 < hdr.FrameCount)
+           std::memcpy(&end, index + (frame + 1) * 4, 4);
+        else
+           end = static_cast<uint32_t>(size);
+
+        if(begin > end || end > size || end - begin < FRAME_HEADER_SIZE)
+           throw std::runtime_error
+           ("Invalid fingerprint frame. The fingerprint database appears to be corrupt.");
+
+        const uint8_t* pf = data + begin;
+
+        uint32_t T;
+        std::memcpy(&T, pf, 4);
+
+        int wT = pf[4], wF = pf[5], wW = pf[6], wE = pf[7];
+
+        if(wT > 32 || wF > 16 || wW > 8 || wE > 8)
+           throw std::runtime_error
+           ("Invalid fingerprint frame. The fingerprint database appears to be corrupt.");
+
+        size_t nlfs = hdr.LFCount - frame * FRAME_LFS;
+        if(nlfs > FRAME_LFS) nlfs = FRAME_LFS;
+
+        BitReader bits (pf + FRAME_HEADER_SIZE, data + end);
+
+        for(size_t i=0; i<nlfs; i++)
+        {
+            LF_t lf;
+            T += UnZigZag(bits.Get(wT));
+            lf.T = T;
+            lf.F = bits.Get(wF);
+            lf.W = bits.Get(wW);
+            lf.E = bits.Get(wE);
+            PutLF(lf, out + i * LF_SIZE);
+        }
+
+        return nlfs;
+    }
+
+public:
+
+    /// Record identifier ("AXFZ")
+    static const uint32_t MAGIC = 0x5A465841;
+
+    /// Encoding version
+    static const uint16_t VERSION = 1;
+
+    /// Number of LFs per frame
+    static const size_t FRAME_LFS = 128;
+
+    /// Encode the given raw fingerprint into 'out'. If the fingerprint cannot
+    /// be encoded or the encoding is not smaller, it is copied as it is.
+    static void Encode(const uint8_t* data, size_t size, std::vector<uint8_t> &out)
+    {
+        out.clear();
+
+        size_t nlfs = size / LF_SIZE;
+
+        if(size == 0 || size % LF_SIZE || nlfs > UINT32_MAX){
+           out.assign(data, data + size);
+           return;
+        }
+
+        Header_t hdr;
+        hdr.Magic = MAGIC;
+        hdr.Version = VERSION;
+        hdr.FrameLFs = FRAME_LFS;
+        hdr.LFCount = static_cast<uint32_t>(nlfs);
+        hdr.FrameCount = static_cast<uint32_t>((nlfs + FRAME_LFS - 1) / FRAME_LFS);
+
+        out.reserve(size);
+        out.resize(sizeof(Header_t) + hdr.FrameCount * 4);
+        std::memcpy(out.data(), &hdr, sizeof(Header_t));
+
+        LF_t lfs[FRAME_LFS];
+
+        for(size_t f=0; f<hdr.FrameCount; f++)
+        {
+            size_t n = nlfs - f * FRAME_LFS;
+            if(n > FRAME_LFS) n = FRAME_LFS;
+
+            uint32_t mT=0, mF=0, mW=0, mE=0;
+            uint32_t Tprev = 0;
+
+            for(size_t i=0; i<n; i++)
+            {
+                LF_t &lf = lfs[i];
+                GetLF(data + (f * FRAME_LFS + i) * LF_SIZE, lf);
+                uint32_t T = lf.T;
+                // Store the zig-zagged time deltas in place of the times
+                lf.T = i ? ZigZag(T - Tprev) : 0;
+                Tprev = T;
+                mT = std::max(mT, lf.T);
+                mF = std::max(mF, lf.F);
+                mW = std::max(mW, lf.W);
+                mE = std::max(mE, lf.E);
+            }
+
+            uint32_t offset = static_cast<uint32_t>(out.size());
+            std::memcpy(out.data() + sizeof(Header_t) + f * 4, &offset, 4);
+
+            uint32_t Tbase;
+            std::memcpy(&Tbase, data + f * FRAME_LFS * LF_SIZE, 4);
+
+            uint8_t fhdr[FRAME_HEADER_SIZE];
+            std::memcpy(fhdr, &Tbase, 4);
+            fhdr[4] = Bits(mT);
+            fhdr[5] = Bits(mF);
+            fhdr[6] = Bits(mW);
+            fhdr[7] = Bits(mE);
+            out.insert(out.end(), fhdr, fhdr + FRAME_HEADER_SIZE);
+
+            BitWriter bits (out);
+
+            for(size_t i=0; i<n; i++){
+                bits.Put(lfs[i].T, fhdr[4]);
+                bits.Put(lfs[i].F, fhdr[5]);
+                bits.Put(lfs[i].W, fhdr[6]);
+                bits.Put(lfs[i].E, fhdr[7]);
+            }
+            bits.Flush();
+        }
+
+        if(out.size() >= size)
+           out.assign(data, data + size);
+    }
+
+    /// Check whether the given record is an encoded fingerprint
+    static bool IsEncoded(const uint8_t* data, size_t size)
+    {
+        return GetDecodedSize(data, size) > 0;
+    }
+
+    /// Get the size of the raw fingerprint held in the given record. Only the
+    /// header of an encoded record is needed (see GetHeaderSize()), so that the
+    /// size can be found without reading the whole record. Returns zero if the
+    /// data is not the header of an encoded record, in which case the record is
+    /// a raw fingerprint and its size is the record's size.
+    static size_t GetDecodedSize(const uint8_t* data, size_t size)
+    {
+        Header_t hdr;
+        if(data && size >= sizeof(Header_t)){
+           std::memcpy(&hdr, data, sizeof(Header_t));
+           if(hdr.Magic == MAGIC && hdr.Version == VERSION && hdr.FrameLFs == FRAME_LFS)
+              return static_cast<size_t>(hdr.LFCount) * LF_SIZE;
+        }
+        return 0;
+    }
+
+    /// Get the size of the records' header
+    static size_t GetHeaderSize()
+    {
+        return sizeof(Header_t);
+    }
+
+    /// Decode 'nbytes' bytes of the raw fingerprint held in the given record,
+    /// starting at offset 'bo', into 'out'. Only the frames spanned by the range
+    /// are decoded. If 'nbytes' is zero, the whole fingerprint starting at 'bo'
+    /// is decoded (use GetDecodedSize() to size the buffer). Returns the number
+    /// of bytes written, which is less than requested if the range exceeds the
+    /// fingerprint's size.
+    static size_t Decode(const uint8_t* data,
+                         size_t size,
+                         uint8_t* out,
+                         size_t nbytes,
+                         size_t bo = 0)
+    {
+        Header_t hdr;
+
+        // Records stored as they are
+        if(!GetHeader(data, size, hdr)){
+           if(bo >= size)
+              return 0;
+           size_t n = nbytes ? std::min(nbytes, size - bo) : size - bo;
+           std::copy(data + bo, data + bo + n, out);
+           return n;
+        }
+
+        size_t raw_size = static_cast<size_t>(hdr.LFCount) * LF_SIZE;
+
+        if(bo >= raw_size)
+           return 0;
+
+        size_t n = nbytes ? std::min(nbytes, raw_size - bo) : raw_size - bo;
+
+        const size_t frame_bytes = FRAME_LFS * LF_SIZE;
+
+        uint8_t frame[FRAME_LFS * LF_SIZE];
+
+        for(size_t f = bo / frame_bytes; f <= (bo + n - 1) / frame_bytes; f++)
+        {
+            size_t fo = f * frame_bytes;
+            size_t flen = DecodeFrame(data, size, hdr, f, frame) * LF_SIZE;
+
+            // Copy the part of the frame overlapping the range
+            size_t lo = std::max(bo, fo);
+            size_t hi = std::min(bo + n, fo + flen);
+
+            std::memcpy(out + (lo - bo), frame + (lo - fo), hi - lo);
+        }
+
+        return n;
+    }
+};
+
+#endif
@@ -14,6 +14,8 @@
 #include <cstdint>
 #include <vector>
 #include <memory>
+#include <string>
+#include <stdexcept>
 #include <boost/unordered_map.hpp>
 
 #include "audioneex.h"
@@ -100,6 +102,13 @@ public:
     /// Get datastore info
     virtual DBInfo_t GetInfo() = 0;
 
+    /// Get the identifiers of all the postings lists in the index, in
+    /// increasing order. This is used by tools that need to walk the whole
+    /// index, such as format converters, and is not supported by default.
+    virtual void GetPListIDs(std::vector<int> &/*lids*/) {
+        throw std::logic_error("GetPListIDs(): Not supported by this data store");
+    }
+
     /// Get operation mode
     virtual eOperation GetOpMode() const { 
         return m_Op; 
@@ -238,11 +247,28 @@ public:
 // ----------------------------------------------------------------------------
 
 
+/// Version of the format of the index lists. The data stores record it when
+/// an index is created and check it on opening, so that indexes built in a
+/// different format are rejected rather than misread. Bump it whenever the
+/// layout of the lists changes. The original format (version 1) was never
+/// recorded, so indexes built in it have no version (0).
+const uint32_t INDEX_FORMAT_VERSION = 3;
+
 /// Data store info record
 struct DBInfo_t{
-    int MatchType  {0};
+    int      MatchType  {0};
+    uint32_t Version    {INDEX_FORMAT_VERSION};
 };
 
+/// Check that an index recorded with the given info is in the current format
+inline void CheckIndexFormat(const DBInfo_t &info)
+{
+    if(info.Version != INDEX_FORMAT_VERSION)
+       throw Audioneex::InvalidIndexDataException
+            ("The index is in an unsupported format (version " +
+             std::to_string(info.Version) + "). It must be rebuilt.");
+}
+
 /// Convenience structure to manipulate index list blocks
 struct PListBlock
 {
@@ -0,0 +1,676 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+
+#include <string>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include "MMapDataStore.h"
+
+using namespace Audioneex;
+
+namespace {
+
+const char SEGMENT_MAGIC[8] = {'A','X','S','E','G','M','N','T'};
+
+const uint64_t SEGMENT_ALIGN = 8;
+
+inline uint64_t Align(uint64_t offset)
+{
+    return (offset + SEGMENT_ALIGN - 1) & ~(SEGMENT_ALIGN - 1);
+}
+
+}// end anonymous namespace
+
+
+// ----------------------------------------------------------------------------
+
+const Segment::Header_t* Segment::Validate(const uint8_t* data, size_t size)
+{
+    auto valid_dir = [size](uint64_t offset, uint64_t count, size_t esize){
+        return offset % SEGMENT_ALIGN == 0 &&
+               offset <= size &&
+               count <= (size - offset) / esize;
+    };
+
+    if(!data || size < sizeof(Header_t))
+       return nullptr;
+
+    const Header_t* hdr = reinterpret_cast<const Header_t*>(data);
+
+    if(std::memcmp(hdr->Magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0 ||
+       hdr->Version != VERSION ||
+       hdr->FileSize != size ||
+       !valid_dir(hdr->ListDirOffset, hdr->ListCount, sizeof(List_t)) ||
+       !valid_dir(hdr->BlockDirOffset, hdr->BlockCount, sizeof(Block_t)) ||
+       !valid_dir(hdr->FPDirOffset, hdr->FPCount, sizeof(Record_t)) ||
+       !valid_dir(hdr->MetaDirOffset, hdr->MetaCount, sizeof(Record_t)))
+       return nullptr;
+
+    return hdr;
+}
+
+// ----------------------------------------------------------------------------
+
+void Segment::CheckVersion(const uint8_t* data, size_t size, const std::string &file)
+{
+    if(!data || size < sizeof(Header_t))
+       return;
+
+    const Header_t* hdr = reinterpret_cast<const Header_t*>(data);
+
+    if(std::memcmp(hdr->Magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) == 0 &&
+       hdr->Version != VERSION)
+       throw Audioneex::InvalidIndexDataException
+            ("Segment file " + file + " is in an unsupported format (version " +
+             std::to_string(hdr->Version) + "). It must be rebuilt.");
+}
+
+// ----------------------------------------------------------------------------
+
+std::string Segment::Path(std::string url, const char* name)
+{
+    // Append the path separator if missing (Windows accepts '/' as well)
+    url += url.empty() ? "" :
+           (url.back()=='/' || url.back()=='\\' ? "" : "/");
+    return url + name;
+}
+
+
+//=============================================================================
+//                             MMapSegmentWriter
+//=============================================================================
+
+
+MMapSegmentWriter::MMapSegmentWriter(const std::string &file) :
+    m_File   (file, std::ios::binary | std::ios::trunc),
+    m_Header ()
+{
+    if(!m_File)
+       throw std::runtime_error("Couldn't create segment file "+file);
+
+    std::memcpy(m_Header.Magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    m_Header.Version = Segment::VERSION;
+
+    // Reserve space for the header. It is written on closing.
+    Append(&m_Header, sizeof(m_Header));
+}
+
+// ----------------------------------------------------------------------------
+
+uint64_t MMapSegmentWriter::Append(const void* data, size_t size)
+{
+    static const char pad[SEGMENT_ALIGN] = {0};
+
+    uint64_t offset = Align(m_Offset);
+
+    m_File.write(pad, offset - m_Offset);
+    m_File.write(reinterpret_cast<const char*>(data), size);
+
+    if(!m_File)
+       throw std::runtime_error("Couldn't write segment file");
+
+    m_Offset = offset + size;
+    return offset;
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapSegmentWriter::AddBlock(int list_id, const uint8_t* data, size_t size)
+{
+    assert(data && size > 0);
+
+    if(m_Lists.empty() || m_Lists.back().LID != list_id)
+    {
+        if(!m_Lists.empty() && m_Lists.back().LID > list_id)
+           throw std::invalid_argument
+           ("AddBlock(): Lists must be added in increasing ID order");
+
+        Segment::List_t list;
+        list.LID = list_id;
+        list.BlockCount = 0;
+        list.FirstBlock = m_Blocks.size();
+        m_Lists.push_back(list);
+    }
+
+    Segment::Block_t block;
+    block.Offset = Append(data, size);
+    block.Size = size;
+
+    m_Blocks.push_back(block);
+    m_Lists.back().BlockCount++;
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapSegmentWriter::AddFingerprint(uint32_t FID, const uint8_t* data, size_t size)
+{
+    assert(data && size > 0);
+
+    if(!m_FPs.empty() && m_FPs.back().FID >= FID)
+       throw std::invalid_argument
+       ("AddFingerprint(): Fingerprints must be added in increasing FID order");
+
+    Segment::Record_t rec;
+    rec.FID = FID;
+    rec.Reserved = 0;
+    rec.Offset = Append(data, size);
+    rec.Size = size;
+
+    m_FPs.push_back(rec);
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapSegmentWriter::AddMetadata(uint32_t FID, const std::string &meta)
+{
+    if(!m_Meta.empty() && m_Meta.back().FID >= FID)
+       throw std::invalid_argument
+       ("AddMetadata(): Metadata must be added in increasing FID order");
+
+    Segment::Record_t rec;
+    rec.FID = FID;
+    rec.Reserved = 0;
+    rec.Offset = Append(meta.data(), meta.size());
+    rec.Size = meta.size();
+
+    m_Meta.push_back(rec);
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapSegmentWriter::SetInfo(const DBInfo_t &info)
+{
+    m_Header.MatchType = info.MatchType;
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapSegmentWriter::Close()
+{
+    if(!m_File.is_open())
+       return;
+
+    m_Header.ListCount = m_Lists.size();
+    m_Header.ListDirOffset = Append(m_Lists.data(), m_Lists.size() * sizeof(Segment::List_t));
+    m_Header.BlockCount = m_Blocks.size();
+    m_Header.BlockDirOffset = Append(m_Blocks.data(), m_Blocks.size() * sizeof(Segment::Block_t));
+    m_Header.FPCount = m_FPs.size();
+    m_Header.FPDirOffset = Append(m_FPs.data(), m_FPs.size() * sizeof(Segment::Record_t));
+    m_Header.MetaCount = m_Meta.size();
+    m_Header.MetaDirOffset = Append(m_Meta.data(), m_Meta.size() * sizeof(Segment::Record_t));
+    m_Header.FileSize = m_Offset;
+
+    m_File.seekp(0);
+    m_File.write(reinterpret_cast<const char*>(&m_Header), sizeof(m_Header));
+    m_File.close();
+
+    if(!m_File)
+       throw std::runtime_error("Couldn't write segment file");
+}
+
+
+
+//=============================================================================
+//                               MMapDataStore
+//=============================================================================
+
+
+const char* MMapDataStore::SEGMENT_FILE_NAME = "data.seg";
+
+// ----------------------------------------------------------------------------
+
+MMapDataStore::MMapDataStore(const std::string &url) :
+    m_SegmentName (SEGMENT_FILE_NAME)
+{
+    m_DBURL = url;
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::Open(eOperation op,
+                         bool use_fing_db,
+                         bool use_meta_db,
+                         bool use_info_db)
+{
+    if(op != GET)
+       throw std::invalid_argument
+       ("Open(): Invalid operation. The data store is read-only.");
+
+    if(m_IsOpen)
+       Close();
+
+    std::string file = Segment::Path(m_DBURL, m_SegmentName.c_str());
+
+    try{
+        using namespace boost::interprocess;
+        file_mapping mapping (file.c_str(), read_only);
+        mapped_region region (mapping, read_only);
+        Segment::CheckVersion(static_cast<const uint8_t*>(region.get_address()),
+                              region.get_size(), file);
+        m_Mapping.swap(mapping);
+        m_Region.swap(region);
+    }
+    catch(const boost::interprocess::interprocess_exception &ex){
+        throw std::runtime_error(std::string(ex.what()) + " " + file);
+    }
+
+    m_Base = static_cast<const uint8_t*>(m_Region.get_address());
+
+    m_Header = Segment::Validate(m_Base, m_Region.get_size());
+
+    // Check that the segment is valid before using its directories.
+    if(!m_Header){
+       Close();
+       throw std::runtime_error("Invalid segment file "+file);
+    }
+
+    m_Lists  = reinterpret_cast<const Segment::List_t*>(m_Base + m_Header->ListDirOffset);
+    m_Blocks = reinterpret_cast<const Segment::Block_t*>(m_Base + m_Header->BlockDirOffset);
+    m_FPs    = reinterpret_cast<const Segment::Record_t*>(m_Base + m_Header->FPDirOffset);
+    m_Meta   = reinterpret_cast<const Segment::Record_t*>(m_Base + m_Header->MetaDirOffset);
+
+    m_Op = op;
+    m_IsOpen = true;
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::Close()
+{
+    boost::interprocess::mapped_region().swap(m_Region);
+    boost::interprocess::file_mapping().swap(m_Mapping);
+
+    m_Base   = nullptr;
+    m_Header = nullptr;
+    m_Lists  = nullptr;
+    m_Blocks = nullptr;
+    m_FPs    = nullptr;
+    m_Meta   = nullptr;
+
+    m_IsOpen = false;
+}
+
+// ----------------------------------------------------------------------------
+
+bool MMapDataStore::Empty()
+{
+    return !m_Header || (m_Header->ListCount == 0 &&
+                         m_Header->FPCount == 0 &&
+                         m_Header->MetaCount == 0);
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::Clear()
+{
+    throw std::logic_error("Clear(): The data store is read-only");
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::SetOpMode(eOperation mode)
+{
+    if(mode != GET)
+       throw std::invalid_argument
+       ("SetOpMode(): Invalid operation. The data store is read-only.");
+}
+
+// ----------------------------------------------------------------------------
+
+const Segment::Record_t* MMapDataStore::FindRecord(const Segment::Record_t* dir,
+                                                   uint64_t count,
+                                                   uint32_t FID) const
+{
+    if(!m_Header)
+       throw std::runtime_error("Segment not open");
+
+    const Segment::Record_t* end = dir + count;
+    const Segment::Record_t* rec = std::lower_bound(dir, end, FID,
+        [](const Segment::Record_t &r, uint32_t fid){ return r.FID < fid; });
+
+    return rec != end && rec->FID == FID ? rec : nullptr;
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::PutFingerprint(uint32_t FID, const uint8_t* data, size_t size)
+{
+    throw std::logic_error("PutFingerprint(): The data store is read-only");
+}
+
+// ----------------------------------------------------------------------------
+
+const uint8_t* MMapDataStore::GetFingerprint(uint32_t FID,
+                                             size_t &read,
+                                             size_t nbytes,
+                                             uint32_t bo)
+{
+    read = 0;
+
+    const Segment::Record_t* rec = FindRecord(m_FPs, m_Header->FPCount, FID);
+
+    if(!rec || bo >= rec->Size || !ValidRange(rec->Offset, rec->Size))
+       return nullptr;
+
+    read = nbytes ? nbytes : rec->Size - bo;
+    read = std::min<size_t>(read, rec->Size - bo);
+
+    return m_Base + rec->Offset + bo;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t MMapDataStore::GetFingerprintSize(uint32_t FID)
+{
+    const Segment::Record_t* rec = FindRecord(m_FPs, m_Header->FPCount, FID);
+    return rec ? rec->Size : 0;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t MMapDataStore::GetFingerprintsCount()
+{
+    return m_Header ? m_Header->FPCount : 0;
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::PutMetadata(uint32_t FID, const std::string& meta)
+{
+    throw std::logic_error("PutMetadata(): The data store is read-only");
+}
+
+// ----------------------------------------------------------------------------
+
+std::string MMapDataStore::GetMetadata(uint32_t FID)
+{
+    const Segment::Record_t* rec = FindRecord(m_Meta, m_Header->MetaCount, FID);
+
+    if(!rec || !ValidRange(rec->Offset, rec->Size))
+       return std::string();
+
+    return std::string(reinterpret_cast<const char*>(m_Base + rec->Offset), rec->Size);
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::PutInfo(const DBInfo_t& info)
+{
+    throw std::logic_error("PutInfo(): The data store is read-only");
+}
+
+// ----------------------------------------------------------------------------
+
+DBInfo_t MMapDataStore::GetInfo()
+{
+    if(!m_Header)
+       throw std::runtime_error("Segment not open");
+
+    DBInfo_t info;
+    info.MatchType = m_Header->MatchType;
+    return info;
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::GetPListIDs(std::vector<int> &lids)
+{
+    lids.clear();
+
+    if(!m_Header)
+       return;
+
+    lids.reserve(m_Header->ListCount);
+
+    for(uint64_t i=0; i<m_Header->ListCount; i++)
+        lids.push_back(m_Lists[i].LID);
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::GetFingerprintIDs(std::vector<uint32_t> &fids) const
+{
+    fids.clear();
+
+    if(!m_Header)
+       return;
+
+    fids.reserve(m_Header->FPCount);
+
+    for(uint64_t i=0; i<m_Header->FPCount; i++)
+        fids.push_back(m_FPs[i].FID);
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::GetMetadataIDs(std::vector<uint32_t> &fids) const
+{
+    fids.clear();
+
+    if(!m_Header)
+       return;
+
+    fids.reserve(m_Header->MetaCount);
+
+    for(uint64_t i=0; i<m_Header->MetaCount; i++)
+        fids.push_back(m_Meta[i].FID);
+}
+
+// ----------------------------------------------------------------------------
+
+const uint8_t* MMapDataStore::GetPListBlock(int list_id,
+                                            int block,
+                                            size_t &data_size,
+                                            bool headers)
+{
+    data_size = 0;
+
+    if(!m_Header)
+       throw std::runtime_error("Segment not open");
+
+    const Segment::List_t* end = m_Lists + m_Header->ListCount;
+    const Segment::List_t* list = std::lower_bound(m_Lists, end, list_id,
+        [](const Segment::List_t &l, int lid){ return l.LID < lid; });
+
+    if(list == end || list->LID != list_id ||
+       block < 1 || static_cast<uint32_t>(block) > list->BlockCount)
+       return nullptr;
+
+    uint64_t bidx = list->FirstBlock + block - 1;
+
+    if(bidx >= m_Header->BlockCount)
+       return nullptr;
+
+    const Segment::Block_t &blk = m_Blocks[bidx];
+
+    // The list header is prepended to the 1st block
+    size_t off = 0;
+
+    if(!headers)
+       off = block==1 ? sizeof(PListHeader) +
+                        sizeof(PListBlockHeader)
+                      :
+                        sizeof(PListBlockHeader);
+
+    if(blk.Size < off || !ValidRange(blk.Offset, blk.Size))
+       return nullptr;
+
+    data_size = blk.Size - off;
+    return m_Base + blk.Offset + off;
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::Convert(KVDataStore &src,
+                            const std::string &url,
+                            bool use_meta_db,
+                            bool use_info_db)
+{
+    MMapSegmentWriter writer (Segment::Path(url, SEGMENT_FILE_NAME));
+
+    std::vector<int> lids;
+    src.GetPListIDs(lids);
+
+    std::vector<uint8_t> buffer (32768);
+
+    uint32_t FIDmax = 0;
+
+    // Copy the postings lists, keeping track of the highest FID in the index
+    for(int lid : lids)
+    {
+        size_t bsize = src.ReadPListBlock(lid, 1, buffer.data(), buffer.size(), true);
+
+        if(bsize > buffer.size()){
+           buffer.resize(bsize);
+           bsize = src.ReadPListBlock(lid, 1, buffer.data(), buffer.size(), true);
+        }
+
+        if(bsize < sizeof(PListHeader) + sizeof(PListBlockHeader))
+           throw std::runtime_error("Invalid list header. The index appears to be corrupt.");
+
+        PListHeader lhdr;
+        std::memcpy(&lhdr, buffer.data(), sizeof(PListHeader));
+
+        for(uint32_t bid=1; bid<=lhdr.BlockCount; bid++)
+        {
+            if(bid > 1){
+               bsize = src.ReadPListBlock(lid, bid, buffer.data(), buffer.size(), true);
+               if(bsize > buffer.size()){
+                  buffer.resize(bsize);
+                  bsize = src.ReadPListBlock(lid, bid, buffer.data(), buffer.size(), true);
+               }
+            }
+
+            size_t hoff = bid==1 ? sizeof(PListHeader) : 0;
+
+            if(bsize < hoff + sizeof(PListBlockHeader))
+               throw std::runtime_error("Missing block. The index appears to be corrupt.");
+
+            PListBlockHeader hdr;
+            std::memcpy(&hdr, buffer.data() + hoff, sizeof(PListBlockHeader));
+            FIDmax = std::max(FIDmax, hdr.FIDmax);
+
+            writer.AddBlock(lid, buffer.data(), bsize);
+        }
+    }
+
+    // The fingerprints are not enumerable, so look for all the FIDs that
+    // may be referenced by the index.
+    size_t Nfp = src.GetFingerprintsCount();
+
+    for(uint32_t FID=1, n=0; n<Nfp && FID<=FIDmax; FID++)
+    {
+        size_t fpsize = src.GetFingerprintSize(FID);
+
+        if(fpsize == 0)
+           continue;
+
+        if(fpsize > buffer.size())
+           buffer.resize(fpsize);
+
+        if(src.ReadFingerprint(FID, buffer.data(), fpsize) != fpsize)
+           throw std::runtime_error("Couldn't read fingerprint "+std::to_string(FID));
+
+        writer.AddFingerprint(FID, buffer.data(), fpsize);
+
+        if(use_meta_db){
+           std::string meta = src.GetMetadata(FID);
+           if(!meta.empty())
+              writer.AddMetadata(FID, meta);
+        }
+        n++;
+    }
+
+    if(use_info_db)
+       writer.SetInfo(src.GetInfo());
+
+    writer.Close();
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::OnIndexerStart()
+{
+    throw std::invalid_argument
+    ("OnIndexerStart(): Invalid operation. The data store is read-only.");
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::OnIndexerEnd()
+{
+    throw std::invalid_argument
+    ("OnIndexerEnd(): Invalid operation. The data store is read-only.");
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::OnIndexerFlushStart()
+{
+    throw std::invalid_argument
+    ("OnIndexerFlushStart(): Invalid operation. The data store is read-only.");
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::OnIndexerFlushEnd()
+{
+    throw std::invalid_argument
+    ("OnIndexerFlushEnd(): Invalid operation. The data store is read-only.");
+}
+
+// ----------------------------------------------------------------------------
+
+PListHeader MMapDataStore::OnIndexerListHeader(int list_id)
+{
+    throw std::invalid_argument
+    ("OnIndexerListHeader(): Invalid operation. The data store is read-only.");
+}
+
+// ----------------------------------------------------------------------------
+
+PListBlockHeader MMapDataStore::OnIndexerBlockHeader(int list_id, int block)
+{
+    throw std::invalid_argument
+    ("OnIndexerBlockHeader(): Invalid operation. The data store is read-only.");
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::OnIndexerChunk(int list_id,
+                                   PListHeader &lhdr,
+                                   PListBlockHeader &hdr,
+                                   uint8_t* data, size_t data_size)
+{
+    throw std::invalid_argument
+    ("OnIndexerChunk(): Invalid operation. The data store is read-only.");
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::OnIndexerNewBlock(int list_id,
+                                      PListHeader &lhdr,
+                                      PListBlockHeader &hdr,
+                                      uint8_t* data, size_t data_size)
+{
+    throw std::invalid_argument
+    ("OnIndexerNewBlock(): Invalid operation. The data store is read-only.");
+}
+
+// ----------------------------------------------------------------------------
+
+void MMapDataStore::OnIndexerFingerprint(uint32_t FID, uint8_t *data, size_t size)
+{
+    throw std::invalid_argument
+    ("OnIndexerFingerprint(): Invalid operation. The data store is read-only.");
+}
@@ -0,0 +1,324 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+#ifndef MMAPDATASTORE_H
+#define MMAPDATASTORE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "KVDataStore.h"
+
+/// The segment file format. A segment is an immutable, single-file snapshot
+/// of a finished index and its fingerprints, laid out so that it can be
+/// memory-mapped and read in place:
+///
+///   [header][data...][lists dir][blocks dir][fingerprints dir][metadata dir]
+///
+/// The data area holds the postings blocks exactly as emitted by the indexer
+/// (the list header prepended to the 1st block), the fingerprints and the
+/// metadata strings. The directories are sorted by key, so lookups are binary
+/// searches. All the items are 8-byte aligned.
+
+namespace Segment
+{
+    /// Current format version
+    const uint32_t VERSION = 4;
+
+    struct Header_t
+    {
+        char     Magic[8];
+        uint32_t Version;
+        int32_t  MatchType;
+        uint64_t ListCount;
+        uint64_t ListDirOffset;
+        uint64_t BlockCount;
+        uint64_t BlockDirOffset;
+        uint64_t FPCount;
+        uint64_t FPDirOffset;
+        uint64_t MetaCount;
+        uint64_t MetaDirOffset;
+        uint64_t FileSize;
+    };
+
+    /// Lists directory entry
+    struct List_t
+    {
+        int32_t  LID;
+        uint32_t BlockCount;
+        uint64_t FirstBlock;  // Index in the blocks directory
+    };
+
+    /// Blocks directory entry
+    struct Block_t
+    {
+        uint64_t Offset;
+        uint64_t Size;
+    };
+
+    /// Fingerprints and metadata directories entry
+    struct Record_t
+    {
+        uint32_t FID;
+        uint32_t Reserved;
+        uint64_t Offset;
+        uint64_t Size;
+    };
+
+    /// Check that the given memory holds a valid segment and return its header
+    /// (null if not valid). The directories of a valid segment can be accessed
+    /// safely, while the data ranges they point to must be checked on access.
+    const Header_t* Validate(const uint8_t* data, size_t size);
+
+    /// Check that a segment in the given memory, if any, is in the current
+    /// format version. Throw an InvalidIndexDataException if it's not, as
+    /// such segments are not corrupt but can't be read.
+    void CheckVersion(const uint8_t* data, size_t size, const std::string &file);
+
+    /// Check that the given data range lies within the segment
+    inline bool ValidRange(const Header_t* hdr, uint64_t offset, uint64_t size) {
+        return offset <= hdr->FileSize && size <= hdr->FileSize - offset;
+    }
+
+    /// Get the path of the segment file in the given URL
+    std::string Path(std::string url, const char* name);
+}
+
+
+// ----------------------------------------------------------------------------
+
+/// This class writes a segment file. Lists must be added in increasing LID
+/// order, each with its blocks in increasing block ID order, and fingerprints
+/// and metadata in increasing FID order.
+
+class MMapSegmentWriter
+{
+    std::ofstream                  m_File;
+    uint64_t                       m_Offset     {0};
+    Segment::Header_t              m_Header;
+    std::vector<Segment::List_t>   m_Lists;
+    std::vector<Segment::Block_t>  m_Blocks;
+    std::vector<Segment::Record_t> m_FPs;
+    std::vector<Segment::Record_t> m_Meta;
+
+    /// Append the given data at the next aligned offset. Return its offset.
+    uint64_t Append(const void* data, size_t size);
+
+public:
+
+    explicit MMapSegmentWriter(const std::string &file);
+    ~MMapSegmentWriter() = default;
+
+    /// Append a block to the specified list. The block's data must include
+    /// its headers, as returned by DataStore::GetPListBlock(..., true).
+    void AddBlock(int list_id, const uint8_t* data, size_t size);
+
+    /// Add a fingerprint
+    void AddFingerprint(uint32_t FID, const uint8_t* data, size_t size);
+
+    /// Add metadata for the specified fingerprint
+    void AddMetadata(uint32_t FID, const std::string &meta);
+
+    /// Set custom info
+    void SetInfo(const DBInfo_t &info);
+
+    /// Write the directories and the header and close the file.
+    void Close();
+};
+
+
+// ----------------------------------------------------------------------------
+
+/// This is a read-only implementation of the KVDataStore interface that serves
+/// the data from a memory-mapped segment file (see Segment). Blocks and
+/// fingerprints are returned as pointers into the mapped file, so reads involve
+/// no copies nor allocations, the mapping is shared among all the processes
+/// using the same segment and all the read methods are reentrant.
+/// Segments are produced from other data stores using Convert().
+
+class MMapDataStore : public KVDataStore
+{
+    boost::interprocess::file_mapping   m_Mapping;
+    boost::interprocess::mapped_region  m_Region;
+
+    const uint8_t*            m_Base       {nullptr};
+    const Segment::Header_t*  m_Header     {nullptr};
+    const Segment::List_t*    m_Lists      {nullptr};
+    const Segment::Block_t*   m_Blocks     {nullptr};
+    const Segment::Record_t*  m_FPs        {nullptr};
+    const Segment::Record_t*  m_Meta       {nullptr};
+    std::string               m_SegmentName;
+
+    /// Find the specified record in the given directory (null if not found)
+    const Segment::Record_t* FindRecord(const Segment::Record_t* dir,
+                                        uint64_t count,
+                                        uint32_t FID) const;
+
+    /// Check that the given data range lies within the segment
+    bool ValidRange(uint64_t offset, uint64_t size) const {
+        return Segment::ValidRange(m_Header, offset, size);
+    }
+
+public:
+
+    /// Name of the segment file within the data store URL
+    static const char* SEGMENT_FILE_NAME;
+
+    explicit MMapDataStore(const std::string &url = std::string());
+    ~MMapDataStore() = default;
+
+    /// Open the datastore. Only the GET operation is supported. The other
+    /// parameters are ignored as all the collections are in the segment.
+    void
+    Open(eOperation op = GET,
+         bool use_fing_db=true,
+         bool use_meta_db=false,
+         bool use_info_db=false) override;
+
+    /// Close the datastore
+    void
+    Close() override;
+
+    /// Check whether the datastore contains no data
+    bool
+    Empty() override;
+
+    /// Not supported (read-only)
+    void
+    Clear() override;
+
+    /// Only the GET operation is supported
+    void
+    SetOpMode(eOperation mode) override;
+
+    /// Not supported (read-only)
+    void
+    PutFingerprint(uint32_t FID, const uint8_t* data, size_t size) override;
+
+    /// Get a fingerprint
+    const uint8_t*
+    GetFingerprint(uint32_t FID,
+                   size_t &read,
+                   size_t nbytes = 0,
+                   uint32_t bo = 0) override;
+
+    /// Not supported (read-only)
+    void
+    PutMetadata(uint32_t FID, const std::string& meta) override;
+
+    /// Get metadata for the specified fingerprint
+    std::string
+    GetMetadata(uint32_t FID) override;
+
+    /// Not supported (read-only)
+    void
+    PutInfo(const DBInfo_t& info) override;
+
+    /// Get custom info
+    DBInfo_t
+    GetInfo() override;
+
+    /// Get the identifiers of all the lists in the index
+    void
+    GetPListIDs(std::vector<int> &lids) override;
+
+    /// Get the identifiers of all the fingerprints in the segment, in
+    /// increasing order
+    void
+    GetFingerprintIDs(std::vector<uint32_t> &fids) const;
+
+    /// Get the identifiers of all the fingerprints having metadata in the
+    /// segment, in increasing order
+    void
+    GetMetadataIDs(std::vector<uint32_t> &fids) const;
+
+    /// Set the name of the segment file within the data store URL
+    /// (SEGMENT_FILE_NAME by default). Takes effect on opening.
+    void
+    SetSegmentName(const std::string &name) {
+        m_SegmentName = name;
+    }
+
+    /// Get the size of the open segment in bytes
+    uint64_t
+    GetSegmentSize() const {
+        return m_Header ? m_Header->FileSize : 0;
+    }
+
+    /// Convert the contents of the given data store into a segment in the
+    /// specified URL. The source data store must be open. Fingerprints are
+    /// converted if the fingerprints collection is open, while metadata and
+    /// info are converted only if requested (their collections must be open).
+    static void
+    Convert(KVDataStore &src,
+            const std::string &url,
+            bool use_meta_db=false,
+            bool use_info_db=false);
+
+
+    // API Interface
+
+    const uint8_t*
+    GetPListBlock(int list_id,
+                  int block,
+                  size_t& data_size,
+                  bool headers=false) override;
+
+    size_t
+    GetFingerprintSize(uint32_t FID) override;
+
+    size_t
+    GetFingerprintsCount() override;
+
+    bool
+    IsReentrant() const override {
+        return true;
+    }
+
+    void
+    OnIndexerStart() override;
+
+    void
+    OnIndexerEnd() override;
+
+    void
+    OnIndexerFlushStart() override;
+
+    void
+    OnIndexerFlushEnd() override;
+
+    Audioneex::PListHeader
+    OnIndexerListHeader(int list_id) override;
+
+    Audioneex::PListBlockHeader
+    OnIndexerBlockHeader(int list_id, int block) override;
+
+    void
+    OnIndexerChunk(int list_id,
+                   Audioneex::PListHeader &lhdr,
+                   Audioneex::PListBlockHeader &hdr,
+                   uint8_t* data, size_t data_size) override;
+
+    void
+    OnIndexerNewBlock (int list_id,
+                       Audioneex::PListHeader &lhdr,
+                       Audioneex::PListBlockHeader &hdr,
+                       uint8_t* data, size_t data_size) override;
+
+    void
+    OnIndexerFingerprint(uint32_t FID,
+                         uint8_t* data,
+                         size_t size) override;
+};
+
+
+#endif
@@ -0,0 +1,651 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+
+#include <string>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <fstream>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "MemDataStore.h"
+
+using namespace Audioneex;
+
+
+// ----------------------------------------------------------------------------
+
+MemDataStore::MemDataStore(const std::string &url)
+{
+    m_DBURL = url;
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::Open(eOperation op,
+                        bool use_fing_db,
+                        bool use_meta_db,
+                        bool use_info_db)
+{
+    if(m_IsOpen)
+       Close();
+
+    // Load the segment, if any
+    if(!m_DBURL.empty() &&
+       std::ifstream(Segment::Path(m_DBURL, MMapDataStore::SEGMENT_FILE_NAME)))
+       Load(m_DBURL);
+
+    m_UseFingerprints = use_fing_db;
+    m_Op = op;
+    m_IsOpen = true;
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::Close()
+{
+    if(m_IsOpen && m_Op != GET && !m_DBURL.empty())
+       Save(m_DBURL);
+
+    m_DeltaIndex.clear();
+
+    m_IsOpen = false;
+}
+
+// ----------------------------------------------------------------------------
+
+bool MemDataStore::Empty()
+{
+    return m_MainIndex.empty() &&
+           m_FPTable.empty() &&
+           m_Metadata.empty();
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::Clear()
+{
+    m_MainIndex.clear();
+    m_DeltaIndex.clear();
+    m_FPArena.clear();
+    m_FPTable.clear();
+    m_Metadata.clear();
+    m_Info = DBInfo_t();
+    m_DocFreq.clear();
+    m_DocFreqValid = true;
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::Save(const std::string &url, const std::string &name)
+{
+    MMapSegmentWriter writer (Segment::Path(url, name.c_str()));
+
+    for(size_t lid=0; lid<m_MainIndex.size(); lid++)
+    {
+        const mem_list &list = m_MainIndex[lid];
+
+        for(const mem_block &block : list)
+        {
+            if(block.empty())
+               throw std::runtime_error("Missing block. The index appears to be corrupt.");
+
+            writer.AddBlock(lid, block.data(), block.size());
+        }
+    }
+
+    // The segment directories must be sorted by FID
+
+    std::vector<uint32_t> fids;
+    fids.reserve(m_FPTable.size());
+
+    for(auto &rec : m_FPTable)
+        fids.push_back(rec.first);
+
+    std::sort(fids.begin(), fids.end());
+
+    for(uint32_t FID : fids){
+        const FPRecord_t &rec = m_FPTable[FID];
+        writer.AddFingerprint(FID, m_FPArena.data() + rec.Offset, rec.Size);
+    }
+
+    fids.clear();
+
+    for(auto &meta : m_Metadata)
+        fids.push_back(meta.first);
+
+    std::sort(fids.begin(), fids.end());
+
+    for(uint32_t FID : fids)
+        writer.AddMetadata(FID, m_Metadata[FID]);
+
+    writer.SetInfo(m_Info);
+    writer.Close();
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::Load(const std::string &url, const std::string &name)
+{
+    using namespace boost::interprocess;
+
+    std::string file = Segment::Path(url, name.c_str());
+
+    file_mapping mapping;
+    mapped_region region;
+
+    try{
+        file_mapping fmap (file.c_str(), read_only);
+        mapped_region freg (fmap, read_only);
+        mapping.swap(fmap);
+        region.swap(freg);
+    }
+    catch(const interprocess_exception &ex){
+        throw std::runtime_error(std::string(ex.what()) + " " + file);
+    }
+
+    const uint8_t* base = static_cast<const uint8_t*>(region.get_address());
+
+    Segment::CheckVersion(base, region.get_size(), file);
+
+    const Segment::Header_t* header = Segment::Validate(base, region.get_size());
+
+    if(!header)
+       throw std::runtime_error("Invalid segment file "+file);
+
+    auto lists  = reinterpret_cast<const Segment::List_t*>(base + header->ListDirOffset);
+    auto blocks = reinterpret_cast<const Segment::Block_t*>(base + header->BlockDirOffset);
+    auto fps    = reinterpret_cast<const Segment::Record_t*>(base + header->FPDirOffset);
+    auto meta   = reinterpret_cast<const Segment::Record_t*>(base + header->MetaDirOffset);
+
+    // Build the new contents aside so that the current ones are left
+    // untouched if the segment turns out to be corrupt.
+
+    mem_index             index;
+    std::vector<uint8_t>  arena;
+    fp_table              fptable;
+    meta_table            metadata;
+
+    for(uint64_t i=0; i<header->ListCount; i++)
+    {
+        const Segment::List_t &list = lists[i];
+
+        if(list.LID < 0 ||
+           list.FirstBlock > header->BlockCount ||
+           list.BlockCount > header->BlockCount - list.FirstBlock)
+           throw std::runtime_error("Invalid segment file "+file);
+
+        if(index.size() <= static_cast<size_t>(list.LID))
+           index.resize(list.LID + 1);
+
+        mem_list &mlist = index[list.LID];
+        mlist.reserve(list.BlockCount);
+
+        for(uint64_t b=0; b<list.BlockCount; b++)
+        {
+            const Segment::Block_t &blk = blocks[list.FirstBlock + b];
+
+            if(blk.Size == 0 || !Segment::ValidRange(header, blk.Offset, blk.Size))
+               throw std::runtime_error("Invalid segment file "+file);
+
+            mlist.emplace_back(base + blk.Offset, base + blk.Offset + blk.Size);
+        }
+    }
+
+    for(uint64_t i=0; i<header->FPCount; i++)
+    {
+        const Segment::Record_t &rec = fps[i];
+
+        if(!Segment::ValidRange(header, rec.Offset, rec.Size))
+           throw std::runtime_error("Invalid segment file "+file);
+
+        FPRecord_t &fprec = fptable[rec.FID];
+        fprec.Offset = arena.size();
+        fprec.Size = rec.Size;
+
+        arena.insert(arena.end(), base + rec.Offset, base + rec.Offset + rec.Size);
+    }
+
+    for(uint64_t i=0; i<header->MetaCount; i++)
+    {
+        const Segment::Record_t &rec = meta[i];
+
+        if(!Segment::ValidRange(header, rec.Offset, rec.Size))
+           throw std::runtime_error("Invalid segment file "+file);
+
+        metadata[rec.FID].assign(reinterpret_cast<const char*>(base + rec.Offset), rec.Size);
+    }
+
+    m_MainIndex.swap(index);
+    m_DeltaIndex.clear();
+    m_FPArena.swap(arena);
+    m_FPTable.swap(fptable);
+    m_Metadata.swap(metadata);
+    m_Info.MatchType = header->MatchType;
+
+    // The document frequencies are not saved in the segment
+    m_DocFreq.clear();
+    m_DocFreqValid = m_MainIndex.empty();
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::PutFingerprint(uint32_t FID, const uint8_t* data, size_t size)
+{
+    assert(data && size > 0);
+
+    FPRecord_t &rec = m_FPTable[FID];
+    rec.Offset = m_FPArena.size();
+    rec.Size = size;
+
+    m_FPArena.insert(m_FPArena.end(), data, data + size);
+}
+
+// ----------------------------------------------------------------------------
+
+const uint8_t* MemDataStore::GetFingerprint(uint32_t FID,
+                                            size_t &read,
+                                            size_t nbytes,
+                                            uint32_t bo)
+{
+    read = 0;
+
+    fp_table::const_iterator it = m_FPTable.find(FID);
+
+    if(it == m_FPTable.end() || bo >= it->second.Size)
+       return nullptr;
+
+    read = nbytes ? nbytes : it->second.Size - bo;
+    read = std::min<size_t>(read, it->second.Size - bo);
+
+    return m_FPArena.data() + it->second.Offset + bo;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t MemDataStore::GetFingerprintSize(uint32_t FID)
+{
+    fp_table::const_iterator it = m_FPTable.find(FID);
+    return it != m_FPTable.end() ? it->second.Size : 0;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t MemDataStore::GetFingerprintsCount()
+{
+    return m_FPTable.size();
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::PutMetadata(uint32_t FID, const std::string& meta)
+{
+    m_Metadata[FID] = meta;
+}
+
+// ----------------------------------------------------------------------------
+
+std::string MemDataStore::GetMetadata(uint32_t FID)
+{
+    meta_table::const_iterator it = m_Metadata.find(FID);
+    return it != m_Metadata.end() ? it->second : std::string();
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::PutInfo(const DBInfo_t& info)
+{
+    m_Info = info;
+}
+
+// ----------------------------------------------------------------------------
+
+DBInfo_t MemDataStore::GetInfo()
+{
+    return m_Info;
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::GetPListIDs(std::vector<int> &lids)
+{
+    lids.clear();
+
+    for(size_t lid=0; lid<m_MainIndex.size(); lid++)
+        if(!m_MainIndex[lid].empty())
+           lids.push_back(lid);
+}
+
+// ----------------------------------------------------------------------------
+
+int64_t MemDataStore::GetDocFrequency(int list_id)
+{
+    if(list_id < 0 || static_cast<size_t>(list_id) >= m_MainIndex.size() ||
+       m_MainIndex[list_id].empty())
+       return 0;
+
+    df_table::const_iterator it = m_DocFreq.find(list_id);
+
+    return m_DocFreqValid && it != m_DocFreq.end() ? it->second : -1;
+}
+
+// ----------------------------------------------------------------------------
+
+const MemDataStore::mem_block*
+MemDataStore::FindBlock(const mem_index &index, int list_id, int block_id)
+{
+    if(list_id < 0 || static_cast<size_t>(list_id) >= index.size() || block_id < 1)
+       return nullptr;
+
+    const mem_list &list = index[list_id];
+
+    if(static_cast<size_t>(block_id) > list.size() || list[block_id-1].empty())
+       return nullptr;
+
+    return &list[block_id-1];
+}
+
+// ----------------------------------------------------------------------------
+
+PListHeader MemDataStore::GetPListHeader(const mem_index &index, int list_id)
+{
+    PListHeader hdr = {};
+
+    // The list header is prepended to the 1st block
+    const mem_block* block = FindBlock(index, list_id, 1);
+
+    if(block && block->size() >= sizeof(PListHeader))
+       std::memcpy(&hdr, block->data(), sizeof(PListHeader));
+
+    return hdr;
+}
+
+// ----------------------------------------------------------------------------
+
+PListBlockHeader MemDataStore::GetPListBlockHeader(const mem_index &index,
+                                                   int list_id,
+                                                   int block_id)
+{
+    PListBlockHeader hdr = {};
+
+    const mem_block* block = FindBlock(index, list_id, block_id);
+
+    // Skip list header if first block
+    size_t hoff = block_id==1 ? sizeof(PListHeader) : 0;
+
+    // NOTE: Delta blocks may contain only the list header (see Merge())
+    if(block && block->size() >= hoff + sizeof(PListBlockHeader))
+       std::memcpy(&hdr, block->data() + hoff, sizeof(PListBlockHeader));
+
+    return hdr;
+}
+
+// ----------------------------------------------------------------------------
+
+const uint8_t* MemDataStore::GetPListBlock(int list_id,
+                                           int block,
+                                           size_t &data_size,
+                                           bool headers)
+{
+    data_size = 0;
+
+    const mem_block* pblock = FindBlock(m_MainIndex, list_id, block);
+
+    if(!pblock)
+       return nullptr;
+
+    // The list header is prepended to the 1st block
+    size_t off = 0;
+
+    if(!headers)
+       off = block==1 ? sizeof(PListHeader) +
+                        sizeof(PListBlockHeader)
+                      :
+                        sizeof(PListBlockHeader);
+
+    if(pblock->size() < off)
+       return nullptr;
+
+    data_size = pblock->size() - off;
+    return pblock->data() + off;
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::AppendChunk(mem_index &index,
+                               int list_id,
+                               PListHeader &lhdr,
+                               PListBlockHeader &hdr,
+                               const uint8_t* chunk, size_t chunk_size,
+                               bool new_block)
+{
+    assert(chunk && chunk_size);
+    assert(!IsNull(hdr));
+
+    if(list_id < 0 || hdr.ID < 1)
+       throw std::invalid_argument("AppendChunk(): Invalid list or block ID");
+
+    if(index.size() <= static_cast<size_t>(list_id))
+       index.resize(list_id + 1);
+
+    mem_list &list = index[list_id];
+
+    if(list.size() < hdr.ID)
+       list.resize(hdr.ID);
+
+    mem_block &block = list[hdr.ID-1];
+
+    // Compute block header offset and headers size
+    size_t hoff = hdr.ID==1 ? sizeof(PListHeader) : 0;
+    size_t hsize = hoff + sizeof(PListBlockHeader);
+
+    // If block does not exist, create new one. The 1st block of a delta index
+    // may hold just the list header (see below).
+    if(block.size() < hsize)
+       block.resize(hsize);
+
+    // Copy/Update list header if first block
+    if(hdr.ID==1){
+       assert(!IsNull(lhdr));
+       std::memcpy(block.data(), &lhdr, sizeof(PListHeader));
+    }
+
+    // Copy/Update block header
+    std::memcpy(block.data() + hoff, &hdr, sizeof(PListBlockHeader));
+
+    // Append chunk
+    block.insert(block.end(), chunk, chunk + chunk_size);
+
+    // Update the list header, located in the first block, as the list's
+    // statistics change with every chunk (not necessary if we're processing
+    // the first block as it's already updated above).
+    if(hdr.ID!=1)
+    {
+       mem_block &first = list[0];
+
+       if(first.size() < sizeof(PListHeader))
+          first.resize(sizeof(PListHeader));
+
+       std::memcpy(first.data(), &lhdr, sizeof(PListHeader));
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::Merge()
+{
+    for(size_t lid=0; lid<m_DeltaIndex.size(); lid++)
+    {
+        mem_list &dlist = m_DeltaIndex[lid];
+
+        if(dlist.empty())
+           continue;
+
+        if(m_MainIndex.size() <= lid)
+           m_MainIndex.resize(lid + 1);
+
+        mem_list &llist = m_MainIndex[lid];
+
+        if(llist.size() < dlist.size())
+           llist.resize(dlist.size());
+
+        for(size_t b=0; b<dlist.size(); b++)
+        {
+            const mem_block &dblock = dlist[b];
+            mem_block &lblock = llist[b];
+
+            if(dblock.empty())
+               continue;
+
+            size_t hoff = b==0 ? sizeof(PListHeader) : 0;
+            size_t hsize = hoff + sizeof(PListBlockHeader);
+
+            // If block doesn't exist in live index, create new one.
+            if(lblock.empty())
+               lblock.resize(hsize);
+
+            // Update list header if first block
+            if(b==0)
+               std::memcpy(lblock.data(), dblock.data(), sizeof(PListHeader));
+
+            // NOTE: Delta blocks may contain only the list header
+            //       (this happens when we are appending a new block other
+            //       than the first and update the block's list header),
+            //       so we need to check whether a block is present.
+            if(dblock.size() > hsize)
+            {
+               // Update block header and append delta body to live block
+               std::memcpy(lblock.data() + hoff, dblock.data() + hoff, sizeof(PListBlockHeader));
+               lblock.insert(lblock.end(), dblock.begin() + hsize, dblock.end());
+            }
+        }
+    }
+
+    m_DeltaIndex.clear();
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::OnIndexerStart()
+{
+    if(m_Op == GET)
+       throw std::invalid_argument
+       ("OnIndexerStart(): Invalid operation (GET)");
+
+    m_DeltaIndex.clear();
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::OnIndexerEnd()
+{
+    // Merge the delta index with the live index if we're performing
+    // a build-merge operation.
+    if(m_Op == BUILD_MERGE)
+       Merge();
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::OnIndexerFlushStart()
+{
+    // Nothing to do. The chunks are written straight into the index.
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::OnIndexerFlushEnd()
+{
+    // Nothing to do. The chunks are written straight into the index.
+}
+
+// ----------------------------------------------------------------------------
+
+PListHeader MemDataStore::OnIndexerListHeader(int list_id)
+{
+    // If we're build-merging read the headers to be updated from the delta
+    // index, and only read from the main index if they cannot be found in
+    // the delta (i.e. the list has not been updated yet).
+
+    if(m_Op == BUILD_MERGE){
+       PListHeader hdr = GetPListHeader(m_DeltaIndex, list_id);
+       return !IsNull(hdr) ? hdr : GetPListHeader(m_MainIndex, list_id);
+    }
+    else if(m_Op == BUILD)
+       return GetPListHeader(m_MainIndex, list_id);
+    else
+       throw std::invalid_argument
+       ("OnIndexerListHeader(): Invalid operation");
+}
+
+// ----------------------------------------------------------------------------
+
+PListBlockHeader MemDataStore::OnIndexerBlockHeader(int list_id, int block)
+{
+    if(m_Op == BUILD_MERGE){
+       PListBlockHeader hdr = GetPListBlockHeader(m_DeltaIndex, list_id, block);
+       return !IsNull(hdr) ? hdr : GetPListBlockHeader(m_MainIndex, list_id, block);
+    }
+    else if(m_Op == BUILD)
+       return GetPListBlockHeader(m_MainIndex, list_id, block);
+    else
+       throw std::invalid_argument
+       ("OnIndexerBlockHeader(): Invalid operation");
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::OnIndexerChunk(int list_id,
+                                  PListHeader &lhdr,
+                                  PListBlockHeader &hdr,
+                                  uint8_t* data, size_t data_size)
+{
+    if(m_Op == BUILD_MERGE)
+       AppendChunk(m_DeltaIndex, list_id, lhdr, hdr, data, data_size);
+    else if(m_Op == BUILD)
+       AppendChunk(m_MainIndex, list_id, lhdr, hdr, data, data_size);
+    else
+       throw std::invalid_argument
+       ("OnIndexerChunkAppend(): Invalid operation");
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::OnIndexerNewBlock(int list_id,
+                                     PListHeader &lhdr,
+                                     PListBlockHeader &hdr,
+                                     uint8_t* data, size_t data_size)
+{
+    if(m_Op == BUILD_MERGE)
+       AppendChunk(m_DeltaIndex, list_id, lhdr, hdr, data, data_size, true);
+    else if(m_Op == BUILD)
+       AppendChunk(m_MainIndex, list_id, lhdr, hdr, data, data_size, true);
+    else
+       throw std::invalid_argument
+       ("OnIndexerChunkNewBlock(): Invalid operation");
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::OnIndexerFingerprint(uint32_t FID, uint8_t *data, size_t size)
+{
+    if(m_UseFingerprints)
+       PutFingerprint(FID, data, size);
+}
+
+// ----------------------------------------------------------------------------
+
+void MemDataStore::OnIndexerDocFrequency(int list_id, uint32_t df)
+{
+    if(m_DocFreqValid)
+       m_DocFreq[list_id] += df;
+}
@@ -0,0 +1,224 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+#ifndef MEMDATASTORE_H
+#define MEMDATASTORE_H
+
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+#include "KVDataStore.h"
+#include "MMapDataStore.h"
+
+/// This is an implementation of the KVDataStore interface that keeps all the
+/// data in memory. The postings lists are held in a vector indexed by list ID,
+/// each list being a vector of blocks stored exactly as emitted by the indexer
+/// (the list header prepended to the 1st block), while the fingerprints are
+/// packed into one contiguous arena. Reads involve no copies nor lookups other
+/// than a few array accesses, and are reentrant when the data store is in GET
+/// mode, as nothing gets modified then.
+///
+/// The data store can be persisted to a single file in the segment format (see
+/// MMapDataStore) using Save() and Load(), so saved data stores can also be
+/// served by MMapDataStore. If a database URL is set, the segment is loaded on
+/// opening, if it exists, and saved on closing after a build. Without a URL the
+/// data store is purely in-memory and its contents last as long as the object,
+/// which is handy for tests and benchmarks.
+///
+/// The terms that are not in the index are known from the index itself, while
+/// the document frequencies reported by the indexer are not saved, so they are
+/// only available for data stores built from scratch in memory.
+
+class MemDataStore : public KVDataStore
+{
+    typedef std::vector<uint8_t>     mem_block;
+    typedef std::vector<mem_block>   mem_list;
+    typedef std::vector<mem_list>    mem_index;
+
+    struct FPRecord_t
+    {
+        size_t Offset;
+        size_t Size;
+    };
+
+    typedef boost::unordered::unordered_map<uint32_t, FPRecord_t>   fp_table;
+    typedef boost::unordered::unordered_map<uint32_t, std::string>  meta_table;
+    typedef boost::unordered::unordered_map<int, uint32_t>          df_table;
+
+    mem_index             m_MainIndex;
+    mem_index             m_DeltaIndex;
+    std::vector<uint8_t>  m_FPArena;
+    fp_table              m_FPTable;
+    meta_table            m_Metadata;
+    DBInfo_t              m_Info;
+    df_table              m_DocFreq;
+    bool                  m_DocFreqValid     {true};
+    bool                  m_UseFingerprints  {true};
+
+    /// Get the specified block from the given index (null if not found)
+    static const mem_block*
+    FindBlock(const mem_index &index, int list_id, int block_id);
+
+    /// Get the header of the specified list from the given index
+    static Audioneex::PListHeader
+    GetPListHeader(const mem_index &index, int list_id);
+
+    /// Get the header of the specified block from the given index
+    static Audioneex::PListBlockHeader
+    GetPListBlockHeader(const mem_index &index, int list_id, int block_id);
+
+    /// Append a chunk to the specified block in the given index, updating the
+    /// list and block headers, as done by the other drivers.
+    static void
+    AppendChunk(mem_index &index,
+                int list_id,
+                Audioneex::PListHeader &lhdr,
+                Audioneex::PListBlockHeader &hdr,
+                const uint8_t* chunk, size_t chunk_size,
+                bool new_block=false);
+
+    /// Merge the delta index into the main index
+    void
+    Merge();
+
+public:
+
+    explicit MemDataStore(const std::string &url = std::string());
+    ~MemDataStore() = default;
+
+    /// Open the datastore in the specified mode. If a database URL is set and
+    /// it contains a segment, the current contents are replaced with it. The
+    /// metadata and info collections are always available.
+    void
+    Open(eOperation op = GET,
+         bool use_fing_db=true,
+         bool use_meta_db=false,
+         bool use_info_db=false) override;
+
+    /// Close the datastore. If a database URL is set and the datastore was
+    /// opened for building, the contents are saved to it. The contents are
+    /// kept in memory until the data store is destroyed or cleared.
+    void
+    Close() override;
+
+    /// Check whether the datastore contains no data
+    bool
+    Empty() override;
+
+    /// Clear the datastore (delete all contents)
+    void
+    Clear() override;
+
+    /// Save the contents in a segment at the specified URL
+    void
+    Save(const std::string &url,
+         const std::string &name = MMapDataStore::SEGMENT_FILE_NAME);
+
+    /// Replace the contents with the segment at the specified URL
+    void
+    Load(const std::string &url,
+         const std::string &name = MMapDataStore::SEGMENT_FILE_NAME);
+
+    /// Store a fingerprint. The space used by a replaced fingerprint is only
+    /// reclaimed when the data store is saved and loaded back.
+    void
+    PutFingerprint(uint32_t FID, const uint8_t* data, size_t size) override;
+
+    /// Get a fingerprint. The returned pointer is valid until the next write.
+    const uint8_t*
+    GetFingerprint(uint32_t FID,
+                   size_t &read,
+                   size_t nbytes = 0,
+                   uint32_t bo = 0) override;
+
+    /// Store metadata for the specified fingerprint
+    void
+    PutMetadata(uint32_t FID, const std::string& meta) override;
+
+    /// Get metadata for the specified fingerprint
+    std::string
+    GetMetadata(uint32_t FID) override;
+
+    /// Store custom info
+    void
+    PutInfo(const DBInfo_t& info) override;
+
+    /// Get custom info
+    DBInfo_t
+    GetInfo() override;
+
+    /// Get the identifiers of all the lists in the main index
+    void
+    GetPListIDs(std::vector<int> &lids) override;
+
+
+    // API Interface
+
+    const uint8_t*
+    GetPListBlock(int list_id,
+                  int block,
+                  size_t& data_size,
+                  bool headers=true) override;
+
+    size_t
+    GetFingerprintSize(uint32_t FID) override;
+
+    size_t
+    GetFingerprintsCount() override;
+
+    bool
+    IsReentrant() const override {
+        return m_Op == GET;
+    }
+
+    int64_t
+    GetDocFrequency(int list_id) override;
+
+    void
+    OnIndexerStart() override;
+
+    void
+    OnIndexerEnd() override;
+
+    void
+    OnIndexerFlushStart() override;
+
+    void
+    OnIndexerFlushEnd() override;
+
+    Audioneex::PListHeader
+    OnIndexerListHeader(int list_id) override;
+
+    Audioneex::PListBlockHeader
+    OnIndexerBlockHeader(int list_id, int block) override;
+
+    void
+    OnIndexerChunk(int list_id,
+                   Audioneex::PListHeader &lhdr,
+                   Audioneex::PListBlockHeader &hdr,
+                   uint8_t* data, size_t data_size) override;
+
+    void
+    OnIndexerNewBlock (int list_id,
+                       Audioneex::PListHeader &lhdr,
+                       Audioneex::PListBlockHeader &hdr,
+                       uint8_t* data, size_t data_size) override;
+
+    void
+    OnIndexerFingerprint(uint32_t FID,
+                         uint8_t* data,
+                         size_t size) override;
+
+    void
+    OnIndexerDocFrequency(int list_id, uint32_t df) override;
+};
+
+
+#endif
@@ -0,0 +1,1005 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+
+#include <string>
+#include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <fstream>
+#include <iostream>
+
+#include "SegmentedDataStore.h"
+
+using namespace Audioneex;
+
+namespace {
+
+const char* MANIFEST_MAGIC = "AXSEGSET 1";
+
+/// Write the given block, with or without headers, into the output buffer.
+/// Returns the required size. Nothing is copied if the buffer is too small.
+size_t ComposeBlock(const uint8_t* body,
+                    size_t body_size,
+                    const PListHeader &lhdr,
+                    const PListBlockHeader &hdr,
+                    bool headers,
+                    uint8_t* out,
+                    size_t out_size)
+{
+    size_t hsize = 0;
+
+    if(headers)
+       hsize = hdr.ID==1 ? sizeof(PListHeader) +
+                           sizeof(PListBlockHeader)
+                         :
+                           sizeof(PListBlockHeader);
+
+    size_t size = hsize + body_size;
+
+    if(size > out_size || out == nullptr)
+       return size;
+
+    if(headers){
+       // The list header is prepended to the 1st block
+       if(hdr.ID==1){
+          std::memcpy(out, &lhdr, sizeof(PListHeader));
+          out += sizeof(PListHeader);
+       }
+       std::memcpy(out, &hdr, sizeof(PListBlockHeader));
+       out += sizeof(PListBlockHeader);
+    }
+
+    std::memcpy(out, body, body_size);
+
+    return size;
+}
+
+}// end anonymous namespace
+
+
+//=============================================================================
+//                               SegmentFile_t
+//=============================================================================
+
+
+SegmentedDataStore::SegmentFile_t::SegmentFile_t(const std::string &url,
+                                                 const std::string &name) :
+    Name  (name),
+    Path  (Segment::Path(url, name.c_str())),
+    Store (url)
+{
+    Store.SetSegmentName(name);
+    Store.Open();
+
+    std::vector<uint32_t> fids;
+    Store.GetFingerprintIDs(fids);
+
+    if(!fids.empty()){
+       FIDmin = fids.front();
+       FIDmax = fids.back();
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+SegmentedDataStore::SegmentFile_t::~SegmentFile_t()
+{
+    Store.Close();
+
+    // Replaced segments are deleted when the last reader is done with them
+    if(Obsolete && std::remove(Path.c_str()))
+       std::cout<<"Couldn't remove "<<Path<<std::endl;
+}
+
+
+
+//=============================================================================
+//                             SegmentedDataStore
+//=============================================================================
+
+
+const char* SegmentedDataStore::MANIFEST_FILE_NAME = "segments.lst";
+
+// ----------------------------------------------------------------------------
+
+SegmentedDataStore::SegmentedDataStore(const std::string &url)
+{
+    m_DBURL = url;
+}
+
+// ----------------------------------------------------------------------------
+
+SegmentedDataStore::~SegmentedDataStore()
+{
+    // NOTE: Pending data is not committed here. Call Close() to publish it.
+    StopCompaction();
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::Open(eOperation op,
+                              bool use_fing_db,
+                              bool use_meta_db,
+                              bool use_info_db)
+{
+    if(m_IsOpen)
+       Close();
+
+    std::shared_ptr<segment_set> segments = std::make_shared<segment_set>();
+
+    std::string file = Segment::Path(m_DBURL, MANIFEST_FILE_NAME);
+    std::ifstream manifest (file);
+
+    // Load the current segment set, if any
+    if(manifest)
+    {
+       std::string line;
+
+       if(!std::getline(manifest, line) || line != MANIFEST_MAGIC)
+          throw std::runtime_error("Invalid manifest "+file);
+
+       while(std::getline(manifest, line))
+       {
+           if(line.empty())
+              continue;
+
+           segments->push_back(std::make_shared<SegmentFile_t>(m_DBURL, line));
+
+           unsigned int seq = 0;
+           if(std::sscanf(line.c_str(), "seg_%u.seg", &seq) == 1 && seq >= m_NextSegment)
+              m_NextSegment = seq + 1;
+       }
+    }
+
+    m_Info = segments->empty() ? DBInfo_t() : segments->back()->Store.GetInfo();
+    m_InfoChanged = false;
+
+    m_Buffer.Clear();
+    m_Buffer.Open(BUILD, use_fing_db);
+
+    std::atomic_store(&m_Segments, segment_set_ptr(segments));
+
+    m_UseFingerprints = use_fing_db;
+    m_Op = op;
+    m_IsOpen = true;
+
+    // Compact in the background when building. Check the current
+    // set straight away as it may have been left uncompacted.
+    if(op != GET){
+       m_CompactionPending = true;
+       m_CompactionThread = std::thread(&SegmentedDataStore::CompactionLoop, this);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::Close()
+{
+    if(m_IsOpen)
+       Commit();
+
+    StopCompaction();
+
+    std::atomic_store(&m_Segments, segment_set_ptr());
+    m_ReadPin.reset();
+    m_Buffer.Close();
+
+    m_IsOpen = false;
+}
+
+// ----------------------------------------------------------------------------
+
+bool SegmentedDataStore::Empty()
+{
+    segment_set_ptr segments = GetSegments();
+    return (!segments || segments->empty()) && m_Buffer.Empty();
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::Clear()
+{
+    std::lock_guard<std::mutex> clock (m_CompactLock);
+    std::lock_guard<std::mutex> wlock (m_WriteLock);
+
+    segment_set_ptr segments = GetSegments();
+
+    PublishSegments(std::make_shared<segment_set>());
+
+    if(segments)
+       for(const segment_ptr &seg : *segments)
+           seg->Obsolete = true;
+
+    m_Buffer.Clear();
+    m_BaseHeaders.clear();
+    m_Info = DBInfo_t();
+    m_InfoChanged = false;
+}
+
+// ----------------------------------------------------------------------------
+
+std::string SegmentedDataStore::NewSegmentName()
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "seg_%06u.seg", m_NextSegment++);
+    return name;
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::PublishSegments(const segment_set_ptr &segments)
+{
+    std::string file = Segment::Path(m_DBURL, MANIFEST_FILE_NAME);
+    std::string tmp = file + ".tmp";
+
+    {
+        std::ofstream manifest (tmp, std::ios::trunc);
+
+        manifest << MANIFEST_MAGIC << "\n";
+
+        for(const segment_ptr &seg : *segments)
+            manifest << seg->Name << "\n";
+
+        manifest.close();
+
+        if(!manifest)
+           throw std::runtime_error("Couldn't write manifest "+tmp);
+    }
+
+    // Replace the manifest (rename() fails on some platforms if the
+    // target exists, in which case we have to remove it first).
+    if(std::rename(tmp.c_str(), file.c_str()) != 0){
+       std::remove(file.c_str());
+       if(std::rename(tmp.c_str(), file.c_str()) != 0)
+          throw std::runtime_error("Couldn't replace manifest "+file);
+    }
+
+    // Switch the readers to the new set
+    std::atomic_store(&m_Segments, segments);
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::Commit()
+{
+    std::lock_guard<std::mutex> lock (m_WriteLock);
+
+    if(m_Buffer.Empty() && !m_InfoChanged)
+       return;
+
+    segment_set_ptr segments = GetSegments();
+
+    if(!segments)
+       throw std::runtime_error("Commit(): The data store is not open");
+
+    std::string name = NewSegmentName();
+
+    m_Buffer.PutInfo(m_Info);
+    m_Buffer.Save(m_DBURL, name);
+
+    std::shared_ptr<segment_set> nsegments = std::make_shared<segment_set>(*segments);
+
+    try{
+        nsegments->push_back(std::make_shared<SegmentFile_t>(m_DBURL, name));
+        PublishSegments(nsegments);
+    }
+    catch(...){
+        std::remove(Segment::Path(m_DBURL, name.c_str()).c_str());
+        throw;
+    }
+
+    m_Buffer.Clear();
+    m_BaseHeaders.clear();
+    m_InfoChanged = false;
+
+    // Wake up the compaction
+    {
+        std::lock_guard<std::mutex> clock (m_CompactionMutex);
+        m_CompactionPending = true;
+    }
+    m_CompactionCond.notify_one();
+}
+
+// ----------------------------------------------------------------------------
+
+bool SegmentedDataStore::Compact(bool full)
+{
+    std::lock_guard<std::mutex> lock (m_CompactLock);
+
+    segment_set_ptr segments = GetSegments();
+
+    if(!segments || segments->size() < 2)
+       return false;
+
+    // Find the segments to be merged
+    size_t first = 0, count = 0;
+
+    if(full)
+       count = segments->size();
+    else{
+       // Take the first run of at least 2 adjacent small segments
+       size_t threshold = m_CompactionThreshold;
+       size_t Ns = segments->size();
+
+       for(size_t i=0; i<Ns && count<2; )
+       {
+           size_t j = i;
+           while(j < Ns && (*segments)[j]->Store.GetSegmentSize() < threshold)
+                 j++;
+
+           first = i;
+           count = j - i;
+           i = j + 1;
+       }
+    }
+
+    if(count < 2)
+       return false;
+
+    segment_set run (segments->begin() + first,
+                     segments->begin() + first + count);
+
+    // The merge is performed without blocking readers nor writers
+    std::string name = NewSegmentName();
+    segment_ptr merged;
+
+    try{
+        MergeSegments(run, name);
+        merged = std::make_shared<SegmentFile_t>(m_DBURL, name);
+    }
+    catch(...){
+        std::remove(Segment::Path(m_DBURL, name.c_str()).c_str());
+        throw;
+    }
+
+    std::lock_guard<std::mutex> wlock (m_WriteLock);
+
+    // Segments are only removed by the compaction, so the merged run is still
+    // in place, while new segments may have been appended in the meantime.
+    segments = GetSegments();
+
+    if(!segments || segments->size() < first + count ||
+       !std::equal(run.begin(), run.end(), segments->begin() + first))
+    {
+       merged->Obsolete = true;
+       return false;
+    }
+
+    std::shared_ptr<segment_set> nsegments = std::make_shared<segment_set>();
+    nsegments->reserve(segments->size() - count + 1);
+    nsegments->insert(nsegments->end(), segments->begin(), segments->begin() + first);
+    nsegments->push_back(merged);
+    nsegments->insert(nsegments->end(), segments->begin() + first + count, segments->end());
+
+    PublishSegments(nsegments);
+
+    for(const segment_ptr &seg : run)
+        seg->Obsolete = true;
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::MergeSegments(const segment_set &segments, const std::string &name)
+{
+    MMapSegmentWriter writer (Segment::Path(m_DBURL, name.c_str()));
+
+    std::vector<int> lids, slids;
+
+    for(const segment_ptr &seg : segments){
+        seg->Store.GetPListIDs(slids);
+        lids.insert(lids.end(), slids.begin(), slids.end());
+    }
+
+    std::sort(lids.begin(), lids.end());
+    lids.erase(std::unique(lids.begin(), lids.end()), lids.end());
+
+    // Concatenate the lists, renumbering the blocks
+
+    std::vector<uint8_t> block;
+
+    for(int lid : lids)
+    {
+        uint32_t Nb = GetPListHeader(segments, lid).BlockCount;
+
+        for(uint32_t bid=1; bid<=Nb; bid++)
+        {
+            size_t bsize = 0;
+            PListHeader lhdr;
+            PListBlockHeader hdr;
+
+            const uint8_t* body = LocateBlock(segments, lid, bid, bsize, lhdr, hdr);
+
+            if(!body)
+               throw std::runtime_error("Missing block. The index appears to be corrupt.");
+
+            block.resize(ComposeBlock(body, bsize, lhdr, hdr, true, nullptr, 0));
+            ComposeBlock(body, bsize, lhdr, hdr, true, block.data(), block.size());
+
+            writer.AddBlock(lid, block.data(), block.size());
+        }
+    }
+
+    // Merge the fingerprints and metadata. Newer segments take precedence.
+
+    typedef std::pair<uint32_t, size_t> record;
+
+    std::vector<uint32_t> fids;
+    std::vector<record> fprecs, metarecs;
+
+    for(size_t i=0; i<segments.size(); i++){
+        segments[i]->Store.GetFingerprintIDs(fids);
+        for(uint32_t FID : fids) fprecs.push_back(record(FID, i));
+        segments[i]->Store.GetMetadataIDs(fids);
+        for(uint32_t FID : fids) metarecs.push_back(record(FID, i));
+    }
+
+    auto by_fid = [](const record &a, const record &b){ return a.first < b.first; };
+
+    std::stable_sort(fprecs.begin(), fprecs.end(), by_fid);
+    std::stable_sort(metarecs.begin(), metarecs.end(), by_fid);
+
+    for(size_t i=0; i<fprecs.size(); i++)
+    {
+        if(i+1 < fprecs.size() && fprecs[i+1].first == fprecs[i].first)
+           continue;
+
+        size_t read = 0;
+        const uint8_t* fp = segments[fprecs[i].second]->Store.GetFingerprint(fprecs[i].first, read);
+
+        if(!fp || read == 0)
+           throw std::runtime_error("Couldn't read fingerprint "+std::to_string(fprecs[i].first));
+
+        writer.AddFingerprint(fprecs[i].first, fp, read);
+    }
+
+    for(size_t i=0; i<metarecs.size(); i++)
+    {
+        if(i+1 < metarecs.size() && metarecs[i+1].first == metarecs[i].first)
+           continue;
+
+        writer.AddMetadata(metarecs[i].first,
+                           segments[metarecs[i].second]->Store.GetMetadata(metarecs[i].first));
+    }
+
+    writer.SetInfo(segments.back()->Store.GetInfo());
+    writer.Close();
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::CompactionLoop()
+{
+    std::unique_lock<std::mutex> lock (m_CompactionMutex);
+
+    for(;;)
+    {
+        m_CompactionCond.wait(lock, [this]{
+            return m_CompactionStop || m_CompactionPending;
+        });
+
+        if(m_CompactionStop)
+           break;
+
+        m_CompactionPending = false;
+
+        lock.unlock();
+
+        // Failures leave the current set untouched, so we can just
+        // report them and carry on.
+        try{
+            while(!m_CompactionStop && Compact());
+        }
+        catch(const std::exception &ex){
+            std::cout<<"Compaction failed: "<<ex.what()<<std::endl;
+        }
+
+        lock.lock();
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::StopCompaction()
+{
+    {
+        std::lock_guard<std::mutex> lock (m_CompactionMutex);
+        m_CompactionStop = true;
+    }
+    m_CompactionCond.notify_all();
+
+    if(m_CompactionThread.joinable())
+       m_CompactionThread.join();
+
+    m_CompactionStop = false;
+    m_CompactionPending = false;
+}
+
+// ----------------------------------------------------------------------------
+
+PListHeader SegmentedDataStore::GetPListHeader(const segment_set &segments, int list_id)
+{
+    PListHeader lhdr = {};
+
+    for(const segment_ptr &seg : segments)
+    {
+        size_t size = 0;
+        const uint8_t* block = seg->Store.GetPListBlock(list_id, 1, size, true);
+
+        if(block && size >= sizeof(PListHeader)){
+           PListHeader slhdr;
+           std::memcpy(&slhdr, block, sizeof(PListHeader));
+           lhdr.BlockCount   += slhdr.BlockCount;
+           lhdr.DocFrequency += slhdr.DocFrequency;
+           lhdr.Occurrences  += slhdr.Occurrences;
+           lhdr.Flags        |= slhdr.Flags;
+           lhdr.FIDmax        = std::max(lhdr.FIDmax, slhdr.FIDmax);
+        }
+    }
+
+    return lhdr;
+}
+
+// ----------------------------------------------------------------------------
+
+const uint8_t* SegmentedDataStore::LocateBlock(const segment_set &segments,
+                                               int list_id,
+                                               int block,
+                                               size_t &body_size,
+                                               PListHeader &lhdr,
+                                               PListBlockHeader &hdr)
+{
+    body_size = 0;
+    lhdr = PListHeader();
+    hdr = PListBlockHeader();
+
+    if(block < 1)
+       return nullptr;
+
+    const uint8_t* body = nullptr;
+    PListHeader base = {};
+
+    for(const segment_ptr &seg : segments)
+    {
+        size_t size = 0;
+        const uint8_t* pblock = seg->Store.GetPListBlock(list_id, 1, size, true);
+
+        if(!pblock || size < sizeof(PListHeader))
+           continue;
+
+        PListHeader slhdr;
+        std::memcpy(&slhdr, pblock, sizeof(PListHeader));
+
+        if(!body && static_cast<uint32_t>(block) <= base.BlockCount + slhdr.BlockCount)
+        {
+            uint32_t local = block - base.BlockCount;
+
+            if(local > 1)
+               pblock = seg->Store.GetPListBlock(list_id, local, size, true);
+
+            size_t hoff = local==1 ? sizeof(PListHeader) : 0;
+
+            if(!pblock || size < hoff + sizeof(PListBlockHeader))
+               throw std::runtime_error("Missing block. The index appears to be corrupt.");
+
+            std::memcpy(&hdr, pblock + hoff, sizeof(PListBlockHeader));
+            hdr.ID = block;
+
+            body = pblock + hoff + sizeof(PListBlockHeader);
+            body_size = size - hoff - sizeof(PListBlockHeader);
+
+            // Only the 1st block needs the total number of blocks
+            if(block > 1)
+               break;
+        }
+
+        base.BlockCount   += slhdr.BlockCount;
+        base.DocFrequency += slhdr.DocFrequency;
+        base.Occurrences  += slhdr.Occurrences;
+        base.Flags        |= slhdr.Flags;
+        base.FIDmax        = std::max(base.FIDmax, slhdr.FIDmax);
+    }
+
+    // The 1st block carries the header of the whole list
+    if(body && block == 1)
+       lhdr = base;
+
+    return body;
+}
+
+// ----------------------------------------------------------------------------
+
+SegmentedDataStore::SegmentFile_t*
+SegmentedDataStore::FindFingerprint(const segment_set &segments, uint32_t FID)
+{
+    // Newer segments take precedence
+    for(auto it = segments.rbegin(); it != segments.rend(); ++it)
+    {
+        SegmentFile_t* seg = it->get();
+
+        if(FID >= seg->FIDmin && FID <= seg->FIDmax &&
+           seg->Store.GetFingerprintSize(FID))
+           return seg;
+    }
+
+    return nullptr;
+}
+
+// ----------------------------------------------------------------------------
+
+const uint8_t* SegmentedDataStore::GetPListBlock(int list_id,
+                                                 int block,
+                                                 size_t &data_size,
+                                                 bool headers)
+{
+    data_size = 0;
+
+    // Keep the segments alive while the returned data is in use
+    m_ReadPin = GetSegments();
+
+    if(!m_ReadPin)
+       return nullptr;
+
+    size_t bsize = 0;
+    PListHeader lhdr;
+    PListBlockHeader hdr;
+
+    const uint8_t* body = LocateBlock(*m_ReadPin, list_id, block, bsize, lhdr, hdr);
+
+    if(!body)
+       return nullptr;
+
+    if(!headers){
+       data_size = bsize;
+       return body;
+    }
+
+    data_size = ComposeBlock(body, bsize, lhdr, hdr, true, nullptr, 0);
+
+    if(m_ReadBuffer.size() < data_size)
+       m_ReadBuffer.resize(data_size);
+
+    ComposeBlock(body, bsize, lhdr, hdr, true, m_ReadBuffer.data(), m_ReadBuffer.size());
+
+    return m_ReadBuffer.data();
+}
+
+// ----------------------------------------------------------------------------
+
+size_t SegmentedDataStore::ReadPListBlock(int list_id,
+                                          int block,
+                                          uint8_t* buffer,
+                                          size_t buffer_size,
+                                          bool headers)
+{
+    segment_set_ptr segments = GetSegments();
+
+    if(!segments)
+       return 0;
+
+    size_t bsize = 0;
+    PListHeader lhdr;
+    PListBlockHeader hdr;
+
+    const uint8_t* body = LocateBlock(*segments, list_id, block, bsize, lhdr, hdr);
+
+    if(!body)
+       return 0;
+
+    return ComposeBlock(body, bsize, lhdr, hdr, headers, buffer, buffer_size);
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::PutFingerprint(uint32_t FID, const uint8_t* data, size_t size)
+{
+    m_Buffer.PutFingerprint(FID, data, size);
+}
+
+// ----------------------------------------------------------------------------
+
+const uint8_t* SegmentedDataStore::GetFingerprint(uint32_t FID,
+                                                  size_t &read,
+                                                  size_t nbytes,
+                                                  uint32_t bo)
+{
+    read = 0;
+
+    // Keep the segments alive while the returned data is in use
+    m_ReadPin = GetSegments();
+
+    SegmentFile_t* seg = m_ReadPin ? FindFingerprint(*m_ReadPin, FID) : nullptr;
+
+    return seg ? seg->Store.GetFingerprint(FID, read, nbytes, bo) : nullptr;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t SegmentedDataStore::ReadFingerprint(uint32_t FID,
+                                           uint8_t* buffer,
+                                           size_t nbytes,
+                                           uint32_t bo)
+{
+    segment_set_ptr segments = GetSegments();
+
+    SegmentFile_t* seg = segments ? FindFingerprint(*segments, FID) : nullptr;
+
+    if(!seg)
+       return 0;
+
+    size_t read = 0;
+    const uint8_t* data = seg->Store.GetFingerprint(FID, read, nbytes, bo);
+
+    if(!data)
+       return 0;
+
+    read = std::min(read, nbytes);
+    std::memcpy(buffer, data, read);
+    return read;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t SegmentedDataStore::GetFingerprintSize(uint32_t FID)
+{
+    segment_set_ptr segments = GetSegments();
+
+    SegmentFile_t* seg = segments ? FindFingerprint(*segments, FID) : nullptr;
+
+    return seg ? seg->Store.GetFingerprintSize(FID) : 0;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t SegmentedDataStore::GetFingerprintsCount()
+{
+    segment_set_ptr segments = GetSegments();
+
+    size_t count = 0;
+
+    if(segments)
+       for(const segment_ptr &seg : *segments)
+           count += seg->Store.GetFingerprintsCount();
+
+    return count;
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::PutMetadata(uint32_t FID, const std::string& meta)
+{
+    m_Buffer.PutMetadata(FID, meta);
+}
+
+// ----------------------------------------------------------------------------
+
+std::string SegmentedDataStore::GetMetadata(uint32_t FID)
+{
+    segment_set_ptr segments = GetSegments();
+
+    if(segments){
+       for(auto it = segments->rbegin(); it != segments->rend(); ++it){
+           std::string meta = (*it)->Store.GetMetadata(FID);
+           if(!meta.empty())
+              return meta;
+       }
+    }
+
+    return std::string();
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::PutInfo(const DBInfo_t& info)
+{
+    std::lock_guard<std::mutex> lock (m_WriteLock);
+    m_Info = info;
+    m_InfoChanged = true;
+}
+
+// ----------------------------------------------------------------------------
+
+DBInfo_t SegmentedDataStore::GetInfo()
+{
+    std::lock_guard<std::mutex> lock (m_WriteLock);
+    return m_Info;
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::GetPListIDs(std::vector<int> &lids)
+{
+    lids.clear();
+
+    segment_set_ptr segments = GetSegments();
+
+    if(!segments)
+       return;
+
+    std::vector<int> slids;
+
+    for(const segment_ptr &seg : *segments){
+        seg->Store.GetPListIDs(slids);
+        lids.insert(lids.end(), slids.begin(), slids.end());
+    }
+
+    std::sort(lids.begin(), lids.end());
+    lids.erase(std::unique(lids.begin(), lids.end()), lids.end());
+}
+
+// ----------------------------------------------------------------------------
+
+PListHeader SegmentedDataStore::GetBaseHeader(int list_id)
+{
+    auto it = m_BaseHeaders.find(list_id);
+
+    if(it == m_BaseHeaders.end()){
+       segment_set_ptr segments = GetSegments();
+       PListHeader lhdr = segments ? GetPListHeader(*segments, list_id) : PListHeader();
+       it = m_BaseHeaders.emplace(list_id, lhdr).first;
+    }
+
+    return it->second;
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::OnIndexerStart()
+{
+    if(m_Op == GET)
+       throw std::invalid_argument
+       ("OnIndexerStart(): Invalid operation (GET)");
+
+    m_BaseHeaders.clear();
+    m_Buffer.OnIndexerStart();
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::OnIndexerEnd()
+{
+    // Publish the new data as a new segment. There is nothing to merge.
+    Commit();
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::OnIndexerFlushStart()
+{
+    // Nothing to do. The chunks are written straight into the buffer.
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::OnIndexerFlushEnd()
+{
+    // Nothing to do. The chunks are written straight into the buffer.
+}
+
+// ----------------------------------------------------------------------------
+
+PListHeader SegmentedDataStore::OnIndexerListHeader(int list_id)
+{
+    if(m_Op == GET)
+       throw std::invalid_argument
+       ("OnIndexerListHeader(): Invalid operation");
+
+    // The list seen by the indexer is the concatenation of the list in
+    // the segments and the one in the buffer.
+    PListHeader base = GetBaseHeader(list_id);
+
+    PListHeader lhdr = m_Buffer.OnIndexerListHeader(list_id);
+    lhdr.BlockCount   += base.BlockCount;
+    lhdr.DocFrequency += base.DocFrequency;
+    lhdr.Occurrences  += base.Occurrences;
+    lhdr.Flags        |= base.Flags;
+
+    return lhdr;
+}
+
+// ----------------------------------------------------------------------------
+
+PListBlockHeader SegmentedDataStore::OnIndexerBlockHeader(int list_id, int block)
+{
+    if(m_Op == GET)
+       throw std::invalid_argument
+       ("OnIndexerBlockHeader(): Invalid operation");
+
+    uint32_t base = GetBaseHeader(list_id).BlockCount;
+
+    if(block > 0 && static_cast<uint32_t>(block) > base){
+       PListBlockHeader hdr = m_Buffer.OnIndexerBlockHeader(list_id, block - base);
+       if(!IsNull(hdr))
+          hdr.ID += base;
+       return hdr;
+    }
+
+    segment_set_ptr segments = GetSegments();
+
+    size_t bsize = 0;
+    PListHeader lhdr;
+    PListBlockHeader hdr;
+
+    if(!segments || !LocateBlock(*segments, list_id, block, bsize, lhdr, hdr))
+       return PListBlockHeader();
+
+    // The segments are immutable, so report the block as full to make
+    // the indexer append the new chunks to a new block in the buffer.
+    hdr.BodySize = std::numeric_limits<uint32_t>::max();
+
+    return hdr;
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::OnIndexerChunk(int list_id,
+                                        PListHeader &lhdr,
+                                        PListBlockHeader &hdr,
+                                        uint8_t* data, size_t data_size)
+{
+    if(m_Op == GET)
+       throw std::invalid_argument
+       ("OnIndexerChunkAppend(): Invalid operation");
+
+    PListHeader base = GetBaseHeader(list_id);
+
+    if(hdr.ID <= base.BlockCount)
+       throw std::invalid_argument
+       ("OnIndexerChunkAppend(): Segment blocks cannot be modified");
+
+    // Translate the headers into the buffer's block numbering
+    PListHeader blhdr = lhdr;
+    PListBlockHeader bhdr = hdr;
+    blhdr.BlockCount   -= base.BlockCount;
+    blhdr.DocFrequency -= base.DocFrequency;
+    blhdr.Occurrences  -= base.Occurrences;
+    bhdr.ID -= base.BlockCount;
+
+    m_Buffer.OnIndexerChunk(list_id, blhdr, bhdr, data, data_size);
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::OnIndexerNewBlock(int list_id,
+                                           PListHeader &lhdr,
+                                           PListBlockHeader &hdr,
+                                           uint8_t* data, size_t data_size)
+{
+    if(m_Op == GET)
+       throw std::invalid_argument
+       ("OnIndexerChunkNewBlock(): Invalid operation");
+
+    PListHeader base = GetBaseHeader(list_id);
+
+    if(hdr.ID <= base.BlockCount)
+       throw std::invalid_argument
+       ("OnIndexerChunkNewBlock(): Segment blocks cannot be modified");
+
+    PListHeader blhdr = lhdr;
+    PListBlockHeader bhdr = hdr;
+    blhdr.BlockCount   -= base.BlockCount;
+    blhdr.DocFrequency -= base.DocFrequency;
+    blhdr.Occurrences  -= base.Occurrences;
+    bhdr.ID -= base.BlockCount;
+
+    m_Buffer.OnIndexerNewBlock(list_id, blhdr, bhdr, data, data_size);
+}
+
+// ----------------------------------------------------------------------------
+
+void SegmentedDataStore::OnIndexerFingerprint(uint32_t FID, uint8_t *data, size_t size)
+{
+    if(m_UseFingerprints)
+       m_Buffer.PutFingerprint(FID, data, size);
+}
@@ -0,0 +1,299 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+#ifndef SEGMENTEDDATASTORE_H
+#define SEGMENTEDDATASTORE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <boost/unordered_map.hpp>
+
+#include "KVDataStore.h"
+#include "MMapDataStore.h"
+#include "MemDataStore.h"
+
+/// This is an implementation of the KVDataStore interface that holds the data
+/// in a set of immutable segments (see MMapDataStore), each one covering a range
+/// of FIDs, in a log-structured fashion.
+///
+/// The indexer writes into an in-memory buffer that is published as a new
+/// segment at the end of each indexing session (or by calling Commit()), so
+/// adding new data never involves rewriting existing blocks. Since the FIDs
+/// are strictly increasing, the postings list for a term is the concatenation
+/// of the lists for that term in all the segments, in order. Blocks are never
+/// shared between segments, so the indexer is always made to start a new block
+/// in the buffer when appending to lists that already exist.
+///
+/// A background thread compacts runs of adjacent small segments into larger
+/// ones by concatenating their blocks, which keeps the block numbering of the
+/// postings lists unchanged. The current segment set is switched atomically,
+/// so reads are reentrant and can be performed while indexing and compacting.
+/// Segments that are replaced are deleted once they are no longer in use.
+///
+/// The segment set is described by a manifest in the database URL, which is
+/// replaced atomically on every change. Only the published segments are visible
+/// to readers (including other processes on opening).
+
+class SegmentedDataStore : public KVDataStore
+{
+    /// A segment in the set
+    struct SegmentFile_t
+    {
+        std::string        Name;
+        std::string        Path;
+        MMapDataStore      Store;
+        uint32_t           FIDmin   {0};
+        uint32_t           FIDmax   {0};
+        std::atomic<bool>  Obsolete {false};
+
+        SegmentFile_t(const std::string &url, const std::string &name);
+        ~SegmentFile_t();
+    };
+
+    typedef std::shared_ptr<SegmentFile_t>     segment_ptr;
+    typedef std::vector<segment_ptr>           segment_set;
+    typedef std::shared_ptr<const segment_set> segment_set_ptr;
+
+    segment_set_ptr          m_Segments;
+    segment_set_ptr          m_ReadPin;
+    std::vector<uint8_t>     m_ReadBuffer;
+    MemDataStore             m_Buffer;
+    DBInfo_t                 m_Info;
+    bool                     m_UseFingerprints      {true};
+    bool                     m_InfoChanged          {false};
+    std::atomic<uint32_t>    m_NextSegment          {1};
+    std::atomic<size_t>      m_CompactionThreshold  {64 << 20};
+    std::mutex               m_WriteLock;
+    std::mutex               m_CompactLock;
+
+    /// Header each list had in the segments when first accessed by the
+    /// indexer during the current session.
+    boost::unordered::unordered_map<int, Audioneex::PListHeader>  m_BaseHeaders;
+
+    // Background compaction
+    std::thread              m_CompactionThread;
+    std::mutex               m_CompactionMutex;
+    std::condition_variable  m_CompactionCond;
+    bool                     m_CompactionPending    {false};
+    std::atomic<bool>        m_CompactionStop       {false};
+
+    /// Get the current segment set
+    segment_set_ptr GetSegments() const {
+        return std::atomic_load(&m_Segments);
+    }
+
+    /// Publish the given segment set and update the manifest
+    void PublishSegments(const segment_set_ptr &segments);
+
+    /// Allocate the name of a new segment file
+    std::string NewSegmentName();
+
+    /// Get the header the specified list has in the segments. Its block count
+    /// is where the blocks written by the indexer in the current session start.
+    Audioneex::PListHeader GetBaseHeader(int list_id);
+
+    /// Get the header of the specified list across the given segments, that is
+    /// the total number of blocks and the list's total statistics.
+    static Audioneex::PListHeader
+    GetPListHeader(const segment_set &segments, int list_id);
+
+    /// Locate the specified block of a list within the given segments. Return
+    /// a pointer to the block's body and the headers the block has in the
+    /// concatenated list (the list header is only set for the 1st block).
+    static const uint8_t*
+    LocateBlock(const segment_set &segments,
+                int list_id,
+                int block,
+                size_t &body_size,
+                Audioneex::PListHeader &lhdr,
+                Audioneex::PListBlockHeader &hdr);
+
+    /// Find the segment holding the specified fingerprint (null if none)
+    static SegmentFile_t*
+    FindFingerprint(const segment_set &segments, uint32_t FID);
+
+    /// Merge the given segments into a new segment with the given name
+    void
+    MergeSegments(const segment_set &segments, const std::string &name);
+
+    /// Compaction thread routine
+    void
+    CompactionLoop();
+
+    /// Stop the compaction thread, if running
+    void
+    StopCompaction();
+
+public:
+
+    /// Name of the manifest file within the data store URL
+    static const char* MANIFEST_FILE_NAME;
+
+    explicit SegmentedDataStore(const std::string &url = std::string());
+    ~SegmentedDataStore();
+
+    /// Open the datastore in the specified mode. The background compaction
+    /// is only performed in the build modes.
+    void
+    Open(eOperation op = GET,
+         bool use_fing_db=true,
+         bool use_meta_db=false,
+         bool use_info_db=false) override;
+
+    /// Close the datastore, publishing any pending data
+    void
+    Close() override;
+
+    /// Check whether the datastore contains no data
+    bool
+    Empty() override;
+
+    /// Clear the datastore (delete all segments)
+    void
+    Clear() override;
+
+    /// Publish the data written since the last commit as a new segment.
+    /// This is done automatically at the end of each indexing session and
+    /// on closing, but fingerprints and metadata stored afterwards are not
+    /// visible until the next commit.
+    void
+    Commit();
+
+    /// Compact the segments. If 'full' is true all the segments are merged
+    /// into one, else only the runs of adjacent segments smaller than the
+    /// compaction threshold are merged. Returns whether anything was merged.
+    bool
+    Compact(bool full=false);
+
+    /// Set the size below which segments are merged by the compaction
+    void
+    SetCompactionThreshold(size_t bytes) {
+        m_CompactionThreshold = bytes;
+    }
+
+    /// Get the size below which segments are merged by the compaction
+    size_t
+    GetCompactionThreshold() const {
+        return m_CompactionThreshold;
+    }
+
+    /// Get the number of segments in the current set
+    size_t
+    GetSegmentsCount() const {
+        segment_set_ptr segments = GetSegments();
+        return segments ? segments->size() : 0;
+    }
+
+    /// Store a fingerprint (visible after the next commit)
+    void
+    PutFingerprint(uint32_t FID, const uint8_t* data, size_t size) override;
+
+    /// Get a fingerprint. The returned pointer is valid until the next call.
+    const uint8_t*
+    GetFingerprint(uint32_t FID,
+                   size_t &read,
+                   size_t nbytes = 0,
+                   uint32_t bo = 0) override;
+
+    /// Store metadata for the specified fingerprint (visible after the next commit)
+    void
+    PutMetadata(uint32_t FID, const std::string& meta) override;
+
+    /// Get metadata for the specified fingerprint
+    std::string
+    GetMetadata(uint32_t FID) override;
+
+    /// Store custom info
+    void
+    PutInfo(const DBInfo_t& info) override;
+
+    /// Get custom info
+    DBInfo_t
+    GetInfo() override;
+
+    /// Get the identifiers of all the lists in the index
+    void
+    GetPListIDs(std::vector<int> &lids) override;
+
+
+    // API Interface
+
+    const uint8_t*
+    GetPListBlock(int list_id,
+                  int block,
+                  size_t& data_size,
+                  bool headers=true) override;
+
+    size_t
+    GetFingerprintSize(uint32_t FID) override;
+
+    size_t
+    ReadPListBlock(int list_id,
+                   int block,
+                   uint8_t* buffer,
+                   size_t buffer_size,
+                   bool headers=false) override;
+
+    size_t
+    ReadFingerprint(uint32_t FID,
+                    uint8_t* buffer,
+                    size_t nbytes,
+                    uint32_t bo = 0) override;
+
+    bool
+    IsReentrant() const override {
+        return true;
+    }
+
+    size_t
+    GetFingerprintsCount() override;
+
+    void
+    OnIndexerStart() override;
+
+    void
+    OnIndexerEnd() override;
+
+    void
+    OnIndexerFlushStart() override;
+
+    void
+    OnIndexerFlushEnd() override;
+
+    Audioneex::PListHeader
+    OnIndexerListHeader(int list_id) override;
+
+    Audioneex::PListBlockHeader
+    OnIndexerBlockHeader(int list_id, int block) override;
+
+    void
+    OnIndexerChunk(int list_id,
+                   Audioneex::PListHeader &lhdr,
+                   Audioneex::PListBlockHeader &hdr,
+                   uint8_t* data, size_t data_size) override;
+
+    void
+    OnIndexerNewBlock (int list_id,
+                       Audioneex::PListHeader &lhdr,
+                       Audioneex::PListBlockHeader &hdr,
+                       uint8_t* data, size_t data_size) override;
+
+    void
+    OnIndexerFingerprint(uint32_t FID,
+                         uint8_t* data,
+                         size_t size) override;
+};
+
+
+#endif
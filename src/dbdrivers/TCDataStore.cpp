@@ -29,6 +29,7 @@ TCDataStore::TCDataStore(const std::string &url) :
     m_DeltaIndex    (this),
     m_Metadata      (this),
     m_Info          (this),
+    m_TermStats     (this),
     m_ReadBuffer    (32768)
 {
     m_DBURL = url;
@@ -38,6 +39,7 @@ TCDataStore::TCDataStore(const std::string &url) :
     m_Metadata.SetName("data.met");
     m_Info.SetName("data.inf");
     m_DeltaIndex.SetName("data.tmp");
+    m_TermStats.SetName("data.trm");
 }
 
 // ----------------------------------------------------------------------------
@@ -61,13 +63,28 @@ void TCDataStore::Open(eOperation op,
     m_QFingerprints.SetURL(m_DBURL);
     m_Metadata.SetURL(m_DBURL);
     m_Info.SetURL(m_DBURL);
+    m_TermStats.SetURL(m_DBURL);
 
     // Open the main index
     m_MainIndex.Open(open_mode);
 
+    // Load the terms statistics. The collection is only created when
+    // building, and the statistics are only valid if they have been
+    // kept since the index was created.
+    m_Terms.Clear();
+
+    if(open_mode != OPEN_READ ||
+       std::ifstream(m_DBURL + m_TermStats.GetName()).good())
+       m_TermStats.Open(open_mode);
+
+    m_TermsValid = m_TermStats.IsOpen() &&
+                  (m_TermStats.Read(m_Terms) || m_MainIndex.GetRecordsCount() == 0);
+
     // NOTE: The fingerprints database is not required by the engine
-    //       and the metadata and info database are optional. The
-	//       delta index is only used for build&merge strategies.
+    //       and the metadata database is optional. The info database
+    //       records the format of the index, so it is always created
+    //       when building. The delta index is only used for build&merge
+    //       strategies.
 
     if(use_fing_db)
        m_QFingerprints.Open(open_mode);
@@ -75,15 +92,48 @@ void TCDataStore::Open(eOperation op,
     if(use_meta_db)
        m_Metadata.Open(open_mode);
 
-    if(use_info_db)
+    if(use_info_db || open_mode != OPEN_READ ||
+       std::ifstream(m_DBURL + m_Info.GetName()).good())
        m_Info.Open(open_mode);
 
+    // Existing indexes must be in the current format, new ones are
+    if(m_MainIndex.GetRecordsCount() > 0)
+       CheckFormat();
+    else if(open_mode != OPEN_READ)
+       RecordFormat();
+
     m_Op = op;
     m_IsOpen = true;
 }
 
 // ----------------------------------------------------------------------------
 
+void TCDataStore::CheckFormat()
+{
+    // Indexes built before the format was recorded have no info
+    DBInfo_t info;
+    info.Version = 0;
+
+    if(m_Info.IsOpen())
+       info = m_Info.Read();
+
+    if(info.Version != INDEX_FORMAT_VERSION)
+       Close();
+
+    CheckIndexFormat(info);
+}
+
+// ----------------------------------------------------------------------------
+
+void TCDataStore::RecordFormat()
+{
+    DBInfo_t info = m_Info.Read();
+    info.Version = INDEX_FORMAT_VERSION;
+    m_Info.Write(info);
+}
+
+// ----------------------------------------------------------------------------
+
 void TCDataStore::Close()
 {
     m_MainIndex.Close();
@@ -91,7 +141,10 @@ void TCDataStore::Close()
     m_QFingerprints.Close();
     m_Metadata.Close();
     m_Info.Close();
+    m_TermStats.Close();
+    m_Terms.Clear();
 
+    m_TermsValid = false;
     m_IsOpen=false;
 }
 
@@ -112,6 +165,14 @@ void TCDataStore::Clear()
     m_QFingerprints.Drop();
     m_Metadata.Drop();
     m_Info.Drop();
+    m_TermStats.Drop();
+    m_Terms.Clear();
+
+    // Start keeping the statistics from scratch
+    m_TermsValid = m_TermStats.IsOpen();
+
+    if(m_Info.IsOpen() && m_Op != GET)
+       RecordFormat();
 }
 
 // ----------------------------------------------------------------------------
@@ -152,6 +213,11 @@ void TCDataStore::OnIndexerStart()
      if(m_Op == BUILD_MERGE)
         m_DeltaIndex.Open(OPEN_READ_WRITE);
 
+     // The stored terms statistics are out of date as soon as the index
+     // is modified, so they're deleted until the session completes.
+     if(m_TermsValid)
+        m_TermStats.Invalidate();
+
      m_Run = 0;
 
 }
@@ -181,6 +247,9 @@ void TCDataStore::OnIndexerEnd()
        if(std::remove( m_DeltaIndex.GetName().c_str() ))
           std::cout<<"Couldn't remove "<<m_DeltaIndex.GetName()<<std::endl;
     }
+
+    if(m_TermsValid)
+       m_TermStats.Write(m_Terms);
 }
 
 // ----------------------------------------------------------------------------
@@ -293,6 +362,24 @@ void TCDataStore::OnIndexerFingerprint(uint32_t FID, uint8_t *data, size_t size)
 
 // ----------------------------------------------------------------------------
 
+void TCDataStore::OnIndexerDocFrequency(int list_id, uint32_t df)
+{
+    if(m_TermsValid)
+       m_Terms.Add(list_id, df);
+}
+
+// ----------------------------------------------------------------------------
+
+int64_t TCDataStore::GetDocFrequency(int list_id)
+{
+    // The statistics are being updated while building
+    if(!m_TermsValid || m_Op != GET)
+       return -1;
+    return m_Terms.GetDocFrequency(list_id);
+}
+
+// ----------------------------------------------------------------------------
+
 size_t TCDataStore::GetFingerprintSize(uint32_t FID)
 {
     return m_QFingerprints.ReadFingerprintSize(FID);
@@ -309,6 +396,27 @@ const uint8_t* TCDataStore::GetFingerprint(uint32_t FID,
     return m_ReadBuffer.data();
 }
 
+// ----------------------------------------------------------------------------
+
+size_t TCDataStore::ReadPListBlock(int list_id,
+                                   int block,
+                                   uint8_t* buffer,
+                                   size_t buffer_size,
+                                   bool headers)
+{
+    return m_MainIndex.ReadBlock(list_id, block, buffer, buffer_size, headers);
+}
+
+// ----------------------------------------------------------------------------
+
+size_t TCDataStore::ReadFingerprint(uint32_t FID,
+                                    uint8_t* buffer,
+                                    size_t nbytes,
+                                    uint32_t bo)
+{
+    return m_QFingerprints.ReadFingerprint(FID, buffer, nbytes, bo);
+}
+
 
 
 //=============================================================================
@@ -360,6 +468,10 @@ void TCCollection::Open(int mode)
     if(!m_DBHandle)
        throw std::runtime_error("Got an invalid db handle");
 
+    // Make the handle thread-safe, so that the collection can be read
+    // concurrently (see TCDataStore::IsReentrant()).
+    tchdbsetmutex(m_DBHandle);
+
     tchdbtune(m_DBHandle, 1000000, 4, 10, HDBTLARGE);
     tchdbsetcache(m_DBHandle, 1000000);
 
@@ -486,6 +598,24 @@ size_t TCIndex::ReadBlock(int list_id,
                           int block_id, 
                           std::vector<uint8_t> &buffer, 
                           bool headers)
+{
+    size_t rbytes = ReadBlock(list_id, block_id, buffer.data(), buffer.size(), headers);
+
+    if(rbytes > buffer.size()){
+       buffer.resize(rbytes);
+       rbytes = ReadBlock(list_id, block_id, buffer.data(), buffer.size(), headers);
+    }
+
+    return rbytes;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t TCIndex::ReadBlock(int list_id, 
+                          int block_id, 
+                          uint8_t *buffer, 
+                          size_t buffer_size, 
+                          bool headers)
 {
     int               bsize;
     void             *block;
@@ -508,11 +638,10 @@ size_t TCIndex::ReadBlock(int list_id,
                                sizeof(PListBlockHeader);
         rbytes = bsize - off;
 
-        if(rbytes > buffer.size())
-           buffer.resize(rbytes);
-
-        uint8_t *pdata = reinterpret_cast<uint8_t*>(block) + off;
-        std::copy(pdata, pdata + rbytes, buffer.begin());
+        if(rbytes <= buffer_size){
+           uint8_t *pdata = reinterpret_cast<uint8_t*>(block) + off;
+           std::copy(pdata, pdata + rbytes, buffer);
+        }
 
        tcfree(block);
     }
@@ -595,10 +724,11 @@ void TCIndex::AppendChunk(int list_id,
     // Append chunk
     block.insert(block.end(), chunk, chunk + chunk_size);
 
-    // If this is a new block we need to update the index list header
-    // for the curent list_id, located in the first block (not necessary if
-    // we're processing the first block as it's already updated above).
-    if(new_block && hdr.ID!=1)
+    // Update the index list header for the curent list_id, located in the
+    // first block, as the list's statistics change with every chunk (not
+    // necessary if we're processing the first block as it's already updated
+    // above).
+    if(hdr.ID!=1)
        UpdateListHeader(list_id, lhdr);
 }
 
@@ -625,6 +755,36 @@ void TCIndex::UpdateListHeader(int list_id, PListHeader &lhdr)
 
 // ----------------------------------------------------------------------------
 
+void TCIndex::GetListIDs(std::vector<int> &lids)
+{
+    void *key;
+    int ksize;
+
+    lids.clear();
+
+    if(!m_DBHandle)
+       return;
+
+    tchdbiterinit(m_DBHandle);
+
+    // Every list has a 1st block, keyed by <listID|1>
+    while((key = tchdbiternext(m_DBHandle, &ksize)))
+    {
+        assert(ksize == sizeof(int)*2);
+
+        int *pkey = static_cast<int*>(key);
+
+        if(pkey[1] == 1)
+           lids.push_back(pkey[0]);
+
+        tcfree(key);
+    }
+
+    std::sort(lids.begin(), lids.end());
+}
+
+// ----------------------------------------------------------------------------
+
 void TCIndex::Merge(TCIndex &lidx)
 {
     void *key, *val;
@@ -789,6 +949,23 @@ size_t TCFingerprints::ReadFingerprintSize(uint32_t FID)
     if(!m_IsOpen)
        throw std::runtime_error("Fingerprint database not open");
 
+    // The size of an encoded fingerprint is in the record's header, so only
+    // the header is read. Fingerprints stored as they are have the size of
+    // the record.
+    uint8_t hdr[32];
+    assert(FingerprintCodec::GetHeaderSize() <= sizeof(hdr));
+
+    int hsize = tchdbget3(m_DBHandle, &FID, sizeof(uint32_t), hdr,
+                          static_cast<int>(FingerprintCodec::GetHeaderSize()));
+
+    if(hsize <= 0)
+       return 0;
+
+    size_t fpsize = FingerprintCodec::GetDecodedSize(hdr, hsize);
+
+    if(fpsize)
+       return fpsize;
+
     int vsize = tchdbvsiz(m_DBHandle, &FID, sizeof(uint32_t));
     return vsize > 0 ? static_cast<size_t>(vsize) : 0;
 }
@@ -809,15 +986,62 @@ size_t TCFingerprints::ReadFingerprint(uint32_t FID,
     data = tchdbget(m_DBHandle, &FID, sizeof(uint32_t), &dsize);
 
     if(data){
-       assert(0 <= bo && bo < dsize);
-       size_t gsize = size ? size : dsize - bo;
-       gsize = std::min<size_t>(gsize, dsize - bo);
+       const uint8_t *pdata = reinterpret_cast<uint8_t*>(data);
+
+       size_t fpsize = FingerprintCodec::GetDecodedSize(pdata, dsize);
+       if(fpsize == 0)
+          fpsize = dsize;
+
+       assert(bo < fpsize);
+       size_t gsize = size ? size : fpsize - bo;
+       gsize = std::min<size_t>(gsize, fpsize - bo);
 
        if(gsize > buffer.size())
           buffer.resize(gsize);
 
-       uint8_t *pdata = reinterpret_cast<uint8_t*>(data) + bo;
-       std::copy(pdata, pdata + gsize, buffer.begin());
+       // Only the frames spanned by the requested range are decoded
+       try{
+          gsize = FingerprintCodec::Decode(pdata, dsize, buffer.data(), gsize, bo);
+       }
+       catch(...){
+          tcfree(data);
+          throw;
+       }
+       tcfree(data);
+
+       return gsize;
+    }
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t TCFingerprints::ReadFingerprint(uint32_t FID, 
+                                       uint8_t *buffer, 
+                                       size_t size, 
+                                       uint32_t bo)
+{
+    int dsize;
+    void *data;
+
+    if(!m_IsOpen)
+       throw std::runtime_error("Fingerprint database not open");
+
+    data = tchdbget(m_DBHandle, &FID, sizeof(uint32_t), &dsize);
+
+    if(data){
+       const uint8_t *pdata = reinterpret_cast<uint8_t*>(data);
+       size_t gsize = 0;
+
+       // Only the frames spanned by the requested range are decoded
+       try{
+          if(size)
+             gsize = FingerprintCodec::Decode(pdata, dsize, buffer, size, bo);
+       }
+       catch(...){
+          tcfree(data);
+          throw;
+       }
        tcfree(data);
 
        return gsize;
@@ -836,7 +1060,10 @@ void TCFingerprints::WriteFingerprint(uint32_t FID, const uint8_t *data, size_t
     assert(size > 0);
     assert(FID > 0);
 
-    if(!tchdbput(m_DBHandle, &FID, sizeof(uint32_t), data, size)){
+    // Store the fingerprint in compressed form (see FingerprintCodec)
+    FingerprintCodec::Encode(data, size, m_Buffer);
+
+    if(!tchdbput(m_DBHandle, &FID, sizeof(uint32_t), m_Buffer.data(), m_Buffer.size())){
         CHECK_OP(m_DBHandle);
     }
 }
@@ -907,11 +1134,16 @@ DBInfo_t TCInfo::Read()
     void *data;
     DBInfo_t dbinfo;
 
+    // No version unless recorded in the current record layout
+    dbinfo.Version = 0;
+
     data = tchdbget(m_DBHandle, &key, sizeof(int), &dsize);
 
     if(data){
-       assert(dsize == sizeof(DBInfo_t));
-       dbinfo = *reinterpret_cast<DBInfo_t*>(data);
+       if(dsize == sizeof(DBInfo_t))
+          dbinfo = *reinterpret_cast<DBInfo_t*>(data);
+       else if(dsize >= static_cast<int>(sizeof(int)))
+          dbinfo.MatchType = *reinterpret_cast<int*>(data);
        tcfree(data);
     }
     return dbinfo;
@@ -930,3 +1162,72 @@ void TCInfo::Write(const DBInfo_t &info)
     }
 }
 
+
+//=============================================================================
+//                                TCTermStats
+//=============================================================================
+
+
+
+TCTermStats::TCTermStats(TCDataStore *dstore) :
+    TCCollection (dstore)
+{
+}
+
+// ----------------------------------------------------------------------------
+
+bool TCTermStats::Read(TermDictionary &terms)
+{
+    if(!m_IsOpen)
+       throw std::runtime_error("Terms database not open");
+
+    int dsize, key = 0;
+    void *data = tchdbget(m_DBHandle, &key, sizeof(int), &dsize);
+
+    if(!data)
+       return false;
+
+    // Invalid statistics are treated as missing, as they're not essential.
+    bool valid = true;
+
+    try{
+        terms.Deserialize(static_cast<uint8_t*>(data), dsize);
+    }
+    catch(const std::runtime_error&){
+        terms.Clear();
+        valid = false;
+    }
+
+    tcfree(data);
+    return valid;
+}
+
+// ----------------------------------------------------------------------------
+
+void TCTermStats::Write(const TermDictionary &terms)
+{
+    if(!m_IsOpen)
+       throw std::runtime_error("Terms database not open");
+
+    std::vector<uint8_t> data;
+    terms.Serialize(data);
+
+    int key = 0;
+    if(!tchdbput(m_DBHandle, &key, sizeof(int), data.data(), data.size())){
+        CHECK_OP(m_DBHandle);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void TCTermStats::Invalidate()
+{
+    if(!m_IsOpen)
+       throw std::runtime_error("Terms database not open");
+
+    int key = 0;
+    if(!tchdbout(m_DBHandle, &key, sizeof(int)) &&
+       tchdbecode(m_DBHandle) != TCENOREC){
+        CHECK_OP(m_DBHandle);
+    }
+}
@@ -17,6 +17,8 @@
 #endif
 
 #include "KVDataStore.h"
+#include "FingerprintCodec.h"
+#include "TermDictionary.h"
 
 class TCDataStore;
 
@@ -107,6 +109,16 @@ public:
               std::vector<uint8_t> &buffer, 
               bool headers=true);
 
+    /// Read the specified index list block data into the given buffer of
+    /// 'buffer_size' bytes. Return the size of the block's data. If it is
+    /// greater than 'buffer_size' nothing is read.
+    size_t 
+    ReadBlock(int list_id, 
+              int block_id, 
+              uint8_t *buffer, 
+              size_t buffer_size, 
+              bool headers=true);
+
     /// Write the contents of the given block in the specified index list.
     /// A new block is created if the specified block does not exist.
     void 
@@ -128,6 +140,10 @@ public:
     void 
     UpdateListHeader(int list_id, Audioneex::PListHeader &lhdr);
 
+    /// Get the identifiers of all the lists in the index
+    void 
+    GetListIDs(std::vector<int> &lids);
+
     /// Merge this index with the given one.
     void 
     Merge(TCIndex &lidx);
@@ -144,6 +160,8 @@ public:
 // ----------------------------------------------------------------------------
 
 /// This class implements functionalities to manipulate a fingerprints collection.
+/// The fingerprints are stored compressed (see FingerprintCodec) and decoded on
+/// reading, so this is transparent to the clients.
 
 class TCFingerprints : public TCCollection
 {
@@ -164,6 +182,14 @@ public:
                     size_t size, 
                     uint32_t bo);
 
+    /// Read at most 'size' bytes of the specified fingerprint's data starting
+    /// at offset bo (in bytes) into the given buffer.
+    size_t 
+    ReadFingerprint(uint32_t FID, 
+                    uint8_t *buffer, 
+                    size_t size, 
+                    uint32_t bo);
+
     /// Write the given fingerprint into the database
     void 
     WriteFingerprint(uint32_t FID, 
@@ -214,6 +240,33 @@ public:
 };
 
 
+// ----------------------------------------------------------------------------
+
+/// This class implements functionalities to manipulate the collection holding
+/// the statistics of the terms in the main index (see TermDictionary).
+
+class TCTermStats : public TCCollection
+{
+public:
+
+    TCTermStats(TCDataStore*);
+    ~TCTermStats() = default;
+
+    /// Read the terms statistics into the given dictionary. Return false if
+    /// they have not been stored.
+    bool
+    Read(TermDictionary &terms);
+
+    /// Store the given terms statistics
+    void
+    Write(const TermDictionary &terms);
+
+    /// Delete the stored terms statistics
+    void
+    Invalidate();
+};
+
+
 // ----------------------------------------------------------------------------
 
 /// This is an implementation of the KVDataStore interface that uses Tokyo Cabinet
@@ -221,6 +274,15 @@ public:
 /// to store and retrieve objects to/from the database by using the TC C API.
 /// You can see it as a communication channel to all the stored data used by the
 /// recognition engine. We also use a "delta index" for build-merge strategies.
+/// The databases are opened in thread-safe mode, so the reentrant read methods
+/// can be used to share an open datastore among multiple recognizers.
+///
+/// The statistics of the terms in the index are kept in a dictionary that is
+/// updated by the indexer and loaded on opening, so the lookups for terms that
+/// are not in the index don't touch the database. They are only available if
+/// they have been kept since the index was created (and a session that didn't
+/// complete invalidates them), so they are not used for indexes built before
+/// their introduction until the data store is cleared.
 
 class TCDataStore : public KVDataStore
 {
@@ -229,8 +291,18 @@ class TCDataStore : public KVDataStore
     TCFingerprints        m_QFingerprints;
     TCMetadata            m_Metadata;
     TCInfo                m_Info;
+    TCTermStats           m_TermStats;
+    TermDictionary        m_Terms;
+    bool                  m_TermsValid  {false};
     std::vector<uint8_t>  m_ReadBuffer;
 
+    /// Check that the index is in the current format (see INDEX_FORMAT_VERSION).
+    /// The data store is closed if it's not.
+    void CheckFormat();
+
+    /// Record the current index format in the info database
+    void RecordFormat();
+
 public:
 
     explicit TCDataStore(const std::string &url = std::string());
@@ -295,6 +367,12 @@ public:
         return m_Info.Read(); 
     }
 
+    /// Get the identifiers of all the lists in the main index
+    void 
+    GetPListIDs(std::vector<int> &lids) override {
+        m_MainIndex.GetListIDs(lids);
+    }
+
 
     // API Interface
 
@@ -307,6 +385,29 @@ public:
     size_t
     GetFingerprintSize(uint32_t FID) override;
 
+    size_t
+    ReadPListBlock(int list_id, 
+                   int block, 
+                   uint8_t* buffer, 
+                   size_t buffer_size, 
+                   bool headers=false) override;
+
+    size_t
+    ReadFingerprint(uint32_t FID, 
+                    uint8_t* buffer, 
+                    size_t nbytes, 
+                    uint32_t bo = 0) override;
+
+    bool
+    IsReentrant() const override { 
+        return true; 
+    }
+
+    /// Get the document frequency of the specified term from the terms
+    /// statistics (-1 if not available or while building the index).
+    int64_t
+    GetDocFrequency(int list_id) override;
+
     size_t 
     GetFingerprintsCount() override;
 
@@ -345,6 +446,9 @@ public:
                          uint8_t* data,
                          size_t size) override;
 
+    void
+    OnIndexerDocFrequency(int list_id, uint32_t df) override;
+
 private:
 
     int  m_Run  {0};
@@ -0,0 +1,174 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+#ifndef TERMDICTIONARY_H
+#define TERMDICTIONARY_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <stdexcept>
+#include <boost/unordered_map.hpp>
+
+/// This class keeps the statistics of the terms in an index, as reported by the
+/// indexer through DataStore::OnIndexerDocFrequency(), so that a data store can
+/// tell whether a term is in the index, and how many fingerprints it occurs in,
+/// without accessing the postings lists (see DataStore::GetDocFrequency()).
+///
+/// The presence of the terms is kept in a bitmap indexed by term, which is a few
+/// MB even for the largest term spaces and answers the common case (a missing
+/// term) with one memory access, while the document frequencies are kept in a
+/// table holding the present terms only.
+///
+/// Serialized layout:
+///
+///   [Header][<LID (i32), DF (u32)> x TermCount]
+///
+/// with the terms sorted by LID. The bitmap is rebuilt on loading.
+
+class TermDictionary
+{
+    struct Header_t
+    {
+        uint32_t Magic;
+        uint16_t Version;
+        uint16_t Reserved;
+        uint32_t TermCount;
+        uint32_t Reserved2;
+    };
+
+    typedef boost::unordered::unordered_map<int, uint32_t> df_table;
+
+    std::vector<uint64_t>  m_Bitmap;
+    df_table               m_DocFreq;
+
+public:
+
+    /// Magic number identifying a serialized dictionary ("ATRM")
+    static const uint32_t MAGIC = 0x4D525441;
+
+    /// Current format version
+    static const uint16_t VERSION = 1;
+
+    /// Size the bitmap for terms in [0, nterms), so that it doesn't have to
+    /// grow as terms are added.
+    void Reserve(size_t nterms)
+    {
+        size_t nwords = (nterms + 63) / 64;
+        if(m_Bitmap.size() < nwords)
+           m_Bitmap.resize(nwords, 0);
+    }
+
+    /// Add 'df' to the document frequency of the specified term
+    void Add(int lid, uint32_t df)
+    {
+        if(lid < 0)
+           throw std::invalid_argument("TermDictionary: Invalid term");
+
+        if(df == 0)
+           return;
+
+        size_t word = static_cast<size_t>(lid) / 64;
+
+        if(word >= m_Bitmap.size())
+           m_Bitmap.resize(word + 1, 0);
+
+        m_Bitmap[word] |= uint64_t(1) << (lid % 64);
+        m_DocFreq[lid] += df;
+    }
+
+    /// Check whether the specified term is in the dictionary
+    bool Contains(int lid) const
+    {
+        size_t word = static_cast<size_t>(lid) / 64;
+        return lid >= 0 && word < m_Bitmap.size() &&
+               (m_Bitmap[word] >> (lid % 64) & 1);
+    }
+
+    /// Get the document frequency of the specified term (0 if not present)
+    uint32_t GetDocFrequency(int lid) const
+    {
+        if(!Contains(lid))
+           return 0;
+        df_table::const_iterator it = m_DocFreq.find(lid);
+        return it != m_DocFreq.end() ? it->second : 0;
+    }
+
+    /// Get the number of terms in the dictionary
+    size_t Size() const {
+        return m_DocFreq.size();
+    }
+
+    /// Remove all the terms
+    void Clear()
+    {
+        m_Bitmap.clear();
+        m_DocFreq.clear();
+    }
+
+    /// Serialize the dictionary into the given buffer
+    void Serialize(std::vector<uint8_t> &out) const
+    {
+        std::vector<std::pair<int, uint32_t> > terms (m_DocFreq.begin(),
+                                                      m_DocFreq.end());
+        std::sort(terms.begin(), terms.end());
+
+        Header_t hdr = {};
+        hdr.Magic     = MAGIC;
+        hdr.Version   = VERSION;
+        hdr.TermCount = static_cast<uint32_t>(terms.size());
+
+        out.resize(sizeof(Header_t) + terms.size() * 8);
+
+        uint8_t* p = out.data();
+        std::memcpy(p, &hdr, sizeof(Header_t));
+        p += sizeof(Header_t);
+
+        for(const std::pair<int, uint32_t> &term : terms){
+            int32_t lid = term.first;
+            std::memcpy(p, &lid, 4);
+            std::memcpy(p + 4, &term.second, 4);
+            p += 8;
+        }
+    }
+
+    /// Replace the contents with the given serialized dictionary
+    void Deserialize(const uint8_t* data, size_t size)
+    {
+        Header_t hdr;
+
+        if(data == nullptr || size < sizeof(Header_t))
+           throw std::runtime_error("TermDictionary: Invalid data");
+
+        std::memcpy(&hdr, data, sizeof(Header_t));
+
+        if(hdr.Magic != MAGIC || hdr.Version != VERSION ||
+           size != sizeof(Header_t) + static_cast<size_t>(hdr.TermCount) * 8)
+           throw std::runtime_error("TermDictionary: Invalid data");
+
+        Clear();
+
+        const uint8_t* p = data + sizeof(Header_t);
+
+        for(uint32_t i=0; i<hdr.TermCount; i++, p+=8){
+            int32_t lid;
+            uint32_t df;
+            std::memcpy(&lid, p, 4);
+            std::memcpy(&df, p + 4, 4);
+            if(lid < 0)
+               throw std::runtime_error("TermDictionary: Invalid data");
+            Add(lid, df);
+        }
+    }
+};
+
+
+#endif
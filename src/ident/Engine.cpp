@@ -0,0 +1,132 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+#include <memory>
+
+#include "Engine.h"
+#include "Recognizer.h"
+#include "AudioCodes.h"
+
+
+//=============================================================================
+//                                 Engine
+//=============================================================================
+
+Audioneex::Engine* Audioneex::Engine::Create() {
+    return new EngineImpl;
+}
+
+//=============================================================================
+//                               EngineImpl
+//=============================================================================
+
+Audioneex::EngineImpl::EngineImpl() :
+    m_AudioCodes  (Codebook::deserialize(GetAudioCodes(), GetAudioCodesSize())),
+    m_StoreLock   (std::make_shared<std::mutex>()),
+    m_DataStore   (nullptr),
+    m_MatchType   (MSCALE_MATCH)
+{
+    if(!m_AudioCodes)
+       throw Audioneex::InvalidAudioCodesException
+             ("Couldn't get audio codes.");
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::EngineImpl::SetDataStore(DataStore* dstore)
+{
+    std::lock_guard<std::mutex> lock (m_Lock);
+    m_DataStore = dstore;
+
+    if(m_FPCache)
+       m_FPCache->Clear();
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::EngineImpl::SetMatchType(eMatchType type)
+{
+    if(type != MSCALE_MATCH && type != XSCALE_MATCH)
+       throw Audioneex::InvalidParameterException("Invalid match type set");
+
+    std::lock_guard<std::mutex> lock (m_Lock);
+    m_MatchType = type;
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::EngineImpl::SetFingerprintCacheSize(size_t bytes)
+{
+    std::shared_ptr<DataStoreImpl::FingerprintCache> cache;
+
+    if(bytes > 0)
+       cache = std::make_shared<DataStoreImpl::FingerprintCache>(bytes);
+
+    // The recognizers created so far keep using the previous cache
+    std::lock_guard<std::mutex> lock (m_Lock);
+    m_FPCache = cache;
+}
+
+// ----------------------------------------------------------------------------
+
+Audioneex::DataStore* Audioneex::EngineImpl::GetDataStore() const
+{
+    std::lock_guard<std::mutex> lock (m_Lock);
+    return m_DataStore;
+}
+
+// ----------------------------------------------------------------------------
+
+Audioneex::eMatchType Audioneex::EngineImpl::GetMatchType() const
+{
+    std::lock_guard<std::mutex> lock (m_Lock);
+    return m_MatchType;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t Audioneex::EngineImpl::GetFingerprintCacheSize() const
+{
+    std::lock_guard<std::mutex> lock (m_Lock);
+    return m_FPCache ? m_FPCache->GetCapacity() : 0;
+}
+
+// ----------------------------------------------------------------------------
+
+Audioneex::Recognizer* Audioneex::EngineImpl::CreateRecognizer()
+{
+    std::unique_ptr<RecognizerImpl> recognizer (new RecognizerImpl);
+
+    std::lock_guard<std::mutex> lock (m_Lock);
+
+    recognizer->SetSharedResources(m_AudioCodes, m_StoreLock, m_FPCache);
+    recognizer->SetMatchType(m_MatchType);
+
+    if(m_DataStore)
+       recognizer->SetDataStore(m_DataStore);
+
+    return recognizer.release();
+}
+
+// ----------------------------------------------------------------------------
+
+size_t Audioneex::EngineImpl::GetMemoryUsage() const
+{
+    std::lock_guard<std::mutex> lock (m_Lock);
+
+    size_t bytes = sizeof(EngineImpl) + sizeof(std::mutex);
+
+    // The centroids take about as much as their serialized form
+    bytes += m_AudioCodes->size() * sizeof(Cluster) + GetAudioCodesSize();
+
+    if(m_FPCache)
+       bytes += sizeof(DataStoreImpl::FingerprintCache) + m_FPCache->GetUsed();
+
+    return bytes;
+}
@@ -0,0 +1,73 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <memory>
+#include <mutex>
+
+#include "Codebook.h"
+#include "FingerprintCache.h"
+#include "audioneex.h"
+
+// The following classes are not part of the public API but we need
+// their interfaces exposed when testing DLLs.
+#ifdef TESTING
+  #define AUDIONEEX_API_TEST AUDIONEEX_API
+#else
+  #define AUDIONEEX_API_TEST
+#endif
+
+
+namespace Audioneex
+{
+
+/// Implementation of the Engine interface
+
+class AUDIONEEX_API_TEST EngineImpl : public Audioneex::Engine
+{
+    /// The audio codes, loaded once for all the recognizers
+    std::shared_ptr<const Codebook>                   m_AudioCodes;
+
+    /// Lock serializing the recognizers' accesses to non-reentrant stores
+    std::shared_ptr<std::mutex>                       m_StoreLock;
+
+    /// Cache of reference fingerprints (null if disabled)
+    std::shared_ptr<DataStoreImpl::FingerprintCache>  m_FPCache;
+
+    Audioneex::DataStore*                             m_DataStore;
+    Audioneex::eMatchType                             m_MatchType;
+
+    /// Protects the settings above
+    mutable std::mutex                                m_Lock;
+
+public:
+
+    EngineImpl();
+   ~EngineImpl() = default;
+
+    // Public interface (see audioneex.h)
+
+    void       SetDataStore(Audioneex::DataStore* dstore);
+    void       SetMatchType(Audioneex::eMatchType type);
+    void       SetFingerprintCacheSize(size_t bytes);
+
+    DataStore* GetDataStore() const;
+    eMatchType GetMatchType() const;
+    size_t     GetFingerprintCacheSize() const;
+
+    Audioneex::Recognizer* CreateRecognizer();
+    size_t     GetMemoryUsage() const;
+
+};
+
+}// end namespace Audioneex
+
+#endif
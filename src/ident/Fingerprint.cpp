@@ -8,10 +8,12 @@
 */
 
 #include <vector>
+#include <cmath>
 
 #include "common.h"
 #include "Fingerprint.h"
 #include "Utils.h"
+#include "Stats.h"
 
 #ifdef TESTING
  #include "Tester.h"
@@ -20,16 +22,43 @@
 
 TEST_HERE( namespace { Audioneex::Tester TEST; } )
 
+namespace {
+
+/// Scratch data used during the processing. This is not part of the state
+/// of a fingerprinter, so it is shared by all the fingerprinters running on
+/// the same thread, which keeps the footprint of each one small.
+struct Scratch_t
+{
+    AudioProcessor<int16_t>  AudioProc;
+    AudioBlock<float>        OSBuffer;
+    std::vector<float>       fftFrame;
+
+    Scratch_t() :
+        fftFrame (Audioneex::Pms::OrigWindowSize + 1)
+    {
+        // Set up FFT processor
+        AudioProc.SetFFT(new FFT(Audioneex::Pms::OrigWindowSize,
+                                 Audioneex::Pms::zeroPadFactor));
+    }
+};
+
+Scratch_t& GetScratch()
+{
+    static thread_local Scratch_t scratch;
+    return scratch;
+}
+
+}// end anonymous namespace
+
 
 Audioneex::Fingerprint::Fingerprint(size_t bufferSize):
-    m_OSBuffer (bufferSize, Pms::Fs, Pms::Ca, 0),
-    m_OSWindow (Pms::OrigWindowSize, Pms::Fs, Pms::Ca, 0),
-    m_fftFrame (Pms::OrigWindowSize + 1),
-    m_LID      (0),
-    m_DeltaT   (0)
+    m_OSWindow   (Pms::OrigWindowSize, Pms::Fs, Pms::Ca, 0),
+    m_BufferSize (bufferSize),
+    m_LID           (0),
+    m_DeltaT        (0),
+    m_GateLevel     (0),
+    m_GateThreshold (0)
 {
-    // Set up FFT processor
-    m_AudioProcessor.SetFFT(new FFT(Pms::OrigWindowSize, Pms::zeroPadFactor));
 }
 
 // ----------------------------------------------------------------------------
@@ -43,6 +72,9 @@ void Audioneex::Fingerprint::Process(AudioBlock<float> &audio, bool flush)
     m_Spectrum.clear();
     m_LF.clear();
     m_Peak.clear();
+    m_Gated.clear();
+    m_GateStats = GateStats_t();
+    m_StageTimes = StageTimes_t();
 
 #ifdef PLOTTING_ENABLED
     m_POI.clear();
@@ -54,21 +86,48 @@ void Audioneex::Fingerprint::Process(AudioBlock<float> &audio, bool flush)
     if(audio.Duration() >= 0.5)
     {
        // This reallocation should never happen, but just in case...
-       if( m_OSBuffer.Capacity() < audio.Size() + Pms::OrigWindowSize ){
+       if( m_BufferSize < audio.Size() + Pms::OrigWindowSize ){
           WARNING_MSG("O&S buffer reallocation.");
-          m_OSBuffer = AudioBlock<float>(audio.Size() + Pms::OrigWindowSize,
-                                         Pms::Fs,
-                                         Pms::Ca,
-                                         0);
+          m_BufferSize = audio.Size() + Pms::OrigWindowSize;
+       }
+
+       AudioBlock<float> &OSBuffer = GetScratch().OSBuffer;
+
+       if( OSBuffer.Capacity() < m_BufferSize )
+          OSBuffer = AudioBlock<float>(m_BufferSize, Pms::Fs, Pms::Ca, 0);
+
+       using Stats::WallTimer;
+
+       {
+          STATS_HERE( WallTimer timer (m_StageTimes.FFT); )
+          ComputeSpectrum(audio, flush);
        }
 
-       ComputeSpectrum(audio, flush);
-       FindPeaks();
-       ExtractPOI();
-       ComputeDescriptors();
+       // Nothing to extract if all the frames have been gated
+       if(m_GateStats.Silent + m_GateStats.Flat < m_GateStats.Frames)
+       {
+          {
+             STATS_HERE( WallTimer timer (m_StageTimes.Peaks); )
+             FindPeaks();
+          }
+          {
+             STATS_HERE( WallTimer timer (m_StageTimes.POI); )
+             ExtractPOI();
+          }
+          {
+             STATS_HERE( WallTimer timer (m_StageTimes.Descriptors); )
+             ComputeDescriptors();
+          }
+       }
 
        // time-traslate the current snippet
        m_DeltaT += m_Spectrum.size();
+
+#ifndef PLOTTING_ENABLED
+       // The spectral data is only needed during the processing
+       std::vector<std::vector<float> >().swap(m_Spectrum);
+       std::vector<std::vector<float> >().swap(m_Peak);
+#endif
     }
     else{
         // Ignore data ?
@@ -79,7 +138,6 @@ void Audioneex::Fingerprint::Process(AudioBlock<float> &audio, bool flush)
 
 void Audioneex::Fingerprint::Reset()
 {
-    m_OSBuffer.Resize(0);
     m_OSWindow.Resize(0);
     m_LID = 0;
     m_DeltaT = 0;
@@ -89,47 +147,74 @@ void Audioneex::Fingerprint::Reset()
 
 void Audioneex::Fingerprint::SetBufferSize(size_t size)
 {
-    m_OSBuffer = AudioBlock<float>(size + Pms::OrigWindowSize, Pms::Fs, Pms::Ca, 0);
+    m_BufferSize = size + Pms::OrigWindowSize;
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Fingerprint::SetGateLevel(float level)
+{
+    if(level < -120 || level > 0)
+       throw Audioneex::InvalidParameterException("Invalid gate level. Must be in [-120,0]");
+
+    m_GateLevel = level;
+
+    // The level is compared to the mean energy of the frames
+    m_GateThreshold = level < 0 ? std::pow(10.f, level / 10.f) : 0;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t Audioneex::Fingerprint::GetMemoryUsage() const
+{
+    size_t bytes = sizeof(Fingerprint) + m_OSWindow.Capacity() * sizeof(float);
+
+    for(const LocalFingerprint_t &lf : m_LF)
+        bytes += sizeof(LocalFingerprint_t) + lf.D.size();
+
+    return bytes;
 }
 
 // ----------------------------------------------------------------------------
 
 void Audioneex::Fingerprint::ComputeSpectrum(AudioBlock<float> &audio, bool flush)
 {
-    // Prepend the last O&S window to current audio block
-    m_OSBuffer.Append(m_OSWindow).Append(audio);
+    Scratch_t &scratch = GetScratch();
+
+    AudioBlock<float> &OSBuffer = scratch.OSBuffer;
+
+    // Prepend the last O&S window to current audio block. The O&S buffer
+    // is shared, so it may hold data from other fingerprinters.
+    OSBuffer.Resize(0);
+    OSBuffer.Append(m_OSWindow).Append(audio);
 
     m_OSWindow.Resize(Pms::OrigWindowSize);
 
     // Read the input block in an overlap windowed fashion
     for(size_t wstart=0; m_OSWindow.Size()==Pms::OrigWindowSize; wstart+=Pms::hopSize)
     {
-        m_OSBuffer.GetSubBlock(wstart, Pms::OrigWindowSize, m_OSWindow);
+        OSBuffer.GetSubBlock(wstart, Pms::OrigWindowSize, m_OSWindow);
 
         // if we have a complete FFT window, process it
-        if(m_OSWindow.Size() == Pms::OrigWindowSize){
-           m_AudioProcessor.FFT_Transform(m_OSWindow, m_fftFrame, FFT::EnergySpectrum);
-           m_Spectrum.push_back(m_fftFrame);
-        }
+        if(m_OSWindow.Size() == Pms::OrigWindowSize)
+           TransformWindow();
     }
 
     // Reset the O&S buffer
-    m_OSBuffer.Resize(0);
+    OSBuffer.Resize(0);
 
     // If the flush flag is set, then any residual data in the O&S window
     // must also be processed after the audio block.
     if(flush && m_OSWindow.Size() > 0)
     {
-       m_OSBuffer = m_OSWindow;
+       OSBuffer = m_OSWindow;
 
        for(size_t wstart=0; m_OSWindow.Size()>0; wstart+=Pms::hopSize)
        {
-           m_OSBuffer.GetSubBlock(wstart, Pms::OrigWindowSize, m_OSWindow);
+           OSBuffer.GetSubBlock(wstart, Pms::OrigWindowSize, m_OSWindow);
 
-           if(m_OSWindow.Size()>0){
-              m_AudioProcessor.FFT_Transform(m_OSWindow, m_fftFrame, FFT::EnergySpectrum);
-              m_Spectrum.push_back(m_fftFrame);
-           }
+           if(m_OSWindow.Size()>0)
+              TransformWindow();
        }
     }
 
@@ -137,6 +222,65 @@ void Audioneex::Fingerprint::ComputeSpectrum(AudioBlock<float> &audio, bool flus
 
 // ----------------------------------------------------------------------------
 
+void Audioneex::Fingerprint::TransformWindow()
+{
+    Scratch_t &scratch = GetScratch();
+
+    m_GateStats.Frames++;
+
+    if(m_GateThreshold == 0){
+       scratch.AudioProc.FFT_Transform(m_OSWindow, scratch.fftFrame, FFT::EnergySpectrum);
+       m_Spectrum.push_back(scratch.fftFrame);
+       m_Gated.push_back(false);
+       return;
+    }
+
+    float E = 0.0f;
+    for(size_t i=0; i<m_OSWindow.Size(); i++)
+        E += m_OSWindow[i] * m_OSWindow[i];
+    E /= m_OSWindow.Size();
+
+    // Silent frames are not transformed. Their spectrum is set to zero,
+    // which produces no peaks while keeping the time axis.
+    if(E < m_GateThreshold){
+       m_Spectrum.push_back(std::vector<float>(scratch.fftFrame.size(), 0.f));
+       m_Gated.push_back(true);
+       m_GateStats.Silent++;
+       return;
+    }
+
+    scratch.AudioProc.FFT_Transform(m_OSWindow, scratch.fftFrame, FFT::EnergySpectrum);
+    m_Spectrum.push_back(scratch.fftFrame);
+
+    // Low-level noise-like frames carry no useful peaks either, so they
+    // are discarded as the silent ones (see Pms::GateFlatness).
+    bool flat = false;
+
+    if(E < m_GateThreshold * std::pow(10.f, Pms::GateMargin / 10.f))
+    {
+       const std::vector<float> &X = m_Spectrum.back();
+
+       double logsum = 0, sum = 0;
+       for(int k=Pms::Kmin; k<=Pms::Kmax; k++){
+           logsum += std::log(X[k] + 1e-12);
+           sum += X[k];
+       }
+
+       int nbins = Pms::Kmax - Pms::Kmin + 1;
+
+       flat = sum > 0 && std::exp(logsum / nbins) / (sum / nbins) > Pms::GateFlatness;
+    }
+
+    if(flat){
+       std::fill(m_Spectrum.back().begin(), m_Spectrum.back().end(), 0.f);
+       m_GateStats.Flat++;
+    }
+
+    m_Gated.push_back(flat);
+}
+
+// ----------------------------------------------------------------------------
+
 void Audioneex::Fingerprint::FindPeaks()
 {
     assert(m_Spectrum.size() >= 3);
@@ -169,6 +313,11 @@ void Audioneex::Fingerprint::FindPeaks()
     // to prevent incomplete descriptors.
 
     for(size_t m=Pms::rNpT; m<X.size()-Pms::rNpT; m++)
+    {
+       // No peaks where the kernel only covers gated (zero) frames
+       if(m_Gated[m-rH] && m_Gated[m] && m_Gated[m+rH])
+          continue;
+
        for(size_t k=Pms::Kmin+Pms::rNpF; k<Pms::Kmax-Pms::rNpF; k++)
        {
            y=0; Ep=0;
@@ -185,6 +334,7 @@ void Audioneex::Fingerprint::FindPeaks()
            if(y>0)
               m_Peak[m][k-Pms::Kmin] = Ep;
        }
+    }
 }
 
 // ----------------------------------------------------------------------------
@@ -353,6 +503,9 @@ void Audioneex::Fingerprint::ComputeDescriptors()
                 // Add local fingerprint to stream
                 m_LF.push_back(lf);
 
+                if(m_Callback)
+                   m_Callback(m_LF.back());
+
             }// end if POI
         }
     }
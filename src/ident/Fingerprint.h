@@ -13,6 +13,7 @@
 #include <boost/unordered_map.hpp>
 #include <list>
 #include <vector>
+#include <functional>
 
 #include "common.h"
 #include "Parameters.h"
@@ -58,11 +59,30 @@ struct AUDIONEEX_API_TEST QLocalFingerprint_t
     uint8_t  E; // Clipped. See NOTE in Codebook::quantize()
 };
 
+/// Gating statistics of a processing step (see Fingerprint::SetGateLevel())
+struct AUDIONEEX_API_TEST GateStats_t
+{
+    uint32_t Frames {0};  // Spectral frames computed
+    uint32_t Silent {0};  // Frames discarded as silent
+    uint32_t Flat   {0};  // Frames discarded as noise-like
+};
+
+/// Time spent (in seconds) in the stages of a processing step. Only
+/// collected in builds with statistics enabled (see STATS_HERE).
+struct AUDIONEEX_API_TEST StageTimes_t
+{
+    double FFT         {0};  // Spectral analysis
+    double Peaks       {0};  // Peaks detection
+    double POI         {0};  // Points of interest extraction
+    double Descriptors {0};  // Descriptors computation
+};
+
 // ----------------------------------------------------
 
 typedef std::vector<LocalFingerprint_t>                       lf_vector;
 typedef std::pair<LocalFingerprint_t*, LocalFingerprint_t*>   lf_pair;
 typedef std::pair<QLocalFingerprint_t*, QLocalFingerprint_t*> qlf_pair;
+typedef std::function<void(const LocalFingerprint_t&)>       lf_callback;
 
 inline bool operator ==(const LocalFingerprint_t &lf1,
                         const LocalFingerprint_t &lf2)
@@ -80,21 +100,26 @@ class AUDIONEEX_API_TEST Fingerprint
 {
     static const int POI_LOCATION = -1;
 
-    AudioProcessor<int16_t>          m_AudioProcessor;
-    AudioBlock<float>                m_OSBuffer;
     AudioBlock<float>                m_OSWindow;
     std::vector<std::vector<float> > m_Spectrum;
     std::vector<std::vector<float> > m_Peak;
-    std::vector<float>               m_fftFrame;
     lf_vector                        m_LF;
+    size_t                           m_BufferSize;
     int                              m_LID;
     int                              m_DeltaT;
+    lf_callback                      m_Callback;
+    float                            m_GateLevel;
+    float                            m_GateThreshold;
+    std::vector<bool>                m_Gated;
+    GateStats_t                      m_GateStats;
+    StageTimes_t                     m_StageTimes;
 
 #ifdef PLOTTING_ENABLED
     std::vector<std::vector<float> > m_POI;  // For display purposes only
 #endif
 
     void  ComputeSpectrum(AudioBlock<float> &audio, bool flush);
+    void  TransformWindow();
     void  FindPeaks();
     void  ExtractPOI();
     void  ComputeDescriptors();
@@ -142,10 +167,38 @@ class AUDIONEEX_API_TEST Fingerprint
     void SetBufferSize(size_t size);
 
     /// Get the size in samples of the internal audio buffer.
-    size_t GetBufferSize() const { return m_OSBuffer.Capacity(); }
+    size_t GetBufferSize() const { return m_BufferSize; }
+
+    /// Set a function to be called with each LF as soon as it is extracted
+    /// during Process(), so that the LFs can be consumed while the rest of
+    /// the audio is still being processed. Pass null to remove it.
+    void SetCallback(const lf_callback &callback) { m_Callback = callback; }
+
+    /// Get the (approximate) amount of memory in bytes owned by this
+    /// fingerprinter. The buffers used during the processing (O&S buffer,
+    /// FFT, spectrum) are shared by all the fingerprinters running on the
+    /// same thread and are not included.
+    size_t GetMemoryUsage() const;
 
 	/// Get the time delta (time-translation) so far processed
 	int GetTimeDelta() const { return m_DeltaT; }
+
+    /// Set the level (in dBFS) below which the audio is considered silent.
+    /// The spectral frames whose mean energy is below this level are not
+    /// transformed and produce no LFs, as do the frames just above it whose
+    /// spectrum is noise-like (see Pms::GateFlatness), while the time axis
+    /// is kept. If a whole audio block is gated its processing is skipped.
+    /// A value of 0 (the default) disables the gate.
+    void SetGateLevel(float level);
+
+    /// Get the gate level (0 if disabled).
+    float GetGateLevel() const { return m_GateLevel; }
+
+    /// Get the gating statistics of the last processing step.
+    const GateStats_t& GetGateStats() const { return m_GateStats; }
+
+    /// Get the stage times of the last processing step.
+    const StageTimes_t& GetStageTimes() const { return m_StageTimes; }
 };
 
 
@@ -0,0 +1,86 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+#include "common.h"
+#include "Fingerprinter.h"
+#include "Matcher.h"
+#include "LFStream.h"
+#include "AudioCodes.h"
+
+
+//=============================================================================
+//                              Fingerprinter
+//=============================================================================
+
+Audioneex::Fingerprinter* Audioneex::Fingerprinter::Create() {
+    return new FingerprinterImpl;
+}
+
+//=============================================================================
+//                            FingerprinterImpl
+//=============================================================================
+
+Audioneex::FingerprinterImpl::FingerprinterImpl() :
+    m_AudioBufferSize  (Pms::Fs * 2.5 * Pms::Ca),
+    m_Fingerprint      (Pms::Fs * 2.5 * Pms::Ca),
+    m_AudioBuffer      (m_AudioBufferSize, Pms::Fs, Pms::Ca, 0),
+    m_Quantize         (true)
+{
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::FingerprinterImpl::Process(const float *audio, size_t nsamples)
+{
+    if(audio == nullptr)
+       throw Audioneex::InvalidParameterException("Got null audio pointer");
+
+    // Same buffering as in Recognizer::Identify(), so that the produced
+    // LFs are the same as those the recognizer would extract.
+    if(m_AudioBufferSize < nsamples){
+       WARNING_MSG("Buffer overflow. Data truncation will occur.")
+       nsamples = m_AudioBufferSize;
+    }
+
+    m_AudioBuffer.SetData(audio, nsamples);
+    m_Fingerprint.Process(m_AudioBuffer);
+    m_AudioBuffer.Resize(0);
+
+    const lf_vector &lfs = m_Fingerprint.Get();
+
+    if(!m_Quantize){
+       LFStream::Encode(lfs, nsamples, m_Stream);
+       return;
+    }
+
+    if(!m_AudioCodes)
+    {
+       m_AudioCodes = Codebook::deserialize(GetAudioCodes(), GetAudioCodesSize());
+
+       if(!m_AudioCodes)
+          throw Audioneex::InvalidAudioCodesException
+                ("Couldn't get audio codes.");
+    }
+
+    m_QLFs.clear();
+
+    for(const LocalFingerprint_t &lf : lfs)
+        m_QLFs.push_back( Matcher::Quantize(*m_AudioCodes, lf) );
+
+    LFStream::Encode(m_QLFs, lfs.empty() ? 0 : lfs.front().ID, nsamples, m_Stream);
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::FingerprinterImpl::Reset()
+{
+    m_Fingerprint.Reset();
+    m_QLFs.clear();
+    m_Stream.clear();
+}
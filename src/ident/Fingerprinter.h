@@ -0,0 +1,65 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+#ifndef FINGERPRINTER_H
+#define FINGERPRINTER_H
+
+#include <memory>
+#include <vector>
+
+#include "Fingerprint.h"
+#include "Codebook.h"
+#include "audioneex.h"
+
+// The following classes are not part of the public API but we need
+// their interfaces exposed when testing DLLs.
+#ifdef TESTING
+  #define AUDIONEEX_API_TEST AUDIONEEX_API
+#else
+  #define AUDIONEEX_API_TEST
+#endif
+
+
+namespace Audioneex
+{
+
+/// Implementation of the Fingerprinter interface
+
+class AUDIONEEX_API_TEST FingerprinterImpl : public Audioneex::Fingerprinter
+{
+    size_t                            m_AudioBufferSize;
+    Fingerprint                       m_Fingerprint;
+    AudioBlock<float>                 m_AudioBuffer;
+
+    /// The audio codes used to quantize the LFs (loaded on first use)
+    std::unique_ptr<Codebook>         m_AudioCodes;
+
+    std::vector<QLocalFingerprint_t>  m_QLFs;
+    std::vector<uint8_t>              m_Stream;
+    bool                              m_Quantize;
+
+public:
+
+    FingerprinterImpl();
+   ~FingerprinterImpl() = default;
+
+    // Public interface (see audioneex.h)
+
+    void           Process(const float *audio, size_t nsamples);
+    const uint8_t* GetStream() const { return m_Stream.data(); }
+    size_t         GetStreamSize() const { return m_Stream.size(); }
+    void           SetQuantization(bool enable) { m_Quantize = enable; }
+    bool           GetQuantization() const { return m_Quantize; }
+    void           Reset();
+
+};
+
+}// end namespace Audioneex
+
+#endif
@@ -0,0 +1,315 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+#ifndef LFSTREAM_H
+#define LFSTREAM_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Fingerprint.h"
+#include "Parameters.h"
+#include "audioneex.h"
+
+namespace Audioneex
+{
+
+/// This class implements the binary format in which the LFs of an audio chunk
+/// are sent by the clients that fingerprint the audio to the recognizers (see
+/// Fingerprinter and Recognizer::IdentifyFingerprint()). The LFs are either
+/// quantized, which takes a few bytes per LF, or raw, carrying the descriptors.
+/// The times and frequencies are delta coded, as they vary little between
+/// consecutive LFs, and written as variable-length integers.
+///
+/// Layout (little-endian):
+///
+///   [Header][LF 1]...[LF n]
+///   Header = [Magic (u32)][Version (u16)][Type (u8)][0 (u8)][FirstID (u32)]
+///            [Count (u32)][Samples (u32)][DescSize (u16)][0 (u16)]
+///   LF     = [dT (varint)][dF (varint)][W (u8)][E (u8)]    (quantized)
+///   LF     = [dT (varint)][dF (varint)][D (DescSize bytes)] (raw)
+///
+/// where dT and dF are the zig-zag coded differences from the previous LF
+/// (from 0 for the first one), FirstID is the ID of the first LF (the IDs
+/// are sequential) and Samples is the length of the fingerprinted audio.
+
+class LFStream
+{
+public:
+
+    /// Magic number identifying a LF stream ("ALFS")
+    static const uint32_t MAGIC = 0x53464C41;
+
+    /// Current format version
+    static const uint16_t VERSION = 1;
+
+    /// Size in bytes of the stream's header
+    static const size_t HEADER_SIZE = 24;
+
+    /// Type of LFs in the stream
+    enum eType
+    {
+        RAW_LFS       = 0,
+        QUANTIZED_LFS = 1
+    };
+
+    /// Stream header
+    struct Info_t
+    {
+        eType     Type     {QUANTIZED_LFS};
+        uint32_t  FirstID  {0};
+        uint32_t  Count    {0};
+        uint32_t  Samples  {0};
+        uint16_t  DescSize {0};
+    };
+
+    /// Serialize the given raw LFs, fingerprinted from 'samples' audio samples
+    static void Encode(const lf_vector &lfs,
+                       uint32_t samples,
+                       std::vector<uint8_t> &out)
+    {
+        Info_t info;
+        info.Type     = RAW_LFS;
+        info.FirstID  = lfs.empty() ? 0 : lfs.front().ID;
+        info.Count    = lfs.size();
+        info.Samples  = samples;
+        info.DescSize = Pms::IDI_b;
+
+        PutHeader(info, out);
+
+        uint32_t Tprev = 0, Fprev = 0;
+
+        for(size_t i=0; i<lfs.size(); i++)
+        {
+            const LocalFingerprint_t &lf = lfs[i];
+
+            if(lf.ID != info.FirstID + i)
+               throw Audioneex::InvalidParameterException
+                     ("Invalid LF stream. LF id's must be sequential.");
+
+            if(lf.D.size() != info.DescSize)
+               throw Audioneex::InvalidParameterException
+                     ("Invalid LF stream. Wrong descriptor size.");
+
+            PutVarint(ZigZag(lf.T - Tprev), out);
+            PutVarint(ZigZag(lf.F - Fprev), out);
+            out.insert(out.end(), lf.D.begin(), lf.D.end());
+            Tprev = lf.T;
+            Fprev = lf.F;
+        }
+    }
+
+    /// Serialize the given quantized LFs, the first of which has the given ID
+    static void Encode(const std::vector<QLocalFingerprint_t> &qlfs,
+                       uint32_t firstID,
+                       uint32_t samples,
+                       std::vector<uint8_t> &out)
+    {
+        Info_t info;
+        info.Type    = QUANTIZED_LFS;
+        info.FirstID = firstID;
+        info.Count   = qlfs.size();
+        info.Samples = samples;
+
+        PutHeader(info, out);
+
+        uint32_t Tprev = 0, Fprev = 0;
+
+        for(const QLocalFingerprint_t &lf : qlfs)
+        {
+            PutVarint(ZigZag(lf.T - Tprev), out);
+            PutVarint(ZigZag(lf.F - Fprev), out);
+            out.push_back(lf.W);
+            out.push_back(lf.E);
+            Tprev = lf.T;
+            Fprev = lf.F;
+        }
+    }
+
+    /// Deserialize the given stream into 'lfs' or 'qlfs', depending on the
+    /// type of LFs, and return its header. The LFs are validated, so that
+    /// streams from untrusted sources can be safely processed.
+    static Info_t Decode(const uint8_t* data,
+                         size_t size,
+                         lf_vector &lfs,
+                         std::vector<QLocalFingerprint_t> &qlfs)
+    {
+        if(data == nullptr || size < HEADER_SIZE)
+           Fail();
+
+        const uint8_t* p = data;
+        const uint8_t* end = data + size;
+
+        Info_t info;
+
+        if(GetU32(p) != MAGIC || GetU16(p) != VERSION)
+           Fail();
+
+        uint8_t type = *p++;
+        p++;
+
+        info.FirstID  = GetU32(p);
+        info.Count    = GetU32(p);
+        info.Samples  = GetU32(p);
+        info.DescSize = GetU16(p);
+        p += 2;
+
+        if(type != RAW_LFS && type != QUANTIZED_LFS)
+           Fail();
+
+        info.Type = static_cast<eType>(type);
+
+        if(info.Type == RAW_LFS && info.DescSize != Pms::IDI_b)
+           Fail();
+
+        // Each LF takes at least 2 bytes for the deltas, which bounds the
+        // allocations below for corrupt counts.
+        size_t lfsize = 2 + (info.Type == RAW_LFS ? info.DescSize : 2);
+
+        if(info.Count > static_cast<size_t>(end - p) / lfsize)
+           Fail();
+
+        lfs.clear();
+        qlfs.clear();
+
+        uint32_t T = 0, F = 0;
+
+        for(uint32_t i=0; i<info.Count; i++)
+        {
+            uint32_t dT = UnZigZag(GetVarint(p, end));
+
+            // The LFs are in time order
+            if(dT > UINT32_MAX - T)
+               Fail();
+
+            T += dT;
+            F += UnZigZag(GetVarint(p, end));
+
+            if(F < static_cast<uint32_t>(Pms::Kmin) || F > static_cast<uint32_t>(Pms::Kmax))
+               Fail();
+
+            if(info.Type == RAW_LFS)
+            {
+                if(static_cast<size_t>(end - p) < info.DescSize)
+                   Fail();
+
+                lfs.emplace_back();
+                LocalFingerprint_t &lf = lfs.back();
+                lf.ID = info.FirstID + i;
+                lf.T = T;
+                lf.F = F;
+                lf.D.assign(p, p + info.DescSize);
+                p += info.DescSize;
+            }
+            else
+            {
+                if(end - p < 2 || p[0] > Pms::Kmed)
+                   Fail();
+
+                QLocalFingerprint_t lf;
+                lf.T = T;
+                lf.F = F;
+                lf.W = p[0];
+                lf.E = p[1];
+                qlfs.push_back(lf);
+                p += 2;
+            }
+        }
+
+        if(p != end)
+           Fail();
+
+        return info;
+    }
+
+private:
+
+    static void Fail()
+    {
+        throw Audioneex::InvalidFingerprintException
+              ("Invalid LF stream. The data appears to be corrupt.");
+    }
+
+    static uint32_t ZigZag(uint32_t d) {
+        return (d << 1) ^ (0 - (d >> 31));
+    }
+
+    static uint32_t UnZigZag(uint32_t z) {
+        return (z >> 1) ^ (0 - (z & 1));
+    }
+
+    static void PutVarint(uint32_t v, std::vector<uint8_t> &out)
+    {
+        for(; v >= 0x80; v >>= 7)
+            out.push_back(static_cast<uint8_t>(v | 0x80));
+        out.push_back(static_cast<uint8_t>(v));
+    }
+
+    static uint32_t GetVarint(const uint8_t* &p, const uint8_t* end)
+    {
+        uint32_t v = 0;
+
+        for(int shift=0; shift<35; shift+=7)
+        {
+            if(p == end)
+               Fail();
+            uint8_t b = *p++;
+            v |= static_cast<uint32_t>(b & 0x7F) << shift;
+            if(!(b & 0x80))
+               return v;
+        }
+
+        Fail();
+        return 0;
+    }
+
+    static void PutU16(uint16_t v, std::vector<uint8_t> &out)
+    {
+        out.push_back(v & 0xFF);
+        out.push_back(v >> 8);
+    }
+
+    static void PutU32(uint32_t v, std::vector<uint8_t> &out)
+    {
+        PutU16(v & 0xFFFF, out);
+        PutU16(v >> 16, out);
+    }
+
+    static uint16_t GetU16(const uint8_t* &p)
+    {
+        uint16_t v = p[0] | p[1] << 8;
+        p += 2;
+        return v;
+    }
+
+    static uint32_t GetU32(const uint8_t* &p)
+    {
+        uint32_t lo = GetU16(p);
+        uint32_t hi = GetU16(p);
+        return lo | hi << 16;
+    }
+
+    static void PutHeader(const Info_t &info, std::vector<uint8_t> &out)
+    {
+        out.clear();
+        PutU32(MAGIC, out);
+        PutU16(VERSION, out);
+        out.push_back(static_cast<uint8_t>(info.Type));
+        out.push_back(0);
+        PutU32(info.FirstID, out);
+        PutU32(info.Count, out);
+        PutU32(info.Samples, out);
+        PutU16(info.DescSize, out);
+        PutU16(0, out);
+    }
+};
+
+}// end namespace Audioneex
+
+#endif
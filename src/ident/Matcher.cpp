@@ -7,12 +7,19 @@
 
 */
 
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <tuple>
+
 #include "common.h"
 #include "Parameters.h"
 #include "Matcher.h"
 #include "Indexer.h"
 #include "AudioCodes.h"
 #include "Utils.h"
+#include "Stats.h"
 
 #ifdef TESTING
  #include "Tester.h"
@@ -20,6 +27,53 @@
 
 TEST_HERE( namespace { Audioneex::Tester TEST; } )
 
+namespace {
+
+// Helpers to estimate the memory taken by the matcher's data structures
+
+template <class T>
+size_t VectorBytes(const std::vector<T> &v) {
+    return v.capacity() * sizeof(T);
+}
+
+template <class M>
+size_t HashtableBytes(const M &m) {
+    return m.bucket_count() * sizeof(void*) +
+           m.size() * (sizeof(typename M::value_type) + sizeof(void*));
+}
+
+size_t HistoBytes(const Audioneex::Qhisto_t &H)
+{
+    size_t bytes = VectorBytes(H.Ht);
+    for(const Audioneex::HistoBin_t &bin : H.Ht)
+        bytes += HashtableBytes(bin.Info);
+    return bytes;
+}
+
+size_t TopKBytes(const Audioneex::hashtable_Qcand &TopK)
+{
+    size_t bytes = TopK.capacity() * sizeof(Audioneex::hashtable_Qcand::value_type);
+    for(const Audioneex::hashtable_Qcand::value_type &e : TopK){
+        bytes += VectorBytes(e.second);
+        for(const Audioneex::Qcand_t &C : e.second){
+            bytes += VectorBytes(C.Peaks);
+            for(const Audioneex::Qcand_t::Peak_t &peak : C.Peaks)
+                bytes += VectorBytes(peak.Pairs);
+        }
+    }
+    return bytes;
+}
+
+size_t PListBuffersBytes(const Audioneex::plist_buffers &buffers)
+{
+    size_t bytes = VectorBytes(buffers);
+    for(const Audioneex::DataStoreImpl::PListBuffers &b : buffers)
+        bytes += VectorBytes(b.Read) + VectorBytes(b.Decoded);
+    return bytes;
+}
+
+}// end anonymous namespace
+
 
 Audioneex::Matcher::Matcher()
 {
@@ -28,12 +82,10 @@ Audioneex::Matcher::Matcher()
     // in case it is not, the histogram will be reallocated).
     // NOTE: This value is arbitrary and can be changed by clients to a proper
     //       value by using SetMaxRecordingDuration().
-    size_t H_size =  900 / (Pms::dt * Pms::Tk);
-
-    m_H.Resize(H_size);
+    // The histogram is allocated on the first matching step.
+    m_HSize =  900 / (Pms::dt * Pms::Tk);
 
     Xk.reserve(256);
-    m_XkSeq.reserve(256);
 }
 
 // ----------------------------------------------------------------------------
@@ -48,28 +100,40 @@ int Audioneex::Matcher::Process(const lf_vector &lfs)
     // Nothing to process
     if(lfs.empty()) return 0;
 
-    // Append LF stream to query sequence
-    for(const auto &lf : lfs)
-    {
-        Codebook::QResults quant = m_AudioCodes->quantize(lf);
-        QLocalFingerprint_t QLF;
-        QLF.T = lf.T;
-        QLF.F = lf.F;
-        QLF.W = quant.word;
-        QLF.E = quant.dist; // Clipped. See NOTE in Codebook::quantize()
-        Xk.push_back(QLF);
-        m_XkSeq.push_back(lf.ID);
-    }
+    AppendQuery(lfs);
 
-    // Validate query sequence
-    if(!ValidQuerySequence())
-        throw Audioneex::InvalidMatchSequenceException
-              ("Invalid query sequence. LF id's must be sequential.");
+    return DoSteps(false);
+}
+
+// ----------------------------------------------------------------------------
+
+int Audioneex::Matcher::ProcessQuantized(const std::vector<QLocalFingerprint_t> &qlfs,
+                                         uint32_t firstID,
+                                         bool more)
+{
+    // Check whether we have valid data store
+    if(m_DataStore == nullptr)
+       throw Audioneex::InvalidParameterException
+             ("No data provider set.");
+
+    // Nothing to process
+    if(qlfs.empty() && more) return 0;
+
+    if(!qlfs.empty())
+       AppendQuery(qlfs, firstID);
 
+    return DoSteps(more);
+}
+
+// ----------------------------------------------------------------------------
+
+int Audioneex::Matcher::DoSteps(bool lookahead)
+{
     int processed = 0;
 
     // Process batches of Nk LF.
-    while(Xk.size() - m_ko >= Pms::Nk)
+    while(Xk.size() - m_ko >= Pms::Nk &&
+          (!lookahead || HasLookahead(m_ko + Pms::Nk)))
     {
         int Xk_T = Xk[m_ko + Pms::Nk - 1].T;
 
@@ -85,11 +149,96 @@ int Audioneex::Matcher::Process(const lf_vector &lfs)
         processed += Pms::Nk;
     }
 
+    TrimQuery();
+
     return processed;
 }
 
 // ----------------------------------------------------------------------------
 
+bool Audioneex::Matcher::HasLookahead(size_t kn) const
+{
+    // A step on the LFs before kn also looks at the LFs that follow, up to
+    // Ntf/2 of them in the reranking (see GraphMatching()) and up to Tmax
+    // later in the bi-terms (see BuildTermPlan()).
+    if(Xk.size() < kn + Pms::Ntf/2)
+       return false;
+
+    return m_MatchType != XSCALE_MATCH ||
+           Xk.back().T > Xk[kn-1].T + IndexerImpl::Tmax;
+}
+
+// ----------------------------------------------------------------------------
+
+Audioneex::QLocalFingerprint_t
+Audioneex::Matcher::Quantize(const LocalFingerprint_t &lf) const
+{
+    if(!m_AudioCodes)
+       throw Audioneex::InvalidParameterException
+             ("No audio codes set.");
+
+    return Quantize(*m_AudioCodes, lf);
+}
+
+// ----------------------------------------------------------------------------
+
+Audioneex::QLocalFingerprint_t
+Audioneex::Matcher::Quantize(const Codebook &codes, const LocalFingerprint_t &lf)
+{
+    Codebook::QResults quant = codes.quantize(lf);
+    QLocalFingerprint_t QLF;
+    QLF.T = lf.T;
+    QLF.F = lf.F;
+    QLF.W = quant.word;
+    QLF.E = quant.dist; // Clipped. See NOTE in Codebook::quantize()
+    return QLF;
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::AppendQuery(const lf_vector &lfs)
+{
+    STATS_HERE( Stats::WallTimer timer (m_Stats.QuantizeTime); )
+
+    // Append LF stream to query sequence
+    for(const auto &lf : lfs)
+    {
+        Xk.push_back(Quantize(lf));
+
+        // The LFs in the query sequence must have sequential IDs starting from 0
+        if(lf.ID != m_XkCount)
+           m_XkValid = false;
+
+        m_XkCount++;
+    }
+
+    // Validate query sequence
+    if(!ValidQuerySequence())
+        throw Audioneex::InvalidMatchSequenceException
+              ("Invalid query sequence. LF id's must be sequential.");
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::AppendQuery(const std::vector<QLocalFingerprint_t> &qlfs,
+                                     uint32_t firstID)
+{
+    // Same as above for LFs that are already quantized
+    Xk.insert(Xk.end(), qlfs.begin(), qlfs.end());
+
+    if(firstID != m_XkCount)
+       m_XkValid = false;
+
+    m_XkCount += qlfs.size();
+
+    // Validate query sequence
+    if(!ValidQuerySequence())
+        throw Audioneex::InvalidMatchSequenceException
+              ("Invalid query sequence. LF id's must be sequential.");
+}
+
+// ----------------------------------------------------------------------------
+
 int Audioneex::Matcher::Flush()
 {
     // Check whether we have a valid data store
@@ -118,42 +267,308 @@ int Audioneex::Matcher::Flush()
     m_ko += Nlf;
     m_ko_T = Xk_T;
     m_Nsteps++;
+
+    TrimQuery();
 	
     return Nlf;
 }
 
 // ----------------------------------------------------------------------------
 
+void Audioneex::Matcher::ProcessBatch(const std::vector<Matcher*> &matchers,
+                                      const std::vector<const lf_vector*> &lfs,
+                                      std::vector<int> &processed)
+{
+    if(matchers.size() != lfs.size())
+       throw Audioneex::InvalidParameterException
+             ("The number of LF streams doesn't match the number of matchers.");
+
+    processed.assign(matchers.size(), 0);
+
+    if(matchers.empty())
+       return;
+
+    for(size_t i=0; i<matchers.size(); i++)
+    {
+        Matcher &m = *matchers[i];
+
+        // Check whether we have valid data store
+        if(m.m_DataStore == nullptr)
+           throw Audioneex::InvalidParameterException
+                 ("No data provider set.");
+
+        // The searches are shared, so they must be performed on the same index
+        if(m.m_DataStore != matchers[0]->m_DataStore ||
+           m.m_MatchType != matchers[0]->m_MatchType)
+           throw Audioneex::InvalidParameterException
+                 ("Batched matchers must use the same data store and match type.");
+
+        if(!lfs[i]->empty())
+           m.AppendQuery(*lfs[i]);
+    }
+
+    std::vector<Matcher*> batch;
+    std::vector<int> Nlf;
+
+    // Perform the pending steps of all the matchers in lockstep, batching
+    // the steps performed at the same time.
+    for(;;)
+    {
+        batch.clear();
+        Nlf.clear();
+
+        for(size_t i=0; i<matchers.size(); i++)
+        {
+            Matcher &m = *matchers[i];
+
+            if(m.Xk.size() - m.m_ko >= Pms::Nk){
+               batch.push_back(&m);
+               Nlf.push_back(Pms::Nk);
+               processed[i] += Pms::Nk;
+            }
+        }
+
+        if(batch.empty())
+           break;
+
+        MatchBatch(batch, Nlf);
+    }
+
+    for(Matcher* m : matchers)
+        m->TrimQuery();
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::FlushBatch(const std::vector<Matcher*> &matchers,
+                                    std::vector<int> &flushed)
+{
+    flushed.assign(matchers.size(), 0);
+
+    std::vector<Matcher*> batch;
+    std::vector<int> Nlf;
+
+    for(size_t i=0; i<matchers.size(); i++)
+    {
+        Matcher &m = *matchers[i];
+
+        if(m.m_DataStore == nullptr)
+           throw Audioneex::InvalidParameterException
+                 ("No data provider set.");
+
+        if(m.m_DataStore != matchers[0]->m_DataStore ||
+           m.m_MatchType != matchers[0]->m_MatchType)
+           throw Audioneex::InvalidParameterException
+                 ("Batched matchers must use the same data store and match type.");
+
+        // Sequences that are invalid or too short are not flushed (see Flush())
+        int n = m.Xk.size() - m.m_ko;
+
+        if(m.ValidQuerySequence() && n >= 2){
+           batch.push_back(&m);
+           Nlf.push_back(n);
+           flushed[i] = n;
+        }
+    }
+
+    if(batch.empty())
+       return;
+
+    MatchBatch(batch, Nlf);
+
+    for(Matcher* m : batch)
+        m->TrimQuery();
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::MatchBatch(const std::vector<Matcher*> &batch,
+                                    const std::vector<int> &Nlf)
+{
+    // Perform a matching step of each matcher on its next Nlf query LFs.
+    // The candidates search of all the steps is done at once.
+
+    if(batch.size() == 1)
+    {
+       Matcher &m = *batch[0];
+       m.DoMatch(m.m_ko, m.m_ko + Nlf[0]);
+    }
+    else
+    {
+       for(size_t i=0; i<batch.size(); i++)
+           batch[i]->BeginMatch(batch[i]->m_ko, batch[i]->m_ko + Nlf[i]);
+
+       {
+          // The search is shared, so its time goes to the lead matcher
+          STATS_HERE( Stats::WallTimer timer (batch.front()->m_Stats.SearchTime); )
+          FindCandidatesBatch(batch);
+       }
+
+       for(Matcher* m : batch)
+           m->EndMatch();
+    }
+
+    // Advance to next batch
+    for(size_t i=0; i<batch.size(); i++)
+    {
+        Matcher &m = *batch[i];
+        m.m_ko_T = m.Xk[m.m_ko + Nlf[i] - 1].T;
+        m.m_ko += Nlf[i];
+        m.m_Nsteps++;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
 bool Audioneex::Matcher::ValidQuerySequence()
 {
-    // The LFs in the query sequence must have sequential IDs starting from 0
-    for(size_t k=0; k<m_XkSeq.size(); k++)
-        if(m_XkSeq[k] != k)
-           return false;
+    // The IDs are checked as the LFs are received (see Process())
+    return m_XkValid;
+}
 
-    return true;
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::TrimQuery()
+{
+    // Discard the LFs that have already been matched, but those that fall
+    // in the t-f neighborhoods of the LFs still to be matched (see
+    // GraphMatching()), so the query doesn't grow with the audio length.
+    int Ntrim = m_ko - Pms::Ntf/2;
+
+    if(Ntrim <= 0)
+       return;
+
+    Xk.erase(Xk.begin(), Xk.begin() + Ntrim);
+    m_ko -= Ntrim;
 }
 
 // ----------------------------------------------------------------------------
 
 void Audioneex::Matcher::Reset()
 {
-    Xk.clear();
-    m_XkSeq.clear();
-    m_TopKMc.clear();
+    m_StepScores.clear();
+
+    // Release the matching buffers (they're reallocated on demand)
+    std::vector<QLocalFingerprint_t>().swap(Xk);
+    std::vector<std::pair<int, uint32_t> >().swap(m_TermPositions);
+    m_TopKMc   = hashtable_Qcand();
+    m_FPSizes  = hashtable_FPSize();
+    m_TermPlan = QueryTermPlan_t();
+    m_H        = Qhisto_t();
+    m_Search   = SearchCtx_t();
+    m_PartH.clear();
+    m_PartTopK.clear();
+    m_PartSearch.clear();
+    m_RerankCtx.clear();
 
     m_Results = MatchResults_t();
     m_ko      = 0;
     m_ko_T    = 0;
     m_Nsteps  = 0;
+    m_XkCount = 0;
+    m_XkValid = true;
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::SetScoreWindow(float seconds)
+{
+    if(seconds < 0)
+       throw Audioneex::InvalidParameterException
+             ("Invalid score window. Must be >= 0");
+
+    m_ScoreWindow = seconds;
+    m_StepScores.clear();
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::SetTermRatio(float ratio)
+{
+    if(ratio <= 0 || ratio > 1)
+       throw Audioneex::InvalidParameterException
+             ("Invalid term ratio. Must be in (0,1]");
+
+    m_TermRatio = ratio;
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::AccumulateScore(int Qi, int score)
+{
+    m_Results.Qc[Qi].Ac += score;
+
+    if(m_ScoreWindow > 0)
+       m_StepScores.back().Scores.emplace_back(Qi, score);
+}
+
+// ----------------------------------------------------------------------------
+
+bool Audioneex::Matcher::ExpireScores()
+{
+    // Take back the scores added in the steps that fell out of the window.
+    // The candidates left with no score are removed, so the results only
+    // hold the candidates found in the window.
+
+    bool expired = false;
+
+    int Tlast = m_StepScores.back().T;
+    int Twin  = m_ScoreWindow / Pms::dt;
+
+    while(m_StepScores.size() > 1 && Tlast - m_StepScores.front().T >= Twin)
+    {
+        for(const std::pair<int,int> &e : m_StepScores.front().Scores)
+        {
+            hashtable_Qc::iterator it = m_Results.Qc.find(e.first);
+
+            if(it != m_Results.Qc.end() && (it->second.Ac -= e.second) <= 0)
+               m_Results.Qc.erase(it);
+        }
+
+        m_StepScores.pop_front();
+        expired = true;
+    }
+
+    return expired;
 }
 
 // ----------------------------------------------------------------------------
 
 void Audioneex::Matcher::SetMaxRecordingDuration(size_t duration)
 {
-    size_t H_size =  duration / (Pms::dt * Pms::Tk);
-    m_H.Resize(H_size);
+    m_HSize =  duration / (Pms::dt * Pms::Tk);
+
+    if(!m_H.Ht.empty())
+       m_H.Resize(m_HSize);
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::SetThreads(size_t nthreads)
+{
+    if(nthreads == 0)
+       throw Audioneex::InvalidParameterException
+             ("Invalid number of threads. Must be > 0");
+
+    if(nthreads == GetThreads())
+       return;
+
+    m_Workers.reset( nthreads > 1 ? new WorkerPool(nthreads) : nullptr );
+
+    m_PartH.clear();
+    m_PartTopK.clear();
+    m_PartSearch.clear();
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::SetMinSearchPartition(uint32_t nfids)
+{
+    if(nfids == 0)
+       throw Audioneex::InvalidParameterException
+             ("Invalid search partition. Must be > 0");
+
+    m_MinSearchPartition = nfids;
 }
 
 // ----------------------------------------------------------------------------
@@ -161,6 +576,7 @@ void Audioneex::Matcher::SetMaxRecordingDuration(size_t duration)
 void Audioneex::Matcher::SetDataStore(DataStore* dstore)
 {
     m_DataStore = dstore;
+    m_FPSizes.clear();
 
     // Check whether we have valid data store
     if(m_DataStore == nullptr)
@@ -176,517 +592,1292 @@ void Audioneex::Matcher::SetDataStore(DataStore* dstore)
           throw Audioneex::InvalidAudioCodesException
                 ("Couldn't get audio codes.");
     }
-}
+}
+
+
+// ----------------------------------------------------------------------------
+
+size_t Audioneex::Matcher::GetMemoryUsage() const
+{
+    size_t bytes = sizeof(Matcher);
+
+    bytes += VectorBytes(Xk);
+    bytes += HistoBytes(m_H);
+    bytes += TopKBytes(m_TopKMc);
+    bytes += HashtableBytes(m_Results.Qc);
+    bytes += m_Results.Top_K.size() * (sizeof(hashtable_Qi::value_type) + 4 * sizeof(void*));
+    bytes += VectorBytes(m_TermPlan.Terms) + VectorBytes(m_TermPlan.Entries);
+    bytes += VectorBytes(m_TermPositions);
+    bytes += HashtableBytes(m_FPSizes);
+
+    for(const Qhisto_t &H : m_PartH)
+        bytes += HistoBytes(H);
+
+    for(const hashtable_Qcand &TopK : m_PartTopK)
+        bytes += TopKBytes(TopK);
+
+    bytes += PListBuffersBytes(m_Search.Buffers);
+
+    for(const SearchCtx_t &ctx : m_PartSearch)
+        bytes += PListBuffersBytes(ctx.Buffers);
+
+    for(const RerankCtx_t &ctx : m_RerankCtx){
+        bytes += sizeof(RerankCtx_t) + HistoBytes(ctx.Hr);
+        bytes += VectorBytes(ctx.Gq) + VectorBytes(ctx.Qh) + VectorBytes(ctx.Sh);
+        bytes += HashtableBytes(ctx.Gx);
+        for(const hashtable_graphs::value_type &g : ctx.Gx)
+            bytes += VectorBytes(g.second);
+    }
+
+    for(const StepScores_t &step : m_StepScores)
+        bytes += sizeof(StepScores_t) + VectorBytes(step.Scores);
+
+    return bytes;
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::DoMatch(int ko, int kn)
+{
+    BeginMatch(ko, kn);
+
+    // Search the Database for candidate Qi's similar to the current query LFs.
+    // Steps starting past the deadline are skipped.
+
+    if(!OutOfTime())
+    {
+       STATS_HERE( Stats::WallTimer timer (m_Stats.SearchTime); )
+
+       if(m_Workers)
+          FindCandidatesParallel(m_TermPlan);
+       else
+       {
+          CreatePListIterators(m_TermPlan, 1, m_Search, SerialStoreLock());
+          FindCandidates(m_TermPlan, 1, FID_MAX, m_H, m_TopKMc, m_Search,
+                         SerialStoreLock());
+       }
+    }
+
+    EndMatch();
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::BeginMatch(int ko, int kn)
+{
+    if(m_H.Ht.empty())
+       m_H.Resize(m_HSize);
+
+    STATS_HERE( m_Stats.Steps++; )
+
+    // Keep track of the scores added in this step if they're windowed
+    if(m_ScoreWindow > 0){
+       m_StepScores.emplace_back();
+       m_StepScores.back().T = Xk[kn-1].T;
+    }
+
+    m_StepDeadline = m_Deadline;
+    m_StepTruncated = false;
+
+    if(m_StepBudget > 0)
+       m_StepDeadline = std::min(m_StepDeadline, clock::now() +
+                                 std::chrono::microseconds(m_StepBudget));
+
+    BuildTermPlan(ko, kn, m_TermPlan);
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::EndMatch()
+{
+    TEST_HERE( TEST.Dump(m_TopKMc); )
+
+    // Here we would evaluate the confidence and decide whether to perform
+    // the reranking based on the confidence score
+
+    // The adaptive algorithm used is a simple threshold-based
+    // classification around a confidence value computed from
+    // the current top-k list: if there is a clear evidence of
+    // a match (confidence >= threshold) the decision is not
+    // to perform reranking, otherwise reranking is applied.
+
+    bool updated = !m_TopKMc.empty();
+
+    if(updated)
+    {
+        // Get top 2 results
+        hashtable_Qcand::iterator it = m_TopKMc.begin();
+
+        float top1 = it->first;
+        float top2 = m_TopKMc.size() > 1 ? (++it)->first : 0;
+        float conf = (2.f * top1) / (top1 + top2) - 1.f;
+
+        assert(0<=conf && conf<=1);
+
+        if(conf <= m_RerankThreshold)
+        {
+           TEST_HERE( DEBUG_MSG("Performing reranking: conf="<<conf) )
+           STATS_HERE( Stats::WallTimer timer (m_Stats.RerankTime); )
+           Reranking();
+           m_Results.Reranked = true;
+        }
+        else
+        {
+           for(auto &e : m_TopKMc)
+           {
+               std::vector<Qcand_t> &tlist = e.second;
+               
+               for(Qcand_t &C : tlist)
+               {
+                    AccumulateScore(C.Qi, C.score);
+                    m_Results.Qc[C.Qi].Tmatch = (Pms::Tk * C.Bmax + Pms::Tk / 2) * Pms::dt;
+               }
+           }
+           m_Results.Reranked = false;
+        }
+
+        m_TopKMc.clear();
+    }
+
+    if(m_StepTruncated)
+       m_Results.Truncated = true;
+
+    // Drop the scores that fell out of the window, if any
+    if(m_ScoreWindow > 0 && ExpireScores())
+       updated = true;
+
+    if(updated)
+    {
+        // Update the final top-k list
+
+        m_Results.Top_K.clear();
+
+        for(auto &e : m_Results.Qc)
+        {
+            int Qi = e.first;
+            int score = e.second.Ac;
+            m_Results.Top_K[score].push_back(Qi);
+           
+            if(m_Results.Top_K.size() > Pms::TopK)
+               m_Results.Top_K.erase(--(m_Results.Top_K.end()) );
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::Reranking()
+{
+    // Collect the candidates in top-k order. The reranking results are
+    // reduced in this order, so they do not depend on the scheduling.
+
+    std::vector<const Qcand_t*> cands;
+
+    for(hashtable_Qcand::value_type &e : m_TopKMc)
+        for(const Qcand_t &C : e.second)
+            cands.push_back(&C);
+
+    std::vector<Rerank_t> results (cands.size());
+
+    // Get the sizes of the candidate fingerprints beforehand, so that the
+    // workers do not need to query the data store for them.
+    std::vector<size_t> fp_sizes (cands.size(), 0);
+
+    for(size_t i=0; i<cands.size(); i++)
+        if(!cands[i]->Peaks.empty())
+           fp_sizes[i] = GetFingerprintSize(cands[i]->Qi);
+
+    size_t Nw = m_Workers ? m_Workers->Size() : 1;
+
+    if(m_RerankCtx.size() != Nw)
+       m_RerankCtx.resize(Nw);
+
+    for(RerankCtx_t &ctx : m_RerankCtx)
+    {
+        if(ctx.Hr.Ht.size() != m_H.Ht.size())
+           ctx.Hr.Resize(m_H.Ht.size());
+
+        // The query graphs are only valid within the current step
+        ctx.Gx.clear();
+    }
+
+    // The candidates are independent from each other, so they can be
+    // reranked concurrently, each worker using its own scratch data.
+
+    if(Nw > 1 && cands.size() > 1)
+    {
+        std::mutex *lock = StoreLock();
+        std::atomic<size_t> next (0);
+        std::vector<std::future<void> > tasks;
+
+        for(size_t w=0; w<Nw; w++)
+        {
+            tasks.push_back( m_Workers->Submit([this, w, lock, &next, &cands, &fp_sizes, &results]{
+                for(size_t i=next++; i<cands.size() && !OutOfTime(); i=next++)
+                    RerankCandidate(*cands[i], fp_sizes[i], m_RerankCtx[w], results[i], lock);
+            }));
+        }
+
+        WorkerPool::Wait(tasks);
+    }
+    else
+    {
+        for(size_t i=0; i<cands.size() && !OutOfTime(); i++)
+            RerankCandidate(*cands[i], fp_sizes[i], m_RerankCtx[0], results[i], SerialStoreLock());
+    }
+
+    STATS_HERE(
+        for(RerankCtx_t &ctx : m_RerankCtx){
+            m_Stats += ctx.Stats;
+            ctx.Stats = MatchStats_t();
+        }
+    )
+
+    for(size_t i=0; i<cands.size(); i++)
+    {
+        const Rerank_t &res = results[i];
+
+        // Update Qi score in candidates set (or insert it if doesn't exist)
+        if(res.Ac > 0)
+           AccumulateScore(cands[i]->Qi, res.Ac);
+
+        // Give an estimate of the match time point within the recording by
+        // a fixed linear interpolation at the bin centre. The time point is
+        // supposed to be within the time bin with the max score.
+        if(res.TopBinScore > 0)
+           m_Results.Qc[cands[i]->Qi].Tmatch = (Pms::Tk * res.TopBin + Pms::Tk / 2) * Pms::dt;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::RerankCandidate(const Qcand_t &C,
+                                         size_t fp_size,
+                                         RerankCtx_t &ctx,
+                                         Rerank_t &res,
+                                         std::mutex *lock)
+{
+    Qhisto_t &Hr = ctx.Hr;
+
+    // perform t-f coherence matching on Qi's peak bins
+    for(const Qcand_t::Peak_t &peak : C.Peaks)
+    {
+        GraphMatching(C.Qi, fp_size, peak, ctx, lock);
+
+        if(Hr.Ht[Hr.Bmax].score > 0)
+           res.Ac += Hr.Ht[Hr.Bmax].score;
+
+        if(Hr.Ht[Hr.Bmax].score > res.TopBinScore){
+           res.TopBinScore = Hr.Ht[Hr.Bmax].score;
+           res.TopBin = Hr.Bmax;
+        }
+        Hr.Reset();
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::UpdateTopK(const Qhisto_t &H, hashtable_Qcand &TopK)
+{
+    int maxScore = H[H.Bmax].score;
+
+    // Skip scores that are too low
+    if(maxScore <= MIN_ACCEPT_SCORE)
+       return;
+
+    // Skip candidates that would be evicted right away because the list is
+    // full and their score is lower than the lowest one in the list.
+    if(TopK.size() >= Pms::TopK && maxScore < TopK.rbegin()->first)
+       return;
+
+    // If the tie lists get too big it may impact performances
+    // so as a provisional solution we simply truncate them at
+    // a predefined length. A better solution would be to find
+    // a method that strongly disambiguates the candidates.
+
+    hashtable_Qcand::iterator it = TopK.find(maxScore);
+
+    if(it != TopK.end() && it->second.size() >= MAX_TIE_LIST)
+       return;
+
+    std::vector<Qcand_t> &tlist = TopK[maxScore];
+    tlist.emplace_back();
+    SummarizeHisto(H, tlist.back());
+
+    if(TopK.size() > Pms::TopK)
+       TopK.erase(--(TopK.end()) );
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::MergeTopK(hashtable_Qcand &TopK)
+{
+    // Merge the given top-k list into the main one using the same rules
+    // as in UpdateTopK(). If the lists are merged in increasing order of
+    // FID ranges the result is the same as that of a single search over
+    // the whole range.
+
+    for(hashtable_Qcand::value_type &e : TopK)
+    {
+        int score = e.first;
+
+        if(m_TopKMc.size() >= Pms::TopK && score < m_TopKMc.rbegin()->first)
+           break;
+
+        std::vector<Qcand_t> &tlist = m_TopKMc[score];
+
+        for(Qcand_t &C : e.second)
+            if(tlist.size() < MAX_TIE_LIST)
+               tlist.push_back(std::move(C));
+
+        if(m_TopKMc.size() > Pms::TopK)
+           m_TopKMc.erase(--(m_TopKMc.end()) );
+    }
+
+    TopK.clear();
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::BuildTermPlan(int ko, int kn, QueryTermPlan_t &plan)
+{
+    // Compute the terms of the query LFs in [ko,kn) once per step, so that
+    // the DaaT loop in FindCandidates*() only has to walk through the plan.
+
+    plan.Clear();
+
+    // Query positions <term,k> in the order they are scored
+    std::vector<std::pair<int, uint32_t> > &positions = m_TermPositions;
+
+    positions.clear();
+
+    if(m_MatchType == MSCALE_MATCH)
+    {
+        for(int k=ko; k<kn; k++)
+        {
+            // Create term <word|channel>
+            int chan = (Xk[k].F - Pms::Kmin + 1) / Pms::qF;
+            positions.emplace_back( (Xk[k].W << 6) | chan, k );
+        }
+    }
+    else
+    {
+        // We cannot process streams shorter than 2 LFs
+        if(kn - ko < 2) return;
+
+        for(int k=ko; k<kn; k++)
+        {
+            int Wpivot = Xk[k].W;
+            int Bpivot = Xk[k].F / IndexerImpl::qB;
+
+            // Compute bi-terms
+            for(size_t j=k+1, dN=0; dN<IndexerImpl::Dmax && j<Xk.size(); j++)
+            {
+                int dt = Xk[j].T - Xk[k].T;
+                assert(dt>=0);
+                if(dt > static_cast<int>(IndexerImpl::Tmax))
+                    break;
+
+                int Bpair = Xk[j].F / IndexerImpl::qB;
+
+                // If the LF is in the same band as pivot's do pairing
+                if(Bpair == Bpivot)
+                {
+                   int W2  = Xk[j].W;
+                   int Vpt = Xk[j].T / Pms::qT - Xk[k].T / Pms::qT;
+                   int Vpf = Xk[j].F / Pms::qF - Xk[k].F / Pms::qF;
+
+                   assert(0 <= Wpivot && Wpivot <= Pms::Kmed);
+                   assert(0 <= W2 && W2 <= Pms::Kmed);
+                   assert(0 <= Vpt && Vpt <= IndexerImpl::Vpt_max);
+                   assert(0 <= abs(Vpf) && abs(Vpf) <=  IndexerImpl::Vpf_max);
+
+                   int term = Wpivot << IndexerImpl::W1_SHIFT |
+                              Bpivot << IndexerImpl::B_SHIFT |
+                              W2 << IndexerImpl::W2_SHIFT |
+                              Vpt << IndexerImpl::VPT_SHIFT |
+                              (Vpf & 0x3F);
+
+                   positions.emplace_back(term, k);
+                   dN++;
+                }
+            }
+        }
+    }
+
+    // Distinct terms. Each one gets the iterator slot with the same index.
+    for(const std::pair<int, uint32_t> &pos : positions)
+        plan.Terms.push_back(pos.first);
+
+    std::sort(plan.Terms.begin(), plan.Terms.end());
+    plan.Terms.erase(std::unique(plan.Terms.begin(), plan.Terms.end()), plan.Terms.end());
+
+    // Keep the first position of each term only. Once a term has been scored
+    // for a fingerprint its iterator has moved past it, so the following
+    // positions would never score.
+    std::vector<bool> visited (plan.Terms.size(), false);
+
+    for(const std::pair<int, uint32_t> &pos : positions)
+    {
+        uint32_t slot = std::lower_bound(plan.Terms.begin(), plan.Terms.end(),
+                                         pos.first) - plan.Terms.begin();
+        if(!visited[slot]){
+           visited[slot] = true;
+           plan.Entries.push_back({pos.second, slot});
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+bool Audioneex::Matcher::OutOfTime()
+{
+    if(m_StepDeadline == clock::time_point::max() ||
+       clock::now() < m_StepDeadline)
+       return false;
+
+    m_StepTruncated = true;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t Audioneex::Matcher::DropTerms(const plist_iterators &iterators,
+                                     std::vector<bool> &EOL_iterators)
+{
+    // Stop scanning the longer half of the lists still being scanned, so
+    // that the scan winds down in a few more checks on the most selective
+    // terms. The lists are ranked by their headers, which have been read
+    // along with their first blocks, as in SelectTerms(). Return the number
+    // of dropped lists.
+
+    std::vector<std::tuple<uint32_t, uint32_t, uint32_t> > costs;
+
+    for(uint32_t slot=0; slot<iterators.size(); slot++)
+    {
+        if(!EOL_iterators[slot]){
+           const PListHeader &lhdr = iterators[slot]->header();
+           costs.emplace_back(lhdr.Occurrences, lhdr.DocFrequency, slot);
+        }
+    }
+
+    size_t ndrop = (costs.size() + 1) / 2;
+
+    std::sort(costs.begin(), costs.end());
+
+    for(size_t i=costs.size()-ndrop; i<costs.size(); i++)
+        EOL_iterators[std::get<2>(costs[i])] = true;
+
+    return ndrop;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t Audioneex::Matcher::SelectTerms(const plist_iterators &iterators,
+                                       std::vector<bool> &EOL_iterators) const
+{
+    // Rank the terms by the number of occurrences in their lists, which is
+    // what scanning them costs, and leave out the most costly ones beyond
+    // the set fraction (see SetTermRatio()). The lists' headers have been
+    // read along with their first blocks. Return the number of dropped terms.
+
+    std::vector<std::tuple<uint32_t, uint32_t, uint32_t> > costs;
+
+    for(uint32_t slot=0; slot<iterators.size(); slot++)
+    {
+        const PListHeader &lhdr = iterators[slot]->header();
+
+        // Missing and stop terms are not searched anyway
+        if(!IsNull(lhdr) && !(lhdr.Flags & PLIST_STOP_TERM))
+           costs.emplace_back(lhdr.Occurrences, lhdr.DocFrequency, slot);
+    }
+
+    size_t nkeep = std::ceil(costs.size() * m_TermRatio);
+
+    if(nkeep >= costs.size())
+       return 0;
+
+    std::sort(costs.begin(), costs.end());
+
+    for(size_t i=nkeep; i<costs.size(); i++)
+        EOL_iterators[std::get<2>(costs[i])] = true;
+
+    return costs.size() - nkeep;
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::FindCandidates(const QueryTermPlan_t &plan,
+                                        uint32_t FIDlo, uint32_t FIDhi,
+                                        Qhisto_t &H, hashtable_Qcand &TopK,
+                                        SearchCtx_t &ctx,
+                                        std::mutex *lock)
+{
+    // The iterators have been created for the range by the caller
+    // (see CreatePListIterators()).
+    if(m_MatchType == MSCALE_MATCH)
+       FindCandidatesSWords(plan, FIDlo, FIDhi, H, TopK, ctx, lock);
+    else if(m_MatchType == XSCALE_MATCH)
+       FindCandidatesBWords(plan, FIDlo, FIDhi, H, TopK, ctx, lock);
+    else
+       throw Audioneex::InvalidParameterException
+             ("Invalid matching algorithm");
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::CreatePListIterators(const QueryTermPlan_t &plan, uint32_t FIDlo,
+                                              SearchCtx_t &ctx,
+                                              std::mutex *lock)
+{
+    // Create the iterators for all the query terms up front and read their
+    // first blocks, along with the lists' headers, in one batch, so that a
+    // remote data store is accessed once rather than once per term. The
+    // iterators use the context's buffers, which are only grown, so no
+    // blocks are allocated in the steady state.
+
+    plist_iterators &iterators = ctx.Iterators;
+    std::vector<DataStoreImpl::PListIterator*> &batch = ctx.Batch;
+
+    iterators.clear();
+    batch.clear();
+
+    if(ctx.Buffers.size() < plan.Terms.size())
+       ctx.Buffers.resize(plan.Terms.size());
+
+    iterators.resize(plan.Terms.size());
+
+    for(size_t i=0; i<plan.Terms.size(); i++){
+        iterators[i].reset(DataStoreImpl::GetPListIterator(m_DataStore, plan.Terms[i],
+                                                           lock, &ctx.Buffers[i]));
+        batch.push_back(iterators[i].get());
+    }
+
+    DataStoreImpl::PrefetchPListBlocks(m_DataStore, batch.data(), batch.size(), FID_MAX, lock);
+
+    // The stop terms are pruned from the index and their lists ignored, so
+    // that their evidence is missing for all the fingerprints alike (see
+    // Indexer::SetStopTermLimit()).
+    for(DataStoreImpl::PListIterator* it : batch)
+        if(it->header().Flags & PLIST_STOP_TERM)
+           it->close();
+
+    if(FIDlo > 1)
+       for(DataStoreImpl::PListIterator* it : batch)
+           it->seek(FIDlo);
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::AddSearchStats(const plist_iterators &iterators,
+                                        const DataStoreImpl::PListIterator *bins_it,
+                                        uint64_t FIDs)
+{
+    // Collect the counters of a search's iterators once it's done. The
+    // partitions of a parallel search may end at the same time.
+    MatchStats_t stats;
+
+    stats.FIDsScored = FIDs;
+
+    for(const std::unique_ptr<DataStoreImpl::PListIterator> &it : iterators){
+        stats.BlocksFetched   += it->blocksFetched();
+        stats.BytesDecoded    += it->bytesDecoded();
+        stats.PostingsScanned += it->postingsScanned();
+    }
+
+    if(bins_it){
+       stats.BlocksFetched   += bins_it->blocksFetched();
+       stats.BytesDecoded    += bins_it->bytesDecoded();
+       stats.PostingsScanned += bins_it->postingsScanned();
+    }
+
+    std::lock_guard<std::mutex> lock (m_StatsLock);
+    m_Stats += stats;
+}
+
+// ----------------------------------------------------------------------------
+
+int Audioneex::Matcher::GetTimeBin(std::unique_ptr<DataStoreImpl::PListIterator> &bins_it,
+                                   uint32_t FID, int LID, int &T, std::mutex *lock)
+{
+    // Get the time bin of an LF indexed with slim postings from the time bins
+    // list, which holds the first LF of each bin for every fingerprint (see
+    // IndexerImpl::IndexTimeBins()). The FIDs are visited in increasing order,
+    // so one iterator moving forward is enough.
+    // The LF's time is estimated by spreading the LFs of its bin evenly over
+    // the bin, so that the time order is scored in frames as with the full
+    // postings. The number of LFs in the last bin is not known, so the one of
+    // the previous bin is used.
+
+    if(!bins_it)
+       bins_it.reset(DataStoreImpl::GetPListIterator(m_DataStore,
+                        IndexerImpl::GetTimeBinsListID(m_MatchType), lock));
+
+    bins_it->seek(FID);
+
+    DataStoreImpl::Posting_t& bins = bins_it->get();
+
+    if(bins.empty() || bins.FID != FID)
+       throw Audioneex::InvalidIndexDataException
+            ("No time bins for fingerprint " + Utils::ToString(FID));
+
+    const uint32_t* first = std::upper_bound(bins.LID, bins.LID + bins.tf,
+                                             static_cast<uint32_t>(LID));
+
+    if(first == bins.LID){
+       T = LID;
+       return 0;
+    }
+
+    size_t i = first - bins.LID - 1;
+
+    int nlfs = i+1 < bins.tf ? bins.LID[i+1] - bins.LID[i] :
+               i > 0         ? bins.LID[i] - bins.LID[i-1] : Pms::Tk;
+
+    int offset = LID - static_cast<int>(bins.LID[i]);
+
+    T = static_cast<int>(bins.T[i]) * Pms::Tk + offset * Pms::Tk / nlfs;
+
+    return bins.T[i];
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::FindCandidatesParallel(const QueryTermPlan_t &plan)
+{
+    // Accesses to the data store are serialized unless it is reentrant.
+    std::mutex *lock = StoreLock();
+
+    // Create the iterators of the 1st partition, which starts at the lists'
+    // heads, and find the FID range spanned by the lists from their headers,
+    // which have been read along with the first blocks. If a header could not
+    // be read (e.g. oversized blocks, see PrefetchPListBlocks()) the ranges
+    // are only less balanced, as the last one extends to FID_MAX.
+
+    CreatePListIterators(plan, 1, m_Search, lock);
+
+    uint32_t FIDmax = 0;
+
+    for(const std::unique_ptr<DataStoreImpl::PListIterator> &it : m_Search.Iterators)
+        FIDmax = std::max(FIDmax, it->header().FIDmax);
+
+    uint32_t Np = m_Workers->Size();
+    uint32_t span = FIDmax / Np + (FIDmax % Np ? 1 : 0);
+
+    // The catalogue is too small to be worth partitioning
+    if(span < m_MinSearchPartition){
+       FindCandidates(plan, 1, FID_MAX, m_H, m_TopKMc, m_Search, lock);
+       return;
+    }
+
+    if(m_PartH.size() != Np){
+       m_PartH.assign(Np, Qhisto_t(m_H.Ht.size()));
+       m_PartTopK.resize(Np);
+       m_PartSearch.resize(Np);
+    }
+
+    // Search each FID range on a worker thread with its own histogram,
+    // top-k list and iterators.
+
+    std::vector<std::future<void> > tasks;
+
+    for(uint32_t p=0; p<Np; p++)
+    {
+        uint32_t FIDlo = p * span + 1;
+        uint32_t FIDhi = (p == Np-1) ? FID_MAX : FIDlo + span - 1;
+
+        tasks.push_back( m_Workers->Submit([this, &plan, FIDlo, FIDhi, p, lock]{
+            SearchCtx_t &ctx = p ? m_PartSearch[p] : m_Search;
+            if(p)
+               CreatePListIterators(plan, FIDlo, ctx, lock);
+            FindCandidates(plan, FIDlo, FIDhi, m_PartH[p], m_PartTopK[p], ctx, lock);
+        }));
+    }
+
+    WorkerPool::Wait(tasks);
+
+    // Merge the partial top-k lists in FID order, so the result is
+    // deterministic and identical to a serial search.
+    for(hashtable_Qcand &TopK : m_PartTopK)
+        MergeTopK(TopK);
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::FindCandidatesBatch(const std::vector<Matcher*> &batch)
+{
+    // Search the candidates of the current steps of all the matchers in the
+    // batch at once. The query terms are merged into one plan, so each
+    // postings list is read once, and the postings of each fingerprint are
+    // scattered into the histograms of the queries they occur in. Within a
+    // query the terms are scored in the same order as in FindCandidates(),
+    // so the results are the same as those of separate searches.
+
+    Matcher &lead = *batch.front();
+
+    void (Matcher::*ScorePosting)(const DataStoreImpl::Posting_t&, size_t, Qhisto_t&,
+                                  std::unique_ptr<DataStoreImpl::PListIterator>&,
+                                  std::mutex*);
+
+    if(lead.m_MatchType == MSCALE_MATCH)
+       ScorePosting = &Matcher::ScorePostingSWords;
+    else if(lead.m_MatchType == XSCALE_MATCH)
+       ScorePosting = &Matcher::ScorePostingBWords;
+    else
+       throw Audioneex::InvalidParameterException
+             ("Invalid matching algorithm");
+
+    // A query position in the batch: the query, the entry in its plan and
+    // the slot of its term in the combined plan.
+    struct BatchEntry_t
+    {
+        uint32_t q;
+        uint32_t e;
+        uint32_t slot;
+
+        bool operator<(const BatchEntry_t &entry) const {
+            return q < entry.q || (q == entry.q && e < entry.e);
+        }
+    };
+
+    QueryTermPlan_t plan;
+
+    for(Matcher* m : batch)
+        plan.Terms.insert(plan.Terms.end(), m->m_TermPlan.Terms.begin(),
+                                            m->m_TermPlan.Terms.end());
+
+    std::sort(plan.Terms.begin(), plan.Terms.end());
+    plan.Terms.erase(std::unique(plan.Terms.begin(), plan.Terms.end()), plan.Terms.end());
+
+    // No terms for these queries
+    if(plan.Terms.empty()) return;
+
+    // Query positions grouped by combined slot (CSR layout)
+    std::vector<uint32_t> offsets (plan.Terms.size() + 1, 0);
+    std::vector<BatchEntry_t> entries;
+
+    for(uint32_t q=0; q<batch.size(); q++)
+    {
+        const QueryTermPlan_t &qplan = batch[q]->m_TermPlan;
+
+        for(uint32_t e=0; e<qplan.Entries.size(); e++)
+        {
+            int term = qplan.Terms[qplan.Entries[e].slot];
+            uint32_t slot = std::lower_bound(plan.Terms.begin(), plan.Terms.end(),
+                                             term) - plan.Terms.begin();
+            entries.push_back({q, e, slot});
+            offsets[slot + 1]++;
+        }
+    }
 
+    for(size_t s=1; s<offsets.size(); s++)
+        offsets[s] += offsets[s-1];
 
-// ----------------------------------------------------------------------------
+    std::vector<BatchEntry_t> slot_entries (entries.size());
+    std::vector<uint32_t> fill (offsets.begin(), offsets.end() - 1);
 
+    for(const BatchEntry_t &entry : entries)
+        slot_entries[fill[entry.slot]++] = entry;
 
-void Audioneex::Matcher::DoMatch(int ko, int kn)
-{
-    // Search the Database for candidate Qi's similar to the current query LFs.
+    std::mutex *lock = lead.SerialStoreLock();
 
-    if(m_MatchType == MSCALE_MATCH)
-       FindCandidatesSWords(ko,kn);
-    else if(m_MatchType == XSCALE_MATCH)
-       FindCandidatesBWords(ko,kn);
-    else
-       throw Audioneex::InvalidParameterException
-             ("Invalid matching algorithm");
-    
-    TEST_HERE( TEST.Dump(m_TopKMc); )
+    std::unique_ptr <DataStoreImpl::PListIterator> bins_it;
 
-    // Here we would evaluate the confidence and decide whether to perform
-    // the reranking based on the confidence score
+    lead.CreatePListIterators(plan, 1, lead.m_Search, lock);
 
-    // The adaptive algorithm used is a simple threshold-based
-    // classification around a confidence value computed from
-    // the current top-k list: if there is a clear evidence of
-    // a match (confidence >= threshold) the decision is not
-    // to perform reranking, otherwise reranking is applied.
+    std::vector<DataStoreImpl::PListIterator*> &pbatch = lead.m_Search.Batch;
 
-    if(!m_TopKMc.empty())
-    {
-        // Get top 2 results
-        hashtable_Qhisto::iterator it = m_TopKMc.begin();
+    // Query positions whose terms have postings for the current fingerprint
+    std::vector<BatchEntry_t> hits;
 
-        float top1 = it->first;
-        float top2 = m_TopKMc.size() > 1 ? (++it)->first : 0;
-        float conf = (2.f * top1) / (top1 + top2) - 1.f;
+    STATS_HERE( uint64_t FIDs = 0; )
 
-        assert(0<=conf && conf<=1);
+    // Score the fingerprints in DaaT fashion, skipping those that have
+    // no postings, until all the iterators reach EOL.
+    for(;;)
+    {
+        DataStoreImpl::PrefetchPListBlocks(lead.m_DataStore, pbatch.data(), pbatch.size(),
+                                           FID_MAX, lock);
 
-        if(conf <= m_RerankThreshold)
-        {
-           TEST_HERE( DEBUG_MSG("Performing reranking: conf="<<conf) )
-           Reranking();
-           m_Results.Reranked = true;
-        }
-        else
+        uint32_t FIDcurr = 0;
+
+        for(DataStoreImpl::PListIterator* it : pbatch)
         {
-           for(auto &e : m_TopKMc)
-           {
-               std::list<Qhisto_t> &tlist = e.second;
-               
-               for(Qhisto_t &H : tlist)
-               {
-                    Ac_t& Accum = m_Results.Qc[H.Qi];
-                    Accum.Ac += H.Ht[H.Bmax].score;
-                    Accum.Tmatch = (Pms::Tk * H.Bmax + Pms::Tk / 2) * Pms::dt;
-               }
-           }
-           m_Results.Reranked = false;
+            DataStoreImpl::Posting_t& post = it->get();
+
+            if(!post.empty() && (FIDcurr == 0 || post.FID < FIDcurr))
+               FIDcurr = post.FID;
         }
 
-        // Update the final top-k list
+        if(FIDcurr == 0)
+           break;
 
-        m_Results.Top_K.clear();
+        STATS_HERE( FIDs++; )
 
-        for(auto &e : m_Results.Qc)
+        hits.clear();
+
+        for(size_t s=0; s<pbatch.size(); s++)
+            if(pbatch[s]->get().FID == FIDcurr)
+               hits.insert(hits.end(), slot_entries.begin() + offsets[s],
+                                       slot_entries.begin() + offsets[s+1]);
+
+        // Visit the terms of each query in the order they occur in it
+        std::sort(hits.begin(), hits.end());
+
+        for(size_t h=0; h<hits.size(); h++)
         {
-            int Qi = e.first;
-            int score = e.second.Ac;
-            m_Results.Top_K[score].push_back(Qi);
-           
-            if(m_Results.Top_K.size() > Pms::TopK)
-               m_Results.Top_K.erase(--(m_Results.Top_K.end()) );
+            Matcher &m = *batch[hits[h].q];
+
+            uint32_t k = m.m_TermPlan.Entries[hits[h].e].k;
+
+            (m.*ScorePosting)(pbatch[hits[h].slot]->get(), k, m.m_H, bins_it, lock);
+
+            // Process the histogram of the query for current fingerprint
+            if(h+1 == hits.size() || hits[h+1].q != hits[h].q)
+            {
+               m.m_H.Qi = FIDcurr;
+               m.UpdateTopK(m.m_H, m.m_TopKMc);
+               m.m_H.Reset();
+            }
         }
 
-        m_TopKMc.clear();
+        for(DataStoreImpl::PListIterator* it : pbatch)
+            if(it->get().FID == FIDcurr)
+               it->next();
     }
+
+    STATS_HERE( lead.AddSearchStats(lead.m_Search.Iterators, bins_it.get(), FIDs); )
 }
 
 // ----------------------------------------------------------------------------
 
-void Audioneex::Matcher::Reranking()
+void Audioneex::Matcher::SummarizeHisto(const Qhisto_t &H, Qcand_t &C)
 {
-    Qhisto_t Hr (m_H.Ht.size());
-
-    for(hashtable_Qhisto::value_type &e : m_TopKMc)
-    {
-        // get list of Qi's with this score (tie list)
-        std::list<Qhisto_t> &tlist = e.second;
-
-        // perform t-f coherence matching on Qi's top bins
-        for(Qhisto_t &H : tlist)
-        {
-         // ============ Find top-n bins in Qi's histo ============
-
-         // The t-f matching is performed on the top-n bins in each of the
-         // top-k Time Histograms built in Time Clustering phase rather than
-         // on the top bin only. This will increase the discrimination power.
-
-         // Choosing a high value of n will test more bins in H, increasing the
-         // probability of correct match, but will also affect performances as
-         // it will require more access to the data store, so the right choice
-         // of n is a tradeoff between accuracy and speed.
-
-         // The approach used here is to select the top bins evenly distributed
-         // across the histogram by scanning it with a fixed size window. The
-         // number of bins selected using this method depends on the lenght of the
-         // recording and the time complexity is approx O(Nh/r) where Nh is the
-         // size of the histogram and r the window's radius.
-         // Alternatively we can select the top n bins regrdless of their distribution
-         // in the histogram, which will have a constant time complexity O(k=n).
+    C.Qi = H.Qi;
+    C.Bmax = H.Bmax;
+    C.score = H[H.Bmax].score;
 
-            int TopBin = 0,
-                TopBinScore = 0,
-                Ht_lbin = H.Ht.size() - 1;
+    // ============ Find top-n bins in Qi's histo ============
 
-            // Only process the used histogram bins
-            for(; Ht_lbin>=0 && H.Ht[Ht_lbin].score==0; Ht_lbin--);
+    // The t-f matching is performed on the top-n bins in each of the
+    // top-k Time Histograms built in Time Clustering phase rather than
+    // on the top bin only. This will increase the discrimination power.
 
-            for(size_t i=0; i<=Ht_lbin; i++)
-            {
-                int lb = i - 3;  //<-- interval radius
-                int rb = i + 3;
+    // Choosing a high value of n will test more bins in H, increasing the
+    // probability of correct match, but will also affect performances as
+    // it will require more access to the data store, so the right choice
+    // of n is a tradeoff between accuracy and speed.
 
-                if(lb<0) lb=0;
-                if(rb>Ht_lbin) rb=Ht_lbin;
+    // The approach used here is to select the top bins evenly distributed
+    // across the histogram by scanning it with a fixed size window. The
+    // number of bins selected using this method depends on the lenght of the
+    // recording and the time complexity is approx O(Nh/r) where Nh is the
+    // size of the histogram and r the window's radius.
+    // Alternatively we can select the top n bins regrdless of their distribution
+    // in the histogram, which will have a constant time complexity O(k=n).
 
-                bool ismax = true;
-                for(int j=lb; lb<rb && j<=rb; j++)
-                    if(H.Ht[j].score > H.Ht[i].score)
-                        ismax=false;
+    int Ht_lbin = H.Ht.size() - 1;
 
-                // If peak bin found
-                if(ismax && H.Ht[i].score > Matcher::MIN_ACCEPT_SCORE*1.5)
-                {
-                    // Perform T-F coherence on bin
-                    GraphMatching(H, i, Hr);
+    // Only process the used histogram bins
+    for(; Ht_lbin>=0 && H.Ht[Ht_lbin].score==0; Ht_lbin--);
 
-                    // Update Qi score in candidates set (or insert it if doesn't exist)
+    for(int i=0; i<=Ht_lbin; i++)
+    {
+        int lb = i - 3;  //<-- interval radius
+        int rb = i + 3;
 
-					if(Hr.Ht[Hr.Bmax].score > 0)
-                       m_Results.Qc[H.Qi].Ac += Hr.Ht[Hr.Bmax].score;
+        if(lb<0) lb=0;
+        if(rb>Ht_lbin) rb=Ht_lbin;
 
-                    if(Hr.Ht[Hr.Bmax].score > TopBinScore){
-                        TopBinScore = Hr.Ht[Hr.Bmax].score;
-                        TopBin = Hr.Bmax;
-                    }
-                    Hr.Reset();
-                }
-            }// end for(i)
+        bool ismax = true;
+        for(int j=lb; lb<rb && j<=rb; j++)
+            if(H.Ht[j].score > H.Ht[i].score)
+                ismax=false;
 
-            // Give an estimate of the match time point within the recording by
-            // a fixed linear interpolation at the bin centre. The time point is
-            // supposed to be within the time bin with the max score.
-			if(TopBinScore > 0)
-               m_Results.Qc[H.Qi].Tmatch = (Pms::Tk * TopBin + Pms::Tk / 2) * Pms::dt;
+        // If peak bin found keep its <Sij,CandLF> pairs
+        if(ismax && H.Ht[i].score > Matcher::MIN_ACCEPT_SCORE*1.5)
+        {
+            C.Peaks.emplace_back();
+            Qcand_t::Peak_t &peak = C.Peaks.back();
+            peak.bin = i;
+            peak.Pairs.reserve(H.Ht[i].Info.size());
 
-        }// end foreach(H)
+            for(const HistoBin_t::info_table::value_type &elem : H.Ht[i].Info)
+                peak.Pairs.emplace_back(elem.first, elem.second.CandLF);
+        }
     }
 }
 
 // ----------------------------------------------------------------------------
 
-void Audioneex::Matcher::FindCandidatesBWords(int ko, int kn)
+void Audioneex::Matcher::FindCandidatesBWords(const QueryTermPlan_t &plan,
+                                              uint32_t FIDlo, uint32_t FIDhi,
+                                              Qhisto_t &H, hashtable_Qcand &TopK,
+                                              SearchCtx_t &ctx,
+                                              std::mutex *lock)
 {
-	hashtable_PLIter  iterators;
-    hashtable_EOLIter EOL_iterators;
+    plist_iterators &iterators = ctx.Iterators;
+    std::vector<DataStoreImpl::PListIterator*> &batch = ctx.Batch;
+    std::unique_ptr <DataStoreImpl::PListIterator> bins_it;
 
-    int NLFs  = kn - ko;
+    uint32_t FIDcurr = FIDlo;
 
-    uint32_t FIDcurr = 1;
+    // No terms for this query (e.g. streams shorter than 2 LFs)
+    if(plan.Entries.empty()) return;
 
-    // We cannot process streams shorter than 2 LFs
-    if(NLFs < 2) return;
+    // Iterators that reached EOL (or past the searched FID range)
+    std::vector<bool> EOL_iterators (iterators.size(), false);
+    size_t EOL_count = 0;
+
+    // Leave out the most costly terms (see SetTermRatio())
+    if(m_TermRatio < 1)
+       EOL_count = SelectTerms(iterators, EOL_iterators);
 
     // Score fingerprints in DaaT fashion until all postings
     // list iterators reach EOL.
     do
     {
-        for(size_t k=ko; k<kn; k++)
-        {
-            int Wpivot = Xk[k].W;
-            int Bpivot = Xk[k].F / IndexerImpl::qB;
-            
-            // Compute bi-terms
-            // TODO: We need to compute the terms only once, so this code
-            //       should be put outside the main loop.
-            for(size_t j=k+1, dN=0; dN<IndexerImpl::Dmax && j<Xk.size()/*kn*/; j++)
-            {
-                int dt = Xk[j].T - Xk[k].T;
-                assert(dt>=0);
-                if(dt > IndexerImpl::Tmax)
-                    break;
-
-                int Bpair = Xk[j].F / IndexerImpl::qB;
-
-                // If the LF is in the same band as pivot's do pairing
-                if(Bpair == Bpivot)
-                {
-                   int W2  = Xk[j].W;
-                   int Vpt = Xk[j].T / Pms::qT - Xk[k].T / Pms::qT;
-                   int Vpf = Xk[j].F / Pms::qF - Xk[k].F / Pms::qF;
+        // Read ahead in one batch the blocks the iterators will need
+        // in this step.
+        DataStoreImpl::PrefetchPListBlocks(m_DataStore, batch.data(), batch.size(), FIDhi, lock);
 
-                   assert(0 <= Wpivot && Wpivot <= Pms::Kmed);
-                   assert(0 <= W2 && W2 <= Pms::Kmed);
-                   assert(0 <= Vpt && Vpt <= IndexerImpl::Vpt_max);
-                   assert(0 <= abs(Vpf) && abs(Vpf) <=  IndexerImpl::Vpf_max);
-
-                   int term = Wpivot << IndexerImpl::W1_SHIFT |
-                              Bpivot << IndexerImpl::B_SHIFT |
-                              W2 << IndexerImpl::W2_SHIFT |
-                              Vpt << IndexerImpl::VPT_SHIFT |
-                              (Vpf & 0x3F);
+        // Visit the bi-terms in the order they occur in the query
+        for(const QueryTermPlan_t::Entry_t &entry : plan.Entries)
+        {
+            size_t k = entry.k;
 
-                   // Get postings list iterator for term from cache.
-                   // If we get a miss then get a new one;
-                   std::unique_ptr <DataStoreImpl::PListIterator> &it = iterators[term];
+            // Skip the exhausted and dropped lists
+            if(EOL_iterators[entry.slot])
+               continue;
 
-                   if(!it)
-                      it.reset(DataStoreImpl::GetPListIterator(m_DataStore, term));
+            DataStoreImpl::PListIterator* it = iterators[entry.slot].get();
 
-                   DataStoreImpl::Posting_t& post = it->get();
+            DataStoreImpl::Posting_t& post = it->get();
 
-                   assert(post.empty() ? 1 : post.FID > 0);
+            assert(post.empty() ? 1 : post.FID > 0);
 
-                   // If the iterator is at EOL add it to 'exhausted' iterators
-                   // list. (NOTE: An EOL iterators must be added only once).
-                   if(post.empty())
-                      EOL_iterators.insert(term);
+            // If the iterator is at EOL (or past the searched FID range)
+            // mark it as 'exhausted'.
+            if((post.empty() || post.FID > FIDhi) && !EOL_iterators[entry.slot]){
+               EOL_iterators[entry.slot] = true;
+               EOL_count++;
+            }
 
-                   if(post.FID == FIDcurr)
-                   {
-                      for(size_t m=0; m<post.tf; m++)
-                      {
-                          // -------- Time clustering ----------
+            if(post.FID == FIDcurr)
+            {
+               ScorePostingBWords(post, k, H, bins_it, lock);
+               it->next();
+            }
+        }// end for(entries)
 
-                          int Sij = post.LID[m];
-                          int Sij_t = post.T[m];
-                          int Sij_e = post.E[m];
+        // Process histogram for current fingerprint
 
-                          int bin = Sij_t / Pms::Tk;
+        H.Qi = FIDcurr;
 
-                          // Check that time values are within the histo.
-                          // Resize if necessary.
-                          if(bin >= m_H.Ht.size()){
-                             m_H.Resize(bin*1.1);
-                             WARNING_MSG("Matcher: Ht reallocation occurred.")
-                          }
+        // Get histo max score and store a summary in top-k list
+        UpdateTopK(H, TopK);
 
-                          // Check whether a candidate has already been scored for this bin
-                          // (a query LF should score only 1 candidate per bin)
-                          if(!m_H[bin].scored)
-                          {
-                              // Check whether the current candidate LF has already been scored
-                              // in this bin and skip scoring if true
-                              bool CanScore;
+        H.Reset();
+        FIDcurr++;
+        // Out of time. Give up the longest lists (see SetStepBudget())
+        if(FIDcurr % DEADLINE_CHECK_INTERVAL == 0 && OutOfTime())
+           EOL_count += DropTerms(iterators, EOL_iterators);
+    }
+    while(EOL_count < iterators.size() && FIDcurr <= FIDhi);
 
-                              HistoBin_t::Info_t &info = m_H[bin].Info[Sij];
+    STATS_HERE( AddSearchStats(iterators, bins_it.get(), FIDcurr - FIDlo); )
+}
 
-                              if(info.CandLF==0 && info.Pivot==0){
-                                  info.CandLF = k;
-                                  info.Pivot = k+1; // NOTE: Pivot id must be 1-based
-                                  CanScore = true;
-                              }else
-                                  CanScore = info.Pivot-1 == k;
+// ----------------------------------------------------------------------------
 
-                              if(CanScore)
-                              {
-                                  // TODO: Use quantized pivots' times to mitigate inaccuracies
-                                  //       in the time order?
+void Audioneex::Matcher::FindCandidatesSWords(const QueryTermPlan_t &plan,
+                                              uint32_t FIDlo, uint32_t FIDhi,
+                                              Qhisto_t &H, hashtable_Qcand &TopK,
+                                              SearchCtx_t &ctx,
+                                              std::mutex *lock)
+{
+    plist_iterators &iterators = ctx.Iterators;
+    std::vector<DataStoreImpl::PListIterator*> &batch = ctx.Batch;
+    std::unique_ptr <DataStoreImpl::PListIterator> bins_it;
 
-                                  int tdiff = Sij_t - m_H[bin].last_T;
-                                  if(abs(tdiff)<=2) tdiff=0;
+    uint32_t FIDcurr = FIDlo;
 
-                                  // Time Proximity score (weighed by similarity value)
-                                  float Wtp = 1.0f - static_cast<float>(abs(Xk[k].E - Sij_e)) /
-                                                     static_cast<float>(Pms::IDI);
+    if(plan.Entries.empty()) return;
 
-                                  int score_tp = Pms::Smax * Wtp;
+    // Iterators that reached EOL (or past the searched FID range)
+    std::vector<bool> EOL_iterators (iterators.size(), false);
+    size_t EOL_count = 0;
 
-                                  // TODO: Can we do Time Order using the LFs ID ?
-                                  //       This will avoid using the time value which must be
-                                  //       fetched from the database or included in the postings.
-                                  if(tdiff>=0)
-                                      m_H[bin].torder++;
+    // Leave out the most costly terms (see SetTermRatio())
+    if(m_TermRatio < 1)
+       EOL_count = SelectTerms(iterators, EOL_iterators);
 
-                                  float Wto = static_cast<float>(m_H[bin].torder) /
-                                              static_cast<float>(m_H[bin].Info.size());
+    // Score fingerprints in DaaT fashion until all postings
+    // list iterators reach EOL.
+    do
+    {
+        // Read ahead in one batch the blocks the iterators will need
+        // in this step.
+        DataStoreImpl::PrefetchPListBlocks(m_DataStore, batch.data(), batch.size(), FIDhi, lock);
 
-                                  int score_to = (tdiff >= 0) ? Pms::Smax * Wto : 0;
+        // Visit the terms in the order they occur in the query
+        for(const QueryTermPlan_t::Entry_t &entry : plan.Entries)
+        {
+            size_t k = entry.k;
 
-                                  m_H[bin].score += (score_tp + score_to);
-                                  m_H[bin].last_T = Sij_t;
+            // Skip the exhausted and dropped lists
+            if(EOL_iterators[entry.slot])
+               continue;
 
-                                  // Update max bin index
-                                  if(m_H[bin].score > m_H[m_H.Bmax].score)
-                                      m_H.Bmax = bin;
+            DataStoreImpl::PListIterator* it = iterators[entry.slot].get();
 
-                                  // Mark the bin as 'scored' to avoid multiple scoring.
-                                  m_H[bin].scored = true;
-                              }
-                          }
+            DataStoreImpl::Posting_t& post = it->get();
 
-                          // -------- End Time clustering ----------
-                      }
+            assert(post.empty() ? 1 : post.FID > 0);
 
-                      m_H.ResetBinScoredFlag();
-                      it->next();
-                   }
-                   dN++;
-                }
+            // If the iterator is at EOL (or past the searched FID range)
+            // mark it as 'exhausted'.
+            if((post.empty() || post.FID > FIDhi) && !EOL_iterators[entry.slot]){
+               EOL_iterators[entry.slot] = true;
+               EOL_count++;
             }
-        }// end for(k)
-
-        // Process histogram for current fingerprint
 
-        m_H.Qi = FIDcurr;
+            if(post.FID == FIDcurr)
+            {
+               ScorePostingSWords(post, k, H, bins_it, lock);
+               it->next();
+            }
 
-        // Get histo max score and store in top-k list
+        }// end for(entries)
 
-        int maxScore = m_H[m_H.Bmax].score;
+        // Process histogram for current fingerprint
 
-        // Skip scores that are too small
-        if(maxScore > MIN_ACCEPT_SCORE)
-        {
-           // If the tie lists get too big it may impact performances
-           // so as a provisional solution we simply truncate them at
-           // a predefined length. A better solution would be to find
-           // a method that strongly disambiguates the candidates.
+        H.Qi = FIDcurr;
 
-           if(m_TopKMc[maxScore].size() < 10)
-              m_TopKMc[maxScore].push_back(m_H);
+        // Get histo max score and store a summary in top-k list
+        UpdateTopK(H, TopK);
 
-           if(m_TopKMc.size() > Pms::TopK)
-              m_TopKMc.erase(--(m_TopKMc.end()) );
-        }
+        H.Reset();
 
-        m_H.Reset();
         FIDcurr++;
+        // Out of time. Give up the longest lists (see SetStepBudget())
+        if(FIDcurr % DEADLINE_CHECK_INTERVAL == 0 && OutOfTime())
+           EOL_count += DropTerms(iterators, EOL_iterators);
     }
-    while(EOL_iterators.size() < iterators.size());
+    while(EOL_count < iterators.size() && FIDcurr <= FIDhi);
+
+    STATS_HERE( AddSearchStats(iterators, bins_it.get(), FIDcurr - FIDlo); )
 }
 
 // ----------------------------------------------------------------------------
 
-void Audioneex::Matcher::FindCandidatesSWords(int ko, int kn)
+void Audioneex::Matcher::ScorePostingBWords(const DataStoreImpl::Posting_t &post, size_t k,
+                                            Qhisto_t &H,
+                                            std::unique_ptr<DataStoreImpl::PListIterator> &bins_it,
+                                            std::mutex *lock)
 {
-	hashtable_PLIter  iterators;
-    hashtable_EOLIter EOL_iterators;
+    // Score the occurrences of the bi-term of query LF k in a candidate
+    // fingerprint into its time histogram.
 
-    uint32_t FIDcurr = 1;
+    for(size_t m=0; m<post.tf; m++)
+    {
+        // -------- Time clustering ----------
 
-    int NLFs  = kn - ko;
+        int Sij = post.LID[m];
+        int Sij_e = post.E[m];
 
-    // Score fingerprints in DaaT fashion until all postings
-    // list iterators reach EOL.
-    do
-    {
-        for(size_t k=ko; k<kn; k++)
-        {
-            // Create term <word|channel>
-            int chan = (Xk[k].F - Pms::Kmin + 1) / Pms::qF;
-            int term = (Xk[k].W << 6) | chan;
+        // Slim postings have no times. Get the bins from the index and
+        // estimate the times from them (see GetTimeBin()), as the time
+        // order tolerance below is in frames, not LIDs.
+        int Sij_t = post.T ? post.T[m] : 0;
 
-            // Get postings list iterator for term from cache.
-            // If we get a miss then get a new one;
-            auto &it = iterators[term];
+        int bin = post.T ? Sij_t / Pms::Tk :
+                  GetTimeBin(bins_it, post.FID, Sij, Sij_t, lock);
 
-            if(it.get() == nullptr)
-               it.reset(DataStoreImpl::GetPListIterator(m_DataStore, term));
+        // Check that time values are within the histo.
+        // Resize if necessary.
+        if(bin >= static_cast<int>(H.Ht.size())){
+           H.Resize(bin*1.1);
+           WARNING_MSG("Matcher: Ht reallocation occurred.")
+        }
 
-            DataStoreImpl::Posting_t& post = it->get();
+        // Check whether a candidate has already been scored for this bin
+        // (a query LF should score only 1 candidate per bin)
+        if(!H[bin].scored)
+        {
+            // Check whether the current candidate LF has already been scored
+            // in this bin and skip scoring if true
+            bool CanScore;
 
-            assert(post.empty() ? 1 : post.FID > 0);
+            HistoBin_t::Info_t &info = H[bin].Info[Sij];
 
-            // If the iterator is at EOL add it to 'exhausted' iterators
-            // list. (NOTE: An EOL iterator must be added only once).
-            if(post.empty())
-               EOL_iterators.insert(term);
+            if(info.CandLF==0 && info.Pivot==0){
+                info.CandLF = k;
+                info.Pivot = k+1; // NOTE: Pivot id must be 1-based
+                CanScore = true;
+            }else
+                CanScore = info.Pivot-1 == static_cast<int>(k);
 
-            if(post.FID == FIDcurr)
+            if(CanScore)
             {
-               for(size_t m=0; m<post.tf; m++)
-               {
-                   // -------- Time clustering ----------
+                // TODO: Use quantized pivots' times to mitigate inaccuracies
+                //       in the time order?
+
+                int tdiff = Sij_t - H[bin].last_T;
+                if(abs(tdiff)<=2) tdiff=0;
+
+                // Time Proximity score (weighed by similarity value)
+                float Wtp = 1.0f - static_cast<float>(abs(Xk[k].E - Sij_e)) /
+                                   static_cast<float>(Pms::IDI);
+
+                int score_tp = Pms::Smax * Wtp;
 
-                   int Sij = post.LID[m];
-                   int Sij_t = post.T[m];
-                   int Sij_e = post.E[m];
+                if(tdiff>=0)
+                    H[bin].torder++;
 
-                   int bin = Sij_t / Pms::Tk;
+                float Wto = static_cast<float>(H[bin].torder) /
+                            static_cast<float>(H[bin].Info.size());
 
-                   // Check that time values are within the histo.
-                   // Resize if necessary.
-                   if(bin >= m_H.Ht.size()){
-                      m_H.Resize(bin*1.1);
-                      WARNING_MSG("Matcher: Ht reallocation occurred.")
-                   }
+                int score_to = (tdiff >= 0) ? Pms::Smax * Wto : 0;
 
-                   // Check whether a candidate has already been scored for this bin
-                   // (a query LF should score only 1 candidate per bin)
-                   if(!m_H[bin].scored)
-                   {
-                       // Check whether the current candidate LF has already been scored
-                       // in this bin and skip scoring if true
-                       bool CanScore = false;
+                H[bin].score += (score_tp + score_to);
+                H[bin].last_T = Sij_t;
 
-                       HistoBin_t::Info_t &info = m_H[bin].Info[Sij];
+                // Update max bin index
+                if(H[bin].score > H[H.Bmax].score)
+                    H.Bmax = bin;
 
-                       if(info.CandLF==0 && info.Pivot==0){
-                           info.CandLF = k;
-                           info.Pivot = 1; // NOTE: Pivot id must be 1-based
-                           CanScore = true;
-                       }
+                // Mark the bin as 'scored' to avoid multiple scoring.
+                H[bin].scored = true;
+            }
+        }
 
-                       if(CanScore)
-                       {
-                           int tdiff = Sij_t - m_H[bin].last_T;
-                           if(abs(tdiff)<=2) tdiff=0;
+        // -------- End Time clustering ----------
+    }
 
-                           float Wtp = 1.0f - static_cast<float>(abs(Xk[k].E - Sij_e)) /
-                                              static_cast<float>(Pms::IDI);
+    H.ResetBinScoredFlag();
+}
 
-                           // Time Proximity score (weighed by similarity value)
-                           int score_tp = 1000 * Wtp;
+// ----------------------------------------------------------------------------
 
-                           if(tdiff>=0)
-                               m_H[bin].torder++;
+void Audioneex::Matcher::ScorePostingSWords(const DataStoreImpl::Posting_t &post, size_t k,
+                                            Qhisto_t &H,
+                                            std::unique_ptr<DataStoreImpl::PListIterator> &bins_it,
+                                            std::mutex *lock)
+{
+    // Score the occurrences of the term of query LF k in a candidate
+    // fingerprint into its time histogram.
 
-                           float Wto = static_cast<float>(m_H[bin].torder) /
-                                       static_cast<float>(m_H[bin].Info.size());
+    for(size_t m=0; m<post.tf; m++)
+    {
+        // -------- Time clustering ----------
 
-                           // Time order score
-                           int score_to = (tdiff >= 0) ? 1000 * Wto : 0;
+        int Sij = post.LID[m];
+        int Sij_e = post.E[m];
 
-                           m_H[bin].score += (score_tp + score_to);
-                           m_H[bin].last_T = Sij_t;
-                           //H[bin].Info[Sij].LF = Xk[k].ID;
+        // Slim postings have no times. Get the bins from the index and
+        // estimate the times from them (see GetTimeBin()), as the time
+        // order tolerance below is in frames, not LIDs.
+        int Sij_t = post.T ? post.T[m] : 0;
 
-                           // Update max bin index
-                           if(m_H[bin].score > m_H[m_H.Bmax].score)
-                               m_H.Bmax = bin;
+        int bin = post.T ? Sij_t / Pms::Tk :
+                  GetTimeBin(bins_it, post.FID, Sij, Sij_t, lock);
 
-                           // Mark the bin as 'scored' to avoid multiple scoring.
-                           m_H[bin].scored = true;
-                       }
-                   }
+        // Check that time values are within the histo.
+        // Resize if necessary.
+        if(bin >= static_cast<int>(H.Ht.size())){
+           H.Resize(bin*1.1);
+           WARNING_MSG("Matcher: Ht reallocation occurred.")
+        }
 
-                   // -------- End Time clustering ----------
+        // Check whether a candidate has already been scored for this bin
+        // (a query LF should score only 1 candidate per bin)
+        if(!H[bin].scored)
+        {
+            // Check whether the current candidate LF has already been scored
+            // in this bin and skip scoring if true
+            bool CanScore = false;
 
-               }// end for(m)
+            HistoBin_t::Info_t &info = H[bin].Info[Sij];
 
-               m_H.ResetBinScoredFlag();
-               it->next();
+            if(info.CandLF==0 && info.Pivot==0){
+                info.CandLF = k;
+                info.Pivot = 1; // NOTE: Pivot id must be 1-based
+                CanScore = true;
             }
 
-        }// end for(k)
+            if(CanScore)
+            {
+                int tdiff = Sij_t - H[bin].last_T;
+                if(abs(tdiff)<=2) tdiff=0;
+
+                float Wtp = 1.0f - static_cast<float>(abs(Xk[k].E - Sij_e)) /
+                                   static_cast<float>(Pms::IDI);
 
-        // Process histogram for current fingerprint
+                // Time Proximity score (weighed by similarity value)
+                int score_tp = 1000 * Wtp;
 
-        m_H.Qi = FIDcurr;
+                if(tdiff>=0)
+                    H[bin].torder++;
 
-        // Get histo max score and store in top-k list
+                float Wto = static_cast<float>(H[bin].torder) /
+                            static_cast<float>(H[bin].Info.size());
 
-        int maxScore = m_H[m_H.Bmax].score;
+                // Time order score
+                int score_to = (tdiff >= 0) ? 1000 * Wto : 0;
 
-        // Skip scores that are too low
-        if(maxScore > MIN_ACCEPT_SCORE)
-        {
-           // If the tie lists get too big it may impact performances
-           // so as a provisional solution we simply truncate them at
-           // a predefined length. A better solution would be to find
-           // a method that strongly disambiguates the candidates.
+                H[bin].score += (score_tp + score_to);
+                H[bin].last_T = Sij_t;
+                //H[bin].Info[Sij].LF = Xk[k].ID;
 
-           if(m_TopKMc[maxScore].size() <= 10)
-              m_TopKMc[maxScore].push_back(m_H);
+                // Update max bin index
+                if(H[bin].score > H[H.Bmax].score)
+                    H.Bmax = bin;
 
-           if(m_TopKMc.size() > Pms::TopK)
-              m_TopKMc.erase(--(m_TopKMc.end()) );
+                // Mark the bin as 'scored' to avoid multiple scoring.
+                H[bin].scored = true;
+            }
         }
 
-        m_H.Reset();
+        // -------- End Time clustering ----------
 
-        FIDcurr++;
-    }
-    while(EOL_iterators.size() < iterators.size());
+    }// end for(m)
+
+    H.ResetBinScoredFlag();
 }
 
 // ----------------------------------------------------------------------------
 
-void Audioneex::Matcher::GraphMatching(Qhisto_t &Qhisto_i, int bin, Qhisto_t &Qhisto)
+void Audioneex::Matcher::GraphMatching(int Qi,
+                                       size_t fp_size,
+                                       const Qcand_t::Peak_t &peak,
+                                       RerankCtx_t &ctx,
+                                       std::mutex *lock)
 {
-    hashtable_qlf_pair  Hx,Hq;
+    graph_edges &Gq = ctx.Gq;
+    Qhisto_t &Qhisto = ctx.Hr;
 
-    int Qi = Qhisto_i.Qi;
+    if(peak.Pairs.empty())
+       return;
 
-    // Score all LF pairs <k,Sij> in the specified histo bin
-    for(HistoBin_t::info_table::value_type &elem : Qhisto_i[bin].Info)
-    {
-        // Get the <query LF, candidate LF> pair.
-        // The pair <k,Sij> is stored in the bin's info table where
-        // the key is Sij and k is the QueryLF field in the info struct.
-        HistoBin_t::Info_t &Binfo = elem.second;
+    STATS_HERE( ctx.Stats.GraphMatchings++; )
 
-        int k = Binfo.CandLF;
-        int Sij = elem.first;
+    int Qlen = fp_size / sizeof(QLocalFingerprint_t);
 
-        assert(0<=k && k<Xk.size());
+    // All the pairs in a peak bin refer to LFs that are close in time in
+    // the candidate, so rather than fetching a chunk of fingerprint for each
+    // pair we compute the neighborhoods first and fetch their union at once.
+    ctx.Sh.resize(peak.Pairs.size());
 
-int common_edges=0;
+    int Smin = Qlen;
+    int Smax = -1;
+
+    for(size_t i=0; i<peak.Pairs.size(); i++)
+    {
+        int k = peak.Pairs[i].second;
+        int Sij = peak.Pairs[i].first;
+
+        assert(0<=k && k<Xk.size());
 
         // For each candidate we perform the t-f matching on a neighborhood
         // of Ntf LFs in the query and candidate sequences. Here the
@@ -694,150 +1885,238 @@ int common_edges=0;
         // for the query sequence X(k).
         int ks = (k>=Pms::Ntf/2) ? k-Pms::Ntf/2 : 0;
         int ke = (Xk.size()-k-1 >= Pms::Ntf/2) ? k+Pms::Ntf/2 : Xk.size()-1;
-        int Nx = ke - ks + 1;
-
-        assert(0<=ks && ks<Xk.size());
-        assert(0<=ke && ke<Xk.size());
-        assert(ks <= ke);
-
-        // Build graph for Xh
-        BuildGraphs(&Xk[ks], Nx, k-ks, Hx);
-
-        // IMPORTANT:
-        // Here we're getting input from external clients that could potentially
-        // crash the whole application if invalid, so runtime checks are needed.
-
-        // We need to know the size of the fingerprint in order to get
-        // the correct subsequence Qh
-        size_t fp_size = m_DataStore->GetFingerprintSize(Qi);
-
-        if(fp_size == 0)
-           throw Audioneex::InvalidFingerprintException
-                ("Zero sized fingerprint received. Maybe not existent? "
-                 "Please check the fingerprint database (FID="+Utils::ToString(Qi)+")");
-
-        if(fp_size % sizeof(QLocalFingerprint_t) != 0)
-           throw Audioneex::InvalidFingerprintException
-                ("Invalid fingerprint data. The fingerprint may be corrupt."
-                 "Please check the fingerprint database (FID="+Utils::ToString(Qi)+")");
-
-        int Qlen = fp_size / sizeof(QLocalFingerprint_t);
-
-        // Starting and ending points for neighborhood of Qij (in LIDs)
-        int ss = Sij - std::min<int>(Sij, k-ks);
-        int se = Sij + std::min<int>(ke-k, Qlen-Sij-1);
-        int Nh = se - ss + 1;
 
         // NOTE:
-        // These checks can fail as a result of the clients using inconsistent
+        // This check can fail as a result of the clients using inconsistent
         // datastores. For example, mixing a set of Qfingerprints with an index
-        // generated by a different set of Qfingrprints may trigger these asserts.
+        // generated by a different set of Qfingrprints may trigger it.
 
         if(Sij<0 || Sij>=Qlen)
            throw Audioneex::InvalidIndexDataException
                 ("Invalid LID. The index appears to be inconsistent.");
 
+        // Starting and ending points for neighborhood of Qij (in LIDs)
+        int ss = Sij - std::min<int>(Sij, k-ks);
+        int se = Sij + std::min<int>(ke-k, Qlen-Sij-1);
+
         assert(0<=ss && ss<Qlen);
         assert(0<=se && se<Qlen);
         assert(ss <= se);
 
-        // Get the fingerprint chunk corresponding to the subsequence Qh
+        ctx.Sh[i] = std::make_pair(ss, se);
+        Smin = std::min(Smin, ss);
+        Smax = std::max(Smax, se);
+    }
+
+    // Get the fingerprint chunk covering all the neighborhoods
+    GetFingerprint(Qi, fp_size, Smin, Smax-Smin+1, ctx.Qh, ctx.Stats, lock);
+
+    // Score all LF pairs <k,Sij> in the specified peak bin
+    for(size_t i=0; i<peak.Pairs.size(); i++)
+    {
+        // Get the <query LF, candidate LF> pair.
+        int k = peak.Pairs[i].second;
+        int Sij = peak.Pairs[i].first;
+
+int common_edges=0;
+
+        int ks = (k>=Pms::Ntf/2) ? k-Pms::Ntf/2 : 0;
+        int ke = (Xk.size()-k-1 >= Pms::Ntf/2) ? k+Pms::Ntf/2 : Xk.size()-1;
+        int Nx = ke - ks + 1;
 
-        size_t bstart = ss * sizeof(QLocalFingerprint_t);
-        size_t Qhsize = Nh * sizeof(QLocalFingerprint_t);
+        assert(0<=ks && ks<static_cast<int>(Xk.size()));
+        assert(0<=ke && ke<static_cast<int>(Xk.size()));
+        assert(ks <= ke);
 
-        size_t rsize;
-        const uint8_t* pQh = m_DataStore->GetFingerprint(Qi, rsize, Qhsize, bstart);
+        // Build graph for Xh. It only depends on k, so it is built once
+        // and reused for all the pairs with the same query LF. The entry
+        // marks the graph as built, as it may legitimately have no edges.
+        std::pair<hashtable_graphs::iterator, bool> gx = ctx.Gx.emplace(k, graph_edges());
+        graph_edges &Gx = gx.first->second;
 
-        if(rsize == 0 || pQh == nullptr)
-           throw Audioneex::InvalidFingerprintException
-                ("No fingerprint data received. Maybe not existent? "
-                 "Please check the fingerprint database (FID="+Utils::ToString(Qi)+")");
+        if(gx.second)
+           BuildGraphs(&Xk[ks], Nx, k-ks, Gx);
 
-        if(rsize != Qhsize)
-           throw Audioneex::InvalidFingerprintException
-                ("Invalid fingerprint data size. Should be "+Utils::ToString(Qhsize)+". "
-                 "Please check the fingerprint database (FID="+Utils::ToString(Qi)+")");
+        // Subsequence Qh within the fetched chunk
+        int ss = ctx.Sh[i].first;
+        int se = ctx.Sh[i].second;
+        int Nh = se - ss + 1;
 
-        const QLocalFingerprint_t* Qh = reinterpret_cast<const QLocalFingerprint_t*>(pQh);
+        const QLocalFingerprint_t* Qh = ctx.Qh.data() + (ss - Smin);
 
         // Build graph for Qh
-        BuildGraphs(Qh, Nh, Sij-ss, Hq);
+        BuildGraphs(Qh, Nh, Sij-ss, Gq);
 
         int score = 0;
 
-        // Perform graph matching
-        for(hashtable_qlf_pair::value_type elem : Hq)
+        // Perform graph matching by intersection of the sorted edge arrays
+        graph_edges::const_iterator iq = Gq.begin();
+        graph_edges::const_iterator ix = Gx.begin();
+
+        while(iq != Gq.end() && ix != Gx.end())
         {
-            // Get edge (it's the key to the table)
-            int e = elem.first;
+            if(iq->e < ix->e){
+               ++iq;
+               continue;
+            }
+            if(ix->e < iq->e){
+               ++ix;
+               continue;
+            }
 
-            // Check for common edge in query graph
-            if(Hx.find(e) != Hx.end())
-            {
-                // Get endpoint LFs for matching edge in G(X,E) and G(Q,E)
-                qlf_pair &Pq = Hq[e];
-                qlf_pair &Px = Hx[e];
+            // Get endpoint LFs for matching edge in G(X,E) and G(Q,E)
+            const GraphEdge_t &Pq = *iq++;
+            const GraphEdge_t &Px = *ix++;
 
-                float sim1 = Pq.first->W == Px.first->W ? 1000.f : 0.f;
-                float sim2 = Pq.second->W == Px.second->W ? 1000.f : 0.f;
+            float sim1 = Pq.first->W == Px.first->W ? 1000.f : 0.f;
+            float sim2 = Pq.second->W == Px.second->W ? 1000.f : 0.f;
 
-                // Compute similarity weights.
-                float Wsim1 = 1.0f - static_cast<float>(abs(Pq.first->E - Px.first->E)) /
-                                     static_cast<float>(Pms::IDI);
+            // Compute similarity weights.
+            float Wsim1 = 1.0f - static_cast<float>(abs(Pq.first->E - Px.first->E)) /
+                                 static_cast<float>(Pms::IDI);
 
-                float Wsim2 = 1.0f - static_cast<float>(abs(Pq.second->E - Px.second->E)) /
-                                     static_cast<float>(Pms::IDI);
+            float Wsim2 = 1.0f - static_cast<float>(abs(Pq.second->E - Px.second->E)) /
+                                 static_cast<float>(Pms::IDI);
 
-                // Increase score by edge match score
-                score += 1000;
+            // Increase score by edge match score
+            score += 1000;
 common_edges++;
 
-                // Increase score by LFs match score
-                score += sim1 * Wsim1;
-                score += sim2 * Wsim2;
+            // Increase score by LFs match score
+            score += sim1 * Wsim1;
+            score += sim2 * Wsim2;
 
-                 // Do time binning of score for current common edge
-                int Hbin1 = Pq.first->T / Pms::Tk;
-                int Hbin2 = Pq.second->T / Pms::Tk;
+             // Do time binning of score for current common edge
+            int Hbin1 = Pq.first->T / Pms::Tk;
+            int Hbin2 = Pq.second->T / Pms::Tk;
 
-                // Check that time values are within the histo.
-                // Resize if necessary.
-                if(Hbin1 >= m_H.Ht.size() || Hbin2 >= m_H.Ht.size()){
-                   Qhisto.Resize( std::max<int>(Hbin1,Hbin2) * 1.1 );
-                   WARNING_MSG("Matcher: Ht reallocation occurred.")
-                }
+            // Check that time values are within the histo.
+            // Resize if necessary.
+            if(Hbin1 >= static_cast<int>(Qhisto.Ht.size()) ||
+               Hbin2 >= static_cast<int>(Qhisto.Ht.size())){
+               Qhisto.Resize( std::max<int>(Hbin1,Hbin2) * 1.1 );
+               WARNING_MSG("Matcher: Ht reallocation occurred.")
+            }
 
-                // If both matching LFs fall in the same time bin then give the
-                // bin full score. If they fall into different (adjacent) bins
-                // then share the score between the 2 bins.
-                Qhisto.Ht[Hbin1].score += score/2;
-                Qhisto.Ht[Hbin2].score += score/2;
+            // If both matching LFs fall in the same time bin then give the
+            // bin full score. If they fall into different (adjacent) bins
+            // then share the score between the 2 bins.
+            Qhisto.Ht[Hbin1].score += score/2;
+            Qhisto.Ht[Hbin2].score += score/2;
 
-                // Update max bin index
-                if(Qhisto.Ht[Hbin1].score > Qhisto.Ht[Qhisto.Bmax].score)
-                   Qhisto.Bmax = Hbin1;
-                if(Qhisto.Ht[Hbin2].score > Qhisto.Ht[Qhisto.Bmax].score)
-                   Qhisto.Bmax = Hbin2;
+            // Update max bin index
+            if(Qhisto.Ht[Hbin1].score > Qhisto.Ht[Qhisto.Bmax].score)
+               Qhisto.Bmax = Hbin1;
+            if(Qhisto.Ht[Hbin2].score > Qhisto.Ht[Qhisto.Bmax].score)
+               Qhisto.Bmax = Hbin2;
 
-                score = 0;
-            }
+            score = 0;
         }
-
-        Hx.clear();
-        Hq.clear();
     }
 }
 
 
 // ----------------------------------------------------------------------------
 
-void Audioneex::Matcher::BuildGraphs(const QLocalFingerprint_t *lfs, size_t Nlfs, int iRef, hashtable_qlf_pair &H)
+size_t Audioneex::Matcher::GetFingerprintSize(uint32_t Qi)
+{
+    hashtable_FPSize::iterator it = m_FPSizes.find(Qi);
+
+    if(it != m_FPSizes.end())
+       return it->second;
+
+    // IMPORTANT:
+    // Here we're getting input from external clients that could potentially
+    // crash the whole application if invalid, so runtime checks are needed.
+
+    // We need to know the size of the fingerprint in order to get
+    // the correct subsequences Qh
+    std::unique_lock<std::mutex> guard;
+
+    if(std::mutex *lock = SerialStoreLock())
+       guard = std::unique_lock<std::mutex>(*lock);
+
+    size_t fp_size = m_DataStore->GetFingerprintSize(Qi);
+
+    if(guard)
+       guard.unlock();
+
+    if(fp_size == 0)
+       throw Audioneex::InvalidFingerprintException
+            ("Zero sized fingerprint received. Maybe not existent? "
+             "Please check the fingerprint database (FID="+Utils::ToString(Qi)+")");
+
+    if(fp_size % sizeof(QLocalFingerprint_t) != 0)
+       throw Audioneex::InvalidFingerprintException
+            ("Invalid fingerprint data. The fingerprint may be corrupt."
+             "Please check the fingerprint database (FID="+Utils::ToString(Qi)+")");
+
+    m_FPSizes[Qi] = fp_size;
+
+    return fp_size;
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::GetFingerprint(uint32_t Qi,
+                                        size_t fp_size,
+                                        int LIDo,
+                                        int Nlf,
+                                        std::vector<QLocalFingerprint_t> &Qh,
+                                        MatchStats_t &stats,
+                                        std::mutex *lock)
+{
+    size_t bstart = LIDo * sizeof(QLocalFingerprint_t);
+    size_t Qhsize = Nlf * sizeof(QLocalFingerprint_t);
+
+    Qh.resize(Nlf);
+
+    STATS_HERE( stats.FingerprintBytes += Qhsize; )
+
+    if(m_FPCache){
+       size_t misses = 0;
+       m_FPCache->Read(m_DataStore, lock, Qi, fp_size, bstart, Qhsize,
+                       reinterpret_cast<uint8_t*>(Qh.data()), &misses);
+       STATS_HERE(
+           size_t psize = m_FPCache->GetPageSize();
+           size_t pages = Qhsize ? (bstart + Qhsize - 1) / psize - bstart / psize + 1 : 0;
+           stats.CacheHits += pages - misses;
+           stats.CacheMisses += misses;
+       )
+       return;
+    }
+
+    // The data store is not required to be reentrant, so the accesses
+    // must be serialized if reranking is performed concurrently.
+    std::unique_lock<std::mutex> guard;
+    if(lock)
+       guard = std::unique_lock<std::mutex>(*lock);
+
+    size_t rsize = m_DataStore->ReadFingerprint(Qi, reinterpret_cast<uint8_t*>(Qh.data()),
+                                                Qhsize, bstart);
+
+    if(rsize == 0)
+       throw Audioneex::InvalidFingerprintException
+            ("No fingerprint data received. Maybe not existent? "
+             "Please check the fingerprint database (FID="+Utils::ToString(Qi)+")");
+
+    if(rsize != Qhsize)
+       throw Audioneex::InvalidFingerprintException
+            ("Invalid fingerprint data size. Should be "+Utils::ToString(Qhsize)+". "
+             "Please check the fingerprint database (FID="+Utils::ToString(Qi)+")");
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::Matcher::BuildGraphs(const QLocalFingerprint_t *lfs, size_t Nlfs, int iRef, graph_edges &G)
 {
     // Build LF sequence graph by Pair-wise Geodesic Hashing
 
     bool hash_ok = true;
 
+    G.clear();
+    G.reserve( (Nlfs*(Nlfs-1))/2 );
+
     assert(0<=iRef && iRef<Nlfs);
 
     int LFref_qt = lfs[iRef].T / Pms::qT + 0.5f;
@@ -873,12 +2152,29 @@ void Audioneex::Matcher::BuildGraphs(const QLocalFingerprint_t *lfs, size_t Nlfs
                     ((Tt_iref&0x000000FF)<<8)|
                     (Tf_iref&0x000000FF);
 
-            // Store the edge pair in the hashtable
-            H[e].first = const_cast<QLocalFingerprint_t*>(&lfs[i]);
-            H[e].second = const_cast<QLocalFingerprint_t*>(&lfs[j]);
+            // Store the edge pair
+            GraphEdge_t edge = { e, &lfs[i], &lfs[j] };
+            G.push_back(edge);
         }
     }
 
+    // Sort the edges by hash value. If there are multiple edges with
+    // the same value (see the collision note below) only the last one
+    // generated is kept.
+    std::stable_sort(G.begin(), G.end());
+
+    graph_edges::iterator out = G.begin();
+
+    for(graph_edges::iterator it = G.begin(); it != G.end(); )
+    {
+        graph_edges::iterator next = it + 1;
+        for(; next != G.end() && next->e == it->e; ++next);
+        *out++ = *(next - 1);
+        it = next;
+    }
+
+    G.erase(out, G.end());
+
     // The following issues should never arise, but in the very unlikely case that
     // they do the worst that can happen is that the identification will fail or produce
     // incorrect results but the process won't crash, so we just report warnings,
@@ -907,8 +2203,8 @@ void Audioneex::Matcher::BuildGraphs(const QLocalFingerprint_t *lfs, size_t Nlfs
     //       there cannot be 2 within the same t-f bin, which is achieved by properly
     //       setting the max suppression window.
 #ifdef TESTING
-    //assert(H.size() == (Nlfs*(Nlfs-1))/2);
-    if(H.size() != (Nlfs*(Nlfs-1))/2)
+    //assert(G.size() == (Nlfs*(Nlfs-1))/2);
+    if(G.size() != (Nlfs*(Nlfs-1))/2)
        WARNING_MSG("LF collision detected in the graphs hash tables.")
 //    DEBUG_MSG( H.size() << "/"<<int((Nlfs*(Nlfs-1))/2)<<" elements in Hx - Mat. size ="<< Nlfs<<"x"<<Nlfs )
 #endif
@@ -12,6 +12,11 @@
 
 #include <vector>
 #include <map>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <limits>
 #include <boost/unordered_map.hpp>
 #include <boost/unordered_set.hpp>
 #include <boost/container/flat_map.hpp>
@@ -19,6 +24,8 @@
 #include "Fingerprint.h"
 #include "Codebook.h"
 #include "DataStore.h"
+#include "FingerprintCache.h"
+#include "WorkerPool.h"
 #include "audioneex.h"
 
 // The following classes are not part of the public API but we need
@@ -41,7 +48,9 @@ class InvalidMatchSequenceException : public Audioneex::Exception {
 };
 
 /// Forward decls
+struct GraphEdge_t;
 struct Qhisto_t;
+struct Qcand_t;
 struct Ac_t;
 
 /// Blessing Typedefs
@@ -49,10 +58,23 @@ typedef std::map<int, std::list<int>, std::greater<int> >  hashtable_Qi;
 typedef boost::unordered::unordered_map<int, Ac_t>         hashtable_Qc;
 typedef boost::unordered::unordered_map<int, lf_pair>      hashtable_lf_pair;
 typedef boost::unordered::unordered_map<int, qlf_pair>     hashtable_qlf_pair;
-//typedef std::map<int, std::list<Qhisto_t>, std::greater<int> > hashtable_Qhisto;
-typedef boost::container::flat_map<int, std::list<Qhisto_t>, std::greater<int> > hashtable_Qhisto;
-typedef boost::unordered::unordered_map<int, std::unique_ptr <DataStoreImpl::PListIterator> > hashtable_PLIter;
-typedef boost::unordered::unordered_set<int>               hashtable_EOLIter;
+typedef std::vector<GraphEdge_t>                           graph_edges;
+typedef boost::unordered::unordered_map<int, graph_edges>  hashtable_graphs;
+typedef boost::container::flat_map<int, std::vector<Qcand_t>, std::greater<int> > hashtable_Qcand;
+typedef std::vector<std::unique_ptr <DataStoreImpl::PListIterator> > plist_iterators;
+typedef std::vector<DataStoreImpl::PListBuffers>           plist_buffers;
+typedef boost::unordered::unordered_map<uint32_t, size_t>  hashtable_FPSize;
+
+/// Edge of a LF sequence graph. The graphs are stored as arrays of edges
+/// sorted by hash value, so they can be matched by merge-intersection.
+struct AUDIONEEX_API_TEST GraphEdge_t
+{
+    int e;
+    const QLocalFingerprint_t* first;
+    const QLocalFingerprint_t* second;
+
+    bool operator<(const GraphEdge_t &edge) const { return e < edge.e; }
+};
 
 /// Time histogram structure
 struct AUDIONEEX_API_TEST HistoBin_t
@@ -126,6 +148,106 @@ struct AUDIONEEX_API_TEST Qhisto_t
 
 };
 
+/// Compact summary of a candidate's time histogram. Only the data needed
+/// by the reranking stage is retained, that is the peak bins and their
+/// <Sij, CandLF> pairs, so that the whole histogram need not be copied.
+struct AUDIONEEX_API_TEST Qcand_t
+{
+    struct Peak_t
+    {
+        int bin   {0};
+        std::vector<std::pair<int,int> > Pairs;  // <Sij, CandLF>
+    };
+
+    int Qi    {0};
+    int Bmax  {0};
+    int score {0};
+    std::vector<Peak_t> Peaks;
+};
+
+/// Counters and stage times (in seconds) of the matching (see Matcher::GetStats()).
+/// Only collected in builds with statistics enabled (see STATS_HERE).
+struct AUDIONEEX_API_TEST MatchStats_t
+{
+    uint64_t Steps            {0};  // Matching steps
+    uint64_t BlocksFetched    {0};  // List blocks read from the data store
+    uint64_t BytesDecoded     {0};  // List bytes decoded
+    uint64_t PostingsScanned  {0};  // Postings visited in the lists
+    uint64_t FIDsScored       {0};  // Fingerprints visited by the search
+    uint64_t GraphMatchings   {0};  // Peak bins matched in the reranking
+    uint64_t FingerprintBytes {0};  // Fingerprint bytes read in the reranking
+    uint64_t CacheHits        {0};  // Fingerprint cache pages found...
+    uint64_t CacheMisses      {0};  // ...and fetched from the data store
+    double   QuantizeTime     {0};
+    double   SearchTime       {0};
+    double   RerankTime       {0};
+
+    MatchStats_t& operator+=(const MatchStats_t &s)
+    {
+        Steps            += s.Steps;
+        BlocksFetched    += s.BlocksFetched;
+        BytesDecoded     += s.BytesDecoded;
+        PostingsScanned  += s.PostingsScanned;
+        FIDsScored       += s.FIDsScored;
+        GraphMatchings   += s.GraphMatchings;
+        FingerprintBytes += s.FingerprintBytes;
+        CacheHits        += s.CacheHits;
+        CacheMisses      += s.CacheMisses;
+        QuantizeTime     += s.QuantizeTime;
+        SearchTime       += s.SearchTime;
+        RerankTime       += s.RerankTime;
+        return *this;
+    }
+};
+
+/// Scratch data used by the reranking stage. Each worker thread has its own.
+struct AUDIONEEX_API_TEST RerankCtx_t
+{
+    hashtable_graphs                  Gx;   // Query graphs (memoized per query LF)
+    graph_edges                       Gq;   // Candidate graph
+    Qhisto_t                          Hr;
+    std::vector<QLocalFingerprint_t>  Qh;   // Local copy of the candidate's LFs
+    std::vector<std::pair<int,int> >  Sh;   // Candidate neighborhoods <ss,se>
+    MatchStats_t                      Stats;  // Counters of the current step
+};
+
+/// Postings list iterators of a search over a FID range. They're created for
+/// each step (see Matcher::CreatePListIterators()), while their buffers are
+/// kept across the steps. Each partition of the parallel search has its own.
+struct AUDIONEEX_API_TEST SearchCtx_t
+{
+    plist_buffers                               Buffers;    // One per query term
+    plist_iterators                             Iterators;  // One per query term
+    std::vector<DataStoreImpl::PListIterator*>  Batch;      // Same, for batched reads
+};
+
+/// Query terms of a matching step. These are computed once per step and
+/// the postings list iterators are kept in slots with the same indexes as
+/// the terms, so the search loop doesn't compute or look up any terms.
+struct AUDIONEEX_API_TEST QueryTermPlan_t
+{
+    /// A query position, that is the LF the term was computed from
+    /// (the pivot for bi-terms) and the slot of the term.
+    struct Entry_t
+    {
+        uint32_t k;
+        uint32_t slot;
+    };
+
+    std::vector<int>      Terms;    // Distinct terms, sorted
+    std::vector<Entry_t>  Entries;  // First position of each term, in query order
+
+    void Clear() { Terms.clear(); Entries.clear(); }
+};
+
+/// Outcome of the reranking of a candidate
+struct AUDIONEEX_API_TEST Rerank_t
+{
+    int Ac          {0};
+    int TopBin      {0};
+    int TopBinScore {0};
+};
+
 /// Candidate structure
 struct AUDIONEEX_API_TEST Ac_t
 {
@@ -169,6 +291,18 @@ struct AUDIONEEX_API_TEST MatchResults_t
     }
 
     bool Reranked;
+
+    /// Whether any matching step since last resetting was cut short by
+    /// the time limits (see Matcher::SetStepBudget()).
+    bool Truncated {false};
+};
+
+/// Scores added to the candidates in a matching step. These are kept for
+/// the steps in the score window so they can be taken back as they expire.
+struct AUDIONEEX_API_TEST StepScores_t
+{
+    int T {0};  // Time point of the last query LF in the step
+    std::vector<std::pair<int,int> > Scores;  // <Qi, score>
 };
 
 
@@ -177,19 +311,52 @@ struct AUDIONEEX_API_TEST MatchResults_t
 
 class AUDIONEEX_API_TEST Matcher
 {
-    std::unique_ptr <Codebook>       m_AudioCodes;
+    std::shared_ptr <const Codebook> m_AudioCodes;
 
     MatchResults_t                   m_Results;
     std::vector<QLocalFingerprint_t> Xk;
-    std::vector<uint32_t>            m_XkSeq;
 
     Audioneex::eMatchType            m_MatchType        {MSCALE_MATCH};
     float                            m_RerankThreshold  {0.5};
-    hashtable_Qhisto                 m_TopKMc;
+    hashtable_Qcand                  m_TopKMc;
     Qhisto_t                         m_H;
+    size_t                           m_HSize            {0};
+
+    /// Query terms of the current step and scratch space to compute them.
+    QueryTermPlan_t                  m_TermPlan;
+    std::vector<std::pair<int, uint32_t> > m_TermPositions;
     
 	Audioneex::DataStore*            m_DataStore        {nullptr};
 
+    /// Worker threads used to parallelize the matching (null if serial).
+    std::unique_ptr <WorkerPool>     m_Workers;
+
+    /// Per-partition histograms and top-k lists for the parallel search.
+    std::vector<Qhisto_t>            m_PartH;
+    std::vector<hashtable_Qcand>     m_PartTopK;
+
+    /// Postings list iterators of the search (see SearchCtx_t). In the
+    /// parallel search they're used by the 1st partition.
+    SearchCtx_t                      m_Search;
+    std::vector<SearchCtx_t>         m_PartSearch;
+
+    /// Serializes data store accesses from the worker threads
+    /// (only used if the data store is not reentrant).
+    std::mutex                       m_StoreLock;
+
+    /// Lock shared with other matchers using the same data store, if any
+    /// (see SetStoreLock()). If set, it's used in place of m_StoreLock.
+    std::shared_ptr <std::mutex>     m_SharedStoreLock;
+
+    /// Reranking scratch data (one per worker thread).
+    std::vector<RerankCtx_t>         m_RerankCtx;
+
+    /// Sizes of the candidate fingerprints fetched so far.
+    hashtable_FPSize                 m_FPSizes;
+
+    /// Optional cache of fingerprint pages (may be shared).
+    std::shared_ptr <DataStoreImpl::FingerprintCache> m_FPCache;
+
     /// Pointer to the start of current LF batch being matched.
     int m_ko     {0};
 
@@ -199,21 +366,117 @@ class AUDIONEEX_API_TEST Matcher
     /// Number of processing steps performed so far.
     int m_Nsteps {0};
 
+    /// Number of LFs received since last resetting and whether their IDs
+    /// have been sequential so far.
+    uint32_t m_XkCount {0};
+    bool     m_XkValid {true};
+
+    /// Length of the score window in seconds (0 = unbounded) and the scores
+    /// added by the steps within the window.
+    float                    m_ScoreWindow {0};
+    std::deque<StepScores_t> m_StepScores;
+
+    /// Time budget of a matching step in microseconds (0 = unlimited), the
+    /// deadline set by the client and the one of the current step (the
+    /// earliest of the two), and whether the current step ran out of time.
+    typedef std::chrono::steady_clock clock;
+
+    size_t                   m_StepBudget   {0};
+    clock::time_point        m_Deadline     {clock::time_point::max()};
+    clock::time_point        m_StepDeadline {clock::time_point::max()};
+    std::atomic<bool>        m_StepTruncated {false};
+
+    /// Fraction of the query terms searched at each step, the least costly
+    /// first (see SetTermRatio()).
+    float                    m_TermRatio    {1.f};
+
+    /// Minimum number of FIDs per partition in the parallel search.
+    /// Smaller ranges are not worth the threading overhead.
+    uint32_t                 m_MinSearchPartition {1000};
+
+    /// Statistics of the matching (see GetStats()). The lock serializes the
+    /// updates made by the parallel searches.
+    MatchStats_t             m_Stats;
+    std::mutex               m_StatsLock;
+
     /// Minimum score to be considered in the match stage.
 	/// Anything smaller will be ignored.
     const static int MIN_ACCEPT_SCORE = Pms::Smax * 2;
 
+    /// Maximum length of the tie lists in the top-k candidates list.
+    const static int MAX_TIE_LIST = 10;
+
+    /// Upper bound of the FID space
+    const static uint32_t FID_MAX = std::numeric_limits<uint32_t>::max();
+
+    /// Number of FIDs scanned between checks of the step deadline.
+    const static uint32_t DEADLINE_CHECK_INTERVAL = 64;
+
 #ifdef PLOTTING_ENABLED
     std::vector< std::vector<float> > Mc;
 #endif
 
     bool  ValidQuerySequence();
+    void  TrimQuery();
+    void  AccumulateScore(int Qi, int score);
+    bool  ExpireScores();
+    void  AppendQuery(const lf_vector &lfs);
+    void  AppendQuery(const std::vector<QLocalFingerprint_t> &qlfs, uint32_t firstID);
+    int   DoSteps(bool lookahead);
+    bool  HasLookahead(size_t kn) const;
     void  DoMatch(int ko, int kn);
-    void  FindCandidatesBWords(int ko, int kn);
-    void  FindCandidatesSWords(int ko, int kn);
+    void  BeginMatch(int ko, int kn);
+    void  EndMatch();
+    static void MatchBatch(const std::vector<Matcher*>& batch, const std::vector<int>& Nlf);
+    static void FindCandidatesBatch(const std::vector<Matcher*>& batch);
+    void  BuildTermPlan(int ko, int kn, /*[out]*/QueryTermPlan_t& plan);
+    bool  OutOfTime();
+    size_t DropTerms(const plist_iterators& iterators, std::vector<bool>& EOL_iterators);
+    size_t SelectTerms(const plist_iterators& iterators, std::vector<bool>& EOL_iterators) const;
+    void  FindCandidatesParallel(const QueryTermPlan_t& plan);
+    void  FindCandidates(const QueryTermPlan_t& plan, uint32_t FIDlo, uint32_t FIDhi,
+                         Qhisto_t& H, hashtable_Qcand& TopK, SearchCtx_t& ctx,
+                         std::mutex* lock);
+    void  FindCandidatesBWords(const QueryTermPlan_t& plan, uint32_t FIDlo, uint32_t FIDhi,
+                               Qhisto_t& H, hashtable_Qcand& TopK, SearchCtx_t& ctx,
+                               std::mutex* lock);
+    void  FindCandidatesSWords(const QueryTermPlan_t& plan, uint32_t FIDlo, uint32_t FIDhi,
+                               Qhisto_t& H, hashtable_Qcand& TopK, SearchCtx_t& ctx,
+                               std::mutex* lock);
+    void  ScorePostingBWords(const DataStoreImpl::Posting_t& post, size_t k, Qhisto_t& H,
+                             std::unique_ptr<DataStoreImpl::PListIterator>& bins_it,
+                             std::mutex* lock);
+    void  ScorePostingSWords(const DataStoreImpl::Posting_t& post, size_t k, Qhisto_t& H,
+                             std::unique_ptr<DataStoreImpl::PListIterator>& bins_it,
+                             std::mutex* lock);
+    void  CreatePListIterators(const QueryTermPlan_t& plan, uint32_t FIDlo,
+                               /*[out]*/SearchCtx_t& ctx, std::mutex* lock);
+    void  AddSearchStats(const plist_iterators& iterators,
+                         const DataStoreImpl::PListIterator* bins_it, uint64_t FIDs);
+    int   GetTimeBin(std::unique_ptr<DataStoreImpl::PListIterator>& bins_it,
+                     uint32_t FID, int LID, /*[out]*/int& T, std::mutex* lock);
+    void  UpdateTopK(const Qhisto_t& H, hashtable_Qcand& TopK);
+    void  MergeTopK(hashtable_Qcand& TopK);
+    void  SummarizeHisto(const Qhisto_t& H, /*[out]*/Qcand_t& C);
     void  Reranking();
-    void  GraphMatching(Qhisto_t& Qhisto_i, int bin, /*[out]*/Qhisto_t& Qhisto);
-    void  BuildGraphs(const QLocalFingerprint_t *lfs, size_t Nlfs, int iRef, hashtable_qlf_pair &H);
+    void  RerankCandidate(const Qcand_t& C, size_t fp_size, RerankCtx_t& ctx,
+                          /*[out]*/Rerank_t& res, std::mutex* lock);
+    void  GraphMatching(int Qi, size_t fp_size, const Qcand_t::Peak_t& peak,
+                        RerankCtx_t& ctx, std::mutex* lock);
+    size_t GetFingerprintSize(uint32_t Qi);
+    std::mutex* StoreLock() {
+        return m_DataStore->IsReentrant() ? nullptr :
+               m_SharedStoreLock ? m_SharedStoreLock.get() : &m_StoreLock;
+    }
+    /// The lock for the accesses made by the calling thread, which need only
+    /// be serialized if the data store is shared with other matchers.
+    std::mutex* SerialStoreLock() {
+        return m_SharedStoreLock ? StoreLock() : nullptr;
+    }
+    void  GetFingerprint(uint32_t Qi, size_t fp_size, int LIDo, int Nlf,
+                         /*[out]*/std::vector<QLocalFingerprint_t>& Qh,
+                         MatchStats_t& stats, std::mutex* lock);
+    void  BuildGraphs(const QLocalFingerprint_t *lfs, size_t Nlfs, int iRef, graph_edges &G);
 
 friend class RecognizerImpl;
 
@@ -229,6 +492,24 @@ friend class RecognizerImpl;
     /// to execute a processing step is available).
     int Process(const lf_vector &lfs);
 
+    /// Process a stream of LFs that have already been quantized by Quantize(),
+    /// the first of which has the given ID. This allows the quantization to be
+    /// performed elsewhere (e.g. on another thread while the matcher is busy
+    /// with the previous LFs). If 'more' is true the stream is a part of a
+    /// larger one still being produced, and the processing steps are deferred
+    /// until enough of the following LFs are available for them to have the
+    /// same results as calling Process() once on the whole stream. The last
+    /// part (possibly empty) must be given with 'more' set to false.
+    int ProcessQuantized(const std::vector<QLocalFingerprint_t> &qlfs,
+                         uint32_t firstID, bool more=false);
+
+    /// Quantize a LF with the audio codes used by the matcher. This method
+    /// may be called concurrently with the matching.
+    QLocalFingerprint_t Quantize(const LocalFingerprint_t &lf) const;
+
+    /// Quantize a LF with the given audio codes
+    static QLocalFingerprint_t Quantize(const Codebook &codes, const LocalFingerprint_t &lf);
+
     /// Get the current match results. This method can be called at any point
     /// during the matching stage (after Process()) to analyze the matching
     /// status. Note that the matcher does not perform the final identification,
@@ -242,11 +523,31 @@ friend class RecognizerImpl;
     /// Return the number of flushed LFs, if any.
     int Flush();
 
+    /// Process many LF streams at once, one per matcher, as by calling
+    /// Process() on each matcher. The matching steps are performed in lockstep
+    /// and those performed at the same time share the candidates search, that
+    /// is each postings list is scanned once for all the queries, which saves
+    /// most of the index accesses when the queries share many terms (e.g. in
+    /// offline identification of large sets of clips). The batched searches are
+    /// performed on the calling thread. All the matchers must use the same
+    /// data store and match type. The number of LFs processed by each matcher
+    /// is returned in 'processed'.
+    static void ProcessBatch(const std::vector<Matcher*>& matchers,
+                             const std::vector<const lf_vector*>& lfs,
+                             /*[out]*/std::vector<int>& processed);
+
+    /// Flush the query sequences of many matchers at once, as by calling
+    /// Flush() on each matcher (see ProcessBatch()). The number of LFs flushed
+    /// by each matcher is returned in 'flushed'.
+    static void FlushBatch(const std::vector<Matcher*>& matchers,
+                           /*[out]*/std::vector<int>& flushed);
+
     /// Reset the internal state of the matching. This method should be called
     /// by the classification module once a classification has been made, or if
     /// the classification cannot be made within a set period of time.
     /// A call to this method is not necessary if the Matcher instance is not
-    /// being reused after the classification.
+    /// being reused after the classification. The buffers used by the matching
+    /// are released, so idle matchers take little memory.
     void Reset();
 
     /// Get the length of the audio being matched since last resetting (or start)
@@ -262,9 +563,34 @@ friend class RecognizerImpl;
     /// the processing if it does not receive enough data.
     float GetStepsCount() const { return m_Nsteps; }
 
+    /// Get the statistics of the matching. They are cumulative across the
+    /// calls to Reset() and are only collected in builds with statistics
+    /// enabled (see STATS_HERE).
+    const MatchStats_t& GetStats() const { return m_Stats; }
+
+    /// Clear the statistics of the matching.
+    void ResetStats() { m_Stats = MatchStats_t(); }
+
     /// Set the data provider
     void SetDataStore(Audioneex::DataStore* dstore);
 
+    /// Set the audio codes used to quantize the query LFs. They can be shared
+    /// by many matchers. If not set, a private copy is loaded by SetDataStore().
+    void SetCodebook(const std::shared_ptr<const Codebook> &codes) { m_AudioCodes = codes; }
+
+    /// Get the audio codes
+    std::shared_ptr<const Codebook> GetCodebook() const { return m_AudioCodes; }
+
+    /// Set a lock to serialize the accesses to the data store with other
+    /// matchers using it concurrently from different threads. It's only used
+    /// if the data store is not reentrant (see DataStore::IsReentrant()).
+    void SetStoreLock(const std::shared_ptr<std::mutex> &lock) { m_SharedStoreLock = lock; }
+
+    /// Get the (approximate) amount of memory in bytes owned by this matcher.
+    /// The shared resources (audio codes, fingerprint cache, worker threads)
+    /// are not included.
+    size_t GetMemoryUsage() const;
+
     /// Getter
     DataStore* GetDataStore() const { return m_DataStore; }
 
@@ -284,6 +610,17 @@ friend class RecognizerImpl;
 
     /// Get the threshold used for adaptive reranking.
     float GetRerankThreshold() const { return m_RerankThreshold; }
+
+    /// Set the length (in seconds) of the window over which the candidates'
+    /// scores are accumulated. The scores added by the matching steps older
+    /// than this are discarded, so that the results reflect the most recent
+    /// audio only, which allows matching a continuous stream without resetting
+    /// (see Recognizer::SetMonitoringWindow()). A value of 0 (the default)
+    /// accumulates the scores since last resetting.
+    void SetScoreWindow(float seconds);
+
+    /// Get the length of the score window (0 = unbounded)
+    float GetScoreWindow() const { return m_ScoreWindow; }
     
     /// Set the maximum duration of the recordings in the database.
     /// This value will be used internally to optimize the efficiency of some data
@@ -291,6 +628,68 @@ friend class RecognizerImpl;
     /// but doing so excessive reallocations of such structures might be avoided.
     void SetMaxRecordingDuration(size_t duration);
 
+    /// Set the number of threads used to perform the matching. If greater
+    /// than 1, the candidates search at each step is split into FID ranges
+    /// that are searched concurrently and whose results are then merged,
+    /// and the top-k candidates are reranked concurrently.
+    /// The results are the same as those obtained with a single thread.
+    void SetThreads(size_t nthreads);
+
+    /// Get the number of threads used to perform the matching.
+    size_t GetThreads() const { return m_Workers ? m_Workers->Size() : 1; }
+
+    /// Set the minimum number of FIDs searched by each thread (1000 by default).
+    /// Catalogues too small to give every thread this many are searched by
+    /// a single thread.
+    void SetMinSearchPartition(uint32_t nfids);
+
+    /// Get the minimum number of FIDs searched by each thread.
+    uint32_t GetMinSearchPartition() const { return m_MinSearchPartition; }
+
+    /// Set the maximum time in microseconds a matching step may take (0, the
+    /// default, means no limit). When a step runs out of time the candidates
+    /// search stops scanning the postings lists, the longest ones first, and
+    /// the reranking, which is performed on the best candidates first, skips
+    /// the remaining candidates. The results of the step are then the best
+    /// found so far and are flagged as truncated (see MatchResults_t). The
+    /// limit does not apply to the batched processing (see ProcessBatch()).
+    void SetStepBudget(size_t us) { m_StepBudget = us; }
+
+    /// Get the time budget of a matching step (0 = unlimited)
+    size_t GetStepBudget() const { return m_StepBudget; }
+
+    /// Set a point in time by which the matching steps must be completed, as
+    /// for the step budget. The steps starting after it are skipped. Pass
+    /// time_point::max() to remove it (the default).
+    void SetDeadline(const std::chrono::steady_clock::time_point &deadline)
+    { m_Deadline = deadline; }
+
+    /// Set the fraction of the query terms to be searched at each step. The
+    /// terms are ranked by the cost of scanning their postings lists, as given
+    /// by the statistics in the lists' headers, and only the given fraction of
+    /// the least costly ones is searched. The most costly terms are also the
+    /// least selective, as they occur in most fingerprints, so leaving them
+    /// out trades little recall for a large part of the scanning cost. A value
+    /// of 1 (the default) searches all the terms. This setting does not apply
+    /// to the batched processing (see ProcessBatch()).
+    void SetTermRatio(float ratio);
+
+    /// Get the fraction of the query terms searched at each step
+    float GetTermRatio() const { return m_TermRatio; }
+
+    /// Set a cache of fingerprint pages to be used during the reranking in
+    /// front of the data store. A cache can be shared by multiple matchers
+    /// as long as they all use the same fingerprints database. Pass null
+    /// to read directly from the data store (the default). The cache is
+    /// meant for databases that are not modified while in use, so it must
+    /// be cleared if the data store is reopened (see FingerprintCache).
+    void SetFingerprintCache(const std::shared_ptr<DataStoreImpl::FingerprintCache> &cache)
+    { m_FPCache = cache; }
+
+    /// Get the fingerprint cache, if any.
+    std::shared_ptr<DataStoreImpl::FingerprintCache> GetFingerprintCache() const
+    { return m_FPCache; }
+
 };
 
 }// end namespace Audioneex
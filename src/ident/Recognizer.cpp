@@ -9,9 +9,14 @@
 
 #include <cmath>
 #include <climits>
+#include <algorithm>
+#include <thread>
 
 #include "common.h"
 #include "Recognizer.h"
+#include "WorkerPool.h"
+#include "LFStream.h"
+#include "Stats.h"
 #include "audioneex.h"
 
 #ifdef TESTING
@@ -20,10 +25,109 @@
 
 TEST_HERE( namespace { Audioneex::Tester TEST; } )
 
+namespace {
+
+/// Worker threads performing the asynchronous identifications, shared by all
+/// the recognizers. The pool is created on first use.
+std::mutex                               g_AsyncPoolLock;
+std::unique_ptr <Audioneex::WorkerPool>  g_AsyncPool;
+size_t                                   g_AsyncThreads = 0;
+
+size_t DefaultAsyncThreads()
+{
+    size_t nthreads = std::thread::hardware_concurrency();
+    return nthreads > 0 ? nthreads : 1;
+}
+
+void SubmitAsync(std::function<void()> task)
+{
+    std::lock_guard<std::mutex> lock (g_AsyncPoolLock);
+
+    if(!g_AsyncPool)
+       g_AsyncPool.reset( new Audioneex::WorkerPool(g_AsyncThreads ? g_AsyncThreads
+                                                                   : DefaultAsyncThreads()) );
+    // The futures are not needed as the tasks handle their own errors
+    g_AsyncPool->Submit( std::move(task) );
+}
+
+/// Add the statistics of a matcher to those of a recognizer
+void AddStats(Audioneex::RecognizerStats &stats, const Audioneex::MatchStats_t &mstats)
+{
+    stats.QuantizeTime     += mstats.QuantizeTime;
+    stats.Steps            += mstats.Steps;
+    stats.SearchTime       += mstats.SearchTime;
+    stats.BlocksFetched    += mstats.BlocksFetched;
+    stats.BytesDecoded     += mstats.BytesDecoded;
+    stats.PostingsScanned  += mstats.PostingsScanned;
+    stats.FIDsScored       += mstats.FIDsScored;
+    stats.RerankTime       += mstats.RerankTime;
+    stats.GraphMatchings   += mstats.GraphMatchings;
+    stats.FingerprintBytes += mstats.FingerprintBytes;
+    stats.CacheHits        += mstats.CacheHits;
+    stats.CacheMisses      += mstats.CacheMisses;
+}
+
+/// Add the statistics of a recognizer to those of another
+void AddStats(Audioneex::RecognizerStats &stats, const Audioneex::RecognizerStats &rstats)
+{
+    stats.Frames           += rstats.Frames;
+    stats.SilentFrames     += rstats.SilentFrames;
+    stats.FlatFrames       += rstats.FlatFrames;
+    stats.GatedChunks      += rstats.GatedChunks;
+    stats.Calls            += rstats.Calls;
+    stats.WallTime         += rstats.WallTime;
+    stats.CPUTime          += rstats.CPUTime;
+    stats.LFs              += rstats.LFs;
+    stats.FFTTime          += rstats.FFTTime;
+    stats.PeaksTime        += rstats.PeaksTime;
+    stats.POITime          += rstats.POITime;
+    stats.DescriptorsTime  += rstats.DescriptorsTime;
+    stats.QuantizeTime     += rstats.QuantizeTime;
+    stats.Steps            += rstats.Steps;
+    stats.SearchTime       += rstats.SearchTime;
+    stats.BlocksFetched    += rstats.BlocksFetched;
+    stats.BytesDecoded     += rstats.BytesDecoded;
+    stats.PostingsScanned  += rstats.PostingsScanned;
+    stats.FIDsScored       += rstats.FIDsScored;
+    stats.RerankTime       += rstats.RerankTime;
+    stats.GraphMatchings   += rstats.GraphMatchings;
+    stats.FingerprintBytes += rstats.FingerprintBytes;
+    stats.CacheHits        += rstats.CacheHits;
+    stats.CacheMisses      += rstats.CacheMisses;
+}
+
+}// end anonymous namespace
+
 
 /// Version string
 const char* Audioneex::GetVersion() { return ENGINE_VERSION_STR; }
 
+// ----------------------------------------------------------------------------
+
+void Audioneex::SetAsyncThreads(size_t nthreads)
+{
+    if(nthreads == 0)
+       throw Audioneex::InvalidParameterException("Invalid number of threads. Must be > 0");
+
+    std::unique_ptr <WorkerPool> old_pool;
+    {
+        std::lock_guard<std::mutex> lock (g_AsyncPoolLock);
+        g_AsyncThreads = nthreads;
+        old_pool = std::move(g_AsyncPool);
+    }
+    // The queued tasks are completed by the old pool, which may requeue
+    // their follow-ups in the new one.
+    old_pool.reset();
+}
+
+// ----------------------------------------------------------------------------
+
+size_t Audioneex::GetAsyncThreads()
+{
+    std::lock_guard<std::mutex> lock (g_AsyncPoolLock);
+    return g_AsyncThreads ? g_AsyncThreads : DefaultAsyncThreads();
+}
+
 //=============================================================================
 //                               Recognizer
 //=============================================================================
@@ -37,18 +141,35 @@ Audioneex::Recognizer* Audioneex::Recognizer::Create() {
 //=============================================================================
 
 Audioneex::RecognizerImpl::RecognizerImpl() :
-    m_AudioBuffer          (Pms::Fs * 2.5 * Pms::Ca, Pms::Fs, Pms::Ca, 0),
+    m_AudioBufferSize      (Pms::Fs * 2.5 * Pms::Ca),
     m_Fingerprint          (Pms::Fs * 2.5 * Pms::Ca),
     m_IdType               (FUZZY_IDENTIFICATION),
     m_IdMode               (EASY_IDENTIFICATION),
     m_BinaryIdThreshold    (0.9),
 	m_BinaryIdMinTime      (0.f),
-    m_IdTime               (0.0)
+    m_IdTime               (0.0),
+    m_Deadline             (0),
+    m_Stats                (),
+    m_MonitorWindow        (0.f),
+    m_Segment              (),
+    m_SegmentSeen          (0.0),
+    m_AsyncRunning         (false)
 {
 }
 
 // ----------------------------------------------------------------------------
 
+Audioneex::RecognizerImpl::~RecognizerImpl()
+{
+    // Wait for the pending asynchronous identifications, if any. This would
+    // never return if called from a callback of this recognizer (see
+    // Recognizer::IdentifyAsync()).
+    std::unique_lock<std::mutex> lock (m_AsyncLock);
+    m_AsyncIdle.wait(lock, [this]{ return !m_AsyncRunning; });
+}
+
+// ----------------------------------------------------------------------------
+
 void Audioneex::RecognizerImpl::SetMatchType(eMatchType type)
 {
     if(type != MSCALE_MATCH && type != XSCALE_MATCH)
@@ -116,6 +237,71 @@ void Audioneex::RecognizerImpl::SetMaxRecordingDuration(size_t duration)
 
 // ----------------------------------------------------------------------------
 
+void Audioneex::RecognizerImpl::SetMatchThreads(size_t nthreads)
+{
+    if(nthreads == 0)
+       throw Audioneex::InvalidParameterException("Invalid number of threads. Must be > 0");
+
+    m_Matcher.SetThreads(nthreads);
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::RecognizerImpl::SetMonitoringWindow(float seconds)
+{
+    if(seconds < 0)
+       throw Audioneex::InvalidParameterException("Invalid monitoring window. Must be >= 0");
+
+    m_MonitorWindow = seconds;
+    m_Matcher.SetScoreWindow(seconds);
+
+    Reset();
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::RecognizerImpl::SetPipelining(bool enable)
+{
+    if(!enable){
+       m_Pipeline.reset();
+       m_Handoff.reset();
+    }
+    else if(!m_Pipeline){
+       m_Handoff.reset( new SPSCQueue<LFBatch_t>(PIPELINE_DEPTH) );
+       m_Pipeline.reset( new WorkerPool(1) );
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::RecognizerImpl::SetStepBudget(size_t us)
+{
+    m_Matcher.SetStepBudget(us);
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::RecognizerImpl::SetDeadline(size_t us)
+{
+    m_Deadline = us;
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::RecognizerImpl::SetTermRatio(float ratio)
+{
+    m_Matcher.SetTermRatio(ratio);
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::RecognizerImpl::SetGateLevel(float level)
+{
+    m_Fingerprint.SetGateLevel(level);
+}
+
+// ----------------------------------------------------------------------------
+
 void Audioneex::RecognizerImpl::Identify(const float *audio, size_t nsamples)
 {
     if(audio == nullptr)
@@ -125,23 +311,448 @@ void Audioneex::RecognizerImpl::Identify(const float *audio, size_t nsamples)
     if(nsamples == 0)
        return;
 
+    STATS_HERE( Stats::WallTimer wall (m_Stats.WallTime);
+                Stats::CPUTimer cpu (m_Stats.CPUTime);
+                m_Stats.Calls++; )
+
+    StartDeadline();
+
+    float dt_proc = 0.f;
+    int processed = 0;
+
+    if(m_Pipeline)
+       processed = ProcessPipelined(audio, nsamples, dt_proc);
+    else{
+       dt_proc = ProcessAudio(audio, nsamples);
+       processed = m_Matcher.Process( m_Fingerprint.Get() );
+    }
+
+    // Process match results, if any (see Match::Process())
+    if(m_MonitorWindow > 0)
+       ProcessMonitorResults( processed );
+    else
+       ProcessMatchResults( processed, dt_proc );
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::RecognizerImpl::IdentifyFingerprint(const uint8_t *data, size_t size)
+{
+    if(data == nullptr)
+       throw Audioneex::InvalidParameterException("Got null stream pointer");
+
+    STATS_HERE( Stats::WallTimer wall (m_Stats.WallTime);
+                Stats::CPUTimer cpu (m_Stats.CPUTime);
+                m_Stats.Calls++; )
+
+    lf_vector lfs;
+    std::vector<QLocalFingerprint_t> qlfs;
+
+    LFStream::Info_t info = LFStream::Decode(data, size, lfs, qlfs);
+
+    StartDeadline();
+
+    // The stream stands for the audio it was extracted from (see ProcessAudio())
+    float dt_proc = info.Samples / (Pms::Ca * static_cast<float>(Pms::Fs));
+
+    m_IdTime += dt_proc;
+    m_Events.clear();
+
+    int processed = 0;
+
+    if(info.Type == LFStream::QUANTIZED_LFS)
+       processed = m_Matcher.ProcessQuantized(qlfs, info.FirstID);
+    else
+       processed = m_Matcher.Process(lfs);
+
+    if(m_MonitorWindow > 0)
+       ProcessMonitorResults( processed );
+    else
+       ProcessMatchResults( processed, dt_proc );
+}
+
+// ----------------------------------------------------------------------------
+
+float Audioneex::RecognizerImpl::ProcessAudio(const float *audio, size_t nsamples)
+{
     // Any audio exceeding the internal buffer capacity will be discarded.
     // This limits the length of the audio snippets that the recognizer
     // can accept to the internal buffer length.
-    if(m_AudioBuffer.Capacity() < nsamples)
+    if(m_AudioBufferSize < nsamples){
        WARNING_MSG("Buffer overflow. Data truncation will occur.")
+       nsamples = m_AudioBufferSize;
+    }
 
-    m_AudioBuffer.SetData(audio, nsamples);
-    m_IdTime += m_AudioBuffer.Duration();
+    // The audio buffer is only needed during the call, so it is shared by
+    // all the recognizers running on this thread.
+    static thread_local AudioBlock<float> audioBuffer;
 
-    m_Fingerprint.Process(m_AudioBuffer);
-    const lf_vector &lfs = m_Fingerprint.Get();
-    int processed = m_Matcher.Process(lfs);
+    if(audioBuffer.Capacity() < m_AudioBufferSize)
+       audioBuffer = AudioBlock<float>(m_AudioBufferSize, Pms::Fs, Pms::Ca, 0);
 
-    // Process match results, if any (see Match::Process())
-    ProcessMatchResults( processed, m_AudioBuffer.Duration() );
+    audioBuffer.SetData(audio, nsamples);
+
+    float duration = audioBuffer.Duration();
+
+    m_IdTime += duration;
+    m_Events.clear();
+
+    m_Fingerprint.Process(audioBuffer);
+
+    audioBuffer.Resize(0);
+
+    // A chunk that is entirely gated produces no LFs, so the matcher has
+    // nothing to process and the identification only advances in time.
+    const GateStats_t &gate = m_Fingerprint.GetGateStats();
+
+    m_Stats.Frames += gate.Frames;
+    m_Stats.SilentFrames += gate.Silent;
+    m_Stats.FlatFrames += gate.Flat;
+
+    if(gate.Frames > 0 && gate.Silent + gate.Flat == gate.Frames)
+       m_Stats.GatedChunks++;
+
+    STATS_HERE(
+        const StageTimes_t &times = m_Fingerprint.GetStageTimes();
+
+        m_Stats.LFs             += m_Fingerprint.Get().size();
+        m_Stats.FFTTime         += times.FFT;
+        m_Stats.PeaksTime       += times.Peaks;
+        m_Stats.POITime         += times.POI;
+        m_Stats.DescriptorsTime += times.Descriptors;
+    )
+
+    return duration;
+}
+
+// ----------------------------------------------------------------------------
+
+int Audioneex::RecognizerImpl::ProcessPipelined(const float *audio,
+                                                size_t nsamples,
+                                                float &dt_proc)
+{
+    // Fail here rather than on the pipeline thread
+    if(m_Matcher.GetDataStore() == nullptr)
+       throw Audioneex::InvalidParameterException
+             ("No data provider set.");
+
+    // Stage 1: the LFs are quantized as they are extracted and handed over
+    // in batches of Nk, so that the matching of a batch can proceed while
+    // the next ones are being computed. The end of the audio is always
+    // signaled, even on errors, so the matching stage never hangs.
+    std::future<void> stage1 = m_Pipeline->Submit( [&]
+    {
+        // This thread's CPU time is not seen by the caller's timer
+        STATS_HERE( Stats::CPUTimer cpu (m_Stats.CPUTime); )
+
+        LFBatch_t batch;
+
+        m_Fingerprint.SetCallback( [&](const LocalFingerprint_t &lf)
+        {
+            if(batch.LFs.empty())
+               batch.ID = lf.ID;
+
+            {
+               STATS_HERE( Stats::WallTimer timer (m_Stats.QuantizeTime); )
+               batch.LFs.push_back( m_Matcher.Quantize(lf) );
+            }
+
+            if(batch.LFs.size() == Pms::Nk){
+               m_Handoff->Push( std::move(batch) );
+               batch = LFBatch_t();
+            }
+        });
+
+        try{
+            dt_proc = ProcessAudio(audio, nsamples);
+        }
+        catch(...){
+            m_Fingerprint.SetCallback(nullptr);
+            m_Handoff->Push( LFBatch_t() );
+            throw;
+        }
+
+        m_Fingerprint.SetCallback(nullptr);
+
+        if(!batch.LFs.empty())
+           m_Handoff->Push( std::move(batch) );
+
+        m_Handoff->Push( LFBatch_t() );
+    });
+
+    // Stage 2: match the batches as they come
+    int processed = 0;
+    LFBatch_t batch;
+
+    try{
+        for(m_Handoff->Pop(batch); !batch.LFs.empty(); m_Handoff->Pop(batch))
+            processed += m_Matcher.ProcessQuantized(batch.LFs, batch.ID, true);
+
+        processed += m_Matcher.ProcessQuantized(batch.LFs, 0, false);
+    }
+    catch(...){
+        // Let the fingerprinting run to the end before leaving
+        while(!batch.LFs.empty())
+            m_Handoff->Pop(batch);
+        stage1.wait();
+        throw;
+    }
+
+    // Rethrow the fingerprinting errors, if any
+    stage1.get();
+
+    return processed;
+}
+
+// ----------------------------------------------------------------------------
+
+std::future<void> Audioneex::RecognizerImpl::IdentifyAsync(const float *audio,
+                                                           size_t nsamples,
+                                                           IdentifyCallback callback)
+{
+    if(audio == nullptr)
+       throw Audioneex::InvalidParameterException("Got null audio pointer");
+
+    AsyncJob_t job;
+    job.Audio.assign(audio, audio + nsamples);
+    job.Callback = std::move(callback);
+
+    std::future<void> done = job.Done.get_future();
+
+    std::lock_guard<std::mutex> lock (m_AsyncLock);
+
+    m_AsyncJobs.push_back( std::move(job) );
+
+    // Only one task at a time per recognizer is queued in the shared pool,
+    // which preserves the order of the identifications.
+    if(!m_AsyncRunning)
+    {
+        try{
+            SubmitAsync( [this]{ RunAsyncJob(); } );
+        }
+        catch(...){
+            m_AsyncJobs.pop_back();
+            throw;
+        }
+        m_AsyncRunning = true;
+    }
 
-    m_AudioBuffer.Resize(0);
+    return done;
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::RecognizerImpl::IdentifyBatch(const float* const* clips,
+                                              const size_t* nsamples,
+                                              size_t nclips)
+{
+    if(nclips > 0 && (clips == nullptr || nsamples == nullptr))
+       throw Audioneex::InvalidParameterException("Got null clips pointer");
+
+    for(size_t i=0; i<nclips; i++)
+        if(clips[i] == nullptr)
+           throw Audioneex::InvalidParameterException("Got null audio pointer");
+
+    if(GetDataStore() == nullptr)
+       throw Audioneex::InvalidParameterException("No data provider set.");
+
+    STATS_HERE( Stats::WallTimer wall (m_Stats.WallTime);
+                Stats::CPUTimer cpu (m_Stats.CPUTime);
+                m_Stats.Calls++; )
+
+    // The sessions are kept between batches to save their reallocation
+    m_BatchSessions.resize(nclips);
+
+    for(std::unique_ptr<RecognizerImpl> &session : m_BatchSessions)
+    {
+        if(!session)
+           session.reset(new RecognizerImpl);
+        else
+           session->Reset();
+
+        ConfigureSession(*session);
+    }
+
+    std::vector<size_t>                 offsets (nclips, 0);
+    std::vector<RecognizerImpl*>        active;
+    std::vector<Matcher*>               matchers;
+    std::vector<const lf_vector*>       lfs;
+    std::vector<float>                  durations;
+    std::vector<int>                    processed;
+
+    // Feed the next chunk of each clip to its session until all the sessions
+    // have given a response or run out of audio, matching all the chunks of
+    // each round in a batch.
+    for(;;)
+    {
+        active.clear();
+        matchers.clear();
+        lfs.clear();
+        durations.clear();
+
+        for(size_t i=0; i<nclips; i++)
+        {
+            RecognizerImpl &session = *m_BatchSessions[i];
+
+            if(!session.m_IdMatches.empty() || offsets[i] >= nsamples[i])
+               continue;
+
+            size_t n = std::min(nsamples[i] - offsets[i], m_AudioBufferSize);
+
+            durations.push_back( session.ProcessAudio(clips[i] + offsets[i], n) );
+            offsets[i] += n;
+
+            active.push_back(&session);
+            matchers.push_back(&session.m_Matcher);
+            lfs.push_back(&session.m_Fingerprint.Get());
+        }
+
+        if(active.empty())
+           break;
+
+        Matcher::ProcessBatch(matchers, lfs, processed);
+
+        for(size_t i=0; i<active.size(); i++)
+            active[i]->ProcessMatchResults( processed[i], durations[i] );
+    }
+
+    // Flush the sessions that have not given a response (see Flush())
+    std::vector<float> To;
+
+    active.clear();
+    matchers.clear();
+
+    for(std::unique_ptr<RecognizerImpl> &session : m_BatchSessions)
+    {
+        if(session->m_IdMatches.empty()){
+           active.push_back(session.get());
+           matchers.push_back(&session->m_Matcher);
+           To.push_back(session->m_Matcher.GetMatchTime());
+        }
+    }
+
+    Matcher::FlushBatch(matchers, processed);
+
+    for(size_t i=0; i<active.size(); i++)
+        if(processed[i])
+           active[i]->ProcessMatchResults( processed[i],
+                                           active[i]->m_Matcher.GetMatchTime() - To[i] );
+
+    // Only the results are needed from now on
+    for(std::unique_ptr<RecognizerImpl> &session : m_BatchSessions)
+    {
+        AddStats(m_Stats, session->GetStats());
+
+        session->m_Matcher.Reset();
+        session->m_Fingerprint.Reset();
+        session->m_MatchAcc.clear();
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+Audioneex::IdMatch* Audioneex::RecognizerImpl::GetBatchResults(size_t clip)
+{
+    if(clip >= m_BatchSessions.size())
+       throw Audioneex::InvalidParameterException("Invalid clip index");
+
+    return m_BatchSessions[clip]->GetResults();
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::RecognizerImpl::ConfigureSession(RecognizerImpl &session) const
+{
+    session.m_IdType            = m_IdType;
+    session.m_IdMode            = m_IdMode;
+    session.m_BinaryIdThreshold = m_BinaryIdThreshold;
+    session.m_BinaryIdMinTime   = m_BinaryIdMinTime;
+    session.m_AudioBufferSize   = m_AudioBufferSize;
+
+    session.ResetStats();
+
+    // The clips are fed in chunks of the maximum length
+    session.m_Fingerprint.SetBufferSize(m_AudioBufferSize);
+    session.m_Fingerprint.SetGateLevel(m_Fingerprint.GetGateLevel());
+
+    Matcher &matcher = session.m_Matcher;
+
+    matcher.SetMatchType( m_Matcher.GetMatchType() );
+    matcher.SetRerankThreshold( m_Matcher.GetRerankThreshold() );
+    matcher.m_HSize = m_Matcher.m_HSize;
+
+    // Share the resources with this recognizer's matcher
+    matcher.SetCodebook( m_Matcher.GetCodebook() );
+    matcher.SetStoreLock( m_Matcher.m_SharedStoreLock );
+    matcher.SetFingerprintCache( m_Matcher.GetFingerprintCache() );
+    matcher.SetDataStore( m_Matcher.GetDataStore() );
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::RecognizerImpl::StartDeadline()
+{
+    typedef std::chrono::steady_clock clock;
+
+    m_Matcher.SetDeadline( m_Deadline ? clock::now() + std::chrono::microseconds(m_Deadline)
+                                      : clock::time_point::max() );
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::RecognizerImpl::RunAsyncJob()
+{
+    AsyncJob_t job;
+    {
+        std::lock_guard<std::mutex> lock (m_AsyncLock);
+        job = std::move( m_AsyncJobs.front() );
+        m_AsyncJobs.pop_front();
+    }
+
+    std::exception_ptr error;
+
+    try{
+        Identify(job.Audio.data(), job.Audio.size());
+    }
+    catch(...){
+        error = std::current_exception();
+    }
+
+    if(job.Callback)
+    {
+        try{
+            job.Callback(*this, error);
+        }
+        catch(...){
+            if(!error) error = std::current_exception();
+        }
+    }
+
+    if(error)
+       job.Done.set_exception(error);
+    else
+       job.Done.set_value();
+
+    // Requeue rather than loop over the pending jobs, so that the recognizers
+    // sharing the pool take turns.
+    std::lock_guard<std::mutex> lock (m_AsyncLock);
+
+    if(!m_AsyncJobs.empty())
+    {
+        try{
+            SubmitAsync( [this]{ RunAsyncJob(); } );
+            return;
+        }
+        catch(...){
+            // Fail the pending jobs if they cannot be queued
+            for(AsyncJob_t &pending : m_AsyncJobs)
+                pending.Done.set_exception( std::current_exception() );
+            m_AsyncJobs.clear();
+        }
+    }
+
+    m_AsyncRunning = false;
+    m_AsyncIdle.notify_all();
 }
 
 // ----------------------------------------------------------------------------
@@ -250,6 +861,76 @@ void Audioneex::RecognizerImpl::ProcessMatchResults(int processed, float dt_proc
 
 // ----------------------------------------------------------------------------
 
+void Audioneex::RecognizerImpl::ProcessMonitorResults(int processed)
+{
+    const MatchResults_t &mresults = m_Matcher.GetResults();
+
+    // The scores are accumulated over the monitoring window only (see
+    // Matcher::SetScoreWindow()), so the top match is that of the most
+    // recent audio and the confidence tracks the changes of content.
+
+    double Tnow = m_Matcher.GetMatchTime();
+    uint32_t FID = 0;
+
+    if(processed && mresults.Top_K.size() >= 1)
+    {
+        TEST_HERE( TEST.Dump(mresults); )
+
+        float top1 = mresults.GetTopScore(1);
+        float top2 = mresults.GetTopScore(2);
+
+        float conf = top1 / (top1 + top2);
+
+        if(conf >= m_BinaryIdThreshold)
+        {
+            // If there are ties keep the current recording, if among them,
+            // so the segment doesn't get split.
+            const std::list<int> &BestQis = mresults.GetTop(1);
+
+            if(std::find(BestQis.begin(), BestQis.end(), m_Segment.FID) != BestQis.end())
+               FID = m_Segment.FID;
+            else
+               FID = BestQis.front();
+        }
+    }
+
+    if(FID != 0)
+    {
+        if(FID != m_Segment.FID)
+        {
+            CloseSegment();
+
+            m_Segment.FID = FID;
+            m_Segment.CuePoint = static_cast<uint32_t>( mresults.GetCuePoint(FID) );
+            m_Segment.StartTime = Tnow;
+
+            m_Events.push_back(m_Segment);
+        }
+
+        // While open, the segment's end time holds the last identification
+        m_Segment.EndTime = Tnow;
+        m_SegmentSeen = m_IdTime;
+    }
+    // The current recording hasn't been identified for a whole window. This
+    // is checked on the stream time, as the match time stands still when no
+    // LFs are extracted (e.g. on silence or gated audio).
+    else if(m_Segment.FID != 0 && m_IdTime - m_SegmentSeen >= m_MonitorWindow)
+        CloseSegment();
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::RecognizerImpl::CloseSegment()
+{
+    if(m_Segment.FID == 0)
+       return;
+
+    m_Events.push_back(m_Segment);
+    m_Segment = MonitorEvent();
+}
+
+// ----------------------------------------------------------------------------
+
 int Audioneex::RecognizerImpl::DoClassification(float Hu, float dT)
 {
     m_Classifier.SetMode( m_IdMode );
@@ -342,13 +1023,41 @@ Audioneex::IdMatch* Audioneex::RecognizerImpl::GetResults()
 
 // ----------------------------------------------------------------------------
 
+Audioneex::MonitorEvent* Audioneex::RecognizerImpl::GetMonitorEvents()
+{
+    if(m_Events.empty())
+       return NULL;
+
+    // Insert an empty element at the end (End Of List marker)
+    if(!IsNull(m_Events.back()))
+       m_Events.push_back(MonitorEvent());
+
+    return m_Events.data();
+}
+
+// ----------------------------------------------------------------------------
+
 void Audioneex::RecognizerImpl::Flush()
 {
+    STATS_HERE( Stats::WallTimer wall (m_Stats.WallTime);
+                Stats::CPUTimer cpu (m_Stats.CPUTime);
+                m_Stats.Calls++; )
+
+    StartDeadline();
+
     float To = m_Matcher.GetMatchTime();
 
     // perform matching of LF stream
     int flushed = m_Matcher.Flush();
 
+    // In monitoring mode the stream ends here, so close the current segment
+    if(m_MonitorWindow > 0){
+       m_Events.clear();
+       ProcessMonitorResults( flushed );
+       CloseSegment();
+       return;
+    }
+
     // Process results, if any
     if(flushed)
        ProcessMatchResults( flushed, m_Matcher.GetMatchTime() - To );
@@ -361,6 +1070,9 @@ void Audioneex::RecognizerImpl::Reset()
     m_IdMatches.clear();
     m_MatchAcc.clear();
     m_IdTime = 0.0;
+    m_Events.clear();
+    m_Segment = MonitorEvent();
+    m_SegmentSeen = 0.0;
     m_Matcher.Reset();
     m_Fingerprint.Reset();
 }
@@ -379,8 +1091,65 @@ void Audioneex::RecognizerImpl::SetAudioBufferSize(float seconds)
     if(seconds < 1 )
        throw Audioneex::InvalidParameterException("Invalid buffer size. Must be >= 1 s");
 
-    size_t bufferSize = Pms::Fs * seconds * Pms::Ca;
-    m_AudioBuffer = AudioBlock<float>(bufferSize, Pms::Fs, Pms::Ca, 0);
+    m_AudioBufferSize = Pms::Fs * seconds * Pms::Ca;
+
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::RecognizerImpl::SetSharedResources
+(const std::shared_ptr<const Codebook> &codes,
+ const std::shared_ptr<std::mutex> &store_lock,
+ const std::shared_ptr<DataStoreImpl::FingerprintCache> &fp_cache)
+{
+    m_Matcher.SetCodebook(codes);
+    m_Matcher.SetStoreLock(store_lock);
+    m_Matcher.SetFingerprintCache(fp_cache);
+}
+
+// ----------------------------------------------------------------------------
+
+size_t Audioneex::RecognizerImpl::GetMemoryUsage() const
+{
+    size_t bytes = sizeof(*this) - sizeof(Fingerprint) - sizeof(Matcher);
+
+    bytes += m_Fingerprint.GetMemoryUsage();
+    bytes += m_Matcher.GetMemoryUsage();
+    bytes += m_IdMatches.capacity() * sizeof(IdMatch);
+    bytes += m_Events.capacity() * sizeof(MonitorEvent);
+    bytes += m_MatchAcc.bucket_count() * sizeof(void*) +
+             m_MatchAcc.size() * (sizeof(hashtable_acc::value_type) + sizeof(void*));
 
+    std::lock_guard<std::mutex> lock (m_AsyncLock);
+
+    for(const AsyncJob_t &job : m_AsyncJobs)
+        bytes += sizeof(AsyncJob_t) + job.Audio.capacity() * sizeof(float);
+
+    for(const std::unique_ptr<RecognizerImpl> &session : m_BatchSessions)
+        bytes += session->GetMemoryUsage();
+
+    if(m_Handoff)
+       bytes += sizeof(WorkerPool) + sizeof(SPSCQueue<LFBatch_t>) +
+                (m_Handoff->Capacity() + 1) * sizeof(LFBatch_t);
+
+    return bytes;
+}
+
+// ----------------------------------------------------------------------------
+
+Audioneex::RecognizerStats Audioneex::RecognizerImpl::GetStats() const
+{
+    // The matching stages are accounted for by the matcher
+    RecognizerStats stats = m_Stats;
+    AddStats(stats, m_Matcher.GetStats());
+    return stats;
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::RecognizerImpl::ResetStats()
+{
+    m_Stats = RecognizerStats();
+    m_Matcher.ResetStats();
 }
 
@@ -10,8 +10,15 @@
 #ifndef RECOGNIZER_H
 #define RECOGNIZER_H
 
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+
 #include "Matcher.h"
 #include "MatchFuzzyClassifier.h"
+#include "WorkerPool.h"
+#include "SPSCQueue.h"
 
 // The following classes are not part of the public API but we need
 // their interfaces exposed when testing DLLs.
@@ -35,12 +42,29 @@ struct IdAcc_t
 
 typedef boost::unordered::unordered_map<uint32_t, IdAcc_t> hashtable_acc;
 
+/// An identification queued by Recognizer::IdentifyAsync()
+struct AsyncJob_t
+{
+    std::vector<float>                Audio;
+    Audioneex::IdentifyCallback       Callback;
+    std::promise<void>                Done;
+};
+
+/// A batch of quantized LFs handed over by the fingerprinting stage of the
+/// pipelined identification (see Recognizer::SetPipelining()). An empty
+/// batch marks the end of the audio chunk.
+struct LFBatch_t
+{
+    uint32_t                          ID {0};
+    std::vector<QLocalFingerprint_t>  LFs;
+};
+
 
 /// Implementation of the Recognizer interface
 
 class AUDIONEEX_API_TEST RecognizerImpl : public Audioneex::Recognizer
 {
-    AudioBlock<float>                 m_AudioBuffer;
+    size_t                            m_AudioBufferSize;
     Fingerprint                       m_Fingerprint;
     Matcher                           m_Matcher;
     MatchFuzzyClassifier              m_Classifier;
@@ -51,6 +75,49 @@ class AUDIONEEX_API_TEST RecognizerImpl : public Audioneex::Recognizer
 	float                             m_BinaryIdMinTime;
     hashtable_acc                     m_MatchAcc;
     double                            m_IdTime;
+    size_t                            m_Deadline;
+    Audioneex::RecognizerStats        m_Stats;
+
+    /// Monitoring mode state (see Recognizer::SetMonitoringWindow())
+    float                             m_MonitorWindow;
+    std::vector<Audioneex::MonitorEvent> m_Events;
+    Audioneex::MonitorEvent           m_Segment;
+    double                            m_SegmentSeen;   ///< Stream time of its last identification
+
+    /// Pending asynchronous identifications (see IdentifyAsync()). At most
+    /// one task per recognizer is queued in the shared worker pool, so the
+    /// identifications are performed in order.
+    std::deque<AsyncJob_t>            m_AsyncJobs;
+    mutable std::mutex                m_AsyncLock;
+    std::condition_variable           m_AsyncIdle;
+    bool                              m_AsyncRunning;
+
+    /// Sessions of the clips identified by IdentifyBatch()
+    std::vector<std::unique_ptr<RecognizerImpl> > m_BatchSessions;
+
+    /// Pipelined identification (see SetPipelining()). The fingerprinting
+    /// runs on a dedicated thread and hands the LFs over to the matching
+    /// in batches of one processing step.
+    std::unique_ptr<WorkerPool>            m_Pipeline;
+    std::unique_ptr<SPSCQueue<LFBatch_t> > m_Handoff;
+
+    /// Max number of LF batches in flight between the pipeline stages
+    const static size_t PIPELINE_DEPTH = 4;
+
+    /// Fingerprint the given audio, returning its duration. The LFs are
+    /// then available from m_Fingerprint.
+    float ProcessAudio(const float *audio, size_t nsamples);
+
+    /// Fingerprint the given audio on the pipeline thread while the LFs
+    /// are matched on the calling thread. Return the number of LFs processed
+    /// by the matcher and the duration of the audio in 'dt_proc'.
+    int ProcessPipelined(const float *audio, size_t nsamples, float &dt_proc);
+
+    /// Set up a batch session with the settings and resources of this recognizer.
+    void ConfigureSession(RecognizerImpl &session) const;
+
+    /// Start the clock of the deadline of an Identify() or Flush() call.
+    void StartDeadline();
 
 
     /// Process match results at each processing step. This method shall
@@ -68,6 +135,17 @@ class AUDIONEEX_API_TEST RecognizerImpl : public Audioneex::Recognizer
     ///                   is the length of the audio being processed.
     ///
     void ProcessMatchResults(int processed, float dt_proc);
+
+    /// Process match results at each processing step in monitoring mode,
+    /// opening and closing the segments of the identified recordings.
+    void ProcessMonitorResults(int processed);
+
+    /// Close the current segment in monitoring mode, if any.
+    void CloseSegment();
+
+    /// Perform the next pending asynchronous identification and requeue
+    /// itself in the shared worker pool if there are more.
+    void RunAsyncJob();
     
     /// Do classification of best matches at current step.
     int DoClassification(float Hu, float dT);
@@ -78,9 +156,16 @@ class AUDIONEEX_API_TEST RecognizerImpl : public Audioneex::Recognizer
 public:
 
     RecognizerImpl();
+   ~RecognizerImpl();
 
     void SetAudioBufferSize(float seconds);
 
+    /// Share the given resources with other recognizers (see Engine). Null
+    /// pointers make the recognizer use its own resources.
+    void SetSharedResources(const std::shared_ptr<const Codebook> &codes,
+                            const std::shared_ptr<std::mutex> &store_lock,
+                            const std::shared_ptr<DataStoreImpl::FingerprintCache> &fp_cache);
+
     // Public interface (see audioneex.h)
 
     void       SetMatchType(Audioneex::eMatchType type);
@@ -90,6 +175,13 @@ public:
     void       SetBinaryIdThreshold(float value);
 	void       SetBinaryIdMinTime(float value);
     void       SetMaxRecordingDuration(size_t duration);
+    void       SetMatchThreads(size_t nthreads);
+    void       SetMonitoringWindow(float seconds);
+    void       SetPipelining(bool enable);
+    void       SetStepBudget(size_t us);
+    void       SetDeadline(size_t us);
+    void       SetTermRatio(float ratio);
+    void       SetGateLevel(float level);
     void       SetDataStore(Audioneex::DataStore* dstore);
 
     eMatchType GetMatchType() const { return m_Matcher.GetMatchType(); }
@@ -98,13 +190,33 @@ public:
     eIdentificationMode GetIdentificationMode() const { return m_IdMode; }
     float      GetBinaryIdThreshold() const { return m_BinaryIdThreshold; }
 	float      GetBinaryIdMinTime() const { return m_BinaryIdMinTime; }
+    size_t     GetMatchThreads() const { return m_Matcher.GetThreads(); }
+    float      GetMonitoringWindow() const { return m_MonitorWindow; }
+    bool       GetPipelining() const { return m_Pipeline != nullptr; }
+    size_t     GetStepBudget() const { return m_Matcher.GetStepBudget(); }
+    size_t     GetDeadline() const { return m_Deadline; }
+    float      GetTermRatio() const { return m_Matcher.GetTermRatio(); }
+    float      GetGateLevel() const { return m_Fingerprint.GetGateLevel(); }
+    bool       IsTruncated() const { return m_Matcher.GetResults().Truncated; }
     DataStore* GetDataStore() const { return m_Matcher.GetDataStore(); }
 
     double     GetIdentificationTime() const { return m_IdTime; }
     void       Identify(const float *audio, size_t nsamples);
+    void       IdentifyFingerprint(const uint8_t *data, size_t size);
+    std::future<void> IdentifyAsync(const float *audio,
+                                    size_t nsamples,
+                                    Audioneex::IdentifyCallback callback = nullptr);
+    void       IdentifyBatch(const float* const* clips,
+                             const size_t* nsamples,
+                             size_t nclips);
+    Audioneex::IdMatch* GetBatchResults(size_t clip);
     Audioneex::IdMatch* GetResults();
+    Audioneex::MonitorEvent* GetMonitorEvents();
     void       Flush();
     void       Reset();
+    size_t     GetMemoryUsage() const;
+    RecognizerStats GetStats() const;
+    void       ResetStats();
     
 };
 
@@ -28,7 +28,8 @@ int BlockEncoder::Encode(const uint32_t* const* plist_chunk,
                          size_t enc_chunk_size,
                          size_t &enc_bytes,
                          uint32_t FIDo,
-                         bool delta_encode)
+                         bool delta_encode,
+                         bool slim)
 {
     // Serialize the postings list chunk into an array of integers converting
     // from the cache layout to the final layout.
@@ -37,12 +38,12 @@ int BlockEncoder::Encode(const uint32_t* const* plist_chunk,
     //       by scanning the whole postings list chunk. This value
     //       may be precomputed and passed as a parameter ...
 
-    size_t m_ser_chunk_size = 0;
+    size_t m_ser_chunk_size = slim ? 2/*marker*/ : 0;
 
     for(size_t pp=0; pp<plist_chunk_size; pp++)
 	{
         const uint32_t* p = plist_chunk[pp];
-        m_ser_chunk_size += 2/*FID,tf*/ + *(p+1) * 3/*LID,T,E*/;
+        m_ser_chunk_size += 2/*FID,tf*/ + *(p+1) * (slim ? 2/*LID,E*/ : 3/*LID,T,E*/);
     }
 
     // Reallocate the buffer if data does not fit
@@ -51,7 +52,7 @@ int BlockEncoder::Encode(const uint32_t* const* plist_chunk,
 
     Serialize(plist_chunk, plist_chunk_size,
               m_ser_chunk.data(), m_ser_chunk_size,
-              FIDo, delta_encode);
+              FIDo, delta_encode, slim);
 
     // IMPORTANT NOTE:
     // If not enough memory was allocated for the encoded chunk in the indexer
@@ -96,10 +97,20 @@ void BlockEncoder::Serialize(const uint32_t * const *plist_chunk,
                              uint32_t *ser_chunk,
                              size_t ser_chunk_size,
                              uint32_t prev_FID,
-                             bool delta_encode)
+                             bool delta_encode,
+                             bool slim)
 {
     size_t vpos = 0, poff0 = 0, poff1 = 0;
 
+    // Slim postings are preceded by a format marker
+    if(slim){
+       ser_chunk[vpos++] = FORMAT_MARKER;
+       ser_chunk[vpos++] = SLIM_FORMAT;
+    }
+
+    // Offset of the quantization errors in the posting's payload
+    size_t Eoff = slim ? 1 : 2;
+
     for(size_t n=0; n<plist_chunk_size; n++)
     {
         const uint32_t* p = plist_chunk[n];
@@ -126,9 +137,10 @@ void BlockEncoder::Serialize(const uint32_t * const *plist_chunk,
             poff1 = i * 3;
 			
             if(i==0 || !delta_encode){
-               ser_chunk[vpos] = *(p+2+poff1);       // LID
-               ser_chunk[vpos+1*tf] = *(p+3+poff1);  // T
-               ser_chunk[vpos+2*tf] = *(p+4+poff1);  // E
+               ser_chunk[vpos] = *(p+2+poff1);          // LID
+               if(!slim)
+                  ser_chunk[vpos+1*tf] = *(p+3+poff1);  // T
+               ser_chunk[vpos+Eoff*tf] = *(p+4+poff1);  // E
             }
 			else{
                poff0 = (i-1) * 3;
@@ -140,13 +152,14 @@ void BlockEncoder::Serialize(const uint32_t * const *plist_chunk,
                assert(*(p+4+poff1) <= Pms::IDI);
 
                ser_chunk[vpos] = *(p+2+poff1) - *(p+2+poff0);
-               ser_chunk[vpos+1*tf] = *(p+3+poff1) - *(p+3+poff0);
+               if(!slim)
+                  ser_chunk[vpos+1*tf] = *(p+3+poff1) - *(p+3+poff0);
                // TODO: Find a way to delta-encode E ?
-               ser_chunk[vpos+2*tf] = *(p+4+poff1);
+               ser_chunk[vpos+Eoff*tf] = *(p+4+poff1);
             }
         }
 
-        vpos += 2*tf;
+        vpos += Eoff*tf;
 
         // Save FID[t-1] if delta-encoding is enabled
         prev_FID = delta_encode ? FID : 0;
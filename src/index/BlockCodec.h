@@ -144,6 +144,12 @@ public:
 /// into byte streams that can be stored somewhere. Postings lists chunks
 /// are first serialized into arrays of integers with specific layout and then
 /// delta-encoded and compressed into a stream of bytes.
+///
+/// Postings are serialized as <FID,tf,{LID},{T},{E}>, or <FID,tf,{LID},{E}>
+/// for slim postings (see Audioneex::ePostingsFormat). Chunks of slim postings
+/// start with a format marker, that is a null FID (which cannot occur otherwise)
+/// followed by the format of the postings that follow, so the format holds up
+/// to the end of the block or the next marker. Markers are kept when decoding.
 class AUDIONEEX_API_TEST BlockEncoder
 {
     VByteCODEC            m_Codec;
@@ -157,9 +163,17 @@ public:
         DDECODE = 1
     };
 
+    /// Format marker constants
+    enum{
+        FORMAT_MARKER = 0,
+        FULL_FORMAT   = 0,
+        SLIM_FORMAT   = 1
+    };
+
     /// Encode the given postings list chunk into a byte stream.
     /// The 'FIDo' parameter indicates the base value from which
-    /// the delta encoding of the FIDs will be computed.
+    /// the delta encoding of the FIDs will be computed. If 'slim'
+    /// is true the times are dropped and a format marker prepended.
     /// @return  Zero if no errors occurred.
     int Encode(const uint32_t* const* plist_chunk,
                 size_t plist_chunk_size,
@@ -167,7 +181,8 @@ public:
                 size_t enc_chunk_size,
                 size_t& enc_bytes,
                 uint32_t FIDo=0,
-                bool delta_encode=true);
+                bool delta_encode=true,
+                bool slim=false);
 
     /// Decode the given byte stream into an array of integers.
     /// The 'FIDo' parameter indicates the base value from which
@@ -186,7 +201,8 @@ public:
                    uint32_t *ser_chunk,
                    size_t ser_chunk_size,
                    uint32_t prev_FID=0,
-                   bool delta_encode=true);
+                   bool delta_encode=true,
+                   bool slim=false);
 
     /// Compute an estimate of the worst case when decoding an encoded
     /// integer array, that is the max size that the encoded array can
@@ -215,16 +231,26 @@ public:
         uint32_t* end   = begin + csize;
         uint32_t bfid   = base_FID;
         uint32_t tf,i,j;
+        uint32_t nfields = 2;
 
         while(begin < end)
 		{
+            // Format marker
+            if(*begin == FORMAT_MARKER){
+               if(begin+1 >= end) return false;
+               nfields = *(begin+1) == SLIM_FORMAT ? 1 : 2;
+               begin += 2;
+               continue;
+            }
             *begin += bfid;
             bfid = *begin;
             begin++;
+            if(begin >= end) return false;
             tf = *begin;
             begin++;
+            if(tf == 0) return false;
             // NOTE: The quantization errors are not d-encoded
-            for(j=1; j<=2; j++, begin++)
+            for(j=1; j<=nfields; j++, begin++)
                for(i=tf-1; i; begin++, i--){
                    if(begin+1 >= end) return false;
                   *(begin+1) += *begin*T;
@@ -11,7 +11,10 @@
 #define DATASTORE_H
 
 #include <stdint.h>
+#include <cstring>
 #include <stdexcept>
+#include <vector>
+#include <mutex>
 
 #include "common.h"
 #include "BlockCodec.h"
@@ -42,7 +45,35 @@ const int POSTINGSLIST_BLOCK_THRESHOLD = 32768;
 const int POSTINGSLIST_CHUNK_THRESHOLD = POSTINGSLIST_BLOCK_THRESHOLD * 0.2;
 
 
-/// Posting cursor used to iterate over the postings lists.
+/// Read the specified postings list block into the given buffer, which is grown
+/// as needed. If a lock is given, it will be held while accessing the data store.
+/// Returns the size of the block's data (zero if not found).
+AUDIONEEX_API_TEST inline size_t ReadPListBlock(Audioneex::DataStore* store,
+                                                int term,
+                                                int bid,
+                                                std::vector<uint8_t> &buffer,
+                                                bool headers,
+                                                std::mutex* lock = nullptr)
+{
+    std::unique_lock<std::mutex> guard;
+    if(lock)
+       guard = std::unique_lock<std::mutex>(*lock);
+
+    size_t size = store->ReadPListBlock(term, bid, buffer.data(), buffer.size(), headers);
+
+    if(size > buffer.size()){
+       buffer.resize(size);
+       size = store->ReadPListBlock(term, bid, buffer.data(), buffer.size(), headers);
+       if(size > buffer.size())
+          throw Audioneex::InvalidIndexDataException
+               ("Inconsistent block size. The index appears to be corrupt.");
+    }
+
+    return size;
+}
+
+/// Posting cursor used to iterate over the postings lists. The times are
+/// not set (null) for slim postings (see Audioneex::ePostingsFormat).
 struct AUDIONEEX_API_TEST Posting_t
 {
     uint32_t  FID {0};
@@ -64,6 +95,17 @@ struct AUDIONEEX_API_TEST Posting_t
     }
 };
 
+/// Buffers used by a postings list iterator to read and decode the blocks.
+/// They can be given to the iterators by the client (see GetPListIterator()),
+/// so that they are reused by all the iterators created over time rather than
+/// allocated by each of them. A set of buffers must only be used by one
+/// iterator at a time.
+struct AUDIONEEX_API_TEST PListBuffers
+{
+    std::vector<uint8_t>   Read;     // Blocks as read from the data store
+    std::vector<uint32_t>  Decoded;  // Decoded block
+};
+
 /// NOTE: To iterate over the postings we need 2 iterators: one to iterate
 ///       over the blocks and another to iterate over the postings within
 ///       a block. However, the block iterator will be transparent to the
@@ -75,7 +117,16 @@ struct AUDIONEEX_API_TEST Posting_t
 /// this iterator.
 class AUDIONEEX_API_TEST PListIterator
 {
-    friend AUDIONEEX_API_TEST PListIterator* GetPListIterator(Audioneex::DataStore* store, int term);
+    friend AUDIONEEX_API_TEST PListIterator* GetPListIterator(Audioneex::DataStore* store,
+                                                              int term,
+                                                              std::mutex* lock,
+                                                              PListBuffers* buffers);
+
+    friend AUDIONEEX_API_TEST size_t PrefetchPListBlocks(Audioneex::DataStore* store,
+                                                         PListIterator* const* iterators,
+                                                         size_t count,
+                                                         uint32_t FIDmax,
+                                                         std::mutex* lock);
 
     Audioneex::DataStore*    m_DataStore   {nullptr};
     int                      m_Term        {0};
@@ -83,7 +134,19 @@ class AUDIONEEX_API_TEST PListIterator
     Posting_t                m_Cursor;
     bool                     m_EOL         {false};
     BlockEncoder             m_BlockCodec;
-    std::vector<uint32_t>    m_BlockDecoded;
+    PListBuffers             m_OwnBuffers;
+    std::vector<uint32_t>&   m_BlockDecoded;
+    std::vector<uint8_t>&    m_BlockRead;
+    std::mutex*              m_StoreLock   {nullptr};
+    bool                     m_Prefetched  {false};
+    size_t                   m_PrefetchedSize {0};
+    bool                     m_Slim        {false};
+    PListHeader              m_ListHeader  {};
+
+    // Counters (only collected in builds with statistics enabled)
+    uint64_t                 m_BlocksFetched   {0};
+    uint64_t                 m_BytesDecoded    {0};
+    uint64_t                 m_PostingsScanned {0};
 
     // -------- Postings iterator ---------
 
@@ -91,39 +154,68 @@ class AUDIONEEX_API_TEST PListIterator
     uint32_t*                m_end         {nullptr};
 
     // Fetch the next block from the index. Returns false if there are
-    // no more blocks (EOL), true otherwise.
-    bool NextBlock()
+    // no more blocks (EOL), true otherwise. If FIDmin is given, blocks
+    // whose FIDmax (from the block's header) is below it are skipped
+    // without being decoded.
+    bool NextBlock(uint32_t FIDmin = 0)
     {
+        // The blocks are read into the iterator's own buffer, so the lock
+        // (if any) is only held while accessing the data store.
         size_t block_size = 0;
-        size_t m_BlockDecoded_size = 0; // No vector::resize() pls
-
-        const uint8_t* pblock = m_DataStore->GetPListBlock(m_Term,
-                                                           m_NextBlock,
-                                                           block_size);
-
-        if(pblock && block_size)
-		{
-            size_t decsize = BlockEncoder::GetDecodedSizeEstimate(block_size);
+        const uint8_t* pblock = nullptr;
+
+        for(;;)
+        {
+            bool headers = FIDmin > 0;
+
+            // A prefetched block is already in the read buffer, along
+            // with its headers (see PrefetchPListBlocks()).
+            if(m_Prefetched){
+               block_size = m_PrefetchedSize;
+               m_Prefetched = false;
+               headers = true;
+            }
+            else
+               block_size = ReadPListBlock(m_DataStore,
+                                           m_Term,
+                                           m_NextBlock,
+                                           m_BlockRead,
+                                           headers,
+                                           m_StoreLock);
+
+            pblock = block_size ? m_BlockRead.data() : nullptr;
+
+            STATS_HERE( if(pblock) m_BlocksFetched++; )
+
+            if(!pblock || !headers)
+               break;
+
+            // The list header is prepended to the 1st block
+            size_t hoff = m_NextBlock==1 ? sizeof(PListHeader) : 0;
+
+            if(block_size < hoff + sizeof(PListBlockHeader))
+               throw Audioneex::InvalidIndexDataException
+                    ("Invalid block header. The index appears to be corrupt.");
 
-            if(m_BlockDecoded.capacity() < decsize)
-               m_BlockDecoded.reserve(decsize);
+            if(m_NextBlock==1)
+               std::memcpy(&m_ListHeader, pblock, sizeof(PListHeader));
 
-            int res = m_BlockCodec.Decode(pblock, block_size,
-                                          m_BlockDecoded.data(),
-                                          m_BlockDecoded.capacity(),
-                                          m_BlockDecoded_size);
+            PListBlockHeader hdr;
+            std::memcpy(&hdr, pblock + hoff, sizeof(PListBlockHeader));
 
-            // If decoding fails the client provided invalid data.
-            if(res<0)
-               throw Audioneex::InvalidIndexDataException
-                    ("Block decoding failed. Invalid data.");
+            hoff += sizeof(PListBlockHeader);
 
-            // If this happens, we've got a bug
-            if(m_BlockDecoded_size==0)
-               throw std::runtime_error("Block decoding failed.");
+            if(hdr.FIDmax >= FIDmin){
+               pblock += hoff;
+               block_size -= hoff;
+               break;
+            }
+            m_NextBlock++;
+        }
 
-            m_begin = m_BlockDecoded.data();
-            m_end   = m_begin + m_BlockDecoded_size;
+        if(pblock && block_size)
+		{
+            DecodeBlock(pblock, block_size);
             m_NextBlock++;
             return true;
         }
@@ -134,15 +226,57 @@ class AUDIONEEX_API_TEST PListIterator
         }
     }
 
+    // Decode the given block's body into the internal buffer and set the
+    // postings iterator to its start.
+    void DecodeBlock(const uint8_t* pblock, size_t block_size)
+    {
+        size_t m_BlockDecoded_size = 0; // No vector::resize() pls
+
+        size_t decsize = BlockEncoder::GetDecodedSizeEstimate(block_size);
+
+        if(m_BlockDecoded.capacity() < decsize)
+           m_BlockDecoded.reserve(decsize);
+
+        int res = m_BlockCodec.Decode(pblock, block_size,
+                                      m_BlockDecoded.data(),
+                                      m_BlockDecoded.capacity(),
+                                      m_BlockDecoded_size);
+
+        // If decoding fails the client provided invalid data.
+        if(res<0)
+           throw Audioneex::InvalidIndexDataException
+                ("Block decoding failed. Invalid data.");
+
+        // If this happens, we've got a bug
+        if(m_BlockDecoded_size==0)
+           throw std::runtime_error("Block decoding failed.");
+
+        m_begin = m_BlockDecoded.data();
+        m_end   = m_begin + m_BlockDecoded_size;
+
+        // Blocks start with full postings unless marked otherwise
+        m_Slim  = false;
+
+        STATS_HERE( m_BytesDecoded += block_size; )
+    }
+
     /// Get the next posting in the current block.
     void NextPosting()
     {
+        // Format markers (see BlockEncoder)
+        while(m_end - m_begin >= 2 && *m_begin == BlockEncoder::FORMAT_MARKER){
+            m_Slim = *(m_begin+1) == BlockEncoder::SLIM_FORMAT;
+            m_begin += 2;
+        }
+
         if(m_begin < m_end){
             m_Cursor.FID = *m_begin++;
             m_Cursor.tf  = *m_begin++;
             m_Cursor.LID = m_begin; m_begin+=m_Cursor.tf;
-            m_Cursor.T   = m_begin; m_begin+=m_Cursor.tf;
+            m_Cursor.T   = m_Slim ? nullptr : m_begin;
+            m_begin+= m_Slim ? 0 : m_Cursor.tf;
             m_Cursor.E   = m_begin; m_begin+=m_Cursor.tf;
+            STATS_HERE( m_PostingsScanned++; )
         }
 		else {
             m_Cursor.reset();
@@ -151,10 +285,16 @@ class AUDIONEEX_API_TEST PListIterator
 
 public:
 
-    PListIterator()
+    /// Create an iterator using the given buffers, if any, else its own.
+    explicit PListIterator(PListBuffers* buffers = nullptr) :
+        m_BlockDecoded (buffers ? buffers->Decoded : m_OwnBuffers.Decoded),
+        m_BlockRead    (buffers ? buffers->Read : m_OwnBuffers.Read)
     {
-        // reserve some space for the decoded blocks
-        m_BlockDecoded.resize(POSTINGSLIST_BLOCK_THRESHOLD);
+        // reserve some space for the read and decoded blocks
+        if(m_BlockRead.size() < POSTINGSLIST_BLOCK_THRESHOLD * 2)
+           m_BlockRead.resize(POSTINGSLIST_BLOCK_THRESHOLD * 2);
+        if(m_BlockDecoded.size() < POSTINGSLIST_BLOCK_THRESHOLD)
+           m_BlockDecoded.resize(POSTINGSLIST_BLOCK_THRESHOLD);
         // We could load the 1st block here
         //...
     }
@@ -178,17 +318,157 @@ public:
         return m_Cursor;
     }
 
+    /// Get the header of the list, which carries the list's statistics. It is
+    /// available once the 1st block has been read along with its headers (as
+    /// done by PrefetchPListBlocks()), else it is null.
+    const PListHeader& header() const { return m_ListHeader; }
+
+    /// Get the number of blocks fetched, the number of block bytes decoded
+    /// and the number of postings scanned by this iterator so far. These are
+    /// only counted in builds with statistics enabled (see STATS_HERE).
+    uint64_t blocksFetched() const { return m_BlocksFetched; }
+    uint64_t bytesDecoded() const { return m_BytesDecoded; }
+    uint64_t postingsScanned() const { return m_PostingsScanned; }
+
+    /// Move the cursor to the end of the list, so that the list is not read
+    /// any further.
+    void close()
+    {
+        m_Cursor.reset();
+        m_Prefetched = false;
+        m_EOL = true;
+    }
+
+    /// Move the cursor to the first posting whose FID is not less than the
+    /// specified one. If the iterator is at the start of the list, blocks
+    /// that cannot contain such FID are skipped without being decoded.
+    void seek(uint32_t FID)
+    {
+        if(m_EOL) return;
+
+        if(!m_begin && NextBlock(FID))
+           NextPosting();
+
+        for(; !get().empty() && m_Cursor.FID < FID; next());
+    }
+
 };
 
+/// Check whether the specified term is known not to be in the index, in which case
+/// its postings list need not be read (see DataStore::GetDocFrequency()).
+AUDIONEEX_API_TEST inline bool IsMissingTerm(Audioneex::DataStore* store,
+                                             int term,
+                                             std::mutex* lock = nullptr){
+    std::unique_lock<std::mutex> guard;
+    if(lock)
+       guard = std::unique_lock<std::mutex>(*lock);
+    return store->GetDocFrequency(term) == 0;
+}
+
 /// Get a postings itarator for the specified postings list from the specified data store.
-AUDIONEEX_API_TEST inline PListIterator* GetPListIterator(Audioneex::DataStore* store, int term){
+/// If a lock is given, it will be held by the iterator while accessing the data store
+/// (not needed if the data store is reentrant). If buffers are given, the iterator reads
+/// the blocks into them rather than into its own (see PListBuffers). Iterators for terms
+/// that are known not to be in the index are created at EOL, so they never access the
+/// data store.
+AUDIONEEX_API_TEST inline PListIterator* GetPListIterator(Audioneex::DataStore* store,
+                                                          int term,
+                                                          std::mutex* lock = nullptr,
+                                                          PListBuffers* buffers = nullptr){
     assert(store != nullptr);
-    PListIterator* it = new PListIterator;
+    PListIterator* it = new PListIterator(buffers);
     it->m_Term = term;
     it->m_DataStore = store;
+    it->m_StoreLock = lock;
+    it->m_EOL = IsMissingTerm(store, term, lock);
     return it;
 }
 
+/// Read ahead the next block of each of the given iterators that will need one on
+/// the next advance (i.e. whose current block has been consumed or that haven't been
+/// started yet) with one batched request to the data store (see DataStore::ReadPListBlocks()),
+/// so that remote data stores are accessed once for all the iterators rather than once
+/// for each of them. Iterators at EOL or positioned past FIDmax are skipped. Blocks that
+/// don't fit an iterator's buffer are left to be read when needed. If a lock is given,
+/// it will be held while accessing the data store. Returns the number of requested blocks.
+AUDIONEEX_API_TEST inline size_t PrefetchPListBlocks(Audioneex::DataStore* store,
+                                                     PListIterator* const* iterators,
+                                                     size_t count,
+                                                     uint32_t FIDmax = UINT32_MAX,
+                                                     std::mutex* lock = nullptr)
+{
+    assert(store != nullptr);
+
+    std::vector<PListBlockRequest> requests;
+    std::vector<PListIterator*>    targets;
+
+    for(size_t i=0; i<count; i++)
+    {
+        PListIterator* it = iterators[i];
+
+        if(it->m_EOL || it->m_Prefetched || it->m_begin < it->m_end ||
+           (it->m_begin && it->m_Cursor.FID > FIDmax))
+           continue;
+
+        // The headers are always read, so that the iterator can still
+        // skip blocks when seeking.
+        PListBlockRequest req = { it->m_Term,
+                                  static_cast<int>(it->m_NextBlock),
+                                  it->m_BlockRead.data(),
+                                  it->m_BlockRead.size(),
+                                  true, 0 };
+        requests.push_back(req);
+        targets.push_back(it);
+    }
+
+    if(requests.empty())
+       return 0;
+
+    {
+        std::unique_lock<std::mutex> guard;
+        if(lock)
+           guard = std::unique_lock<std::mutex>(*lock);
+
+        store->ReadPListBlocks(requests.data(), requests.size());
+    }
+
+    for(size_t i=0; i<requests.size(); i++)
+    {
+        if(requests[i].data_size > requests[i].buffer_size)
+           continue;
+        targets[i]->m_Prefetched = true;
+        targets[i]->m_PrefetchedSize = requests[i].data_size;
+
+        if(targets[i]->m_NextBlock == 1 && requests[i].data_size >= sizeof(PListHeader))
+           std::memcpy(&targets[i]->m_ListHeader, requests[i].buffer, sizeof(PListHeader));
+    }
+
+    return requests.size();
+}
+
+/// Get the highest FID in the specified postings list from the list's header.
+/// Returns 0 if the list does not exist. The searches get it from the headers
+/// read along with the first blocks (see PListIterator::header()).
+AUDIONEEX_API_TEST inline uint32_t GetPListMaxFID(Audioneex::DataStore* store,
+                                                  int term,
+                                                  std::mutex* lock = nullptr){
+    assert(store != nullptr);
+
+    if(IsMissingTerm(store, term, lock))
+       return 0;
+
+    std::vector<uint8_t> block;
+
+    size_t bsize = ReadPListBlock(store, term, 1, block, true, lock);
+
+    if(bsize < sizeof(PListHeader))
+       return 0;
+
+    PListHeader lhdr;
+    std::memcpy(&lhdr, block.data(), sizeof(PListHeader));
+    return lhdr.FIDmax;
+}
+
 } // end namespace DatastoreImpl
 
 }// end namespace Audioneex
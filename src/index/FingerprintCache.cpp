@@ -0,0 +1,214 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+#include <cstring>
+#include <algorithm>
+
+#include "common.h"
+#include "FingerprintCache.h"
+#include "Fingerprint.h"
+#include "Utils.h"
+
+
+Audioneex::DataStoreImpl::FingerprintCache::FingerprintCache(size_t capacity,
+                                                             size_t page_size) :
+    m_Capacity (capacity),
+    m_PageSize (page_size)
+{
+    if(m_PageSize == 0 || m_PageSize % sizeof(QLocalFingerprint_t) != 0)
+       throw Audioneex::InvalidParameterException
+            ("Invalid fingerprint cache page size. Must be a multiple of the LF size.");
+}
+
+// ----------------------------------------------------------------------------
+
+Audioneex::DataStoreImpl::FingerprintCache::page_ptr
+Audioneex::DataStoreImpl::FingerprintCache::Lookup(uint64_t key)
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+
+    page_table::iterator it = m_Pages.find(key);
+
+    if(it == m_Pages.end()){
+       m_Misses++;
+       return page_ptr();
+    }
+
+    // Move the page to the front of the LRU list
+    m_LRU.splice(m_LRU.begin(), m_LRU, it->second.Pos);
+    m_Hits++;
+
+    return it->second.Page;
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::DataStoreImpl::FingerprintCache::Insert(const void* store,
+                                                        uint64_t key,
+                                                        const page_ptr &page)
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+
+    // Another thread may have fetched the same page in the meantime, or
+    // the cache may have moved to another data store while it was fetched
+    if(store != m_Store || m_Pages.find(key) != m_Pages.end())
+       return;
+
+    m_LRU.push_front(key);
+
+    Entry_t &entry = m_Pages[key];
+    entry.Page = page;
+    entry.Pos = m_LRU.begin();
+
+    m_Used += page->size();
+
+    // Evict the least recently used pages. Readers holding a page being
+    // evicted keep it alive until they are done with it.
+    while(m_Used > m_Capacity && m_LRU.size() > 1)
+    {
+        page_table::iterator it = m_Pages.find(m_LRU.back());
+        m_Used -= it->second.Page->size();
+        m_Pages.erase(it);
+        m_LRU.pop_back();
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::DataStoreImpl::FingerprintCache::Bind(const void* store)
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+
+    // The pages of a different data store are stale
+    if(store != m_Store){
+       m_Pages.clear();
+       m_LRU.clear();
+       m_Used = 0;
+       m_Store = store;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+Audioneex::DataStoreImpl::FingerprintCache::page_ptr
+Audioneex::DataStoreImpl::FingerprintCache::FetchPage(Audioneex::DataStore* store,
+                                                      std::mutex* store_lock,
+                                                      uint32_t FID,
+                                                      size_t fp_size,
+                                                      size_t page)
+{
+    size_t bo = page * m_PageSize;
+    size_t nbytes = std::min(m_PageSize, fp_size - bo);
+
+    std::shared_ptr<std::vector<uint8_t> > data (new std::vector<uint8_t>(nbytes));
+
+    {
+        std::unique_lock<std::mutex> guard;
+        if(store_lock)
+           guard = std::unique_lock<std::mutex>(*store_lock);
+
+        size_t rsize = store->ReadFingerprint(FID, data->data(), nbytes, bo);
+
+        if(rsize == 0)
+           throw Audioneex::InvalidFingerprintException
+                ("No fingerprint data received. Maybe not existent? "
+                 "Please check the fingerprint database (FID="+Utils::ToString(FID)+")");
+
+        if(rsize != nbytes)
+           throw Audioneex::InvalidFingerprintException
+                ("Invalid fingerprint data size. Should be "+Utils::ToString(nbytes)+". "
+                 "Please check the fingerprint database (FID="+Utils::ToString(FID)+")");
+    }
+
+    return data;
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::DataStoreImpl::FingerprintCache::Read(Audioneex::DataStore* store,
+                                                      std::mutex* store_lock,
+                                                      uint32_t FID,
+                                                      size_t fp_size,
+                                                      size_t bo,
+                                                      size_t nbytes,
+                                                      uint8_t* out,
+                                                      size_t* misses)
+{
+    assert(store && out);
+    assert(bo + nbytes <= fp_size);
+
+    if(nbytes == 0)
+       return;
+
+    Bind(store);
+
+    size_t pfirst = bo / m_PageSize;
+    size_t plast = (bo + nbytes - 1) / m_PageSize;
+
+    for(size_t p=pfirst; p<=plast; p++)
+    {
+        uint64_t key = (static_cast<uint64_t>(FID) << 32) | p;
+
+        page_ptr page = Lookup(key);
+
+        if(!page){
+           page = FetchPage(store, store_lock, FID, fp_size, p);
+           Insert(store, key, page);
+
+           if(misses)
+              (*misses)++;
+        }
+
+        // Copy the part of the page overlapping the requested range
+        size_t pstart = p * m_PageSize;
+        size_t cstart = std::max(bo, pstart);
+        size_t cend = std::min(bo + nbytes, pstart + page->size());
+
+        if(cend <= cstart)
+           throw Audioneex::InvalidFingerprintException
+                ("Fingerprint shorter than expected. "
+                 "Please check the fingerprint database (FID="+Utils::ToString(FID)+")");
+
+        std::memcpy(out + (cstart - bo), page->data() + (cstart - pstart), cend - cstart);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void Audioneex::DataStoreImpl::FingerprintCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    m_Pages.clear();
+    m_LRU.clear();
+    m_Used = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t Audioneex::DataStoreImpl::FingerprintCache::GetUsed()
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    return m_Used;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t Audioneex::DataStoreImpl::FingerprintCache::GetHits()
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    return m_Hits;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t Audioneex::DataStoreImpl::FingerprintCache::GetMisses()
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    return m_Misses;
+}
@@ -0,0 +1,117 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+#ifndef FINGERPRINTCACHE_H
+#define FINGERPRINTCACHE_H
+
+#include <cstdint>
+#include <list>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <boost/unordered_map.hpp>
+
+#include "audioneex.h"
+
+// The following classes are not part of the public API but we need
+// their interfaces exposed when testing DLLs.
+#ifdef TESTING
+  #define AUDIONEEX_API_TEST AUDIONEEX_API
+#else
+  #define AUDIONEEX_API_TEST
+#endif
+
+
+namespace Audioneex
+{
+namespace DataStoreImpl
+{
+
+/// A LRU cache of fingerprint pages sitting in front of a data store.
+/// Fingerprints are split into fixed size pages that are fetched from the
+/// data store on a miss and evicted in least recently used order once the
+/// set capacity is exceeded. The cache is thread-safe and can be shared by
+/// multiple matchers, provided they all use the same fingerprints database
+/// (pages are keyed by FID only).
+/// The cache assumes that the fingerprints are not modified while it's in
+/// use. It is emptied when it's read from a different data store, but it
+/// must be cleared explicitly if the same data store is reopened or changed.
+
+class AUDIONEEX_API_TEST FingerprintCache
+{
+    typedef std::shared_ptr<const std::vector<uint8_t> >  page_ptr;
+    typedef std::list<uint64_t>                           lru_list;
+
+    struct Entry_t
+    {
+        page_ptr           Page;
+        lru_list::iterator Pos;
+    };
+
+    typedef boost::unordered::unordered_map<uint64_t, Entry_t> page_table;
+
+    size_t       m_Capacity;
+    size_t       m_PageSize;
+    size_t       m_Used    {0};
+    size_t       m_Hits    {0};
+    size_t       m_Misses  {0};
+    const void*  m_Store   {nullptr};
+    lru_list     m_LRU;
+    page_table   m_Pages;
+    std::mutex   m_Lock;
+
+    page_ptr Lookup(uint64_t key);
+    void     Insert(const void* store, uint64_t key, const page_ptr &page);
+    void     Bind(const void* store);
+    page_ptr FetchPage(Audioneex::DataStore* store,
+                       std::mutex* store_lock,
+                       uint32_t FID,
+                       size_t fp_size,
+                       size_t page);
+
+public:
+
+    /// Default page size. Must be a multiple of the LF size.
+    static const size_t DEFAULT_PAGE_SIZE = 4096;
+
+    /// Create a cache holding up to 'capacity' bytes of fingerprint data.
+    explicit FingerprintCache(size_t capacity, size_t page_size = DEFAULT_PAGE_SIZE);
+
+    /// Read 'nbytes' bytes at offset 'bo' of the specified fingerprint,
+    /// whose total size is 'fp_size', into 'out'. Missing pages are fetched
+    /// from the given data store holding 'store_lock', if not null (a lock
+    /// is not needed if the data store is reentrant), and their number is
+    /// added to 'misses', if given.
+    /// Throws InvalidFingerprintException if the data store returns
+    /// inconsistent data.
+    void Read(Audioneex::DataStore* store,
+              std::mutex* store_lock,
+              uint32_t FID,
+              size_t fp_size,
+              size_t bo,
+              size_t nbytes,
+              uint8_t* out,
+              size_t* misses = nullptr);
+
+    /// Drop all the cached pages. This must be called whenever the data
+    /// store the pages come from is reopened or modified.
+    void Clear();
+
+    size_t GetCapacity() const { return m_Capacity; }
+    size_t GetPageSize() const { return m_PageSize; }
+    size_t GetUsed();
+    size_t GetHits();
+    size_t GetMisses();
+};
+
+} // end namespace DataStoreImpl
+
+}// end namespace Audioneex
+
+#endif // FINGERPRINTCACHE_H
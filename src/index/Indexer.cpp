@@ -10,6 +10,7 @@
 #include <iostream>
 #include <exception>
 #include <cmath>
+#include <algorithm>
 
 #include "common.h"
 #include "Indexer.h"
@@ -17,6 +18,7 @@
 #include "DataStore.h"
 #include "Parameters.h"
 #include "Utils.h"
+#include "Stats.h"
 
 #ifdef TESTING
  #include "Tester.h"
@@ -100,6 +102,13 @@ void Audioneex::IndexerImpl::Start()
     // Signal the data store that an indexing session has started.
     m_DataStore->OnIndexerStart();
 
+    // Once an index holds slim postings it must keep using them, as the
+    // matcher resolves the time bins of all the fingerprints following the
+    // first slim one from the time bins list.
+    if(m_PostingsFormat == FULL_POSTINGS &&
+       !IsNull(m_DataStore->OnIndexerListHeader(GetTimeBinsListID(m_MatchType))))
+       m_PostingsFormat = SLIM_POSTINGS;
+
 }
 
 // ----------------------------------------------------------------------------
@@ -168,9 +177,20 @@ void Audioneex::IndexerImpl::Index(uint32_t FID)
            // compute fingerprint of current audio block
            fingerprint.Process(buffer);
 
+           STATS_HERE(
+               const StageTimes_t &times = fingerprint.GetStageTimes();
+
+               m_Stats.FFTTime         += times.FFT;
+               m_Stats.PeaksTime       += times.Peaks;
+               m_Stats.POITime         += times.POI;
+               m_Stats.DescriptorsTime += times.Descriptors;
+           )
+
            // get LF stream for current block
            const lf_vector &lfs = fingerprint.Get();
 
+           STATS_HERE( Stats::WallTimer timer (m_Stats.QuantizeTime); )
+
            // quantize the LFs		   
            for(const auto &lf : lfs)
 		   {
@@ -204,11 +224,21 @@ void Audioneex::IndexerImpl::Index(uint32_t FID)
     m_CurrFID = FID;
 
     // At this point we have successfully fingerprinted the audio. Proceed to indexing.
+    {
+       STATS_HERE( Stats::WallTimer wall (m_Stats.IndexTime);
+                   Stats::CPUTimer cpu (m_Stats.IndexCPUTime); )
 
-    if(m_MatchType == MSCALE_MATCH)
-       IndexSTerms(m_CurrFID, QLFs.data(), QLFs.size());
-    else if(m_MatchType == XSCALE_MATCH)
-       IndexBTerms(m_CurrFID, QLFs.data(), QLFs.size());
+       if(m_MatchType == MSCALE_MATCH)
+          IndexSTerms(m_CurrFID, QLFs.data(), QLFs.size());
+       else if(m_MatchType == XSCALE_MATCH)
+          IndexBTerms(m_CurrFID, QLFs.data(), QLFs.size());
+
+       if(m_PostingsFormat == SLIM_POSTINGS)
+          IndexTimeBins(m_CurrFID, QLFs.data(), QLFs.size());
+    }
+
+    STATS_HERE( m_Stats.Fingerprints++;
+                m_Stats.LFs += QLFs.size(); )
 
     // Emit the quantized fingerprint
     uint8_t* QLFs_ptr = reinterpret_cast<uint8_t*>(QLFs.data());
@@ -256,10 +286,21 @@ void Audioneex::IndexerImpl::Index(uint32_t FID, const uint8_t *fpdata, size_t f
 
     const QLocalFingerprint_t *QLFs = reinterpret_cast<const QLocalFingerprint_t*>(fpdata);
 
-    if(m_MatchType == MSCALE_MATCH)
-       IndexSTerms(FID, QLFs, NLFs);
-    else if(m_MatchType == XSCALE_MATCH)
-       IndexBTerms(FID, QLFs, NLFs);
+    {
+       STATS_HERE( Stats::WallTimer wall (m_Stats.IndexTime);
+                   Stats::CPUTimer cpu (m_Stats.IndexCPUTime); )
+
+       if(m_MatchType == MSCALE_MATCH)
+          IndexSTerms(FID, QLFs, NLFs);
+       else if(m_MatchType == XSCALE_MATCH)
+          IndexBTerms(FID, QLFs, NLFs);
+
+       if(m_PostingsFormat == SLIM_POSTINGS)
+          IndexTimeBins(FID, QLFs, NLFs);
+    }
+
+    STATS_HERE( m_Stats.Fingerprints++;
+                m_Stats.LFs += NLFs; )
 
 //m_Cache.Dump();
     // Check whether the cache needs to be flushed to disk
@@ -344,6 +385,28 @@ void Audioneex::IndexerImpl::IndexBTerms(uint32_t FID, const QLocalFingerprint_t
 
 // ----------------------------------------------------------------------------
 
+void Audioneex::IndexerImpl::IndexTimeBins(uint32_t FID, const QLocalFingerprint_t *lfs, size_t Nlfs)
+{
+    assert(lfs != nullptr);
+
+    int list_id = GetTimeBinsListID(m_MatchType);
+    int bin_prev = -1;
+
+    // The LFs are sorted by time, so each bin is a range of LIDs
+    // starting at the first LF falling in it.
+    for(size_t i=0; i<Nlfs; i++)
+    {
+        int bin = lfs[i].T / Pms::Tk;
+
+        if(bin != bin_prev){
+           m_Cache.Update(list_id, FID, i, bin, 0);
+           bin_prev = bin;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+
 void Audioneex::IndexerImpl::DoFlush()
 {
     // Produce and emit postings lists chunks in lexicographic order.
@@ -381,9 +444,12 @@ void Audioneex::IndexerImpl::DoFlush()
     size_t plchunk_size       = 0;
     size_t plchunk_size_bytes = 0;
     size_t plchunk_nposts     = 0;
+    size_t plchunk_noccurs    = 0;
 
     IndexCache::buffer_type &buffer = m_Cache.GetBuffer();
 
+    int time_bins_list = GetTimeBinsListID(m_MatchType);
+
 
     for(IndexCache::buffer_type::value_type &elem : buffer)
     {
@@ -396,6 +462,10 @@ void Audioneex::IndexerImpl::DoFlush()
         // blocks in the list, which is equal to the last block number/id.
         PListHeader lhdr = m_DataStore->OnIndexerListHeader(term);
 
+        // Stop terms are no longer indexed (see SetStopTermLimit())
+        if(lhdr.Flags & PLIST_STOP_TERM)
+           continue;
+
         PListBlockHeader hdr = {};
 
         // Get the last block header. If we get a null list header then we
@@ -421,12 +491,38 @@ void Audioneex::IndexerImpl::DoFlush()
         uint32_t* pcurr   = plist.data();
         uint32_t* plast   = plist.data() + last_pos;
 
+        // If the list would exceed the limit set for the terms' document
+        // frequency mark it as a stop term. Only the first posting is still
+        // emitted, so that the updated header is stored with its chunk.
+        // The time bins are needed to resolve slim postings, so they're
+        // never pruned.
+        if(m_StopTermLimit > 0 && term != time_bins_list)
+        {
+           uint32_t ndocs = 0;
+
+           for(uint32_t* p = pcurr; p <= plast; p += 2 + *(p+1) * 3)
+               ndocs++;
+
+           if(lhdr.DocFrequency + ndocs > m_StopTermLimit){
+              lhdr.Flags |= PLIST_STOP_TERM;
+              plast = pcurr;
+           }
+        }
+
+        // Number of fingerprints added to the list (one posting each)
+        uint32_t df = 0;
+
+        // The time bins are needed to resolve slim postings, so they're
+        // always stored in full.
+        bool slim = m_PostingsFormat == SLIM_POSTINGS && term != time_bins_list;
+
         // Iterate thru the postings until we reach the chunk limit
         while(pcurr <= plast)
         {
             plchunk.push_back(pcurr);
 
             plchunk_nposts++;
+            plchunk_noccurs += *(pcurr+1);
             // Accumulate size of postings <FID,tf,{LID},{T},{E}>
             plchunk_size += 2 + *(pcurr+1) * 3;
             plchunk_size_bytes = plchunk_size * sizeof(uint32_t);
@@ -452,13 +548,20 @@ void Audioneex::IndexerImpl::DoFlush()
 
                size_t ebytes = 0;
 
+               // Keep the list's statistics up to date with each emitted
+               // chunk (the matcher uses them to estimate the cost of the
+               // query terms).
+               lhdr.DocFrequency += plchunk_nposts;
+               lhdr.Occurrences  += plchunk_noccurs;
+               lhdr.FIDmax        = *plchunk.back();
+
                // Append the chunk to the current block if its size is below the threshold
                // else append it to a new block
                if(!IsNull(hdr) && hdr.BodySize < DataStoreImpl::POSTINGSLIST_BLOCK_THRESHOLD){
 
                    blockEncoder.Encode(plchunk_ptr, plchunk_nposts,
                                        bchunk_ptr, bchunk_size,
-                                       ebytes, hdr.FIDmax);
+                                       ebytes, hdr.FIDmax, true, slim);
                    hdr.BodySize += ebytes;
                    hdr.FIDmax = *plchunk.back();
                    m_DataStore->OnIndexerChunk(term, lhdr, hdr, bchunk_ptr, ebytes);
@@ -466,7 +569,7 @@ void Audioneex::IndexerImpl::DoFlush()
                else{
                    blockEncoder.Encode(plchunk_ptr, plchunk_nposts,
                                        bchunk_ptr, bchunk_size,
-                                       ebytes, 0);
+                                       ebytes, 0, true, slim);
                    hdr.ID++;
                    hdr.BodySize = ebytes;
                    hdr.FIDmax = *plchunk.back();
@@ -474,17 +577,24 @@ void Audioneex::IndexerImpl::DoFlush()
                    m_DataStore->OnIndexerNewBlock(term, lhdr, hdr, bchunk_ptr, ebytes);
                }
 
+               STATS_HERE( m_Stats.ChunksWritten++;
+                           m_Stats.BytesWritten += ebytes; )
+
                plchunk.clear();
                plchunk_nposts = 0;
+               plchunk_noccurs = 0;
                plchunk_size = 0;
                plchunk_size_bytes = 0;
             }
 
             // Next posting
             pcurr += 2 + *(pcurr+1) * 3;
+            df++;
         }
 
         assert(plchunk.empty());
+
+        m_DataStore->OnIndexerDocFrequency(term, df);
         //plist.clear();
 
     }//end foreach(list,buffer)
@@ -499,10 +609,20 @@ void Audioneex::IndexerImpl::Flush()
     if(!m_SessionOpen)
        throw Audioneex::InvalidIndexerStateException("No indexing session open.");
 
-    m_DataStore->OnIndexerFlushStart();
-    DoFlush();
-    m_Cache.Reset();
-    m_DataStore->OnIndexerFlushEnd();
+    STATS_HERE( double flush_time = 0; )
+    {
+       STATS_HERE( Stats::WallTimer wall (flush_time);
+                   Stats::CPUTimer cpu (m_Stats.FlushCPUTime); )
+
+       m_DataStore->OnIndexerFlushStart();
+       DoFlush();
+       m_Cache.Reset();
+       m_DataStore->OnIndexerFlushEnd();
+    }
+
+    STATS_HERE( m_Stats.Flushes++;
+                m_Stats.FlushTime += flush_time;
+                m_Stats.MaxFlushTime = std::max(m_Stats.MaxFlushTime, flush_time); )
 }
 
 // ----------------------------------------------------------------------------
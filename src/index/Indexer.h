@@ -170,6 +170,16 @@ public:
     void SetMatchType(Audioneex::eMatchType type) { m_MatchType = type; }
 
     Audioneex::eMatchType GetMatchType() const { return m_MatchType; }
+
+    /// Set the layout of the postings added to the index.
+    void SetPostingsFormat(Audioneex::ePostingsFormat format) { m_PostingsFormat = format; }
+
+    Audioneex::ePostingsFormat GetPostingsFormat() const { return m_PostingsFormat; }
+
+    /// Set the max number of fingerprints a term may occur in (0 = no limit)
+    void SetStopTermLimit(uint32_t limit) { m_StopTermLimit = limit; }
+
+    uint32_t GetStopTermLimit() const { return m_StopTermLimit; }
     
     /// Set the memory limit (in MB) after which the cached index is flushed
     void SetCacheLimit(size_t limit) { m_Cache.SetMemoryLimit(limit); }
@@ -189,10 +199,24 @@ public:
 
     Audioneex::AudioProvider* GetAudioProvider() const { return m_AudioProvider; }
 
+    /// Get the statistics of the indexing (see Audioneex::IndexerStats)
+    Audioneex::IndexerStats GetStats() const { return m_Stats; }
+
+    /// Clear the statistics of the indexing
+    void ResetStats() { m_Stats = Audioneex::IndexerStats(); }
+
     /// Get the maximum possible value that a term can take.
     /// This value depends on how the various components that make up a term
     /// are combined by the indexing algorithm.
     static uint32_t GetMaxTermValue(Audioneex::eMatchType type);
+
+    /// Get the identifier of the list holding the time bins of the LFs in the
+    /// fingerprints indexed with slim postings. For each fingerprint, there is
+    /// one posting whose entries are the first LF in each time bin (LID) and the
+    /// bin's index (T). This value is outside the range of the terms.
+    static uint32_t GetTimeBinsListID(Audioneex::eMatchType type) {
+        return GetMaxTermValue(type) + 1;
+    }
     
 private:
 
@@ -201,12 +225,16 @@ private:
     bool                        m_SessionOpen    {false};
     uint32_t                    m_CurrFID        {0};
     Audioneex::eMatchType       m_MatchType      {MSCALE_MATCH};
+    Audioneex::ePostingsFormat  m_PostingsFormat {FULL_POSTINGS};
+    uint32_t                    m_StopTermLimit  {0};
     IndexCache                  m_Cache;
     std::unique_ptr <Codebook>  m_AudioCodes;
+    Audioneex::IndexerStats     m_Stats          {};
     
     void DoFlush();
     void IndexSTerms(uint32_t FID, const QLocalFingerprint_t* lfs, size_t Nlfs);
     void IndexBTerms(uint32_t FID, const QLocalFingerprint_t *lfs, size_t Nlfs);
+    void IndexTimeBins(uint32_t FID, const QLocalFingerprint_t *lfs, size_t Nlfs);
 
 };
 
@@ -12,6 +12,7 @@
 
 #include <iostream>
 #include <cstring>
+#include <cmath>
 #include <cassert>
 #include <memory>
 
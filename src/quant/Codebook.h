@@ -71,7 +71,7 @@ class Codebook
     /// Load a codebook from a file
     static std::unique_ptr <Codebook> Load(const std::string &filename);
 
-    QResults  quantize(const LocalFingerprint_t &lf);
+    QResults  quantize(const LocalFingerprint_t &lf) const;
 
     void FindDuplicates();
     void Analyze();
@@ -0,0 +1,104 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+// A bounded lock-free single-producer/single-consumer queue for internal use.
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+
+namespace Audioneex
+{
+
+/// A fixed-capacity ring buffer through which exactly one producer thread
+/// hands items over to exactly one consumer thread. The indexes are only
+/// written by their owning side, so no locks are involved; the blocking
+/// operations spin briefly and then back off while the queue is full/empty.
+template <typename T>
+class SPSCQueue
+{
+    std::vector<T>       m_Ring;
+    std::atomic<size_t>  m_Head {0};  // Next slot to pop
+    char                 m_Pad[64];   // Keep the indexes on separate cache lines
+    std::atomic<size_t>  m_Tail {0};  // Next slot to push
+
+    size_t Next(size_t i) const { return i + 1 == m_Ring.size() ? 0 : i + 1; }
+
+    static void Backoff(int &spins)
+    {
+        if(++spins < 64)
+           return;
+        if(spins < 128)
+           std::this_thread::yield();
+        else
+           std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+ public:
+
+    /// Create a queue holding up to 'capacity' items
+    explicit SPSCQueue(size_t capacity) :
+        m_Ring(capacity + 1)
+    {
+        if(capacity == 0)
+           throw std::invalid_argument("SPSCQueue: zero capacity");
+    }
+
+    SPSCQueue(const SPSCQueue&) = delete;
+    SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+    /// Push an item if there is room. Producer side only.
+    bool TryPush(T &&item)
+    {
+        size_t tail = m_Tail.load(std::memory_order_relaxed);
+        size_t next = Next(tail);
+        if(next == m_Head.load(std::memory_order_acquire))
+           return false;
+        m_Ring[tail] = std::move(item);
+        m_Tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /// Pop an item if there is any. Consumer side only.
+    bool TryPop(T &item)
+    {
+        size_t head = m_Head.load(std::memory_order_relaxed);
+        if(head == m_Tail.load(std::memory_order_acquire))
+           return false;
+        item = std::move(m_Ring[head]);
+        m_Head.store(Next(head), std::memory_order_release);
+        return true;
+    }
+
+    /// Push an item, waiting for room if the queue is full
+    void Push(T &&item)
+    {
+        for(int spins=0; !TryPush(std::move(item)); )
+            Backoff(spins);
+    }
+
+    /// Pop an item, waiting for one if the queue is empty
+    void Pop(T &item)
+    {
+        for(int spins=0; !TryPop(item); )
+            Backoff(spins);
+    }
+
+    /// Get the maximum number of items in the queue
+    size_t Capacity() const { return m_Ring.size() - 1; }
+};
+
+}// end namespace Audioneex
+
+#endif
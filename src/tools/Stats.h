@@ -0,0 +1,85 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+// Timing helpers for the engine's run-time statistics (see STATS_HERE).
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+
+#include "common.h"
+
+#ifdef WIN32
+ #include <windows.h>
+#else
+ #include <time.h>
+#endif
+
+namespace Audioneex
+{
+namespace Stats
+{
+
+/// Monotonic wall clock time, in seconds.
+inline double GetWallTime()
+{
+    return std::chrono::duration<double>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// CPU time consumed so far by the calling thread, in seconds.
+inline double GetThreadCPUTime()
+{
+#ifdef WIN32
+    FILETIME tc, te, tk, tu;
+    if(!::GetThreadTimes(::GetCurrentThread(), &tc, &te, &tk, &tu))
+       return 0;
+    ULARGE_INTEGER k, u;
+    k.LowPart = tk.dwLowDateTime; k.HighPart = tk.dwHighDateTime;
+    u.LowPart = tu.dwLowDateTime; u.HighPart = tu.dwHighDateTime;
+    return double(k.QuadPart + u.QuadPart) * 1e-7;
+#else
+    struct timespec ts;
+    if(::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+       return 0;
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+
+/// Adds the time elapsed during its lifetime, as measured by the given
+/// clock, to a running total.
+template <double (*Clock)()>
+class ScopedTimer
+{
+    double& m_Total;
+    double  m_Start;
+
+public:
+
+    explicit ScopedTimer(double& total) :
+        m_Total (total),
+        m_Start (Clock())
+    {}
+
+    ~ScopedTimer() { m_Total += Clock() - m_Start; }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+typedef ScopedTimer<GetWallTime>       WallTimer;
+typedef ScopedTimer<GetThreadCPUTime>  CPUTimer;
+
+
+}// end namespace Stats
+}// end namespace Audioneex
+
+#endif // STATS_H
@@ -167,17 +167,17 @@ class Tester
 	
 	// ----------------------------------------------------------------------------
 	
-	void Dump(const hashtable_Qhisto &table)
+	void Dump(const hashtable_Qcand &table)
 	{
 	    std::string str;
-	    for(const hashtable_Qhisto::value_type &e : table){
+	    for(const hashtable_Qcand::value_type &e : table){
 	        int score = e.first;
 	        str.append(" score: ")
 	           .append(std::to_string(score))
 	           .append("\t");
-            const std::list<Qhisto_t> &tie_list = e.second;
-	        for(Qhisto_t H : tie_list){
-	            str.append(" Q").append(std::to_string(H.Qi));
+            const std::vector<Qcand_t> &tie_list = e.second;
+	        for(const Qcand_t &C : tie_list){
+	            str.append(" Q").append(std::to_string(C.Qi));
 	        }
 	        str.append("\n");
 	    }
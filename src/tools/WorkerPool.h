@@ -0,0 +1,110 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+// A minimal fixed-size thread pool for internal use.
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <stdexcept>
+
+namespace Audioneex
+{
+
+class WorkerPool
+{
+    std::vector<std::thread>            m_Workers;
+    std::deque<std::function<void()> >  m_Tasks;
+    std::mutex                          m_Lock;
+    std::condition_variable             m_Signal;
+    bool                                m_Stop {false};
+
+    void Run()
+    {
+        for(;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_Lock);
+                m_Signal.wait(lock, [this]{ return m_Stop || !m_Tasks.empty(); });
+                if(m_Stop && m_Tasks.empty())
+                   return;
+                task = std::move(m_Tasks.front());
+                m_Tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+ public:
+
+    /// Create a pool with the given number of worker threads.
+    explicit WorkerPool(size_t nthreads)
+    {
+        if(nthreads == 0)
+           throw std::invalid_argument("WorkerPool: no threads requested");
+
+        m_Workers.reserve(nthreads);
+        for(size_t i=0; i<nthreads; i++)
+            m_Workers.emplace_back(&WorkerPool::Run, this);
+    }
+
+    /// Pending tasks are completed before the workers are joined.
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            m_Stop = true;
+        }
+        m_Signal.notify_all();
+        for(std::thread &t : m_Workers)
+            t.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /// Queue a task for execution. Any exception thrown by the task is
+    /// stored in the returned future and rethrown by future::get().
+    std::future<void> Submit(std::function<void()> fn)
+    {
+        auto task = std::make_shared<std::packaged_task<void()> >(std::move(fn));
+        std::future<void> res = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            m_Tasks.emplace_back([task]{ (*task)(); });
+        }
+        m_Signal.notify_one();
+        return res;
+    }
+
+    /// Wait for all the given tasks to complete. If any of them failed
+    /// the first exception (in submission order) is rethrown.
+    static void Wait(std::vector<std::future<void> > &tasks)
+    {
+        for(std::future<void> &f : tasks)
+            f.wait();
+        for(std::future<void> &f : tasks)
+            f.get();
+    }
+
+    /// Number of worker threads
+    size_t Size() const { return m_Workers.size(); }
+};
+
+}// end namespace Audioneex
+
+#endif // WORKERPOOL_H
@@ -0,0 +1,44 @@
+/*
+  Copyright (c) 2014, Alberto Gramaglia
+
+  This Source Code Form is subject to the terms of the Mozilla Public
+  License, v. 2.0. If a copy of the MPL was not distributed with this
+  file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+*/
+
+#ifndef TESTCOMMON_H
+#define TESTCOMMON_H
+
+#include <string>
+#include <boost/filesystem.hpp>
+
+
+/// A uniquely named directory in the system's temporary directory, for
+/// the tests that need a private data store. It is deleted along with its
+/// contents on destruction.
+class TempDir
+{
+    boost::filesystem::path m_Path;
+
+public:
+
+    TempDir() :
+        m_Path (boost::filesystem::temp_directory_path() /
+                boost::filesystem::unique_path("audioneex-%%%%-%%%%-%%%%"))
+    {
+        boost::filesystem::create_directories(m_Path);
+    }
+
+    ~TempDir(){
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(m_Path, ec);
+    }
+
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+
+    std::string Path() const { return m_Path.string(); }
+};
+
+#endif
@@ -112,3 +112,72 @@ TEST_CASE("Fingerprint processing") {
 #endif
 }
 
+
+
+TEST_CASE("Fingerprint gating") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    Audioneex::Fingerprint fingerprint;
+
+    REQUIRE( fingerprint.GetGateLevel() == 0 );
+    REQUIRE_THROWS( fingerprint.SetGateLevel(1) );
+    REQUIRE_THROWS( fingerprint.SetGateLevel(-121) );
+    REQUIRE_NOTHROW( fingerprint.SetGateLevel(-60) );
+    REQUIRE( fingerprint.GetGateLevel() == -60 );
+
+    AudioBlock<int16_t> iblock(Srate, Srate, Nchan);
+    AudioBlock<float>   music(Srate, Srate, Nchan);
+    AudioBlock<float>   silence(Srate, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan, 0);
+
+    AudioSourceFile     asource;
+
+    asource.SetSampleRate( Srate );
+    asource.SetChannelCount( Nchan );
+    asource.SetSampleResolution( 16 );
+
+    REQUIRE_NOTHROW( asource.Open("./data/rec1.mp3") );
+    REQUIRE_NOTHROW( asource.GetAudioBlock(iblock) );
+    REQUIRE( iblock.Size() == Srate );
+    REQUIRE_NOTHROW( iblock.Normalize( music ) );
+
+    // Silence is gated entirely and only advances the time
+    audio.Append(silence).Append(silence);
+
+    REQUIRE_NOTHROW( fingerprint.Process( audio ) );
+
+    const Audioneex::GateStats_t &gate = fingerprint.GetGateStats();
+
+    REQUIRE( gate.Frames > 0 );
+    REQUIRE( gate.Silent == gate.Frames );
+    REQUIRE( fingerprint.Get().empty() );
+    REQUIRE( fingerprint.GetTimeDelta() == static_cast<int>(gate.Frames) );
+
+    // Silence followed by music produces the LFs of the music only
+    Audioneex::Fingerprint ungated;
+
+    audio.Resize(0);
+    audio.Append(silence).Append(music);
+
+    fingerprint.Reset();
+
+    REQUIRE_NOTHROW( fingerprint.Process( audio ) );
+    REQUIRE_NOTHROW( ungated.Process( audio ) );
+
+    REQUIRE( gate.Silent > 0 );
+    REQUIRE( gate.Silent < gate.Frames );
+    REQUIRE( !fingerprint.Get().empty() );
+    REQUIRE( fingerprint.Get().size() <= ungated.Get().size() );
+
+    for(const Audioneex::LocalFingerprint_t &lf : fingerprint.Get()){
+        double T = lf.T * Audioneex::Pms::dt;
+        REQUIRE( T >= 0.5 );
+    }
+
+    // The gate is off by default
+    REQUIRE( ungated.GetGateStats().Frames == gate.Frames );
+    REQUIRE( ungated.GetGateStats().Silent == 0 );
+    REQUIRE( ungated.GetGateStats().Flat == 0 );
+}
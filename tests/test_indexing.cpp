@@ -11,6 +11,8 @@
 #include "catch.hpp"
 
 #include "dao_common.h"
+#include "FingerprintCodec.h"
+#include "test_common.h"
 #include "test_indexing.h"
 
 ///
@@ -37,6 +39,9 @@ TEST_CASE("Indexer accessors") {
     indexer->SetCacheLimit( 128 );
     REQUIRE( indexer->GetCacheLimit() == 128 );
     REQUIRE( indexer->GetCacheUsed() == 0 );
+    REQUIRE( indexer->GetStopTermLimit() == 0 );
+    indexer->SetStopTermLimit( 1000 );
+    REQUIRE( indexer->GetStopTermLimit() == 1000 );
     indexer->SetAudioProvider( &itest );
     REQUIRE( indexer->GetAudioProvider() == &itest );
     indexer->SetDataStore( &dstore );
@@ -120,3 +125,153 @@ TEST_CASE("Indexer indexing") {
 
 }
 
+
+TEST_CASE("Fingerprint store compression") {
+
+    std::ifstream ifp ("./data/rec1.fp", std::ios::binary | std::ios::ate);
+    REQUIRE( ifp.good() );
+    size_t fpsize = ifp.tellg();
+    ifp.seekg(0);
+    REQUIRE( fpsize > FingerprintCodec::FRAME_LFS * sizeof(Audioneex::QLocalFingerprint_t) * 2 );
+
+    std::vector<uint8_t> fp (fpsize);
+    ifp.read(reinterpret_cast<char*>(fp.data()), fpsize);
+
+    // Encoding
+
+    std::vector<uint8_t> enc;
+    FingerprintCodec::Encode(fp.data(), fp.size(), enc);
+    REQUIRE( FingerprintCodec::IsEncoded(enc.data(), enc.size()) );
+    REQUIRE( enc.size() < fp.size() );
+    REQUIRE( FingerprintCodec::GetDecodedSize(enc.data(), FingerprintCodec::GetHeaderSize()) == fpsize );
+
+    std::vector<uint8_t> dec (fpsize);
+    REQUIRE( FingerprintCodec::Decode(enc.data(), enc.size(), dec.data(), 0) == fpsize );
+    REQUIRE( dec == fp );
+
+    // Fingerprints that can't be encoded are stored as they are
+    FingerprintCodec::Encode(fp.data(), 13, enc);
+    REQUIRE( FingerprintCodec::IsEncoded(enc.data(), enc.size()) == false );
+    REQUIRE( std::equal(enc.begin(), enc.end(), fp.begin()) );
+
+    // Range reads from the data store, within and across frames. A private
+    // store is used, so as not to interfere with the other tests' data.
+
+    TempDir tmp;
+    DATASTORE_T dstore ( tmp.Path() );
+
+	// For client/server databases only (e.g. Couchbase)
+    dstore.SetServerName( "localhost" );
+    dstore.SetServerPort( 8091 );
+    dstore.SetUsername( "admin" );
+    dstore.SetPassword( "password" );
+
+    REQUIRE_NOTHROW( dstore.Open( KVDataStore::BUILD, true ) );
+    REQUIRE_NOTHROW( dstore.PutFingerprint(1, fp.data(), fp.size()) );
+    REQUIRE( dstore.GetFingerprintSize(1) == fpsize );
+
+    size_t lfsize = sizeof(Audioneex::QLocalFingerprint_t);
+    size_t frame = FingerprintCodec::FRAME_LFS * lfsize;
+
+    size_t ranges[][2] = { {0, 0},
+                           {0, lfsize},
+                           {frame - lfsize, 2 * lfsize},
+                           {frame, frame},
+                           {lfsize * 3, frame * 2},
+                           {fpsize - lfsize, 0},
+                           {fpsize - lfsize, 10 * lfsize} };
+
+    for(auto &range : ranges)
+    {
+        size_t bo = range[0];
+        size_t nbytes = range[1];
+        size_t expected = nbytes ? std::min(nbytes, fpsize - bo) : fpsize - bo;
+
+        size_t read = 0;
+        const uint8_t* pfp = dstore.GetFingerprint(1, read, nbytes, bo);
+        REQUIRE( read == expected );
+        REQUIRE( std::equal(pfp, pfp + read, fp.begin() + bo) );
+
+        if(nbytes){
+           std::vector<uint8_t> buffer (nbytes);
+           read = dstore.ReadFingerprint(1, buffer.data(), nbytes, bo);
+           REQUIRE( read == expected );
+           REQUIRE( std::equal(buffer.begin(), buffer.begin() + read, fp.begin() + bo) );
+        }
+    }
+
+    dstore.Close();
+}
+
+
+TEST_CASE("Indexer statistics") {
+
+    std::vector<std::vector<uint8_t> > fps;
+    uint64_t Nlfs = 0;
+
+    for(const char* file : { "./data/rec1.fp", "./data/rec2.fp" })
+    {
+        std::ifstream ifp (file, std::ios::binary | std::ios::ate);
+        REQUIRE( ifp.good() );
+        size_t fpsize = ifp.tellg();
+        ifp.seekg(0);
+
+        fps.emplace_back(fpsize);
+        ifp.read(reinterpret_cast<char*>(fps.back().data()), fpsize);
+        Nlfs += fpsize / sizeof(Audioneex::QLocalFingerprint_t);
+    }
+
+    TempDir tmp;
+    DATASTORE_T dstore ( tmp.Path() );
+
+    // For client/server databases only (e.g. Couchbase)
+    dstore.SetServerName( "localhost" );
+    dstore.SetServerPort( 8091 );
+    dstore.SetUsername( "admin" );
+    dstore.SetPassword( "password" );
+
+    REQUIRE_NOTHROW( dstore.Open( KVDataStore::BUILD, true ) );
+
+    std::unique_ptr <Audioneex::Indexer>
+    indexer ( Audioneex::Indexer::Create() );
+
+    REQUIRE_NOTHROW( indexer->SetDataStore( &dstore ) );
+    REQUIRE_NOTHROW( indexer->Start() );
+
+    for(size_t i=0; i<fps.size(); i++)
+        REQUIRE_NOTHROW( indexer->Index(i+1, fps[i].data(), fps[i].size()) );
+
+    REQUIRE_NOTHROW( indexer->End() );
+
+    Audioneex::IndexerStats stats = indexer->GetStats();
+
+#ifdef WITH_STATS
+    REQUIRE( stats.Fingerprints == fps.size() );
+    REQUIRE( stats.LFs == Nlfs );
+    REQUIRE( stats.IndexTime > 0 );
+    REQUIRE( stats.Flushes > 0 );
+    REQUIRE( stats.FlushTime > 0 );
+    REQUIRE( stats.MaxFlushTime > 0 );
+    REQUIRE( stats.MaxFlushTime <= stats.FlushTime );
+    REQUIRE( stats.ChunksWritten > 0 );
+    REQUIRE( stats.BytesWritten > 0 );
+#else
+    // Nothing is collected
+    REQUIRE( stats.Fingerprints == 0 );
+    REQUIRE( stats.LFs == 0 );
+    REQUIRE( stats.Flushes == 0 );
+    REQUIRE( stats.BytesWritten == 0 );
+#endif
+
+    // The fingerprints were given, so nothing was extracted from audio
+    REQUIRE( stats.FFTTime == 0 );
+    REQUIRE( stats.QuantizeTime == 0 );
+
+    indexer->ResetStats();
+    stats = indexer->GetStats();
+    REQUIRE( stats.Fingerprints == 0 );
+    REQUIRE( stats.Flushes == 0 );
+    REQUIRE( stats.IndexTime == 0 );
+
+    dstore.Close();
+}
@@ -11,6 +11,14 @@
 #include "catch.hpp"
 
 #include "dao_common.h"
+#include "MMapDataStore.h"
+#include "MemDataStore.h"
+#include "SegmentedDataStore.h"
+#include "TermDictionary.h"
+#include "LFStream.h"
+#include "Indexer.h"
+#include "Recognizer.h"
+#include "test_common.h"
 #include "test_matching.h"
 
 ///
@@ -37,6 +45,19 @@ TEST_CASE("Matcher accessors") {
     REQUIRE( matcher.GetMatchType() == Audioneex::MSCALE_MATCH );
     matcher.SetRerankThreshold(0.6f);
     REQUIRE( matcher.GetRerankThreshold() == 0.6f );
+    REQUIRE( matcher.GetThreads() == 1 );
+    matcher.SetThreads(4);
+    REQUIRE( matcher.GetThreads() == 4 );
+    matcher.SetThreads(1);
+    REQUIRE( matcher.GetThreads() == 1 );
+    REQUIRE_THROWS_AS( matcher.SetThreads(0),
+                       Audioneex::InvalidParameterException );
+    REQUIRE( !matcher.GetFingerprintCache() );
+    auto fpcache = std::make_shared<Audioneex::DataStoreImpl::FingerprintCache>(1<<20);
+    matcher.SetFingerprintCache( fpcache );
+    REQUIRE( matcher.GetFingerprintCache() == fpcache );
+    REQUIRE_THROWS_AS( Audioneex::DataStoreImpl::FingerprintCache(1<<20, 10),
+                       Audioneex::InvalidParameterException );
     REQUIRE( matcher.GetMatchTime() == 0 );
     REQUIRE( matcher.GetStepsCount() == 0 );
     REQUIRE( matcher.GetResults().Top_K.empty() );
@@ -239,3 +260,2452 @@ TEST_CASE("Matcher processing broken data stores") {
 
 }
 
+
+TEST_CASE("Matcher processing mmap data stores") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    DATASTORE_T dstore ( "./data" );
+
+    BuildTestIndex(dstore);
+
+    // Convert the data store into a segment and check that it serves
+    // the same data.
+
+    REQUIRE_NOTHROW( MMapDataStore::Convert(dstore, "./data") );
+
+    MMapDataStore mstore ( "./data" );
+
+    REQUIRE_THROWS_AS( mstore.Open(KVDataStore::BUILD), std::invalid_argument );
+    REQUIRE_NOTHROW( mstore.Open() );
+    REQUIRE( mstore.IsReentrant() );
+    REQUIRE( mstore.GetFingerprintsCount() == 2 );
+
+    std::vector<int> lids, mlids;
+    dstore.GetPListIDs(lids);
+    mstore.GetPListIDs(mlids);
+    REQUIRE( lids.empty() == false );
+    REQUIRE( lids == mlids );
+
+    for(int lid : lids)
+    {
+        for(int bid=1; ; bid++)
+        {
+            size_t size = 0, msize = 0;
+            const uint8_t* pblock = dstore.GetPListBlock(lid, bid, size, false);
+            std::vector<uint8_t> block (pblock, pblock + size);
+            const uint8_t* mblock = mstore.GetPListBlock(lid, bid, msize, false);
+            REQUIRE( msize == size );
+            if(size == 0)
+               break;
+            REQUIRE( std::equal(block.begin(), block.end(), mblock) );
+        }
+    }
+
+    for(uint32_t FID=1; FID<=2; FID++)
+    {
+        size_t fpsize = dstore.GetFingerprintSize(FID);
+        REQUIRE( mstore.GetFingerprintSize(FID) == fpsize );
+
+        size_t read = 0, mread = 0;
+        const uint8_t* pfp = dstore.GetFingerprint(FID, read);
+        std::vector<uint8_t> fp (pfp, pfp + read);
+        const uint8_t* mfp = mstore.GetFingerprint(FID, mread);
+        REQUIRE( mread == fpsize );
+        REQUIRE( std::equal(fp.begin(), fp.end(), mfp) );
+    }
+
+    // Match against the segment
+
+    Audioneex::Matcher matcher;
+    Audioneex::Fingerprint fingerprint;
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    GetAudio(asource, iblock, audio);
+    fingerprint.Process( audio );
+    Audioneex::lf_vector lfs = fingerprint.Get();
+    REQUIRE( lfs.empty() == false );
+
+    matcher.SetRerankThreshold(1);
+
+    REQUIRE_NOTHROW( matcher.SetDataStore( &mstore ) );
+    REQUIRE( matcher.Process( lfs ) > 0 );
+    REQUIRE( matcher.GetResults().GetTopScore(1) > 0 );
+}
+
+
+TEST_CASE("Matcher processing in-memory data stores") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    DATASTORE_T dstore ( "./data" );
+
+    BuildTestIndex(dstore);
+
+    // Build the same index in memory, merging the 2nd recording,
+    // and check that it holds the same data.
+
+    MemDataStore mstore;
+
+    REQUIRE_NOTHROW( mstore.Open(KVDataStore::BUILD) );
+    REQUIRE( mstore.Empty() );
+    REQUIRE( mstore.IsReentrant() == false );
+
+    IndexFiles (&mstore, "./data/rec1.fp", 1);
+
+    REQUIRE_NOTHROW( mstore.Open(KVDataStore::BUILD_MERGE) );
+
+    IndexFiles (&mstore, "./data/rec2.fp", 2);
+
+    REQUIRE_NOTHROW( mstore.Open() );
+    REQUIRE( mstore.IsReentrant() );
+    REQUIRE( mstore.GetFingerprintsCount() == 2 );
+    REQUIRE_THROWS_AS( mstore.OnIndexerListHeader(1), std::invalid_argument );
+
+    std::vector<int> lids, mlids;
+    dstore.GetPListIDs(lids);
+    mstore.GetPListIDs(mlids);
+    REQUIRE( lids.empty() == false );
+    REQUIRE( lids == mlids );
+
+    for(int lid : lids)
+    {
+        for(int bid=1; ; bid++)
+        {
+            size_t size = 0, msize = 0;
+            const uint8_t* pblock = dstore.GetPListBlock(lid, bid, size, true);
+            std::vector<uint8_t> block (pblock, pblock + size);
+            const uint8_t* mblock = mstore.GetPListBlock(lid, bid, msize, true);
+            REQUIRE( msize == size );
+            if(size == 0)
+               break;
+            REQUIRE( std::equal(block.begin(), block.end(), mblock) );
+        }
+    }
+
+    // Save and load back
+
+    mstore.PutMetadata(1, "rec1");
+    REQUIRE_NOTHROW( mstore.Save("./data") );
+
+    MemDataStore lstore ( "./data" );
+
+    REQUIRE_NOTHROW( lstore.Open() );
+    REQUIRE( lstore.GetFingerprintsCount() == 2 );
+    REQUIRE( lstore.GetMetadata(1) == "rec1" );
+    REQUIRE( lstore.GetMetadata(2).empty() );
+
+    lstore.GetPListIDs(mlids);
+    REQUIRE( lids == mlids );
+
+    for(uint32_t FID=1; FID<=2; FID++)
+    {
+        size_t fpsize = dstore.GetFingerprintSize(FID);
+        REQUIRE( lstore.GetFingerprintSize(FID) == fpsize );
+
+        size_t read = 0, mread = 0;
+        const uint8_t* pfp = dstore.GetFingerprint(FID, read);
+        std::vector<uint8_t> fp (pfp, pfp + read);
+        const uint8_t* mfp = lstore.GetFingerprint(FID, mread);
+        REQUIRE( mread == fpsize );
+        REQUIRE( std::equal(fp.begin(), fp.end(), mfp) );
+    }
+
+    // Match against the loaded data store
+
+    Audioneex::Matcher matcher;
+    Audioneex::Fingerprint fingerprint;
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    GetAudio(asource, iblock, audio);
+    fingerprint.Process( audio );
+    Audioneex::lf_vector lfs = fingerprint.Get();
+    REQUIRE( lfs.empty() == false );
+
+    matcher.SetRerankThreshold(1);
+
+    REQUIRE_NOTHROW( matcher.SetDataStore( &lstore ) );
+    REQUIRE( matcher.Process( lfs ) > 0 );
+    REQUIRE( matcher.GetResults().GetTopScore(1) > 0 );
+}
+
+
+TEST_CASE("Matcher processing remote data stores") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    // Build the same index in a local data store and in one simulating
+    // the latency of a remote data store.
+
+    MemDataStore  mstore;
+    SlowDataStore sstore;
+
+    BuildTestIndex(mstore);
+    BuildTestIndex(sstore);
+
+    // Batched reads must return the same blocks as single reads
+
+    std::vector<int> lids;
+    mstore.GetPListIDs(lids);
+    REQUIRE( lids.empty() == false );
+
+    std::vector<uint8_t> buffer (Audioneex::DataStoreImpl::POSTINGSLIST_BLOCK_THRESHOLD * 2);
+    std::vector<uint8_t> bbuffer (buffer.size() * 2);
+
+    Audioneex::PListBlockRequest reqs[3] = {
+        { lids.front(), 1, bbuffer.data(), buffer.size(), true, 0 },
+        { lids.back(), 1, bbuffer.data() + buffer.size(), buffer.size(), false, 0 },
+        { lids.back(), 1000000, bbuffer.data(), 0, false, 0 }
+    };
+
+    mstore.ReadPListBlocks(reqs, 3);
+
+    size_t size = mstore.ReadPListBlock(lids.front(), 1, buffer.data(), buffer.size(), true);
+    REQUIRE( size > 0 );
+    REQUIRE( reqs[0].data_size == size );
+    REQUIRE( std::equal(buffer.begin(), buffer.begin() + size, reqs[0].buffer) );
+
+    size = mstore.ReadPListBlock(lids.back(), 1, buffer.data(), buffer.size(), false);
+    REQUIRE( size > 0 );
+    REQUIRE( reqs[1].data_size == size );
+    REQUIRE( std::equal(buffer.begin(), buffer.begin() + size, reqs[1].buffer) );
+
+    REQUIRE( reqs[2].data_size == 0 );
+
+    // The matcher must find the same results, reading the blocks for
+    // all the query terms in far fewer round-trips.
+
+    Audioneex::Fingerprint fingerprint;
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    GetAudio(asource, iblock, audio);
+    fingerprint.Process( audio );
+    Audioneex::lf_vector lfs = fingerprint.Get();
+    REQUIRE( lfs.empty() == false );
+
+    Audioneex::Matcher matcher, smatcher;
+
+    matcher.SetRerankThreshold(1);
+    smatcher.SetRerankThreshold(1);
+
+    REQUIRE_NOTHROW( matcher.SetDataStore( &mstore ) );
+    REQUIRE_NOTHROW( smatcher.SetDataStore( &sstore ) );
+    REQUIRE( matcher.Process( lfs ) > 0 );
+    REQUIRE( smatcher.Process( lfs ) > 0 );
+
+    const Audioneex::MatchResults_t &res = matcher.GetResults();
+    const Audioneex::MatchResults_t &sres = smatcher.GetResults();
+
+    REQUIRE( res.GetTopScore(1) > 0 );
+    REQUIRE( sres.Top_K.size() == res.Top_K.size() );
+
+    for(size_t k=1; k<=res.Top_K.size(); k++){
+        REQUIRE( sres.GetTopScore(k) == res.GetTopScore(k) );
+        REQUIRE( sres.GetTop(k) == res.GetTop(k) );
+    }
+
+    REQUIRE( sstore.Blocks > 0 );
+    REQUIRE( sstore.Calls < sstore.Blocks );
+}
+
+
+TEST_CASE("Matcher processing segmented data stores") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    DATASTORE_T dstore ( "./data" );
+
+    BuildTestIndex(dstore);
+
+    // Index each recording in its own segment. The background compaction
+    // is disabled so that the segments can be checked.
+
+    SegmentedDataStore sstore ( "./data" );
+
+    sstore.SetCompactionThreshold(0);
+
+    REQUIRE_NOTHROW( sstore.Open(KVDataStore::BUILD_MERGE) );
+    REQUIRE_NOTHROW( sstore.Clear() );
+    REQUIRE( sstore.Empty() );
+    REQUIRE( sstore.IsReentrant() );
+
+    IndexFiles (&sstore, "./data/rec1.fp", 1);
+
+    REQUIRE( sstore.GetSegmentsCount() == 1 );
+    REQUIRE( sstore.GetFingerprintsCount() == 0 );
+
+    IndexFiles (&sstore, "./data/rec2.fp", 2);
+
+    REQUIRE_NOTHROW( sstore.Commit() );
+    REQUIRE( sstore.GetSegmentsCount() == 3 );
+    REQUIRE( sstore.GetFingerprintsCount() == 2 );
+
+    // The segmented lists must hold the same postings as the single index
+
+    auto check_lists = [&]()
+    {
+        std::vector<int> lids, slids;
+        dstore.GetPListIDs(lids);
+        sstore.GetPListIDs(slids);
+        REQUIRE( lids.empty() == false );
+        REQUIRE( lids == slids );
+
+        for(int lid : lids)
+        {
+            using namespace Audioneex::DataStoreImpl;
+
+            REQUIRE( GetPListMaxFID(&dstore, lid) == GetPListMaxFID(&sstore, lid) );
+
+            std::unique_ptr<PListIterator> it (GetPListIterator(&dstore, lid));
+            std::unique_ptr<PListIterator> sit (GetPListIterator(&sstore, lid));
+
+            for(;;)
+            {
+                Posting_t &p = it->get();
+                Posting_t &sp = sit->get();
+                REQUIRE( p.FID == sp.FID );
+                REQUIRE( p.tf == sp.tf );
+                if(p.empty())
+                   break;
+                REQUIRE( std::equal(p.LID, p.LID + p.tf, sp.LID) );
+                REQUIRE( std::equal(p.T, p.T + p.tf, sp.T) );
+                REQUIRE( std::equal(p.E, p.E + p.tf, sp.E) );
+                it->next();
+                sit->next();
+            }
+        }
+    };
+
+    check_lists();
+
+    REQUIRE( sstore.Compact(true) );
+    REQUIRE( sstore.GetSegmentsCount() == 1 );
+    REQUIRE( sstore.GetFingerprintsCount() == 2 );
+
+    check_lists();
+
+    // Reopen for reading and match against it
+
+    REQUIRE_NOTHROW( sstore.Open() );
+    REQUIRE( sstore.GetSegmentsCount() == 1 );
+    REQUIRE_THROWS_AS( sstore.OnIndexerStart(), std::invalid_argument );
+
+    Audioneex::Matcher matcher;
+    Audioneex::Fingerprint fingerprint;
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    GetAudio(asource, iblock, audio);
+    fingerprint.Process( audio );
+    Audioneex::lf_vector lfs = fingerprint.Get();
+    REQUIRE( lfs.empty() == false );
+
+    matcher.SetRerankThreshold(1);
+
+    REQUIRE_NOTHROW( matcher.SetDataStore( &sstore ) );
+    REQUIRE( matcher.Process( lfs ) > 0 );
+    REQUIRE( matcher.GetResults().GetTopScore(1) > 0 );
+}
+
+
+TEST_CASE("Matcher skipping missing terms") {
+
+    // Terms statistics serialization
+
+    TermDictionary terms;
+
+    terms.Add(3, 1);
+    terms.Add(3, 2);
+    terms.Add(200, 1);
+
+    std::vector<uint8_t> data;
+    terms.Serialize(data);
+
+    TermDictionary terms2;
+    REQUIRE_NOTHROW( terms2.Deserialize(data.data(), data.size()) );
+    REQUIRE( terms2.Size() == 2 );
+    REQUIRE( terms2.Contains(3) );
+    REQUIRE( terms2.GetDocFrequency(3) == 3 );
+    REQUIRE( terms2.GetDocFrequency(200) == 1 );
+    REQUIRE( terms2.Contains(4) == false );
+    REQUIRE( terms2.GetDocFrequency(100000) == 0 );
+    REQUIRE_THROWS_AS( terms2.Deserialize(data.data(), data.size() - 1),
+                       std::runtime_error );
+
+    // Build the same index in a data store and in memory, and check that
+    // the statistics match the index.
+
+    DATASTORE_T dstore ( "./data" );
+
+    BuildTestIndex(dstore);
+
+    SlowDataStore sstore;
+
+    BuildTestIndex(sstore);
+
+    std::vector<int> lids;
+    sstore.GetPListIDs(lids);
+    REQUIRE( lids.empty() == false );
+
+    int missing = -1;
+
+    for(size_t i=0; i<lids.size(); i++)
+    {
+        int64_t df = sstore.GetDocFrequency(lids[i]);
+        REQUIRE( (df == 1 || df == 2) );
+
+        // Data stores not keeping the statistics return -1
+        int64_t ddf = dstore.GetDocFrequency(lids[i]);
+        REQUIRE( (ddf == df || ddf == -1) );
+
+        if(missing < 0 && lids[i] != static_cast<int>(i))
+           missing = static_cast<int>(i);
+    }
+
+    if(missing < 0)
+       missing = lids.back() + 1;
+
+    REQUIRE( sstore.GetDocFrequency(missing) == 0 );
+    REQUIRE( dstore.GetDocFrequency(missing) <= 0 );
+
+    // Missing terms must not be looked up in the data store
+
+    using namespace Audioneex::DataStoreImpl;
+
+    sstore.Calls = 0;
+
+    std::unique_ptr<PListIterator> it (GetPListIterator(&sstore, missing));
+    REQUIRE( it->get().empty() );
+    it->seek(2);
+    REQUIRE( it->get().empty() );
+    REQUIRE( GetPListMaxFID(&sstore, missing) == 0 );
+
+    PListIterator* batch = it.get();
+    REQUIRE( PrefetchPListBlocks(&sstore, &batch, 1) == 0 );
+    REQUIRE( sstore.Calls == 0 );
+
+    it.reset(GetPListIterator(&sstore, lids.front()));
+    REQUIRE( it->get().empty() == false );
+    REQUIRE( sstore.Calls > 0 );
+}
+
+
+TEST_CASE("Matcher processing slim postings") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    // Build the same index with full and slim postings. Once the index holds
+    // slim postings they're used regardless of the indexer's setting.
+
+    MemDataStore fstore, sstore;
+
+    REQUIRE_NOTHROW( fstore.Open(KVDataStore::BUILD) );
+    REQUIRE_NOTHROW( sstore.Open(KVDataStore::BUILD) );
+
+    IndexFiles (&fstore, "./data/rec1.fp", 1);
+    IndexFiles (&fstore, "./data/rec2.fp", 2);
+    IndexFiles (&sstore, "./data/rec1.fp", 1, Audioneex::SLIM_POSTINGS);
+    IndexFiles (&sstore, "./data/rec2.fp", 2, Audioneex::FULL_POSTINGS);
+
+    REQUIRE_NOTHROW( fstore.Open() );
+    REQUIRE_NOTHROW( sstore.Open() );
+
+    std::vector<int> flids, slids;
+    fstore.GetPListIDs(flids);
+    sstore.GetPListIDs(slids);
+
+    int bins_list = Audioneex::IndexerImpl::GetTimeBinsListID(Audioneex::MSCALE_MATCH);
+
+    REQUIRE( flids.empty() == false );
+    REQUIRE( slids.size() == flids.size() + 1 );
+    REQUIRE( slids.back() == bins_list );
+
+    // The slim postings hold the same data but the times
+
+    using namespace Audioneex::DataStoreImpl;
+
+    size_t fsize = 0, ssize = 0;
+
+    for(int lid : flids)
+    {
+        for(int bid=1; ; bid++)
+        {
+            size_t size = 0, ssz = 0;
+            fstore.GetPListBlock(lid, bid, size, true);
+            sstore.GetPListBlock(lid, bid, ssz, true);
+            if(size == 0 && ssz == 0)
+               break;
+            fsize += size;
+            ssize += ssz;
+        }
+
+        std::unique_ptr<PListIterator> fit (GetPListIterator(&fstore, lid));
+        std::unique_ptr<PListIterator> sit (GetPListIterator(&sstore, lid));
+
+        for(; !fit->get().empty(); fit->next(), sit->next())
+        {
+            Posting_t &p = fit->get();
+            Posting_t &sp = sit->get();
+            REQUIRE( sp.FID == p.FID );
+            REQUIRE( sp.tf == p.tf );
+            REQUIRE( sp.T == nullptr );
+            REQUIRE( std::equal(p.LID, p.LID + p.tf, sp.LID) );
+            REQUIRE( std::equal(p.E, p.E + p.tf, sp.E) );
+        }
+
+        REQUIRE( sit->get().empty() );
+    }
+
+    REQUIRE( ssize < fsize );
+
+    // Match against both indexes
+
+    Audioneex::Matcher fmatcher, smatcher;
+    Audioneex::Fingerprint fingerprint;
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    GetAudio(asource, iblock, audio);
+    fingerprint.Process( audio );
+    Audioneex::lf_vector lfs = fingerprint.Get();
+    REQUIRE( lfs.empty() == false );
+
+    REQUIRE_NOTHROW( fmatcher.SetDataStore( &fstore ) );
+    REQUIRE_NOTHROW( smatcher.SetDataStore( &sstore ) );
+    REQUIRE( fmatcher.Process( lfs ) > 0 );
+    REQUIRE( smatcher.Process( lfs ) > 0 );
+
+    const Audioneex::MatchResults_t &fres = fmatcher.GetResults();
+    const Audioneex::MatchResults_t &sres = smatcher.GetResults();
+
+    REQUIRE( sres.GetTopScore(1) > 0 );
+    REQUIRE( sres.GetTop(1).empty() == false );
+    REQUIRE( sres.GetTop(1) == fres.GetTop(1) );
+}
+
+
+TEST_CASE("Matcher processing with a score window") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    Audioneex::Matcher matcher;
+    Audioneex::Fingerprint fingerprint;
+
+    REQUIRE( matcher.GetScoreWindow() == 0 );
+    REQUIRE_THROWS_AS( matcher.SetScoreWindow(-1),
+                       Audioneex::InvalidParameterException );
+    REQUIRE_NOTHROW( matcher.SetScoreWindow(5) );
+    REQUIRE( matcher.GetScoreWindow() == 5 );
+    REQUIRE_NOTHROW( matcher.SetDataStore( &dstore ) );
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    // Match a continuous stream in which rec1 is followed by rec2 without
+    // resetting. Only the scores of the last 5 seconds are kept, so the
+    // best match must follow the change of content.
+
+    const char* recordings[] = { "./data/rec1.mp3", "./data/rec2.mp3" };
+
+    for(int FID=1; FID<=2; FID++)
+    {
+        OpenTestAudio(asource, recordings[FID-1]);
+
+        for(int i=0; i<10; i++)
+        {
+            GetAudio(asource, iblock, audio);
+            fingerprint.Process( audio );
+            matcher.Process( fingerprint.Get() );
+        }
+
+        REQUIRE( matcher.GetResults().GetTop(1).empty() == false );
+        REQUIRE( matcher.GetResults().GetTop(1).front() == FID );
+
+        asource.Close();
+    }
+
+    REQUIRE( matcher.GetMatchTime() > 20 );
+}
+
+// ----------------------------------------------------------------------------
+
+TEST_CASE("Matcher sharing resources") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    REQUIRE_NOTHROW( dstore.Open(KVDataStore::BUILD) );
+
+    IndexFiles (&dstore, "./data/rec1.fp", 1);
+
+    REQUIRE_NOTHROW( dstore.Open() );
+
+    Audioneex::Matcher matcher1;
+    Audioneex::Matcher matcher2;
+    Audioneex::Fingerprint fingerprint;
+
+    // The audio codes are loaded once and shared
+    REQUIRE_NOTHROW( matcher1.SetDataStore( &dstore ) );
+    REQUIRE( matcher1.GetCodebook() );
+    REQUIRE_NOTHROW( matcher2.SetCodebook( matcher1.GetCodebook() ) );
+    REQUIRE_NOTHROW( matcher2.SetStoreLock( std::make_shared<std::mutex>() ) );
+    REQUIRE_NOTHROW( matcher2.SetDataStore( &dstore ) );
+    REQUIRE( matcher2.GetCodebook() == matcher1.GetCodebook() );
+
+    size_t idle = matcher2.GetMemoryUsage();
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    for(int i=0; i<10; i++)
+    {
+        GetAudio(asource, iblock, audio);
+        fingerprint.Process( audio );
+        matcher2.Process( fingerprint.Get() );
+    }
+
+    REQUIRE( matcher2.GetResults().GetTop(1).empty() == false );
+    REQUIRE( matcher2.GetResults().GetTop(1).front() == 1 );
+    REQUIRE( matcher2.GetMemoryUsage() > idle );
+
+    // The matching buffers are released on reset
+    matcher2.Reset();
+
+    REQUIRE( matcher2.GetMemoryUsage() <= idle );
+}
+
+// ----------------------------------------------------------------------------
+
+TEST_CASE("Matcher reranking through a fingerprint cache") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    auto fpcache = std::make_shared<Audioneex::DataStoreImpl::FingerprintCache>(1<<20);
+
+    Audioneex::Matcher direct;
+    Audioneex::Matcher cached;
+
+    for(Audioneex::Matcher* m : { &direct, &cached }){
+        REQUIRE_NOTHROW( m->SetDataStore( &dstore ) );
+        // Rerank at every step
+        m->SetRerankThreshold( 1 );
+    }
+
+    REQUIRE_NOTHROW( cached.SetFingerprintCache( fpcache ) );
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    Audioneex::Fingerprint fingerprint;
+    std::vector<Audioneex::lf_vector> steps;
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    // The reranking reads the same fingerprint data through the cache
+    for(int i=0; i<4; i++)
+    {
+        GetAudio(asource, iblock, audio);
+        fingerprint.Process( audio );
+        steps.push_back( fingerprint.Get() );
+
+        REQUIRE( cached.Process( steps.back() ) == direct.Process( steps.back() ) );
+        REQUIRE( cached.GetResults().Top_K == direct.GetResults().Top_K );
+    }
+
+    asource.Close();
+
+    REQUIRE( cached.GetResults().GetTop(1).empty() == false );
+    REQUIRE( cached.GetResults().GetTop(1).front() == 1 );
+
+    size_t misses = fpcache->GetMisses();
+    size_t hits = fpcache->GetHits();
+
+    REQUIRE( misses > 0 );
+    REQUIRE( fpcache->GetUsed() > 0 );
+    REQUIRE( fpcache->GetUsed() <= fpcache->GetCapacity() );
+
+    // Identifying the same audio again is served by the cache
+    cached.Reset();
+
+    for(const Audioneex::lf_vector &lfs : steps)
+        cached.Process( lfs );
+
+    REQUIRE( fpcache->GetMisses() == misses );
+    REQUIRE( fpcache->GetHits() > hits );
+    REQUIRE( cached.GetResults().Top_K == direct.GetResults().Top_K );
+
+    // Reads spanning many pages give the stored data
+    size_t fpsize = dstore.GetFingerprintSize(1);
+    size_t fpread = 0;
+    const uint8_t* fpdata = dstore.GetFingerprint(1, fpread);
+    std::vector<uint8_t> fpbuf (fpsize);
+
+    REQUIRE( fpread == fpsize );
+    REQUIRE( fpsize > 2 * fpcache->GetPageSize() );
+    REQUIRE_NOTHROW( fpcache->Read(&dstore, nullptr, 1, fpsize, 0, fpsize, fpbuf.data()) );
+    REQUIRE( std::equal(fpbuf.begin(), fpbuf.end(), fpdata) );
+
+    // The pages of another data store are never served, even if they
+    // have the same FID
+    MemDataStore dstore2;
+
+    REQUIRE_NOTHROW( dstore2.Open(KVDataStore::BUILD) );
+    IndexFiles (&dstore2, "./data/rec2.fp", 1);
+    REQUIRE_NOTHROW( dstore2.Open() );
+
+    size_t fpsize2 = dstore2.GetFingerprintSize(1);
+    const uint8_t* fpdata2 = dstore2.GetFingerprint(1, fpread);
+    std::vector<uint8_t> fpbuf2 (fpsize2);
+
+    REQUIRE( fpsize2 != fpsize );
+    REQUIRE_NOTHROW( fpcache->Read(&dstore2, nullptr, 1, fpsize2, 0, fpsize2, fpbuf2.data()) );
+    REQUIRE( std::equal(fpbuf2.begin(), fpbuf2.end(), fpdata2) );
+    REQUIRE( fpcache->GetUsed() == fpsize2 );
+
+    fpcache->Clear();
+    REQUIRE( fpcache->GetUsed() == 0 );
+
+    // The cache of an engine is cleared when its data store is set again,
+    // as required when the data store is reopened.
+    std::unique_ptr <Audioneex::Engine> engine ( Audioneex::Engine::Create() );
+
+    REQUIRE_NOTHROW( engine->SetDataStore( &dstore ) );
+    REQUIRE_NOTHROW( engine->SetFingerprintCacheSize( 1<<20 ) );
+
+    size_t idle = engine->GetMemoryUsage();
+
+    std::unique_ptr <Audioneex::Recognizer> recognizer ( engine->CreateRecognizer() );
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    for(int i=0; i<10 && !recognizer->GetResults(); i++)
+    {
+        GetAudio(asource, iblock, audio);
+        recognizer->Identify( audio.Data(), audio.Size() );
+    }
+
+    asource.Close();
+
+    REQUIRE( recognizer->GetResults() );
+    REQUIRE( engine->GetMemoryUsage() > idle );
+    REQUIRE_NOTHROW( engine->SetDataStore( &dstore ) );
+    REQUIRE( engine->GetMemoryUsage() == idle );
+}
+
+// ----------------------------------------------------------------------------
+
+TEST_CASE("Matcher reranking candidates") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    Audioneex::Matcher plain;
+    Audioneex::Matcher reranked;
+    Audioneex::Matcher parallel;
+
+    for(Audioneex::Matcher* m : { &plain, &reranked, &parallel })
+        REQUIRE_NOTHROW( m->SetDataStore( &dstore ) );
+
+    // Never rerank vs. rerank at every step
+    plain.SetRerankThreshold( -1 );
+    reranked.SetRerankThreshold( 1 );
+    parallel.SetRerankThreshold( 1 );
+
+    // The candidates are reranked concurrently, each worker building its
+    // own query graphs.
+    REQUIRE_NOTHROW( parallel.SetThreads(4) );
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    Audioneex::Fingerprint fingerprint;
+    std::vector<Audioneex::lf_vector> steps;
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    for(int i=0; i<4; i++)
+    {
+        GetAudio(asource, iblock, audio);
+        fingerprint.Process( audio );
+        steps.push_back( fingerprint.Get() );
+
+        int Nlfs = plain.Process( steps.back() );
+
+        REQUIRE( reranked.Process( steps.back() ) == Nlfs );
+        REQUIRE( parallel.Process( steps.back() ) == Nlfs );
+
+        REQUIRE( plain.GetResults().Reranked == false );
+        REQUIRE( reranked.GetResults().Reranked == true );
+        REQUIRE( parallel.GetResults().Top_K == reranked.GetResults().Top_K );
+
+        // The graph matchings of the true match add to its score
+        REQUIRE( reranked.GetResults().GetTop(1).front() == 1 );
+        REQUIRE( reranked.GetResults().GetTopScore(1) >
+                 plain.GetResults().GetTopScore(1) );
+    }
+
+    asource.Close();
+
+    // The query graphs are rebuilt at each step, so replaying the
+    // identification gives the same results.
+    Audioneex::hashtable_Qi top_k = reranked.GetResults().Top_K;
+
+    reranked.Reset();
+
+    for(const Audioneex::lf_vector &lfs : steps)
+        reranked.Process( lfs );
+
+    REQUIRE( reranked.GetResults().Top_K == top_k );
+}
+
+// ----------------------------------------------------------------------------
+
+TEST_CASE("Matcher reranking in parallel") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    // Many candidates to be spread over the workers. The slow data store
+    // is not reentrant, so the workers' reads are serialized.
+    const uint32_t Nfp = 12;
+
+    MemDataStore  mstore;
+    SlowDataStore sstore;
+
+    sstore.Latency = std::chrono::microseconds(0);
+
+    for(KVDataStore* dstore : { static_cast<KVDataStore*>(&mstore),
+                                static_cast<KVDataStore*>(&sstore) })
+    {
+        REQUIRE_NOTHROW( dstore->Open(KVDataStore::BUILD) );
+
+        for(uint32_t FID=1; FID<=Nfp; FID++)
+            IndexFiles (dstore, FID % 2 ? "./data/rec1.fp" : "./data/rec2.fp", FID);
+
+        REQUIRE_NOTHROW( dstore->Open() );
+
+        Audioneex::Matcher serial;
+        Audioneex::Matcher parallel;
+
+        for(Audioneex::Matcher* m : { &serial, &parallel }){
+            REQUIRE_NOTHROW( m->SetDataStore( dstore ) );
+            // Rerank at every step
+            m->SetRerankThreshold( 1 );
+        }
+
+        REQUIRE_NOTHROW( parallel.SetThreads(4) );
+
+        Audioneex::Fingerprint fingerprint;
+
+        OpenTestAudio(asource, "./data/rec1.mp3");
+
+        for(int i=0; i<4; i++)
+        {
+            GetAudio(asource, iblock, audio);
+            fingerprint.Process( audio );
+
+            REQUIRE( parallel.Process( fingerprint.Get() ) ==
+                     serial.Process( fingerprint.Get() ) );
+
+            // The reranking results are reduced in top-k order, so they
+            // do not depend on the scheduling of the workers.
+            REQUIRE( parallel.GetResults().Reranked == true );
+            REQUIRE( parallel.GetResults().Top_K == serial.GetResults().Top_K );
+
+            for(uint32_t FID=1; FID<=Nfp; FID++)
+                REQUIRE( parallel.GetResults().GetCuePoint(FID) ==
+                         serial.GetResults().GetCuePoint(FID) );
+        }
+
+        asource.Close();
+
+        // The copies of rec1 have odd FIDs
+        REQUIRE( parallel.GetResults().GetTop(1).empty() == false );
+        REQUIRE( (parallel.GetResults().GetTop(1).front() % 2) == 1 );
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+TEST_CASE("Matcher keeping the top-k candidates") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    // More copies of the same recording than a tie list can hold
+    // (Matcher::MAX_TIE_LIST).
+    const uint32_t Ncopies = 15;
+    const size_t MaxTieList = 10;
+
+    for(Audioneex::eMatchType type : { Audioneex::MSCALE_MATCH,
+                                       Audioneex::XSCALE_MATCH })
+    {
+        MemDataStore dstore;
+
+        REQUIRE_NOTHROW( dstore.Open(KVDataStore::BUILD) );
+
+        for(uint32_t FID=1; FID<=Ncopies; FID++)
+            IndexFiles (&dstore, "./data/rec2.fp", FID, Audioneex::FULL_POSTINGS, 0, type);
+
+        IndexFiles (&dstore, "./data/rec1.fp", Ncopies+1, Audioneex::FULL_POSTINGS, 0, type);
+
+        REQUIRE_NOTHROW( dstore.Open() );
+
+        Audioneex::Matcher serial;
+        Audioneex::Matcher parallel;
+
+        for(Audioneex::Matcher* m : { &serial, &parallel }){
+            REQUIRE_NOTHROW( m->SetDataStore( &dstore ) );
+            m->SetMatchType( type );
+        }
+
+        // The partitions' top-k lists are merged into the same list
+        REQUIRE_NOTHROW( parallel.SetThreads(4) );
+        REQUIRE_NOTHROW( parallel.SetMinSearchPartition(1) );
+
+        Audioneex::Fingerprint fingerprint;
+
+        OpenTestAudio(asource, "./data/rec2.mp3");
+
+        for(int i=0; i<4; i++)
+        {
+            GetAudio(asource, iblock, audio);
+            fingerprint.Process( audio );
+
+            REQUIRE( parallel.Process( fingerprint.Get() ) ==
+                     serial.Process( fingerprint.Get() ) );
+            REQUIRE( parallel.GetResults().Top_K == serial.GetResults().Top_K );
+
+            // The copies tie, and only a full tie list of them is kept
+            std::list<int> top1 = serial.GetResults().GetTop(1);
+
+            REQUIRE( top1.size() == MaxTieList );
+
+            for(int FID : top1){
+                REQUIRE( FID >= 1 );
+                REQUIRE( FID <= int(Ncopies) );
+            }
+        }
+
+        asource.Close();
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+TEST_CASE("Matcher processing in parallel") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    for(Audioneex::eMatchType type : { Audioneex::MSCALE_MATCH,
+                                       Audioneex::XSCALE_MATCH })
+    {
+        MemDataStore dstore;
+
+        BuildTestIndex(dstore, type);
+
+        Audioneex::Matcher serial;
+        Audioneex::Matcher parallel;
+
+        for(Audioneex::Matcher* m : { &serial, &parallel }){
+            REQUIRE_NOTHROW( m->SetDataStore( &dstore ) );
+            m->SetMatchType( type );
+        }
+
+        // Give each thread a partition of a single FID, so that even this
+        // tiny catalogue is searched concurrently.
+        REQUIRE_NOTHROW( parallel.SetThreads(4) );
+        REQUIRE_THROWS_AS( parallel.SetMinSearchPartition(0),
+                           Audioneex::InvalidParameterException );
+        REQUIRE_NOTHROW( parallel.SetMinSearchPartition(1) );
+        REQUIRE( parallel.GetMinSearchPartition() == 1 );
+
+        Audioneex::Fingerprint fingerprint;
+
+        OpenTestAudio(asource, "./data/rec2.mp3");
+
+        for(int i=0; i<4; i++)
+        {
+            GetAudio(asource, iblock, audio);
+            fingerprint.Process( audio );
+
+            REQUIRE( parallel.Process( fingerprint.Get() ) ==
+                     serial.Process( fingerprint.Get() ) );
+            REQUIRE( parallel.GetResults().Top_K == serial.GetResults().Top_K );
+        }
+
+        asource.Close();
+
+        REQUIRE( parallel.Flush() == serial.Flush() );
+        REQUIRE( parallel.GetResults().Top_K == serial.GetResults().Top_K );
+        REQUIRE( parallel.GetResults().GetTop(1).empty() == false );
+        REQUIRE( parallel.GetResults().GetTop(1).front() == 2 );
+    }
+}
+
+
+TEST_CASE("Postings list iterators sharing buffers") {
+
+    using namespace Audioneex::DataStoreImpl;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    std::vector<int> lids;
+    dstore.GetPListIDs(lids);
+    REQUIRE( lids.empty() == false );
+
+    // The iterators created over time on the same buffers read the same
+    // postings as those with their own buffers.
+    PListBuffers buffers;
+
+    for(int lid : lids)
+    {
+        std::unique_ptr<PListIterator> it (GetPListIterator(&dstore, lid));
+        std::unique_ptr<PListIterator> sit (GetPListIterator(&dstore, lid, nullptr, &buffers));
+
+        std::vector<uint32_t> postings, spostings;
+
+        for(; !it->get().empty(); it->next()){
+            Posting_t &post = it->get();
+            postings.push_back(post.FID);
+            postings.insert(postings.end(), post.LID, post.LID + post.tf);
+            postings.insert(postings.end(), post.E, post.E + post.tf);
+        }
+
+        for(; !sit->get().empty(); sit->next()){
+            Posting_t &post = sit->get();
+            spostings.push_back(post.FID);
+            spostings.insert(spostings.end(), post.LID, post.LID + post.tf);
+            spostings.insert(spostings.end(), post.E, post.E + post.tf);
+        }
+
+        REQUIRE( postings.empty() == false );
+        REQUIRE( spostings == postings );
+    }
+
+    REQUIRE( buffers.Read.size() >= POSTINGSLIST_BLOCK_THRESHOLD * 2 );
+    REQUIRE( buffers.Decoded.size() >= POSTINGSLIST_BLOCK_THRESHOLD );
+}
+
+// ----------------------------------------------------------------------------
+
+TEST_CASE("Data stores reading into caller buffers") {
+
+    TempDir tmp;
+
+    MemDataStore mstore;
+    DATASTORE_T  tstore ( tmp.Path() );
+
+    for(KVDataStore* dstore : { static_cast<KVDataStore*>(&mstore),
+                                static_cast<KVDataStore*>(&tstore) })
+    {
+        BuildTestIndex(*dstore);
+
+        // A store is reentrant when opened for reading
+        REQUIRE( dstore->IsReentrant() == true );
+
+        std::vector<int> lids;
+        dstore->GetPListIDs(lids);
+        REQUIRE( lids.empty() == false );
+
+        // The blocks read into the caller's buffers are those returned
+        // by the getters, with and without their headers.
+        typedef std::pair<std::pair<int,int>, std::vector<uint8_t> > block_t;
+
+        std::vector<block_t> blocks;
+        std::vector<uint8_t> buffer;
+
+        for(int lid : lids)
+        {
+            for(int bid=1; ; bid++)
+            {
+                size_t bsize = 0;
+                const uint8_t* block = dstore->GetPListBlock(lid, bid, bsize, true);
+
+                if(block == nullptr)
+                   break;
+
+                blocks.push_back( block_t(std::make_pair(lid, bid),
+                                          std::vector<uint8_t>(block, block + bsize)) );
+
+                // A buffer too small receives nothing, but the size is returned
+                buffer.assign(bsize, 0);
+                REQUIRE( dstore->ReadPListBlock(lid, bid, buffer.data(), bsize - 1, true) == bsize );
+                REQUIRE( std::count(buffer.begin(), buffer.end(), 0) == int(bsize) );
+
+                REQUIRE( dstore->ReadPListBlock(lid, bid, buffer.data(), bsize, true) == bsize );
+                REQUIRE( buffer == blocks.back().second );
+
+                block = dstore->GetPListBlock(lid, bid, bsize, false);
+                REQUIRE( block != nullptr );
+                buffer.assign(bsize, 0);
+                REQUIRE( dstore->ReadPListBlock(lid, bid, buffer.data(), bsize, false) == bsize );
+                REQUIRE( std::equal(buffer.begin(), buffer.end(), block) );
+            }
+        }
+
+        REQUIRE( blocks.empty() == false );
+        REQUIRE( dstore->ReadPListBlock(lids.back(), 0x7fffffff, buffer.data(), buffer.size()) == 0 );
+
+        // As above for the fingerprints, whole and in chunks
+        for(uint32_t FID : { 1, 2 })
+        {
+            size_t fpsize = dstore->GetFingerprintSize(FID);
+            size_t read = 0;
+            const uint8_t* fp = dstore->GetFingerprint(FID, read);
+
+            REQUIRE( fp != nullptr );
+            REQUIRE( read == fpsize );
+
+            std::vector<uint8_t> fpdata (fp, fp + fpsize);
+
+            buffer.assign(fpsize, 0);
+            REQUIRE( dstore->ReadFingerprint(FID, buffer.data(), fpsize) == fpsize );
+            REQUIRE( buffer == fpdata );
+
+            size_t chunk = sizeof(Audioneex::QLocalFingerprint_t) * 10;
+            size_t bo = fpsize / 2;
+
+            buffer.assign(chunk, 0);
+            REQUIRE( dstore->ReadFingerprint(FID, buffer.data(), chunk, bo) == chunk );
+            REQUIRE( std::equal(buffer.begin(), buffer.end(), fpdata.begin() + bo) );
+        }
+
+        // Concurrent readers get the same data. The mismatches are counted
+        // as the assertions are not thread-safe.
+        std::atomic<int> mismatches (0);
+        std::vector<std::thread> readers;
+
+        for(int r=0; r<4; r++)
+        {
+            readers.emplace_back([dstore, &blocks, &mismatches]{
+                std::vector<uint8_t> buf;
+                for(int n=0; n<4; n++){
+                    for(const block_t &b : blocks){
+                        buf.assign(b.second.size(), 0);
+                        size_t bsize = dstore->ReadPListBlock(b.first.first, b.first.second,
+                                                              buf.data(), buf.size(), true);
+                        if(bsize != b.second.size() || buf != b.second)
+                           mismatches++;
+                    }
+                }
+            });
+        }
+
+        for(std::thread &t : readers)
+            t.join();
+
+        REQUIRE( mismatches == 0 );
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+TEST_CASE("Matcher batch processing") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    // Fingerprint a clip of each recording
+    const char* recordings[] = { "./data/rec1.mp3", "./data/rec2.mp3" };
+    std::vector<Audioneex::lf_vector> clips (2);
+
+    for(int i=0; i<2; i++)
+    {
+        Audioneex::Fingerprint fingerprint;
+
+        OpenTestAudio(asource, recordings[i]);
+
+        for(int j=0; j<4; j++)
+        {
+            GetAudio(asource, iblock, audio);
+            fingerprint.Process( audio );
+            clips[i].insert(clips[i].end(), fingerprint.Get().begin(),
+                                            fingerprint.Get().end());
+        }
+
+        asource.Close();
+    }
+
+    // Match the clips separately and in a batch
+    Audioneex::Matcher single[2];
+    Audioneex::Matcher batched[2];
+
+    std::vector<Audioneex::Matcher*> matchers = { &batched[0], &batched[1] };
+    std::vector<const Audioneex::lf_vector*> lfs = { &clips[0], &clips[1] };
+    std::vector<int> processed;
+    std::vector<int> flushed;
+
+    for(int i=0; i<2; i++)
+    {
+        REQUIRE_NOTHROW( single[i].SetDataStore( &dstore ) );
+        REQUIRE_NOTHROW( batched[i].SetDataStore( &dstore ) );
+    }
+
+    REQUIRE_NOTHROW( Audioneex::Matcher::ProcessBatch(matchers, lfs, processed) );
+    REQUIRE_NOTHROW( Audioneex::Matcher::FlushBatch(matchers, flushed) );
+
+    for(int i=0; i<2; i++)
+    {
+        REQUIRE( processed[i] == single[i].Process( clips[i] ) );
+        REQUIRE( flushed[i] == single[i].Flush() );
+        REQUIRE( batched[i].GetStepsCount() == single[i].GetStepsCount() );
+        REQUIRE( batched[i].GetResults().Top_K == single[i].GetResults().Top_K );
+        REQUIRE( batched[i].GetResults().GetTop(1).empty() == false );
+        REQUIRE( batched[i].GetResults().GetTop(1).front() == i+1 );
+    }
+
+    // The matchers must use the same data store
+    MemDataStore dstore2;
+    Audioneex::Matcher other;
+
+    REQUIRE_NOTHROW( dstore2.Open() );
+    REQUIRE_NOTHROW( other.SetDataStore( &dstore2 ) );
+
+    matchers.push_back(&other);
+    lfs.push_back(&clips[0]);
+
+    REQUIRE_THROWS_AS( Audioneex::Matcher::ProcessBatch(matchers, lfs, processed),
+                       Audioneex::InvalidParameterException );
+}
+
+TEST_CASE("Matcher processing quantized LFs") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    Audioneex::Fingerprint fingerprint;
+    Audioneex::Matcher matcher;
+    Audioneex::Matcher qmatcher;
+
+    REQUIRE_NOTHROW( matcher.SetDataStore( &dstore ) );
+    REQUIRE_NOTHROW( qmatcher.SetDataStore( &dstore ) );
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    // Feed each chunk to the second matcher in small parts, as they would
+    // be handed over by a pipelined fingerprinting.
+    for(int i=0; i<4; i++)
+    {
+        GetAudio(asource, iblock, audio);
+        fingerprint.Process( audio );
+
+        const Audioneex::lf_vector &lfs = fingerprint.Get();
+        int processed = 0;
+
+        for(size_t j=0; j<lfs.size(); j+=7)
+        {
+            std::vector<Audioneex::QLocalFingerprint_t> qlfs;
+
+            for(size_t k=j; k<std::min(j+7, lfs.size()); k++)
+                qlfs.push_back( qmatcher.Quantize( lfs[k] ) );
+
+            processed += qmatcher.ProcessQuantized(qlfs, lfs[j].ID, true);
+        }
+
+        processed += qmatcher.ProcessQuantized({}, 0, false);
+
+        REQUIRE( processed == matcher.Process( lfs ) );
+        REQUIRE( qmatcher.GetStepsCount() == matcher.GetStepsCount() );
+        REQUIRE( qmatcher.GetResults().Top_K == matcher.GetResults().Top_K );
+    }
+
+    asource.Close();
+
+    REQUIRE( qmatcher.GetResults().GetTop(1).empty() == false );
+    REQUIRE( qmatcher.GetResults().GetTop(1).front() == 1 );
+
+    // The IDs must be sequential
+    std::vector<Audioneex::QLocalFingerprint_t> qlfs (1);
+
+    REQUIRE_THROWS_AS( qmatcher.ProcessQuantized(qlfs, 0),
+                       Audioneex::InvalidMatchSequenceException );
+}
+
+
+TEST_CASE("Matcher processing LF streams") {
+
+    using Audioneex::LFStream;
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    Audioneex::Fingerprint fingerprint;
+    Audioneex::Matcher matcher;
+    Audioneex::Matcher qmatcher;
+
+    REQUIRE_NOTHROW( matcher.SetDataStore( &dstore ) );
+    REQUIRE_NOTHROW( qmatcher.SetDataStore( &dstore ) );
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    std::vector<uint8_t> stream, qstream;
+    Audioneex::lf_vector dlfs;
+    std::vector<Audioneex::QLocalFingerprint_t> qlfs, dqlfs;
+
+    for(int i=0; i<4; i++)
+    {
+        GetAudio(asource, iblock, audio);
+        fingerprint.Process( audio );
+
+        const Audioneex::lf_vector &lfs = fingerprint.Get();
+
+        REQUIRE( lfs.empty() == false );
+
+        qlfs.clear();
+        for(const Audioneex::LocalFingerprint_t &lf : lfs)
+            qlfs.push_back( qmatcher.Quantize( lf ) );
+
+        LFStream::Encode(lfs, audio.Size(), stream);
+        LFStream::Encode(qlfs, lfs.front().ID, audio.Size(), qstream);
+
+        // The quantized LFs take a few bytes each
+        REQUIRE( qstream.size() < LFStream::HEADER_SIZE + lfs.size() * 8 );
+        REQUIRE( stream.size() > qstream.size() * 10 );
+
+        LFStream::Info_t info = LFStream::Decode(stream.data(), stream.size(), dlfs, dqlfs);
+
+        REQUIRE( info.Type == LFStream::RAW_LFS );
+        REQUIRE( info.Samples == audio.Size() );
+        REQUIRE( dlfs == lfs );
+        REQUIRE( dqlfs.empty() );
+
+        info = LFStream::Decode(qstream.data(), qstream.size(), dlfs, dqlfs);
+
+        REQUIRE( info.Type == LFStream::QUANTIZED_LFS );
+        REQUIRE( info.FirstID == lfs.front().ID );
+        REQUIRE( info.Count == lfs.size() );
+        REQUIRE( dlfs.empty() );
+        REQUIRE( dqlfs.size() == qlfs.size() );
+
+        for(size_t j=0; j<qlfs.size(); j++){
+            REQUIRE( dqlfs[j].T == qlfs[j].T );
+            REQUIRE( dqlfs[j].F == qlfs[j].F );
+            REQUIRE( dqlfs[j].W == qlfs[j].W );
+            REQUIRE( dqlfs[j].E == qlfs[j].E );
+        }
+
+        // Matching the decoded LFs gives the same results
+        REQUIRE( qmatcher.ProcessQuantized(dqlfs, info.FirstID) == matcher.Process( lfs ) );
+        REQUIRE( qmatcher.GetResults().Top_K == matcher.GetResults().Top_K );
+    }
+
+    asource.Close();
+
+    REQUIRE( qmatcher.GetResults().GetTop(1).empty() == false );
+    REQUIRE( qmatcher.GetResults().GetTop(1).front() == 1 );
+
+    // Corrupt streams are rejected
+    std::vector<uint8_t> bad = qstream;
+    bad.pop_back();
+    REQUIRE_THROWS_AS( LFStream::Decode(bad.data(), bad.size(), dlfs, dqlfs),
+                       Audioneex::InvalidFingerprintException );
+    bad = qstream;
+    bad.push_back(0);
+    REQUIRE_THROWS_AS( LFStream::Decode(bad.data(), bad.size(), dlfs, dqlfs),
+                       Audioneex::InvalidFingerprintException );
+    bad = qstream;
+    bad[0] ^= 0xFF;
+    REQUIRE_THROWS_AS( LFStream::Decode(bad.data(), bad.size(), dlfs, dqlfs),
+                       Audioneex::InvalidFingerprintException );
+    bad = qstream;
+    bad[15] = 0xFF;  // Count
+    REQUIRE_THROWS_AS( LFStream::Decode(bad.data(), bad.size(), dlfs, dqlfs),
+                       Audioneex::InvalidFingerprintException );
+    REQUIRE_THROWS_AS( LFStream::Decode(qstream.data(), 10, dlfs, dqlfs),
+                       Audioneex::InvalidFingerprintException );
+}
+
+TEST_CASE("Matcher processing with a time limit") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    Audioneex::Fingerprint fingerprint;
+    Audioneex::Matcher unlimited;
+    Audioneex::Matcher budgeted;
+    Audioneex::Matcher late;
+
+    for(Audioneex::Matcher* m : { &unlimited, &budgeted, &late })
+        REQUIRE_NOTHROW( m->SetDataStore( &dstore ) );
+
+    // A budget that is never spent doesn't change the results, while
+    // the steps starting after the deadline are skipped.
+    budgeted.SetStepBudget( 60000000 );
+    late.SetDeadline( std::chrono::steady_clock::now() );
+
+    REQUIRE( budgeted.GetStepBudget() == 60000000 );
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    for(int i=0; i<4; i++)
+    {
+        GetAudio(asource, iblock, audio);
+        fingerprint.Process( audio );
+
+        int processed = unlimited.Process( fingerprint.Get() );
+
+        REQUIRE( budgeted.Process( fingerprint.Get() ) == processed );
+        REQUIRE( late.Process( fingerprint.Get() ) == processed );
+        REQUIRE( budgeted.GetResults().Top_K == unlimited.GetResults().Top_K );
+    }
+
+    asource.Close();
+
+    REQUIRE( unlimited.GetResults().GetTop(1).empty() == false );
+    REQUIRE( unlimited.GetResults().Truncated == false );
+    REQUIRE( budgeted.GetResults().Truncated == false );
+    REQUIRE( late.GetResults().Truncated == true );
+    REQUIRE( late.GetResults().Top_K.empty() );
+
+    late.Reset();
+
+    REQUIRE( late.GetResults().Truncated == false );
+}
+
+
+TEST_CASE("Matcher processing with a step budget") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    // Enough fingerprints for the search to check the time several times
+    // while scanning the lists (see Matcher::DEADLINE_CHECK_INTERVAL).
+    const uint32_t Nfp = 256;
+
+    REQUIRE_NOTHROW( dstore.Open(KVDataStore::BUILD) );
+
+    for(uint32_t FID=1; FID<Nfp; FID++)
+        IndexFiles (&dstore, "./data/rec2.fp", FID);
+
+    IndexFiles (&dstore, "./data/rec1.fp", Nfp);
+
+    REQUIRE_NOTHROW( dstore.Open() );
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    Audioneex::Fingerprint fingerprint;
+    std::vector<Audioneex::lf_vector> chunks;
+
+    for(int i=0; i<4; i++){
+        GetAudio(asource, iblock, audio);
+        fingerprint.Process( audio );
+        chunks.push_back( fingerprint.Get() );
+    }
+
+    asource.Close();
+
+    Audioneex::Matcher unlimited;
+
+    REQUIRE_NOTHROW( unlimited.SetDataStore( &dstore ) );
+
+    for(const Audioneex::lf_vector &lfs : chunks)
+        REQUIRE_NOTHROW( unlimited.Process( lfs ) );
+
+    REQUIRE( unlimited.GetResults().Truncated == false );
+    REQUIRE( unlimited.GetResults().Top_K.empty() == false );
+
+    // Grow the budget until the search starts but can't scan the lists to
+    // the end, so that the longest ones are given up. The results must still
+    // be made of indexed fingerprints with scores no higher than those found
+    // by the full search. Big enough budgets don't change the results.
+    bool cut_short = false;
+
+    for(size_t budget=1; budget<=60000000; budget*=2)
+    {
+        Audioneex::Matcher budgeted;
+
+        REQUIRE_NOTHROW( budgeted.SetDataStore( &dstore ) );
+        budgeted.SetStepBudget( budget );
+
+        for(const Audioneex::lf_vector &lfs : chunks)
+            REQUIRE_NOTHROW( budgeted.Process( lfs ) );
+
+        const Audioneex::MatchResults_t &results = budgeted.GetResults();
+
+        if(!results.Truncated){
+           REQUIRE( results.Top_K == unlimited.GetResults().Top_K );
+           break;
+        }
+
+        cut_short |= !results.Top_K.empty();
+
+        for(const auto &e : results.Top_K){
+            REQUIRE( e.first > 0 );
+            REQUIRE( e.first <= unlimited.GetResults().GetTopScore(1) );
+            for(int Qi : e.second)
+                REQUIRE( (Qi >= 1 && Qi <= static_cast<int>(Nfp)) );
+        }
+    }
+
+    REQUIRE( cut_short );
+}
+
+
+TEST_CASE("Matcher selecting query terms") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    // The recordings are indexed in two sessions, so that the second one
+    // updates the lists' statistics
+    BuildTestIndex(dstore);
+
+    // The list headers carry the lists' statistics
+
+    using namespace Audioneex::DataStoreImpl;
+
+    std::vector<int> lids;
+    dstore.GetPListIDs(lids);
+    REQUIRE( lids.empty() == false );
+
+    for(int lid : lids)
+    {
+        std::unique_ptr<PListIterator> it (GetPListIterator(&dstore, lid));
+        PListIterator* batch = it.get();
+
+        REQUIRE( PrefetchPListBlocks(&dstore, &batch, 1) == 1 );
+
+        Audioneex::PListHeader lhdr = it->header();
+
+        uint32_t df = 0, occurrences = 0, FIDmax = 0;
+
+        for(; !it->get().empty(); it->next()){
+            df++;
+            occurrences += it->get().tf;
+            FIDmax = it->get().FID;
+        }
+
+        REQUIRE( lhdr.DocFrequency == df );
+        REQUIRE( lhdr.Occurrences == occurrences );
+        REQUIRE( lhdr.FIDmax == FIDmax );
+        REQUIRE( GetPListMaxFID(&dstore, lid) == FIDmax );
+        REQUIRE( dstore.GetDocFrequency(lid) == df );
+    }
+
+    Audioneex::Matcher matcher;
+
+    REQUIRE( matcher.GetTermRatio() == 1.f );
+    REQUIRE_THROWS_AS( matcher.SetTermRatio(0),
+                       Audioneex::InvalidParameterException );
+    REQUIRE_THROWS_AS( matcher.SetTermRatio(1.5),
+                       Audioneex::InvalidParameterException );
+    REQUIRE_NOTHROW( matcher.SetTermRatio(0.8) );
+
+    // A matcher searching all the terms, to check that some were left out.
+    // The scores are compared before reranking.
+    Audioneex::Matcher full;
+
+    for(Audioneex::Matcher* m : { &matcher, &full }){
+        REQUIRE_NOTHROW( m->SetDataStore( &dstore ) );
+        m->SetRerankThreshold( 0 );
+    }
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    Audioneex::Fingerprint fingerprint;
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    // The most selective terms are enough to identify the recording
+    for(int i=0; i<4; i++)
+    {
+        GetAudio(asource, iblock, audio);
+        fingerprint.Process( audio );
+        matcher.Process( fingerprint.Get() );
+        full.Process( fingerprint.Get() );
+    }
+
+    asource.Close();
+
+    REQUIRE( matcher.GetResults().GetTop(1).empty() == false );
+    REQUIRE( matcher.GetResults().GetTop(1).front() == 1 );
+    REQUIRE( matcher.GetResults().GetTopScore(1) > 0 );
+    REQUIRE( matcher.GetResults().GetTopScore(1) < full.GetResults().GetTopScore(1) );
+}
+
+
+TEST_CASE("Matcher rejecting indexes in an old format") {
+
+    TempDir tmp;
+
+    // Client/server data stores are shared by all the tests, so only
+    // the local ones are tampered with.
+
+#if DATASTORE_T_ID == DATASTORE_T_TC
+    {
+        DATASTORE_T dstore ( tmp.Path() );
+
+        // A new index is recorded in the current format
+        REQUIRE_NOTHROW( dstore.Open(KVDataStore::BUILD) );
+        IndexFiles (&dstore, "./data/rec1.fp", 1);
+        REQUIRE( dstore.GetInfo().Version == INDEX_FORMAT_VERSION );
+        REQUIRE_NOTHROW( dstore.Open() );
+        REQUIRE_NOTHROW( dstore.Open(KVDataStore::BUILD_MERGE) );
+
+        // Pretend it was built in the original one
+        DBInfo_t info;
+        info.Version = 1;
+        REQUIRE_NOTHROW( dstore.PutInfo(info) );
+
+        REQUIRE_THROWS_AS( dstore.Open(), Audioneex::InvalidIndexDataException );
+        REQUIRE( dstore.IsOpen() == false );
+        REQUIRE_THROWS_AS( dstore.Open(KVDataStore::BUILD_MERGE),
+                           Audioneex::InvalidIndexDataException );
+    }
+#endif
+
+    // Segments record the format in their header
+    {
+        MemDataStore mstore ( tmp.Path() );
+
+        REQUIRE_NOTHROW( mstore.Open(KVDataStore::BUILD) );
+        IndexFiles (&mstore, "./data/rec1.fp", 1);
+        REQUIRE_NOTHROW( mstore.Close() );
+    }
+
+    MemDataStore mstore ( tmp.Path() );
+    MMapDataStore xstore ( tmp.Path() );
+
+    REQUIRE_NOTHROW( mstore.Open() );
+    REQUIRE( mstore.GetInfo().Version == INDEX_FORMAT_VERSION );
+    REQUIRE_NOTHROW( xstore.Open() );
+    REQUIRE( xstore.GetInfo().Version == INDEX_FORMAT_VERSION );
+
+    mstore.Close();
+    xstore.Close();
+
+    std::string file = Segment::Path(tmp.Path(), MMapDataStore::SEGMENT_FILE_NAME);
+    std::fstream segment (file, std::ios::in | std::ios::out | std::ios::binary);
+    uint32_t version = Segment::VERSION - 1;
+    segment.seekp( offsetof(Segment::Header_t, Version) );
+    segment.write( reinterpret_cast<const char*>(&version), sizeof(version) );
+    segment.close();
+
+    REQUIRE_THROWS_AS( mstore.Open(), Audioneex::InvalidIndexDataException );
+    REQUIRE_THROWS_AS( xstore.Open(), Audioneex::InvalidIndexDataException );
+}
+
+
+TEST_CASE("Matcher skipping stop terms") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    using namespace Audioneex::DataStoreImpl;
+
+    auto GetListHeader = [](KVDataStore *dstore, int lid){
+        std::unique_ptr<PListIterator> it (GetPListIterator(dstore, lid));
+        PListIterator* batch = it.get();
+        PrefetchPListBlocks(dstore, &batch, 1);
+        return it->header();
+    };
+
+    MemDataStore fullstore;
+    MemDataStore dstore;
+
+    BuildTestIndex(fullstore);
+
+    // Prune the terms occurring in both recordings
+    REQUIRE_NOTHROW( dstore.Open(KVDataStore::BUILD) );
+    IndexFiles (&dstore, "./data/rec1.fp", 1, Audioneex::FULL_POSTINGS, 1);
+    IndexFiles (&dstore, "./data/rec2.fp", 2, Audioneex::FULL_POSTINGS, 1);
+    REQUIRE_NOTHROW( dstore.Open() );
+
+    std::vector<int> lids;
+    fullstore.GetPListIDs(lids);
+    REQUIRE( lids.empty() == false );
+
+    size_t nstop = 0;
+
+    for(int lid : lids)
+    {
+        Audioneex::PListHeader full = GetListHeader(&fullstore, lid);
+        Audioneex::PListHeader lhdr = GetListHeader(&dstore, lid);
+
+        bool stop = (lhdr.Flags & Audioneex::PLIST_STOP_TERM) != 0;
+
+        REQUIRE( stop == (full.DocFrequency > 1) );
+        REQUIRE( lhdr.DocFrequency <= full.DocFrequency );
+        nstop += stop;
+    }
+
+    REQUIRE( nstop > 0 );
+    REQUIRE( nstop < lids.size() );
+
+    // Stop terms stay so and don't grow any further regardless of the limit
+    REQUIRE_NOTHROW( dstore.Open(KVDataStore::BUILD_MERGE) );
+    IndexFiles (&dstore, "./data/rec1.fp", 3);
+    REQUIRE_NOTHROW( dstore.Open() );
+
+    for(int lid : lids)
+    {
+        Audioneex::PListHeader full = GetListHeader(&fullstore, lid);
+        Audioneex::PListHeader lhdr = GetListHeader(&dstore, lid);
+
+        if(full.DocFrequency > 1){
+           REQUIRE( (lhdr.Flags & Audioneex::PLIST_STOP_TERM) != 0 );
+           REQUIRE( lhdr.DocFrequency < 3 );
+        }
+    }
+
+    // The remaining terms are enough to identify the recordings
+    Audioneex::Matcher matcher;
+
+    REQUIRE_NOTHROW( matcher.SetDataStore( &dstore ) );
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    Audioneex::Fingerprint fingerprint;
+
+    OpenTestAudio(asource, "./data/rec2.mp3");
+
+    for(int i=0; i<4; i++)
+    {
+        GetAudio(asource, iblock, audio);
+        fingerprint.Process( audio );
+        matcher.Process( fingerprint.Get() );
+    }
+
+    asource.Close();
+
+    REQUIRE( matcher.GetResults().GetTop(1).empty() == false );
+    REQUIRE( matcher.GetResults().GetTop(1).front() == 2 );
+}
+
+
+TEST_CASE("Matcher statistics") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    Audioneex::Matcher matcher;
+
+    REQUIRE_NOTHROW( matcher.SetDataStore( &dstore ) );
+    REQUIRE_NOTHROW( matcher.SetFingerprintCache(
+                     std::make_shared<Audioneex::DataStoreImpl::FingerprintCache>(1<<20) ) );
+
+    // Rerank at every step
+    matcher.SetRerankThreshold( 1 );
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    Audioneex::Fingerprint fingerprint;
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    for(int i=0; i<4; i++)
+    {
+        GetAudio(asource, iblock, audio);
+        fingerprint.Process( audio );
+        matcher.Process( fingerprint.Get() );
+    }
+
+    asource.Close();
+
+    REQUIRE( matcher.GetResults().GetTop(1).empty() == false );
+    REQUIRE( matcher.GetResults().GetTop(1).front() == 1 );
+
+    const Audioneex::MatchStats_t &stats = matcher.GetStats();
+
+#ifdef WITH_STATS
+    REQUIRE( stats.Steps == matcher.GetStepsCount() );
+    REQUIRE( stats.BlocksFetched > 0 );
+    REQUIRE( stats.BytesDecoded > 0 );
+    REQUIRE( stats.PostingsScanned > 0 );
+    REQUIRE( stats.FIDsScored > 0 );
+    REQUIRE( stats.GraphMatchings > 0 );
+    REQUIRE( stats.FingerprintBytes > 0 );
+    REQUIRE( stats.CacheMisses > 0 );
+    REQUIRE( stats.SearchTime > 0 );
+    REQUIRE( stats.RerankTime > 0 );
+#else
+    // Nothing is collected
+    REQUIRE( stats.Steps == 0 );
+    REQUIRE( stats.PostingsScanned == 0 );
+    REQUIRE( stats.SearchTime == 0 );
+#endif
+
+    // The statistics are kept across the identifications
+    uint64_t steps = stats.Steps;
+
+    matcher.Reset();
+    REQUIRE( matcher.GetStats().Steps == steps );
+    matcher.ResetStats();
+    REQUIRE( matcher.GetStats().Steps == 0 );
+    REQUIRE( matcher.GetStats().BlocksFetched == 0 );
+}
+
+// ----------------------------------------------------------------------------
+
+TEST_CASE("Recognizer statistics") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    std::unique_ptr <Audioneex::Recognizer> recognizer ( Audioneex::Recognizer::Create() );
+
+    REQUIRE_NOTHROW( recognizer->SetDataStore( &dstore ) );
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    uint64_t calls = 0;
+
+    for(int i=0; i<10 && !recognizer->GetResults(); i++, calls++)
+    {
+        GetAudio(asource, iblock, audio);
+        REQUIRE_NOTHROW( recognizer->Identify( audio.Data(), audio.Size() ) );
+    }
+
+    asource.Close();
+
+    REQUIRE( recognizer->GetResults() );
+    REQUIRE( recognizer->GetResults()[0].FID == 1 );
+
+    Audioneex::RecognizerStats stats = recognizer->GetStats();
+
+    // The gating counters are always collected
+    REQUIRE( stats.Frames > 0 );
+
+#ifdef WITH_STATS
+    REQUIRE( stats.Calls == calls );
+    REQUIRE( stats.WallTime > 0 );
+    REQUIRE( stats.CPUTime > 0 );
+    REQUIRE( stats.LFs > 0 );
+    REQUIRE( stats.FFTTime > 0 );
+    REQUIRE( stats.PeaksTime > 0 );
+    REQUIRE( stats.POITime > 0 );
+    REQUIRE( stats.DescriptorsTime > 0 );
+    REQUIRE( stats.QuantizeTime > 0 );
+    REQUIRE( stats.Steps > 0 );
+    REQUIRE( stats.SearchTime > 0 );
+    REQUIRE( stats.BlocksFetched > 0 );
+    REQUIRE( stats.BytesDecoded > 0 );
+    REQUIRE( stats.PostingsScanned > 0 );
+    REQUIRE( stats.FIDsScored > 0 );
+    REQUIRE( stats.FIDsScored <= stats.PostingsScanned );
+    REQUIRE( stats.WallTime >= stats.SearchTime + stats.RerankTime );
+#else
+    // Nothing else is collected
+    REQUIRE( stats.Calls == 0 );
+    REQUIRE( stats.WallTime == 0 );
+    REQUIRE( stats.LFs == 0 );
+    REQUIRE( stats.FFTTime == 0 );
+    REQUIRE( stats.Steps == 0 );
+    REQUIRE( stats.PostingsScanned == 0 );
+#endif
+
+    // The statistics are kept across the identifications
+    recognizer->Reset();
+    REQUIRE( recognizer->GetStats().Frames == stats.Frames );
+    REQUIRE( recognizer->GetStats().Steps == stats.Steps );
+
+    recognizer->ResetStats();
+    stats = recognizer->GetStats();
+    REQUIRE( stats.Frames == 0 );
+    REQUIRE( stats.Calls == 0 );
+    REQUIRE( stats.WallTime == 0 );
+    REQUIRE( stats.Steps == 0 );
+}
+
+
+TEST_CASE("Recognizer pipelined identification") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    std::unique_ptr<Audioneex::Recognizer> serial ( Audioneex::Recognizer::Create() );
+    std::unique_ptr<Audioneex::Recognizer> pipelined ( Audioneex::Recognizer::Create() );
+
+    REQUIRE( pipelined->GetPipelining() == false );
+    REQUIRE_NOTHROW( pipelined->SetPipelining(true) );
+    REQUIRE( pipelined->GetPipelining() == true );
+    REQUIRE_NOTHROW( pipelined->SetPipelining(false) );
+    REQUIRE( pipelined->GetPipelining() == false );
+    REQUIRE_NOTHROW( pipelined->SetPipelining(true) );
+    REQUIRE_NOTHROW( pipelined->SetPipelining(true) );
+    REQUIRE( pipelined->GetPipelining() == true );
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    OpenTestAudio(asource, "./data/rec2.mp3");
+
+    // A data store must be set
+    GetAudio(asource, iblock, audio);
+    REQUIRE_THROWS_AS( pipelined->Identify(audio.Data(), audio.Size()),
+                       Audioneex::InvalidParameterException );
+
+    REQUIRE_NOTHROW( serial->SetDataStore( &dstore ) );
+    REQUIRE_NOTHROW( pipelined->SetDataStore( &dstore ) );
+
+    // The results are the same at every step
+    for(int i=0; i<20 && !serial->GetResults(); i++)
+    {
+        GetAudio(asource, iblock, audio);
+
+        REQUIRE_NOTHROW( serial->Identify(audio.Data(), audio.Size()) );
+        REQUIRE_NOTHROW( pipelined->Identify(audio.Data(), audio.Size()) );
+        REQUIRE( SameResults(pipelined->GetResults(), serial->GetResults()) );
+        REQUIRE( pipelined->GetIdentificationTime() == serial->GetIdentificationTime() );
+    }
+
+    REQUIRE( pipelined->GetResults() != nullptr );
+    REQUIRE( Audioneex::IsNull(pipelined->GetResults()[0]) == false );
+    REQUIRE( pipelined->GetResults()[0].FID == 2 );
+
+    // The fingerprinting errors are reported by Identify() and leave the
+    // pipeline usable. Quantizing the LFs fails without the audio codes.
+    Audioneex::RecognizerImpl recognizer;
+
+    REQUIRE_NOTHROW( recognizer.SetDataStore( &dstore ) );
+    REQUIRE_NOTHROW( recognizer.SetPipelining(true) );
+    REQUIRE_NOTHROW( recognizer.SetSharedResources(nullptr, nullptr, nullptr) );
+
+    GetAudio(asource, iblock, audio);
+
+    for(int i=0; i<2; i++)
+        REQUIRE_THROWS_AS( recognizer.Identify(audio.Data(), audio.Size()),
+                           Audioneex::InvalidParameterException );
+
+    // Reloads the audio codes
+    REQUIRE_NOTHROW( recognizer.SetDataStore( &dstore ) );
+    REQUIRE_NOTHROW( recognizer.Reset() );
+    REQUIRE_NOTHROW( recognizer.Identify(audio.Data(), audio.Size()) );
+    REQUIRE( recognizer.GetIdentificationTime() > 0 );
+
+    asource.Close();
+}
+
+
+TEST_CASE("Recognizer asynchronous identification") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    size_t nthreads = Audioneex::GetAsyncThreads();
+
+    REQUIRE_THROWS_AS( Audioneex::SetAsyncThreads(0),
+                       Audioneex::InvalidParameterException );
+    REQUIRE_NOTHROW( Audioneex::SetAsyncThreads(4) );
+    REQUIRE( Audioneex::GetAsyncThreads() == 4 );
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    std::vector< std::vector<float> > chunks (8);
+
+    for(std::vector<float> &chunk : chunks){
+        GetAudio(asource, iblock, audio);
+        chunk.assign(audio.Data(), audio.Data() + audio.Size());
+    }
+
+    asource.Close();
+
+    // A copy of the results set of a recognizer (empty if none)
+    typedef std::vector<Audioneex::IdMatch> results_t;
+
+    auto CopyResults = [](Audioneex::Recognizer &recognizer){
+        const Audioneex::IdMatch* res = recognizer.GetResults();
+        results_t copy;
+        for(; res && !Audioneex::IsNull(*res); res++)
+            copy.push_back(*res);
+        if(res)
+           copy.push_back(*res);
+        return copy;
+    };
+
+    auto Results = [](const results_t &res){
+        return res.empty() ? nullptr : res.data();
+    };
+
+    // The reference identification
+    std::unique_ptr<Audioneex::Recognizer> serial ( Audioneex::Recognizer::Create() );
+    std::vector<results_t> expected;
+
+    REQUIRE_NOTHROW( serial->SetDataStore( &dstore ) );
+
+    for(const std::vector<float> &chunk : chunks){
+        REQUIRE_NOTHROW( serial->Identify(chunk.data(), chunk.size()) );
+        expected.push_back( CopyResults(*serial) );
+    }
+
+    REQUIRE( expected.back().empty() == false );
+    REQUIRE( expected.back().front().FID == 1 );
+
+    // The snippets are identified in order and each callback sees the
+    // results of its own snippet before its future gets ready. The checks
+    // are made on this thread, as the test framework is not thread-safe.
+    std::unique_ptr<Audioneex::Recognizer> queued ( Audioneex::Recognizer::Create() );
+    std::vector<results_t> results;
+    std::vector<size_t> order;
+    std::vector<std::future<void> > done;
+    bool callbacks_ok = true;
+
+    REQUIRE_NOTHROW( queued->SetDataStore( &dstore ) );
+    REQUIRE_THROWS_AS( queued->IdentifyAsync(nullptr, 10),
+                       Audioneex::InvalidParameterException );
+
+    for(size_t i=0; i<chunks.size(); i++)
+    {
+        done.push_back( queued->IdentifyAsync(chunks[i].data(), chunks[i].size(),
+            [&, i](Audioneex::Recognizer &recognizer, std::exception_ptr error)
+            {
+                callbacks_ok &= &recognizer == queued.get() && !error;
+                order.push_back(i);
+                results.push_back( CopyResults(recognizer) );
+            })
+        );
+    }
+
+    for(std::future<void> &f : done)
+        REQUIRE_NOTHROW( f.get() );
+
+    REQUIRE( callbacks_ok );
+    REQUIRE( order.size() == chunks.size() );
+
+    for(size_t i=0; i<chunks.size(); i++){
+        REQUIRE( order[i] == i );
+        REQUIRE( SameResults(Results(results[i]), Results(expected[i])) );
+    }
+
+    REQUIRE( SameResults(queued->GetResults(), serial->GetResults()) );
+
+    // The errors are passed to the callback and stored in the future
+    std::unique_ptr<Audioneex::Recognizer> failing ( Audioneex::Recognizer::Create() );
+    bool failed = false;
+
+    std::future<void> error = failing->IdentifyAsync(chunks[0].data(), chunks[0].size(),
+        [&](Audioneex::Recognizer&, std::exception_ptr e){ failed = e != nullptr; });
+
+    REQUIRE_THROWS_AS( error.get(), Audioneex::InvalidParameterException );
+    REQUIRE( failed );
+
+    // Destroying a recognizer waits for its pending identifications
+    std::unique_ptr<Audioneex::Recognizer> pending ( Audioneex::Recognizer::Create() );
+    std::atomic<size_t> ncallbacks (0);
+
+    REQUIRE_NOTHROW( pending->SetDataStore( &dstore ) );
+
+    done.clear();
+
+    for(const std::vector<float> &chunk : chunks)
+        done.push_back( pending->IdentifyAsync(chunk.data(), chunk.size(),
+            [&](Audioneex::Recognizer&, std::exception_ptr){ ncallbacks++; }) );
+
+    REQUIRE_NOTHROW( pending.reset() );
+    REQUIRE( ncallbacks == chunks.size() );
+
+    for(std::future<void> &f : done){
+        REQUIRE( f.wait_for(std::chrono::seconds(0)) == std::future_status::ready );
+        REQUIRE_NOTHROW( f.get() );
+    }
+
+    REQUIRE_NOTHROW( Audioneex::SetAsyncThreads(nthreads) );
+}
+
+
+TEST_CASE("Recognizer identifying fingerprint streams") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    std::unique_ptr<Audioneex::Fingerprinter> fingerprinter ( Audioneex::Fingerprinter::Create() );
+
+    REQUIRE( fingerprinter->GetQuantization() == true );
+    REQUIRE( fingerprinter->GetStreamSize() == 0 );
+    REQUIRE_THROWS_AS( fingerprinter->Process(nullptr, 10),
+                       Audioneex::InvalidParameterException );
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    // Identifying the streams of the audio gives the same results at every
+    // step as identifying the audio, for both quantized and raw streams.
+    for(bool quantize : {true, false})
+    {
+        std::unique_ptr<Audioneex::Recognizer> local ( Audioneex::Recognizer::Create() );
+        std::unique_ptr<Audioneex::Recognizer> remote ( Audioneex::Recognizer::Create() );
+
+        REQUIRE_NOTHROW( local->SetDataStore( &dstore ) );
+        REQUIRE_NOTHROW( remote->SetDataStore( &dstore ) );
+
+        REQUIRE_NOTHROW( fingerprinter->SetQuantization(quantize) );
+        REQUIRE( fingerprinter->GetQuantization() == quantize );
+        REQUIRE_NOTHROW( fingerprinter->Reset() );
+
+        OpenTestAudio(asource, "./data/rec1.mp3");
+
+        for(int i=0; i<20 && !local->GetResults(); i++)
+        {
+            GetAudio(asource, iblock, audio);
+
+            REQUIRE_NOTHROW( fingerprinter->Process(audio.Data(), audio.Size()) );
+            REQUIRE( fingerprinter->GetStream() != nullptr );
+            REQUIRE( fingerprinter->GetStreamSize() > 0 );
+
+            REQUIRE_NOTHROW( local->Identify(audio.Data(), audio.Size()) );
+            REQUIRE_NOTHROW( remote->IdentifyFingerprint(fingerprinter->GetStream(),
+                                                         fingerprinter->GetStreamSize()) );
+            REQUIRE( SameResults(remote->GetResults(), local->GetResults()) );
+            REQUIRE( remote->GetIdentificationTime() == local->GetIdentificationTime() );
+        }
+
+        REQUIRE( remote->GetResults() != nullptr );
+        REQUIRE( Audioneex::IsNull(remote->GetResults()[0]) == false );
+        REQUIRE( remote->GetResults()[0].FID == 1 );
+
+        asource.Close();
+    }
+
+    // Malformed streams are rejected
+    std::unique_ptr<Audioneex::Recognizer> remote ( Audioneex::Recognizer::Create() );
+    std::vector<uint8_t> bad (fingerprinter->GetStream(),
+                              fingerprinter->GetStream() + fingerprinter->GetStreamSize());
+    bad.resize(bad.size() / 2);
+
+    REQUIRE_NOTHROW( remote->SetDataStore( &dstore ) );
+    REQUIRE_THROWS_AS( remote->IdentifyFingerprint(bad.data(), bad.size()),
+                       Audioneex::InvalidFingerprintException );
+}
+
+
+TEST_CASE("Recognizer time limits") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    std::unique_ptr<Audioneex::Recognizer> recognizer ( Audioneex::Recognizer::Create() );
+
+    REQUIRE( recognizer->GetStepBudget() == 0 );
+    REQUIRE( recognizer->GetDeadline() == 0 );
+    REQUIRE( recognizer->IsTruncated() == false );
+
+    REQUIRE_NOTHROW( recognizer->SetStepBudget(5000) );
+    REQUIRE_NOTHROW( recognizer->SetDeadline(20000) );
+    REQUIRE( recognizer->GetStepBudget() == 5000 );
+    REQUIRE( recognizer->GetDeadline() == 20000 );
+
+    REQUIRE_NOTHROW( recognizer->SetStepBudget(0) );
+    REQUIRE_NOTHROW( recognizer->SetDataStore( &dstore ) );
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    // The deadline is reached while fingerprinting, so all the matching
+    // steps are skipped and flagged as truncated.
+    REQUIRE_NOTHROW( recognizer->SetDeadline(1) );
+
+    for(int i=0; i<4; i++){
+        GetAudio(asource, iblock, audio);
+        REQUIRE_NOTHROW( recognizer->Identify(audio.Data(), audio.Size()) );
+    }
+
+    REQUIRE( recognizer->IsTruncated() == true );
+    REQUIRE( recognizer->GetResults() == nullptr );
+
+    // Resetting clears the flag and no time limit gives a complete search
+    REQUIRE_NOTHROW( recognizer->Reset() );
+    REQUIRE( recognizer->IsTruncated() == false );
+    REQUIRE_NOTHROW( recognizer->SetDeadline(0) );
+
+    for(int i=0; i<20 && !recognizer->GetResults(); i++){
+        GetAudio(asource, iblock, audio);
+        REQUIRE_NOTHROW( recognizer->Identify(audio.Data(), audio.Size()) );
+    }
+
+    REQUIRE( recognizer->IsTruncated() == false );
+    REQUIRE( recognizer->GetResults() != nullptr );
+
+    asource.Close();
+}
+
+
+
+TEST_CASE("Recognizer monitoring a stream") {
+
+    int Srate = Audioneex::Pms::Fs;
+    int Nchan = Audioneex::Pms::Ca;
+
+    AudioBlock<int16_t> iblock(Srate*2, Srate, Nchan);
+    AudioBlock<float>   audio(Srate*2, Srate, Nchan);
+    AudioSourceFile     asource;
+
+    MemDataStore dstore;
+
+    BuildTestIndex(dstore);
+
+    std::unique_ptr<Audioneex::Recognizer> recognizer ( Audioneex::Recognizer::Create() );
+
+    const float window = 5.f;
+
+    REQUIRE_NOTHROW( recognizer->SetDataStore( &dstore ) );
+    REQUIRE_NOTHROW( recognizer->SetMonitoringWindow( window ) );
+
+    iblock.Resize(Srate*1.5);
+    audio.Resize(Srate*1.5);
+
+    OpenTestAudio(asource, "./data/rec1.mp3");
+
+    std::vector<Audioneex::MonitorEvent> events;
+
+    for(int i=0; i<20 && events.empty(); i++)
+    {
+        GetAudio(asource, iblock, audio);
+        REQUIRE_NOTHROW( recognizer->Identify( audio.Data(), audio.Size() ) );
+
+        const Audioneex::MonitorEvent *e = recognizer->GetMonitorEvents();
+        for(; e && !Audioneex::IsNull(*e); e++)
+            events.push_back(*e);
+    }
+
+    asource.Close();
+
+    // The segment has started
+    REQUIRE( events.size() == 1 );
+    REQUIRE( events[0].FID == 1 );
+    REQUIRE( events[0].EndTime == 0 );
+
+    // Dead air gives no LFs, so the segment must be closed on the stream
+    // time once the recording hasn't been identified for a whole window.
+    std::fill(audio.Data(), audio.Data() + audio.Size(), 0.f);
+
+    double Tsilence = recognizer->GetIdentificationTime();
+
+    for(int i=0; i<10 && events.size() == 1; i++)
+    {
+        REQUIRE_NOTHROW( recognizer->Identify( audio.Data(), audio.Size() ) );
+
+        const Audioneex::MonitorEvent *e = recognizer->GetMonitorEvents();
+        for(; e && !Audioneex::IsNull(*e); e++)
+            events.push_back(*e);
+    }
+
+    REQUIRE( events.size() == 2 );
+    REQUIRE( events[1].FID == 1 );
+    REQUIRE( events[1].StartTime == events[0].StartTime );
+    REQUIRE( events[1].EndTime >= events[1].StartTime );
+    REQUIRE( recognizer->GetIdentificationTime() <= Tsilence + window + 1.5 );
+}
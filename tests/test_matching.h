@@ -12,11 +12,13 @@
 
 #include <chrono>
 #include <thread>
+#include <atomic>
 
 #include "audioneex.h"
 #include "Fingerprint.h"
 #include "Matcher.h"
 #include "AudioSource.h"
+#include "MemDataStore.h"
 
 
 inline void GetAudio(AudioSourceFile& source,
@@ -29,6 +31,27 @@ inline void GetAudio(AudioSourceFile& source,
 }
 
 
+/// Check whether two results sets returned by the recognizers are the same
+inline bool SameResults(const Audioneex::IdMatch* res1,
+                        const Audioneex::IdMatch* res2)
+{
+    if(!res1 || !res2)
+       return res1 == res2;
+
+    for(; !Audioneex::IsNull(*res1) && !Audioneex::IsNull(*res2); res1++, res2++)
+    {
+        if(res1->FID != res2->FID ||
+           res1->Confidence != res2->Confidence ||
+           res1->Score != res2->Score ||
+           res1->IdClass != res2->IdClass ||
+           res1->CuePoint != res2->CuePoint)
+           return false;
+    }
+
+    return Audioneex::IsNull(*res1) && Audioneex::IsNull(*res2);
+}
+
+
 /// A dummy and broken data store for testing purposes
 class BrokenDataStore : public DATASTORE_T
 {
@@ -55,6 +78,54 @@ public:
                                   uint32_t bo = 0){
         return nullptr;
     }
+
+    size_t ReadFingerprint(uint32_t FID,
+                           uint8_t* buffer,
+                           size_t nbytes,
+                           uint32_t bo = 0){
+        return 0;
+    }
+};
+
+
+/// An in-memory data store injecting a fixed latency in each access to the
+/// postings lists, as a remote data store would, and counting the accesses.
+class SlowDataStore : public MemDataStore
+{
+    void Access(size_t nblocks){
+        Calls++;
+        Blocks += nblocks;
+        std::this_thread::sleep_for(Latency);
+    }
+
+public:
+    std::chrono::microseconds Latency {500};
+    size_t Calls  {0};   // round-trips to the data store
+    size_t Blocks {0};   // blocks read
+
+    size_t ReadPListBlock(int lid, int bid,
+                          uint8_t* buffer,
+                          size_t buffer_size,
+                          bool headers=false){
+        Access(1);
+        return MemDataStore::ReadPListBlock(lid, bid, buffer, buffer_size, headers);
+    }
+
+    void ReadPListBlocks(Audioneex::PListBlockRequest* requests, size_t count){
+        Access(count);
+        for(size_t i=0; i<count; i++){
+            Audioneex::PListBlockRequest &req = requests[i];
+            req.data_size = MemDataStore::ReadPListBlock(req.lid, req.bid,
+                                                         req.buffer,
+                                                         req.buffer_size,
+                                                         req.headers);
+        }
+    }
+
+    // Serialize the accesses, as the counters are not thread-safe
+    bool IsReentrant() const {
+        return false;
+    }
 };
 
 
@@ -68,7 +139,10 @@ class IndexFiles {
 	
 public:
 
-	IndexFiles(KVDataStore *dstore, const std::string &file, uint32_t FID)
+	IndexFiles(KVDataStore *dstore, const std::string &file, uint32_t FID,
+	           Audioneex::ePostingsFormat format = Audioneex::FULL_POSTINGS,
+	           uint32_t stop_limit = 0,
+	           Audioneex::eMatchType type = Audioneex::MSCALE_MATCH)
 	{
 		size_t fpsize = get_file_size(file);
 		
@@ -87,6 +161,9 @@ public:
         indexer ( Audioneex::Indexer::Create() );
 		
         REQUIRE_NOTHROW( indexer->SetDataStore( dstore ) );
+        REQUIRE_NOTHROW( indexer->SetMatchType( type ) );
+        REQUIRE_NOTHROW( indexer->SetPostingsFormat( format ) );
+        REQUIRE_NOTHROW( indexer->SetStopTermLimit( stop_limit ) );
         REQUIRE_NOTHROW( indexer->Start() );
         REQUIRE_NOTHROW( indexer->Index(FID, fp, fpsize) );
         REQUIRE_NOTHROW( indexer->End() );
@@ -96,4 +173,45 @@ public:
 	}
 };
 
+
+/// Build the index of the test recordings (FIDs 1 and 2) into an empty data
+/// store and open it for matching.
+inline void BuildTestIndex(KVDataStore &dstore,
+                           Audioneex::eMatchType type = Audioneex::MSCALE_MATCH,
+                           Audioneex::ePostingsFormat format = Audioneex::FULL_POSTINGS)
+{
+    // For client/server databases only (e.g. Couchbase)
+    dstore.SetServerName( "localhost" );
+    dstore.SetServerPort( 8091 );
+    dstore.SetUsername( "admin" );
+    dstore.SetPassword( "password" );
+
+    REQUIRE_NOTHROW( dstore.Open(KVDataStore::BUILD) );
+
+    // We need an empty database to perform the tests.
+    if(!dstore.Empty()) {
+        dstore.Clear();
+        // Wait until the clearing is finished (see "Matcher processing")
+        while(!dstore.Empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        }
+    }
+
+    IndexFiles (&dstore, "./data/rec1.fp", 1, format, 0, type);
+    IndexFiles (&dstore, "./data/rec2.fp", 2, format, 0, type);
+
+    REQUIRE_NOTHROW( dstore.Open() );
+}
+
+
+/// Open a test recording decoding it in the format used by the engine
+inline void OpenTestAudio(AudioSourceFile &source, const std::string &file)
+{
+    source.SetSampleRate( Audioneex::Pms::Fs );
+    source.SetChannelCount( Audioneex::Pms::Ca );
+    source.SetSampleResolution( 16 );
+
+    REQUIRE_NOTHROW( source.Open( file ) );
+}
+
 #endif